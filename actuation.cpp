@@ -0,0 +1,174 @@
+#include "app.h"
+
+/** Life of one valve command */
+struct s_act_trace
+{
+	uint16_t id;	  // 0 if the slot was never used
+	uint8_t zone;	  // Valve zone
+	uint8_t state;	  // Requested VALVE_STATE_*
+	uint8_t cause;	  // HC_* cause
+	uint8_t outcome;  // ACT_* outcome
+	uint32_t queued;  // millis() when the command was accepted
+	uint32_t started; // millis() when the relay was driven for it
+	uint32_t done;	  // millis() when it ended
+};
+
+static s_act_trace act_traces[ACT_TRACE_LEN];
+
+/** Id of the newest trace, never 0 */
+static uint16_t act_last_id = 0;
+
+/** Commands taken from the bucket of each source, the bucket starts full */
+static uint8_t act_used[AT_SRC_COUNT];
+static uint32_t act_refill_millis[AT_SRC_COUNT];
+
+/** Commands refused by the rate limit since boot */
+static uint32_t act_limited = 0;
+
+static const char *const act_outcome_names[] = {"pending", "done", "merged", "superseded"};
+
+/**
+ * @brief Find a trace that was not overwritten yet
+ *
+ * @param id trace id
+ * @return s_act_trace* trace or NULL
+ */
+static s_act_trace *act_trace_find(uint16_t id)
+{
+	s_act_trace *trace = &act_traces[id % ACT_TRACE_LEN];
+	return (id && (trace->id == id)) ? trace : NULL;
+}
+
+/**
+ * @brief Start the trace of an accepted valve command
+ *
+ * @param zone valve zone
+ * @param state requested VALVE_STATE_*
+ * @param cause HC_* cause
+ * @return uint16_t trace id
+ */
+uint16_t act_trace_new(uint8_t zone, uint8_t state, uint8_t cause)
+{
+	if (++act_last_id == 0)
+	{
+		act_last_id = 1;
+	}
+	s_act_trace *trace = &act_traces[act_last_id % ACT_TRACE_LEN];
+	trace->id = act_last_id;
+	trace->zone = zone;
+	trace->state = state;
+	trace->cause = cause;
+	trace->outcome = ACT_PENDING;
+	trace->queued = millis();
+	trace->started = 0;
+	trace->done = 0;
+	return act_last_id;
+}
+
+/**
+ * @brief The relay is driven for a command
+ *
+ * @param id trace id
+ */
+void act_trace_start(uint16_t id)
+{
+	s_act_trace *trace = act_trace_find(id);
+	if (trace && (trace->outcome == ACT_PENDING))
+	{
+		trace->started = millis();
+	}
+}
+
+/**
+ * @brief A command ended, later calls for the same trace are ignored
+ *
+ * @param id trace id
+ * @param outcome ACT_* outcome
+ */
+void act_trace_end(uint16_t id, uint8_t outcome)
+{
+	s_act_trace *trace = act_trace_find(id);
+	if (!trace || (trace->outcome != ACT_PENDING))
+	{
+		return;
+	}
+	trace->done = millis();
+	trace->outcome = outcome;
+	MYLOG("ACT", "Zone %d %s %s after %lu ms, relay after %lu ms", trace->zone, trace->state ? "open" : "close",
+		  act_outcome_names[outcome], trace->done - trace->queued, trace->started ? trace->started - trace->queued : 0);
+}
+
+/**
+ * @brief Check the rate limit before a valve is opened or an interval or
+ *		  volume run started. Each source has a bucket of ACT_RATE_BURST
+ *		  commands that refills by one every ACT_RATE_MS, a command is only
+ *		  taken from it by act_charge() once it was accepted.
+ *
+ * @param src AT_SRC_* source of the command
+ * @return true command allowed
+ * @return false too many commands from this source
+ */
+bool act_admit(uint8_t src)
+{
+	uint32_t now = millis();
+	uint32_t refill = (now - act_refill_millis[src]) / ACT_RATE_MS;
+	if (refill >= act_used[src])
+	{
+		act_used[src] = 0;
+		act_refill_millis[src] = now;
+	}
+	else
+	{
+		act_used[src] -= refill;
+		act_refill_millis[src] += refill * ACT_RATE_MS;
+	}
+
+	if (act_used[src] >= ACT_RATE_BURST)
+	{
+		act_limited++;
+		MYLOG("ACT", "Source %d over the rate limit", src);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Take an accepted command from the bucket, after act_admit()
+ *
+ * @param src AT_SRC_* source of the command
+ */
+void act_charge(uint8_t src)
+{
+	if (act_used[src] < ACT_RATE_BURST)
+	{
+		act_used[src]++;
+	}
+}
+
+/**
+ * @brief Write the rate limit count and the newest traces in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void act_print(char *buf, uint16_t size)
+{
+	int len = snprintf(buf, size, "Limited %lu", (unsigned long)act_limited);
+	for (uint8_t idx = 0; (idx < 3) && (len < size); idx++)
+	{
+		s_act_trace *trace = act_trace_find(act_last_id - idx);
+		if (!trace)
+		{
+			break;
+		}
+		if (trace->outcome == ACT_PENDING)
+		{
+			len += snprintf(&buf[len], size - len, ", Z%d %s pending", trace->zone, trace->state ? "open" : "close");
+			continue;
+		}
+		len += snprintf(&buf[len], size - len, ", Z%d %s %s %lu/%lu ms", trace->zone, trace->state ? "open" : "close",
+						act_outcome_names[trace->outcome],
+						(unsigned long)(trace->started ? trace->started - trace->queued : 0),
+						(unsigned long)(trace->done - trace->queued));
+	}
+}
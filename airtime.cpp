@@ -0,0 +1,141 @@
+#include "app.h"
+
+/** Airtime left to spend in us, refilled at the budget rate, below 0 after urgent uplinks */
+static int32_t budget_left_us = 0;
+
+/** Last refill */
+static uint32_t refill_millis = 0;
+
+/** Airtime of all uplinks since boot in ms */
+static uint32_t airtime_total_ms = 0;
+
+/** Uplinks held back by the budget */
+static uint32_t airtime_deferred = 0;
+
+/**
+ * @brief Channel plan of the configured region
+ *		  AS923, KR920, IN865, CN470 and the other regions use the SF12 .. SF7
+ *		  layout of EU868, AS923 with the payload limits without dwell time.
+ *
+ * @return uint8_t AIRTIME_PLAN_*
+ */
+uint8_t airtime_plan(void)
+{
+	switch (g_lorawan_settings.lora_region)
+	{
+	case LORAMAC_REGION_US915:
+		return AIRTIME_PLAN_US915;
+	case LORAMAC_REGION_AU915:
+		return AIRTIME_PLAN_AU915;
+	default:
+		return AIRTIME_PLAN_EU868;
+	}
+}
+
+/**
+ * @brief Airtime allowed per AIRTIME_WINDOW_MS
+ *		  The duty cycle limit applies when it is lower than the configured budget.
+ *
+ * @return uint32_t budget in us
+ */
+static uint32_t airtime_budget_us(void)
+{
+	uint32_t budget_ms = AIRTIME_BUDGET_MS;
+	if (g_lorawan_settings.duty_cycle_enabled && (budget_ms > AIRTIME_WINDOW_MS / AIRTIME_DUTY_CYCLE))
+	{
+		budget_ms = AIRTIME_WINDOW_MS / AIRTIME_DUTY_CYCLE;
+	}
+	return budget_ms * 1000;
+}
+
+/**
+ * @brief Start with a full budget, called once the LoRaWAN settings are loaded
+ */
+void airtime_init(void)
+{
+	budget_left_us = airtime_budget_us();
+	refill_millis = millis();
+}
+
+/**
+ * @brief Add the airtime earned since the last refill
+ */
+static void airtime_refill(void)
+{
+	uint32_t budget = airtime_budget_us();
+	uint32_t now = millis();
+	uint64_t earned = (uint64_t)(now - refill_millis) * budget / AIRTIME_WINDOW_MS;
+	if (earned == 0)
+	{
+		// Keep the start so short steps add up
+		return;
+	}
+	refill_millis = now;
+	int64_t left = budget_left_us + (int64_t)earned;
+	budget_left_us = (left > (int64_t)budget) ? budget : left;
+}
+
+/**
+ * @brief Time on air of an uplink at the current data rate
+ *
+ * @param len application payload length
+ * @return uint32_t time on air in ms, rounded up
+ */
+uint32_t airtime_uplink_ms(uint8_t len)
+{
+	return (airtime_uplink_us(airtime_plan(), g_lorawan_settings.data_rate, len) + 999) / 1000;
+}
+
+/**
+ * @brief Largest application payload at the current data rate
+ */
+uint8_t airtime_max_len(void)
+{
+	return airtime_dr_max_len(airtime_plan(), g_lorawan_settings.data_rate);
+}
+
+/**
+ * @brief Check if the budget has room for a deferrable uplink
+ *
+ * @param len application payload length
+ * @return true send it now
+ * @return false budget spent, the uplink waits
+ */
+bool airtime_allow(uint8_t len)
+{
+	airtime_refill();
+	if (budget_left_us >= (int32_t)airtime_uplink_us(airtime_plan(), g_lorawan_settings.data_rate, len))
+	{
+		return true;
+	}
+	airtime_deferred++;
+	return false;
+}
+
+/**
+ * @brief Book the airtime of an uplink that was enqueued
+ *		  Urgent uplinks are sent regardless and may overdraw the budget.
+ *
+ * @param len application payload length
+ */
+void airtime_spend(uint8_t len)
+{
+	uint32_t toa_us = airtime_uplink_us(airtime_plan(), g_lorawan_settings.data_rate, len);
+	airtime_refill();
+	budget_left_us -= toa_us;
+	airtime_total_ms += (toa_us + 999) / 1000;
+}
+
+/**
+ * @brief Write the airtime budget in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void airtime_print(char *buf, uint16_t size)
+{
+	airtime_refill();
+	snprintf(buf, size, "Left %ld of %lu ms per day, used %lu ms, deferred %lu, DR %d max %d bytes",
+			 (long)(budget_left_us / 1000), (unsigned long)(airtime_budget_us() / 1000), (unsigned long)airtime_total_ms,
+			 (unsigned long)airtime_deferred, g_lorawan_settings.data_rate, airtime_max_len());
+}
@@ -0,0 +1,134 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+/**
+ * LoRa time on air and data rate tables, no Arduino dependencies.
+ *
+ * All functions are constexpr so fixed payloads can be checked at compile
+ * time. Times are integer us: the symbol time 2^SF / BW is exact for 125,
+ * 250 and 500 kHz. Explicit header, CRC on, low data rate optimization at
+ * SF11 and SF12 on 125 kHz as set by the LoRaWAN stack.
+ */
+
+#include <stdint.h>
+
+/** Channel plans, the data rate layout of the region */
+#define AIRTIME_PLAN_EU868 0 // DR0 .. DR5 SF12 .. SF7 at 125 kHz, DR6 SF7 at 250 kHz
+#define AIRTIME_PLAN_US915 1 // DR0 .. DR3 SF10 .. SF7 at 125 kHz, DR4 SF8 at 500 kHz
+#define AIRTIME_PLAN_AU915 2 // DR0 .. DR5 SF12 .. SF7 at 125 kHz, DR6 SF8 at 500 kHz
+
+/** LoRaWAN adds MHDR, FHDR without options, FPort and MIC */
+#define AIRTIME_LORAWAN_OVERHEAD 13
+
+/** Preamble symbols of LoRaWAN uplinks */
+#define AIRTIME_PREAMBLE 8
+
+/** Coding rate 4/5 */
+#define AIRTIME_CR_4_5 1
+
+/**
+ * @brief Spreading factor of a data rate
+ */
+constexpr uint8_t airtime_dr_sf(uint8_t plan, uint8_t dr)
+{
+	return (plan == AIRTIME_PLAN_US915)	  ? ((dr >= 4) ? 8 : 10 - dr)
+		   : (plan == AIRTIME_PLAN_AU915) ? ((dr >= 6) ? 8 : 12 - dr)
+										  : ((dr >= 5) ? 7 : 12 - dr);
+}
+
+/**
+ * @brief Bandwidth of a data rate in kHz
+ */
+constexpr uint16_t airtime_dr_bw(uint8_t plan, uint8_t dr)
+{
+	return (plan == AIRTIME_PLAN_US915)	  ? ((dr >= 4) ? 500 : 125)
+		   : (plan == AIRTIME_PLAN_AU915) ? ((dr >= 6) ? 500 : 125)
+										  : ((dr >= 6) ? 250 : 125);
+}
+
+/**
+ * @brief Largest application payload of a data rate, without MAC commands in FOpts
+ */
+constexpr uint8_t airtime_dr_max_len(uint8_t plan, uint8_t dr)
+{
+	return (plan == AIRTIME_PLAN_US915)	  ? ((dr == 0) ? 11 : (dr == 1) ? 53 : (dr == 2) ? 125 : 242)
+		   : (plan == AIRTIME_PLAN_AU915) ? ((dr <= 2) ? 51 : (dr == 3) ? 115 : 242)
+										  : ((dr <= 2) ? 51 : (dr == 3) ? 115 : 222);
+}
+
+/**
+ * @brief Symbol time in us
+ */
+constexpr uint32_t airtime_symbol_us(uint8_t sf, uint16_t bw_khz)
+{
+	return ((uint32_t)1000 << sf) / bw_khz;
+}
+
+/**
+ * @brief Bits per payload block of 4 + CR symbols, fewer with low data rate optimization
+ */
+constexpr int32_t airtime_block_bits(uint8_t sf, uint16_t bw_khz)
+{
+	return 4 * (sf - (((sf >= 11) && (bw_khz == 125)) ? 2 : 0));
+}
+
+/**
+ * @brief Payload bits past the header block, including the CRC
+ */
+constexpr int32_t airtime_payload_bits(uint8_t sf, uint16_t phy_len)
+{
+	return 8 * (int32_t)phy_len - 4 * sf + 28 + 16;
+}
+
+/**
+ * @brief Number of payload symbols
+ *
+ * @param sf spreading factor 7 .. 12
+ * @param bw_khz bandwidth 125, 250 or 500
+ * @param cr coding rate 1 .. 4 for 4/5 .. 4/8
+ * @param phy_len PHY payload length in bytes
+ */
+constexpr uint32_t airtime_payload_symbols(uint8_t sf, uint16_t bw_khz, uint8_t cr, uint16_t phy_len)
+{
+	return 8 + ((airtime_payload_bits(sf, phy_len) > 0)
+					? (uint32_t)((airtime_payload_bits(sf, phy_len) + airtime_block_bits(sf, bw_khz) - 1) /
+								 airtime_block_bits(sf, bw_khz)) *
+						  (4 + cr)
+					: 0);
+}
+
+/**
+ * @brief Time on air of a LoRa frame
+ *		  The preamble is followed by 4.25 sync symbols.
+ *
+ * @param sf spreading factor 7 .. 12
+ * @param bw_khz bandwidth 125, 250 or 500
+ * @param cr coding rate 1 .. 4 for 4/5 .. 4/8
+ * @param phy_len PHY payload length in bytes
+ * @return uint32_t time on air in us
+ */
+constexpr uint32_t airtime_us(uint8_t sf, uint16_t bw_khz, uint8_t cr, uint16_t phy_len)
+{
+	return (4 * AIRTIME_PREAMBLE + 17) * airtime_symbol_us(sf, bw_khz) / 4 +
+		   airtime_payload_symbols(sf, bw_khz, cr, phy_len) * airtime_symbol_us(sf, bw_khz);
+}
+
+/**
+ * @brief Time on air of a LoRaWAN uplink
+ *
+ * @param plan AIRTIME_PLAN_*
+ * @param dr data rate
+ * @param len application payload length
+ * @return uint32_t time on air in us
+ */
+constexpr uint32_t airtime_uplink_us(uint8_t plan, uint8_t dr, uint8_t len)
+{
+	return airtime_us(airtime_dr_sf(plan, dr), airtime_dr_bw(plan, dr), AIRTIME_CR_4_5, len + AIRTIME_LORAWAN_OVERHEAD);
+}
+
+// Reference values of the Semtech calculator
+static_assert(airtime_uplink_us(AIRTIME_PLAN_EU868, 0, 2) == 1155072, "SF12 time on air");
+static_assert(airtime_uplink_us(AIRTIME_PLAN_EU868, 5, 2) == 46336, "SF7 time on air");
+static_assert(airtime_uplink_us(AIRTIME_PLAN_US915, 4, 11) == 28288, "SF8 500 kHz time on air");
+
+#endif
@@ -5,43 +5,175 @@
 /** Add you required includes after Arduino.h */
 
 #include <Wire.h>
-#include <Adafruit_MCP23X17.h> //click here to get the library: http://librarymanager/All#Adafruit_MCP23017
 
 /** Include the WisBlock-API */
 #include <WisBlock-API.h>
 
+#include "payload.h"
+#include "downlink.h"
+#include "expander.h"
+#include "airtime.h"
+#include "tlog.h"
+#include "at_registry.h"
+#include "spsc_queue.h"
+
 // Debug output set to 0 to disable app debug output
 #ifndef MY_DEBUG
 #define MY_DEBUG 0
 #endif
 
+// How long to wait for the USB serial at boot, 0 boots without waiting (debug output before the host attaches is lost)
+#ifndef SERIAL_WAIT_MS
+#define SERIAL_WAIT_MS 0
+#endif
+
 // Enable perpetual BLE advertising
 #ifndef BLE_ADVERTISE_FOREVER
 #define BLE_ADVERTISE_FOREVER 1
 #endif
 
-/** GPIO pins for valve control */
+/** Number of independently controlled valve zones, 1 .. 8
+ * Each zone uses two RAK13003 pins, see valve.cpp for the pin map. */
+#ifndef VALVE_ZONES
+#define VALVE_ZONES 1
+#endif
+#if (VALVE_ZONES < 1) || (VALVE_ZONES > 8)
+#error "VALVE_ZONES must be 1 .. 8"
+#endif
+
+/** How many zones may be open at once by default, limited by the water pressure */
+#ifndef VALVE_MAX_OPEN_ZONES
+#define VALVE_MAX_OPEN_ZONES 1
+#endif
+
+/** GPIO pins for valve control of zone 0 */
 #define VPIN_OPEN 6
 #define VPIN_CLOSED 7
 #define VALVE_STATE_CLOSED 0
 #define VALVE_STATE_OPENED 1
 
+/** Valve actuator states, the relay is only powered while driving */
+#define VALVE_ACT_IDLE 0
+#define VALVE_ACT_DRIVING_OPEN 1
+#define VALVE_ACT_DRIVING_CLOSED 2
+
 /** How long to hold the relay input signal HIGH to allow for valve
  * to fully transition between open/closed. May be tweaked per valve. */
 #define DEFAULT_VALVE_OPER_TIME_SEC 6
 
-/** User defined structure for storing valve state */
+/** End stop feedback, 0 drives the relay for the fixed oper time
+ * The end stop switches of zone n are read on expander pin 8 + 2n (open)
+ * and 9 + 2n (closed), they pull to GND while the valve is at that end.
+ * Port B is free with up to 4 zones. */
+#ifndef VALVE_FEEDBACK
+#define VALVE_FEEDBACK 0
+#endif
+#if VALVE_FEEDBACK && (VALVE_ZONES > 4)
+#error "VALVE_FEEDBACK uses port B of the expander, at most 4 zones"
+#endif
+/** WisBlock IO pin wired to an interrupt output of the MCP23017 */
+#ifndef VALVE_FB_INT_PIN
+#define VALVE_FB_INT_PIN WB_IO5
+#endif
+/** Pulse timeout once the travel time is learned, travel + 50 % + margin, never above the oper time */
+#define VALVE_TRAVEL_MARGIN_MS 1000
+/** Shorter pulses did not move the valve between the end stops and are not learned */
+#define VALVE_TRAVEL_MIN_MS 500
+
+/** Extra time added when a pulse is reversed mid-travel, so the valve
+ * is driven all the way back to its end stop. */
+#define VALVE_REVERSAL_MARGIN_MS 500
+
+/** Opens wait this long before the relay is driven, so a burst of commands
+ * ends in one movement. Closes are never held. */
+#ifndef VALVE_HOLD_MS
+#define VALVE_HOLD_MS 300
+#endif
+
+/** Application events, WisBlock-API only uses the lower bits */
+#define VALVE_ACT_DONE 0b1000000000000000
+#define N_VALVE_ACT_DONE 0b0111111111111111
+#define VALVE_INTERVAL_DONE 0b0100000000000000
+#define N_VALVE_INTERVAL_DONE 0b1011111111111111
+#define SCHEDULE_DUE 0b0010000000000000
+#define N_SCHEDULE_DUE 0b1101111111111111
+#define UPLINK_DUE 0b0001000000000000
+#define N_UPLINK_DUE 0b1110111111111111
+#define APP_EVENT 0b0000100000000000
+#define N_APP_EVENT 0b1111011111111111
+#define FLOW_DUE 0b0000010000000000
+#define N_FLOW_DUE 0b1111101111111111
+
+/** Events queued by timer callbacks and interrupts, see events.cpp */
+#define EV_WAKE 1	  // Wakeup timer fired, value is millis()
+#define EV_VALVE_FB 2 // End stop switch changed, value is millis() of the edge
+#define EV_FLOW 3	  // Flow pulse count reached, value is the count
+
+/** One queue per producer context */
+#define EVQ_TIMER 0
+#define EVQ_VALVE_FB 1
+#define EVQ_FLOW 2
+#define EVQ_COUNT 3
+
+/** Events each queue holds, a power of 2 */
+#ifndef EVENT_QUEUE_LEN
+#define EVENT_QUEUE_LEN 8
+#endif
+
+struct s_app_event
+{
+	uint8_t type;	// EV_* event
+	uint32_t value; // Event data
+};
+
+void event_post(uint8_t queue, uint8_t type, uint32_t value);
+void event_handler(void);
+void event_print(char *buf, uint16_t size);
+
+/** User defined structure for storing valve state, one array entry per zone */
 struct s_valve_settings
 {
-	uint8_t state;					 // Current valve state
-	uint8_t oper_time_sec;			 // How long it takes to open/close the valve
-	bool valve_interval_started;	 // Is the valve interval running?
-	int valve_interval_begin_millis; // When did the valve interval begin? (timestamp)
-	int valve_interval_millis;		 // How long the current valve interval is
+	uint8_t state[VALVE_ZONES];				  // Current valve state
+	uint8_t oper_time_sec[VALVE_ZONES];		  // How long it takes to open/close the valve
+	uint8_t act_state[VALVE_ZONES];			  // Actuator state (VALVE_ACT_*)
+	uint32_t act_begin_millis[VALVE_ZONES];	  // When did the current relay pulse begin? (timestamp)
+	uint32_t act_deadline[VALVE_ZONES];		  // When does the current relay pulse end? (timestamp)
+	uint32_t interval_deadline[VALVE_ZONES]; // When does the valve interval end? (timestamp)
+	uint8_t interval_running;				  // Zones with a running valve interval (bitmap)
+	uint8_t interval_volume;				  // Running intervals that end on volume, see flow.cpp (bitmap)
+	uint8_t max_open;						  // How many zones may be open at once
+	uint16_t travel_ms[VALVE_ZONES];		  // Learned end stop to end stop time, 0 if unknown
+	uint8_t stalled;						  // Zones that did not reach their end stop (bitmap)
 };
 
+/** Number of entries in the watering schedule */
+#ifndef SCHED_MAX_ENTRIES
+#define SCHED_MAX_ENTRIES 16
+#endif
+
+/** Schedule entry flags */
+#define SCHED_FLAG_SKIP 0x01 // Skip the next occurrence
+
+/** Recurring watering schedule entry, days == 0 marks an unused entry */
+struct s_sched_entry
+{
+	uint8_t days;		   // Weekdays, bit 0 Sunday .. bit 6 Saturday, 0x7F for daily
+	uint8_t flags;		   // SCHED_FLAG_*
+	uint16_t start_min;	   // Start time, minutes after midnight
+	uint32_t duration_sec; // How long to keep the valve open
+	uint8_t zone;		   // Valve zone to open
+};
+
+/** Debug output
+ * MY_DEBUG 1 stores tokenized records in a RAM ring, see tlog.h, decode them with tlog_decode.py.
+ * MY_DEBUG 2 formats the messages on the device. */
+#if MY_DEBUG == 1
+#define MYLOG(tag, fmt, ...) tlog_put(TLOG_ID(tag, fmt), ##__VA_ARGS__)
+#define MYLOG_HEX(tag, data, len) tlog_put_bytes(TLOG_ID(tag, "%H"), data, len)
+#endif
+
 #ifdef NRF52_SERIES
-#if MY_DEBUG > 0
+#if MY_DEBUG > 1
 #define MYLOG(tag, ...)                     \
 	do                                      \
 	{                                       \
@@ -55,12 +187,21 @@ struct s_valve_settings
 			g_ble_uart.printf("\n");        \
 		}                                   \
 	} while (0)
-#else
+#define MYLOG_HEX(tag, data, len)                    \
+	do                                               \
+	{                                                \
+		PRINTF("[%s] ", tag);                        \
+		for (uint8_t _idx = 0; _idx < (len); _idx++) \
+			PRINTF("%02X ", (data)[_idx]);           \
+		PRINTF("\n");                                \
+	} while (0)
+#elif MY_DEBUG == 0
 #define MYLOG(...)
+#define MYLOG_HEX(...)
 #endif
 #endif
 #ifdef ARDUINO_ARCH_RP2040
-#if MY_DEBUG > 0
+#if MY_DEBUG > 1
 #define MYLOG(tag, ...)                  \
 	do                                   \
 	{                                    \
@@ -69,43 +210,429 @@ struct s_valve_settings
 		Serial.printf(__VA_ARGS__);      \
 		Serial.printf("\n");             \
 	} while (0)
-#else
+#define MYLOG_HEX(tag, data, len)                    \
+	do                                               \
+	{                                                \
+		Serial.printf("[%s] ", tag);                 \
+		for (uint8_t _idx = 0; _idx < (len); _idx++) \
+			Serial.printf("%02X ", (data)[_idx]);    \
+		Serial.printf("\n");                         \
+	} while (0)
+#elif MY_DEBUG == 0
 #define MYLOG(...)
+#define MYLOG_HEX(...)
 #endif
 #endif
 
+/** Tokenized log ring in words, 4 bytes each */
+#ifndef TLOG_RING_WORDS
+#define TLOG_RING_WORDS 512
+#endif
+
+void tlog_init(void);
+void tlog_drain(void);
+void tlog_dump(void);
+void tlog_clear(void);
+void tlog_print(char *buf, uint16_t size);
+
 /** Application function definitions */
 void setup_app(void);
 bool init_app(void);
 void app_event_handler(void);
 void ble_data_handler(void) __attribute__((weak));
 void lora_data_handler(void);
-void send_lora_uplink(void);
 
-// LoRaWan functions (TBD - more efficient bit packing)
-struct lpwan_data_s
-{
-	uint8_t batt_1 = 0;
-	uint8_t batt_2 = 0;
-	uint8_t valve_inteval_1 = 0;
-	uint8_t valve_inteval_2 = 0;
-	bool valve_opened = false;
-};
-extern lpwan_data_s g_lpwan_data;
-#define LPWAN_DATA_LEN sizeof(lpwan_data_s)
+/** Uplink queue, kinds in priority order */
+#define UPLINK_STATE 0x01	// Valve reached a new position
+#define UPLINK_REQUEST 0x02 // Requested by a command, never suppressed
+#define UPLINK_STATUS 0x04	// Periodic status
+#define UPLINK_ENERGY 0x08	// Energy ledger summary
+#define UPLINK_HISTORY 0x10 // Batch of valve events
 
-/** Battery level uinion */
-union batt_s
-{
-	uint16_t batt16 = 0;
-	uint8_t batt8[2];
-};
+/** A periodic status identical to the last acknowledged one is still sent after this many were skipped */
+#ifndef UPLINK_HEARTBEAT_EVERY
+#define UPLINK_HEARTBEAT_EVERY 3
+#endif
+/** Delay before an undelivered state change is sent again */
+#define UPLINK_RETRY_MS 30000
+
+void uplink_enqueue(uint8_t kind);
+void uplink_drain(void);
+void uplink_tx_done(bool success);
+void status_restart(void);
+
+/** Latency mode, the status period is shortened after a command or while a valve is open */
+#ifndef LATENCY_POLL_MIN_MS
+#define LATENCY_POLL_MIN_MS 30000 // First poll period, doubles after each uplink
+#endif
+#ifndef LATENCY_POLL_OPEN_MS
+#define LATENCY_POLL_OPEN_MS 120000 // Longest poll period while a valve is open
+#endif
+
+bool latency_active(void);
+void latency_kick(void);
+void latency_polled(void);
+uint32_t latency_period(uint32_t normal_ms);
+uint32_t latency_worst_sec(void);
+void latency_reset(void);
+void latency_print(char *buf, uint16_t size);
+
+/** Link health, local data rate and TX power adaptation while ADR is off */
+#define LINK_DR_MIN DR_0					  // Lowest data rate the adaptation uses
+#define LINK_DR_DOWN_FAILS 3				  // Failed uplinks in a row before the data rate is lowered
+#define LINK_UP_OKS 10						  // Good uplinks in a row before the data rate is raised
+#define LINK_MARGIN_UP_DB 10				  // Downlink margin needed to raise the data rate
+#define LINK_POWER_SAVE_STEPS 3				  // TX power steps below the configured power at the highest data rate
+#define LINK_REJOIN_FAILS 12				  // Failed uplinks in a row before a rejoin
+#define LINK_LOSS_MIN_MS (2 * 60 * 60 * 1000) // and for at least this long
+#define LINK_RESET_JOINS 3					  // Failed rejoins before the node is reset
+#define LINK_BACKOFF_MAX_SHIFT 5			  // Retry delay grows up to UPLINK_RETRY_MS << 5
+#define LINK_MARGIN_UNKNOWN INT16_MIN
 
-/** Valve info union */
-union valve_s
+/** Uplink outcome counters */
+struct s_link_stats
 {
-	uint16_t valve_ts16 = 0; // Interval remaining in seconds
-	uint8_t valve_ts8[2];
+	uint32_t acked;		  // Sent, acknowledged if confirmed
+	uint32_t failed;	  // Not acknowledged
+	uint32_t busy;		  // Stack busy, kept for later
+	uint32_t errors;	  // Rejected by the stack, e.g. too long for the data rate
+	uint32_t rejoins;	  // Rejoins after sustained loss
+	uint32_t adaptations; // Data rate or TX power changes
 };
+extern s_link_stats g_link_stats;
+
+void link_init(void);
+void link_send_result(lmh_error_status result);
+void link_rx(int8_t snr);
+void link_tx_done(bool success);
+void link_join_done(bool success);
+uint32_t link_retry_ms(void);
+void link_print(char *buf, uint16_t size);
+
+/** Airtime budget, periodic and bulk uplinks wait while it is spent, state changes always go out */
+#ifndef AIRTIME_BUDGET_MS
+#define AIRTIME_BUDGET_MS 30000 // Per day, e.g. a network fair use policy, at most 2000000
+#endif
+#define AIRTIME_WINDOW_MS (24UL * 60 * 60 * 1000)
+#define AIRTIME_DUTY_CYCLE 100 // The budget is at most 1/100 of the window when duty_cycle_enabled
+
+void airtime_init(void);
+uint8_t airtime_plan(void);
+uint32_t airtime_uplink_ms(uint8_t len);
+uint8_t airtime_max_len(void);
+bool airtime_allow(uint8_t len);
+void airtime_spend(uint8_t len);
+void airtime_print(char *buf, uint16_t size);
+
+/** Time from boot to the first join in ms */
+extern uint32_t g_boot_join_ms;
+
+/** Valve control functions */
+bool setValve(uint8_t zone, int state, int sec, bool report = false, uint8_t cause = 0);
+bool beginValveInterval(uint8_t zone, uint32_t sec, uint8_t cause = 0);
+bool stopValveInterval(uint8_t zone);
+bool endValveInterval(uint8_t zone);
+uint32_t valve_interval_remaining(uint8_t zone);
+uint8_t valve_open_count(void);
+void valve_pins_init(void);
+void valve_actuator_init(void);
+void valve_actuator_handler(void);
+void valve_feedback_handler(uint32_t at_millis);
+void valve_interval_handler(void);
+bool valve_is_busy(uint8_t zone);
+bool valve_report_pending(void);
+void valve_set_oper_time(uint8_t zone, uint8_t sec);
+bool valve_set_max_open(uint8_t max_open);
+void valve_clear_travel(void);
+
+/** LoRaWan payload, layout is described by the schema in payload.h */
+extern uint8_t g_lpwan_data[PAYLOAD_MAX_LEN];
+extern uint8_t g_lpwan_data_len;
+
+/** Deadline scheduler, all application wakeups share one timer */
+#define WAKE_STATUS 0		  // Periodic uplink, replaces the WisBlock-API send timer
+#define WAKE_UPLINK 1		  // Requested uplink (AT+UPLINK)
+#define WAKE_VALVE_ACT 2	  // End of a relay pulse
+#define WAKE_VALVE_INTERVAL 3 // End of a valve interval
+#define WAKE_SCHEDULE 4		  // Next schedule occurrence
+#define WAKE_FLOW 5			  // Flow check while water runs, or end of the settle time
+#define WAKE_VALVE_HOLD 6	  // End of the hold time of an open
+#define WAKE_AT_LINE 7		  // Idle end of a partial BLE command line
+#define WAKE_CLIENTS 8
+#define WAKE_NEVER 0xFFFFFFFF
+
+/** How much earlier the periodic uplink may be sent to share a wakeup */
+#ifndef WAKE_STATUS_SLACK_MS
+#define WAKE_STATUS_SLACK_MS 60000
+#endif
+/** How much earlier a requested uplink may be sent to share a wakeup */
+#ifndef WAKE_UPLINK_SLACK_MS
+#define WAKE_UPLINK_SLACK_MS 5000
+#endif
+
+extern uint32_t g_wake_count;
+void wake_init(void);
+void wake_set(uint8_t client, uint32_t deadline, uint32_t slack);
+void wake_clear(uint8_t client);
+bool wake_pending(uint8_t client);
+uint32_t wake_next_ms(void);
+void wake_handler(void);
+
+/** Energy ledger subsystems */
+#define EN_RELAY_OPEN 0	 // Relay driving a valve open
+#define EN_RELAY_CLOSE 1 // Relay driving a valve closed
+#define EN_LORA_TX 2	 // LoRa transmit, estimated time on air
+#define EN_LORA_RX 3	 // LoRa receive windows
+#define EN_BLE 4		 // BLE advertising or connected
+#define EN_MCU 5		 // MCU awake in the app handlers
+#define EN_COUNT 6
+
+/** Assumed currents in uA, adjust to the hardware in use */
+#ifndef EN_CURRENT_RELAY_UA
+#define EN_CURRENT_RELAY_UA 75000
+#endif
+#ifndef EN_CURRENT_LORA_TX_UA
+#define EN_CURRENT_LORA_TX_UA 118000
+#endif
+#ifndef EN_CURRENT_LORA_RX_UA
+#define EN_CURRENT_LORA_RX_UA 5300
+#endif
+#ifndef EN_CURRENT_BLE_UA
+#define EN_CURRENT_BLE_UA 150
+#endif
+#ifndef EN_CURRENT_MCU_UA
+#define EN_CURRENT_MCU_UA 3300
+#endif
+
+/** Time one receive window stays open when nothing is received */
+#define EN_LORA_RX_WINDOW_MS 30
+
+/** Energy report uplink, sent instead of every ENERGY_REPORT_EVERY status uplink, 0 disables it */
+#ifndef ENERGY_REPORT_EVERY
+#define ENERGY_REPORT_EVERY 96
+#endif
+#define ENERGY_FPORT 3
+#define ENERGY_REPORT_VERSION 2
+#define ENERGY_REPORT_LEN (1 + 2 * EN_COUNT + 2)
+
+void energy_add_ms(uint8_t sub, uint32_t ms);
+void energy_begin(uint8_t sub);
+void energy_end(uint8_t sub);
+uint32_t energy_charge_uah(uint8_t sub);
+void energy_reset(void);
+void energy_lora_uplink(uint8_t len);
+void energy_print(char *buf, uint16_t size);
+bool energy_report_due(void);
+uint8_t energy_report(uint8_t *out, uint8_t max_len);
+
+/** Valve state journal in flash */
+#define JOURNAL_SEG_RECORDS 256
+/** Resume an interval that was interrupted by a reset, with the time left at the last checkpoint, 0 closes the valve */
+#ifndef VALVE_RESUME_INTERVAL
+#define VALVE_RESUME_INTERVAL 1
+#endif
+
+void journal_init(void);
+uint32_t journal_interval_restored(uint8_t zone);
+void journal_valve_state(uint8_t zone, uint8_t state);
+void journal_oper_time(uint8_t zone, uint32_t sec);
+void journal_interval(uint8_t zone, uint32_t remaining_sec);
+void journal_max_open(uint8_t max_open);
+void journal_travel(uint8_t zone, uint16_t ms);
+void journal_motor_used(void);
+void journal_flow_volume(void);
+void journal_flow_max_rate(uint16_t rate);
+uint32_t journal_time_restored(void);
+void journal_time(uint32_t epoch);
+void journal_checkpoint(void);
+void journal_print(char *buf, uint16_t size);
+
+/** Records written since boot and the time the boot replay took */
+extern uint32_t g_journal_writes;
+extern uint32_t g_journal_scan_us;
+
+/** Battery estimator */
+#define BATT_OVERSAMPLE 5					 // Readings per sample, the median is used
+#define BATT_RATE_WINDOW_MS (6 * 60 * 60 * 1000) // Minimum time to measure the discharge rate over
+#define BATT_LOW_SOC 150					 // Low battery below 15 %
+#define BATT_LOW_HYST 100					 // and until above 25 %
+#define BATT_FULL_RATE_SOC 500				 // Status period is stretched below 50 % while the discharge rate is unknown
+#define BATT_FULL_RATE_DAYS 60				 // Status period is stretched below 60 days of projected life
+#define BATT_PERIOD_MAX_MS (4 * 60 * 60 * 1000)	 // Status period at an empty battery
+#define BATT_DAYS_UNKNOWN 0xFFFF
+#define BATT_RATE_UNKNOWN INT32_MIN
+
+/** 9V motor battery, tracked by counting the motor run time */
+#ifndef VALVE_MOTOR_CURRENT_MA
+#define VALVE_MOTOR_CURRENT_MA 150
+#endif
+#ifndef MOTOR_BATT_CAPACITY_MAH
+#define MOTOR_BATT_CAPACITY_MAH 550
+#endif
+
+bool battery_sample(void);
+uint16_t battery_mv(void);
+uint16_t battery_soc(void);
+uint16_t battery_days_left(void);
+bool battery_low(void);
+uint32_t battery_report_period(uint32_t base_ms);
+void battery_motor_add_ms(uint32_t ms);
+uint32_t battery_motor_used(void);
+void battery_motor_set_used(uint32_t mas);
+uint16_t battery_motor_soc(void);
+void battery_print(char *buf, uint16_t size);
+
+/** Valve event history */
+#define HISTORY_SIZE 64			 // Events kept in RAM
+#define HISTORY_BATCH_EVENTS 8	 // Send a batch once this many events are unsent
+#define HISTORY_ACK_PERIODS 4	 // Status periods to wait for an acknowledge before resending
+#define HISTORY_MAX_LEN 48		 // Largest batch uplink
+#define HISTORY_FPORT 4
+#define HISTORY_VERSION 1
+#define HISTORY_FLAG_EPOCH 0x01	 // Times are local epoch seconds, else seconds since boot
+#define HISTORY_HEADER_LEN 7
+
+/** History event types */
+#define HE_OPEN 0			 // Valve reached open
+#define HE_CLOSE 1			 // Valve reached closed
+#define HE_INTERVAL_START 2	 // Interval started
+#define HE_INTERVAL_END 3	 // Interval expired
+#define HE_INTERVAL_ABORT 4	 // Interval stopped before it expired
+#define HE_LEAK 5			 // Flow with all valves closed
+#define HE_FLOW_HIGH 6		 // Flow above the rate limit
+#define HE_STALL 7			 // Valve did not reach its end stop
+
+/** History event causes */
+#define HC_MANUAL 0	  // AT command or downlink
+#define HC_SCHEDULE 1 // Watering schedule
+#define HC_INTERVAL 2 // Interval start or expiry
+#define HC_BOOT 3	  // Startup or resume after reset
+
+void history_add(uint8_t type, uint8_t zone, uint8_t cause);
+uint16_t history_pending(void);
+void history_tick(void);
+bool history_ack(uint16_t seq);
+uint8_t history_build(uint8_t *out, uint8_t max_len, uint16_t *next);
+void history_sent(uint16_t next);
+void history_print(char *buf, uint16_t size);
+
+/** Flow meter with a pulse output on a WisBlock IO pin, 0 disables it
+ * One meter measures the supply of all zones. Enabling it switches the
+ * status uplink to the payload versions with flow data. */
+#ifndef FLOW_METER
+#define FLOW_METER 0
+#endif
+#ifndef FLOW_PIN
+#define FLOW_PIN WB_IO6
+#endif
+/** Pulses per liter, 450 for the common YF-S201 hall sensor */
+#ifndef FLOW_PULSES_PER_L
+#define FLOW_PULSES_PER_L 450
+#endif
+/** Flow rate limit in 0.1 L/min, 0 disables it */
+#ifndef FLOW_MAX_RATE
+#define FLOW_MAX_RATE 400
+#endif
+/** Pulses within one status period with all valves closed that count as a leak */
+#ifndef FLOW_LEAK_PULSES
+#define FLOW_LEAK_PULSES (FLOW_PULSES_PER_L / 10)
+#endif
+/** Pulse count at boot, the counter wraps at 32 bit, the host tests start it just before the wrap */
+#ifndef FLOW_PULSES_START
+#define FLOW_PULSES_START 0
+#endif
+#define FLOW_CHECK_MS 5000					   // Rate check period while a valve is open
+#define FLOW_SETTLE_MS 10000				   // Flow ignored after the last valve closed, the line drains
+#define FLOW_VOLUME_MAX_SEC (4 * 60 * 60)	   // Time limit of a volume interval
+
+/** Flow alarm bits, latched until cleared, valves do not open while set */
+#define FLOW_ALARM_LEAK 0x01 // Flow with all valves closed
+#define FLOW_ALARM_RATE 0x02 // Flow above the rate limit
+
+void flow_init(void);
+void flow_handler(void);
+void flow_tick(void);
+void flow_valve_changed(void);
+bool flow_begin_volume(uint8_t zone, uint16_t liters, uint8_t cause = 0);
+uint32_t flow_volume_remaining(uint8_t zone);
+uint16_t flow_rate(void);
+uint32_t flow_volume(void);
+void flow_set_volume(uint32_t volume);
+uint8_t flow_alarm(void);
+void flow_alarm_clear(void);
+uint16_t flow_max_rate(void);
+void flow_set_max_rate(uint16_t rate);
+void flow_print(char *buf, uint16_t size);
+
+/** Wall clock */
+void time_set(uint32_t epoch);
+uint32_t time_now(void);
+uint32_t uptime_sec(void);
+
+/** Watering schedule */
+extern s_sched_entry g_sched[SCHED_MAX_ENTRIES];
+void schedule_init(void);
+void schedule_handler(void);
+void schedule_rebuild(void);
+bool schedule_set(uint8_t idx, uint8_t days, uint16_t start_min, uint32_t duration_sec, uint8_t zone);
+bool schedule_skip(uint8_t idx);
+
+/** Argument limits of the AT commands */
+#define AT_INTERVAL_MAX_SEC 86400
+#define AT_UPLINK_MAX_SEC 3600
+
+/** Longest AT command line received as a byte stream (BLE UART) */
+#define AT_LINE_MAX 256
+
+/** Bytes read from the BLE UART at once */
+#define BLE_RX_CHUNK 64
+
+/** Time a partial line waits for its line end, for clients that end their lines */
+#ifndef AT_LINE_IDLE_MS
+#define AT_LINE_IDLE_MS 500
+#endif
+
+/** Transports an AT command can arrive on */
+#define AT_SRC_LORA 0
+#define AT_SRC_BLE 1
+#define AT_SRC_USB 2
+#define AT_SRC_COUNT 3
+
+/** Direct AT command dispatch */
+void at_dispatch(char *buf, uint16_t len, uint8_t src);
+void at_feed(const char *data, uint16_t len, uint8_t src);
+void at_feed_end(uint8_t src);
+atcmd_t *at_user_find(const char *name, size_t len);
+uint8_t at_source(void);
+
+/** Rate limit of valve opens and interval starts per AT_SRC_*, closes are never limited */
+#ifndef ACT_RATE_BURST
+#define ACT_RATE_BURST 4
+#endif
+#ifndef ACT_RATE_MS
+#define ACT_RATE_MS 15000 // One more command per period
+#endif
+
+/** Valve commands traced */
+#define ACT_TRACE_LEN 8
+
+/** How a valve command ended */
+#define ACT_PENDING 0	 // Held or running
+#define ACT_DONE 1		 // Valve reached the position
+#define ACT_MERGED 2	 // Joined a running command in the same direction
+#define ACT_SUPERSEDED 3 // Replaced by a later command before it was done
+
+uint16_t act_trace_new(uint8_t zone, uint8_t state, uint8_t cause);
+void act_trace_start(uint16_t id);
+void act_trace_end(uint16_t id, uint8_t outcome);
+bool act_admit(uint8_t src);
+void act_charge(uint8_t src);
+void act_print(char *buf, uint16_t size);
+
+/** Binary downlink commands */
+void downlink_handler(uint8_t *data, uint8_t len);
+void downlink_add_result(uint8_t result);
+uint8_t downlink_append_results(uint8_t *out, uint8_t len, uint8_t max_len);
+void downlink_results_sent(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "app.h"
+
+/** Transport of the command being executed, USB commands are executed by the WisBlock-API */
+static uint8_t at_src = AT_SRC_USB;
+
+/** Partial command line of a byte stream source */
+struct s_at_line
+{
+	char buf[AT_LINE_MAX + 1];
+	uint16_t len;
+	bool overflow;		  // The line was too long, it is dropped at its end
+	bool crlf;			  // The client ends its lines with CR or LF
+	uint32_t last_millis; // Last byte received
+};
+
+static s_at_line at_lines[AT_SRC_COUNT];
+
+/**
+ * @brief Transport of the command being executed
+ *
+ * @return uint8_t AT_SRC_*
+ */
+uint8_t at_source(void)
+{
+	return at_src;
+}
+
+/**
+ * @brief Send the response of a command back to where it came from
+ *		  LoRa commands are answered with a result code in the next uplink
+ *
+ * @param src AT_SRC_LORA or AT_SRC_BLE
+ * @param result 0 on success or an AT error code
+ * @param text optional response text
+ */
+static void at_respond(uint8_t src, int result, const char *text)
+{
+	if (src == AT_SRC_LORA)
+	{
+		switch (result)
+		{
+		case 0:
+			downlink_add_result(DL_RESULT_OK);
+			break;
+		case AT_ERR_NOT_SUPPORTED:
+			downlink_add_result(DL_RESULT_UNKNOWN);
+			break;
+		case AT_ERR_PARAM:
+			downlink_add_result(DL_RESULT_BAD_ARG);
+			break;
+		default:
+			downlink_add_result(DL_RESULT_REJECTED);
+			break;
+		}
+		return;
+	}
+
+#ifdef NRF52_SERIES
+	if (g_ble_uart_is_connected)
+	{
+		if (text)
+		{
+			g_ble_uart.printf("%s\r\n", text);
+		}
+		if (result == 0)
+		{
+			g_ble_uart.printf("OK\r\n");
+		}
+		else
+		{
+			g_ble_uart.printf("+CME ERROR:%d\r\n", result);
+		}
+	}
+#endif
+}
+
+/**
+ * @brief Execute a single command line, the line is modified in place
+ *
+ * @param line NUL terminated command line
+ * @param len length of the line
+ * @param src AT_SRC_LORA or AT_SRC_BLE
+ */
+static void at_dispatch_line(char *line, size_t len, uint8_t src)
+{
+	if ((len < 2) || (strncasecmp(line, "AT", 2) != 0))
+	{
+		MYLOG("AT", "Not an AT command");
+		at_respond(src, AT_ERR_NOT_SUPPORTED, NULL);
+		return;
+	}
+
+	char *name = &line[2];
+	if (*name == 0)
+	{
+		at_respond(src, 0, NULL);
+		return;
+	}
+
+	size_t name_len = strcspn(name, "=?");
+	atcmd_t *cmd = at_user_find(name, name_len);
+	if (cmd == NULL)
+	{
+		// Not one of ours, hand it to the WisBlock-API parser
+		for (size_t idx = 0; idx < len; idx++)
+		{
+			at_serial_input(uint8_t(line[idx]));
+		}
+		at_serial_input(uint8_t('\n'));
+		return;
+	}
+
+	char *param = &name[name_len];
+	int result = AT_ERR_NOT_SUPPORTED;
+	if (param[0] == '?')
+	{
+		// AT+CMD? shows the help
+		at_respond(src, 0, cmd->cmd_desc);
+		return;
+	}
+	else if ((param[0] == '=') && (param[1] == '?'))
+	{
+		// AT+CMD=? queries the value
+		if (cmd->query_cmd)
+		{
+			result = cmd->query_cmd();
+			if (result == 0)
+			{
+				at_respond(src, 0, g_at_query_buf);
+				return;
+			}
+		}
+	}
+	else if (param[0] == '=')
+	{
+		// AT+CMD=value
+		if (cmd->exec_cmd)
+		{
+			at_src = src;
+			result = cmd->exec_cmd(&param[1]);
+		}
+	}
+	else if (cmd->exec_cmd_no_para)
+	{
+		// AT+CMD
+		at_src = src;
+		result = cmd->exec_cmd_no_para();
+	}
+	at_src = AT_SRC_USB;
+
+	at_respond(src, result, NULL);
+}
+
+/**
+ * @brief Parse and execute AT commands directly from a receive buffer
+ *		  One command per line, the buffer is split in place.
+ *
+ * @param buf received data, buf[len] must be writable
+ * @param len length of the received data
+ * @param src AT_SRC_LORA or AT_SRC_BLE
+ */
+void at_dispatch(char *buf, uint16_t len, uint8_t src)
+{
+	char *line = buf;
+	char *end = &buf[len];
+	*end = 0;
+
+	while (line < end)
+	{
+		char *eol = line;
+		while ((eol < end) && (*eol != '\n') && (*eol != '\r'))
+		{
+			eol++;
+		}
+		*eol = 0;
+
+		if (eol != line)
+		{
+			at_dispatch_line(line, eol - line, src);
+		}
+		line = eol + 1;
+	}
+}
+
+/**
+ * @brief Execute a collected line and start a new one
+ */
+static void at_line_end(s_at_line *line, uint8_t src)
+{
+	if (line->overflow)
+	{
+		MYLOG("AT", "Line longer than %d bytes dropped", AT_LINE_MAX);
+		at_respond(src, AT_ERR_PARAM, NULL);
+	}
+	else if (line->len)
+	{
+		line->buf[line->len] = 0;
+		at_dispatch_line(line->buf, line->len, src);
+	}
+	line->len = 0;
+	line->overflow = false;
+}
+
+/**
+ * @brief Collect AT command lines from a byte stream and execute each complete line
+ *		  A line may be split across any number of calls, it ends at CR or LF.
+ *		  A line longer than AT_LINE_MAX is answered with a parameter error.
+ *		  Call at_feed_end() once the received data is used up.
+ *
+ * @param data received bytes
+ * @param len number of bytes
+ * @param src AT_SRC_BLE
+ */
+void at_feed(const char *data, uint16_t len, uint8_t src)
+{
+	s_at_line *line = &at_lines[src];
+
+	if (len)
+	{
+		line->last_millis = millis();
+	}
+	for (uint16_t idx = 0; idx < len; idx++)
+	{
+		char chr = data[idx];
+		if ((chr != '\r') && (chr != '\n'))
+		{
+			if (line->len < AT_LINE_MAX)
+			{
+				line->buf[line->len++] = chr;
+			}
+			else
+			{
+				line->overflow = true;
+			}
+			continue;
+		}
+
+		line->crlf = true;
+		at_line_end(line, src);
+	}
+}
+
+/**
+ * @brief The received data is used up, decide about a partial line
+ *		  Clients that never sent CR or LF (e.g. Bluefruit Connect) send one
+ *		  command per write, their partial line is executed right away.
+ *		  For clients that end their lines the partial line waits for the rest,
+ *		  up to AT_LINE_IDLE_MS after the last byte.
+ *
+ * @param src AT_SRC_BLE
+ */
+void at_feed_end(uint8_t src)
+{
+	s_at_line *line = &at_lines[src];
+
+	if ((line->len == 0) && !line->overflow)
+	{
+		wake_clear(WAKE_AT_LINE);
+		return;
+	}
+
+	uint32_t idle = millis() - line->last_millis;
+	if (!line->crlf || (idle >= AT_LINE_IDLE_MS))
+	{
+		wake_clear(WAKE_AT_LINE);
+		at_line_end(line, src);
+		return;
+	}
+
+	// Handled again as received data once the idle time is over
+	wake_set(WAKE_AT_LINE, line->last_millis + AT_LINE_IDLE_MS, 0);
+}
@@ -0,0 +1,100 @@
+#include "at_registry.h"
+
+/**
+ * @brief Hash of a received command name, same as at_hash()
+ *
+ * @param name command name including the '+', not NUL terminated
+ * @param len length of the name
+ * @param seed hash seed of the command list
+ * @return uint32_t hash
+ */
+uint32_t at_hash_name(const char *name, size_t len, uint32_t seed)
+{
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		seed = (seed ^ at_upper(name[idx])) * 16777619UL;
+	}
+	return seed;
+}
+
+/**
+ * @brief Parse colon separated decimal values by a schema
+ *		  The whole string must be consumed, values that overflow 32 bits or
+ *		  are out of range are rejected. Left out optional values get their
+ *		  default.
+ *
+ * @param str argument string
+ * @param schema one entry per value
+ * @param num number of values in the schema, at most AT_ARGS_MAX
+ * @param values parsed values, num entries
+ * @return int 0 or AT_ERR_PARAM
+ */
+int at_parse_args(const char *str, const at_arg_s *schema, uint8_t num, uint32_t *values)
+{
+	uint32_t given[AT_ARGS_MAX];
+	uint8_t count = 0;
+
+	while (true)
+	{
+		if (count >= num)
+		{
+			return AT_ERR_PARAM;
+		}
+		const char *start = str;
+		uint32_t value = 0;
+		while ((*str >= '0') && (*str <= '9'))
+		{
+			uint8_t digit = *str++ - '0';
+			if (value > (UINT32_MAX - digit) / 10)
+			{
+				return AT_ERR_PARAM;
+			}
+			value = value * 10 + digit;
+		}
+		if (str == start)
+		{
+			return AT_ERR_PARAM;
+		}
+		given[count++] = value;
+		if (*str == 0)
+		{
+			break;
+		}
+		if (*str++ != ':')
+		{
+			return AT_ERR_PARAM;
+		}
+	}
+
+	// Leave out optional values at the front first, then at the end
+	uint8_t skip = 0;
+	uint8_t omit = num - count;
+	for (uint8_t idx = 0; (idx < num) && omit && (schema[idx].flags == AT_ARG_LEAD); idx++, omit--)
+	{
+		skip |= 1 << idx;
+	}
+	for (uint8_t idx = num; (idx > 0) && omit && (schema[idx - 1].flags == AT_ARG_TRAIL); idx--, omit--)
+	{
+		skip |= 1 << (idx - 1);
+	}
+	if (omit)
+	{
+		return AT_ERR_PARAM;
+	}
+
+	const uint32_t *next = given;
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		if (skip & (1 << idx))
+		{
+			values[idx] = schema[idx].def;
+			continue;
+		}
+		if ((*next < schema[idx].min) || (*next > schema[idx].max))
+		{
+			return AT_ERR_PARAM;
+		}
+		values[idx] = *next++;
+	}
+	return 0;
+}
@@ -0,0 +1,148 @@
+#ifndef AT_REGISTRY_H
+#define AT_REGISTRY_H
+
+/**
+ * AT command registry helpers, no Arduino dependencies.
+ *
+ * Command names are looked up with a perfect hash: the seed is searched at
+ * compile time so that every name of the command list lands in its own slot
+ * of AT_HASH_SLOTS. The lookup is one hash of the name, a switch on the slot
+ * and one string compare.
+ *
+ * Arguments are colon separated decimal numbers. Each command declares a
+ * schema with the range of every value. Optional values at the front (e.g.
+ * the zone) are left out first, then optional values at the end.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** AT command error codes, as used by the WisBlock-API */
+#define AT_ERR_NOT_SUPPORTED 1
+#define AT_ERR_NOT_ALLOWED 2
+#define AT_ERR_PARAM 5
+
+/** Slots of the name hash, a power of 2 up to 256 */
+#define AT_HASH_SLOTS 256
+
+/** Most command names, about a fifth of the slots keeps the seed search
+ * short and well within the constexpr limits of the compiler */
+#define AT_HASH_MAX_NAMES 48
+
+/** Seeds tried by the compile time search */
+#define AT_HASH_SEED_RANGE 4096
+#define AT_HASH_NO_SEED UINT32_MAX
+
+/** Most values of one command */
+#define AT_ARGS_MAX 8
+
+/** How a value may be left out */
+#define AT_ARG_REQ 0   // Always given
+#define AT_ARG_LEAD 1  // May be left out at the front
+#define AT_ARG_TRAIL 2 // May be left out at the end
+
+/** One value of an argument schema */
+struct at_arg_s
+{
+	uint32_t min;
+	uint32_t max;
+	uint32_t def; // Used when the value is left out, not range checked
+	uint8_t flags;
+};
+
+/**
+ * @brief Upper case of an ASCII character
+ */
+constexpr uint8_t at_upper(char chr)
+{
+	return ((chr >= 'a') && (chr <= 'z')) ? chr - 'a' + 'A' : chr;
+}
+
+/**
+ * @brief FNV-1a hash of a command name, case insensitive
+ */
+constexpr uint32_t at_hash(const char *name, uint32_t seed)
+{
+	return *name ? at_hash(name + 1, (seed ^ at_upper(*name)) * 16777619UL) : seed;
+}
+
+/**
+ * @brief Slot of a hash
+ */
+constexpr uint8_t at_slot(uint32_t hash)
+{
+	return (hash ^ (hash >> 16)) & (AT_HASH_SLOTS - 1);
+}
+
+/**
+ * @brief Check that a name does not share its slot with any name before it
+ */
+constexpr bool at_slot_free(const char *const *names, uint8_t idx, uint8_t other, uint32_t seed)
+{
+	return (other >= idx) ? true
+						  : (at_slot(at_hash(names[idx], seed)) != at_slot(at_hash(names[other], seed))) &&
+								at_slot_free(names, idx, other + 1, seed);
+}
+
+/**
+ * @brief Check that all names land in their own slot
+ */
+constexpr bool at_seed_ok(const char *const *names, uint8_t num, uint8_t idx, uint32_t seed)
+{
+	return (idx >= num) ? true : at_slot_free(names, idx, 0, seed) && at_seed_ok(names, num, idx + 1, seed);
+}
+
+constexpr uint32_t at_find_seed(const char *const *names, uint8_t num, uint32_t first, uint32_t last);
+
+/**
+ * @brief Keep the seed found in the lower half or search the upper half
+ */
+constexpr uint32_t at_pick_seed(uint32_t lower, const char *const *names, uint8_t num, uint32_t mid, uint32_t last)
+{
+	return (lower != AT_HASH_NO_SEED) ? lower : at_find_seed(names, num, mid, last);
+}
+
+/**
+ * @brief Find the first seed in [first, last) without shared slots
+ *		  Splits the range in halves to keep the recursion shallow.
+ */
+constexpr uint32_t at_find_seed(const char *const *names, uint8_t num, uint32_t first, uint32_t last)
+{
+	return ((last - first) == 1) ? (at_seed_ok(names, num, 0, 2166136261UL + first) ? 2166136261UL + first : AT_HASH_NO_SEED)
+								 : at_pick_seed(at_find_seed(names, num, first, first + (last - first) / 2), names, num,
+												first + (last - first) / 2, last);
+}
+
+/**
+ * @brief Perfect hash seed of a command list
+ *
+ * @return AT_HASH_NO_SEED if there are more than AT_HASH_MAX_NAMES names or no seed was found
+ */
+constexpr uint32_t at_seed_for(const char *const *names, uint8_t num)
+{
+	return (num > AT_HASH_MAX_NAMES) ? AT_HASH_NO_SEED : at_find_seed(names, num, 0, AT_HASH_SEED_RANGE);
+}
+
+uint32_t at_hash_name(const char *name, size_t len, uint32_t seed);
+int at_parse_args(const char *str, const at_arg_s *schema, uint8_t num, uint32_t *values);
+
+/**
+ * @brief Parse the arguments by a schema and call the handler with the values
+ *		  Used as exec_cmd of the WisBlock-API command list.
+ *
+ * @tparam schema argument schema
+ * @tparam num number of values in the schema
+ * @tparam handler called with num values, all within their range
+ * @param str argument string after the '='
+ * @return int 0 or an AT_ERR_* code
+ */
+template <const at_arg_s *schema, uint8_t num, int (*handler)(const uint32_t *)>
+int at_exec_typed(char *str)
+{
+	static_assert(num <= AT_ARGS_MAX, "Too many values");
+	uint32_t values[num];
+	int result = at_parse_args(str, schema, num, values);
+	return result ? result : handler(values);
+}
+
+#endif
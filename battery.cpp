@@ -0,0 +1,283 @@
+#include "app.h"
+
+/** Filtered LiPo voltage, mV in 12.4 fixed point, 0 before the first sample */
+static uint32_t batt_ewma = 0;
+
+/** Start of the current discharge rate window */
+static uint16_t rate_anchor_soc = 0;
+static uint32_t rate_anchor_millis = 0;
+
+/** Filtered discharge rate in 0.1 % per day, negative while charging, BATT_RATE_UNKNOWN if unknown */
+static int32_t batt_rate = BATT_RATE_UNKNOWN;
+
+/** Low battery flag with hysteresis */
+static bool batt_low = false;
+
+/** Charge drawn from the 9V battery by the valve motor in mAs */
+static uint32_t motor_used_mas = 0;
+
+/** LiPo discharge curve, {mV, SoC in 0.1 %}, sorted by voltage */
+static const uint16_t lipo_curve[][2] = {
+	{3000, 0}, {3300, 20}, {3400, 50}, {3500, 100}, {3600, 200}, {3700, 380}, {3800, 550}, {3900, 680}, {4000, 800}, {4100, 900}, {4200, 1000}};
+#define LIPO_CURVE_POINTS (sizeof(lipo_curve) / sizeof(lipo_curve[0]))
+
+/**
+ * @brief Check if a relay is powered, the LiPo voltage sags under the relay current
+ */
+static bool battery_relay_active(void)
+{
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (valve_is_busy(zone))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Read the LiPo voltage as the median of BATT_OVERSAMPLE readings
+ *
+ * @return uint16_t voltage in mV
+ */
+static uint16_t battery_read_median(void)
+{
+	uint16_t samples[BATT_OVERSAMPLE];
+	for (uint8_t idx = 0; idx < BATT_OVERSAMPLE; idx++)
+	{
+		uint16_t value = read_batt();
+		// Insertion sort, the set is tiny
+		uint8_t pos = idx;
+		while ((pos > 0) && (samples[pos - 1] > value))
+		{
+			samples[pos] = samples[pos - 1];
+			pos--;
+		}
+		samples[pos] = value;
+	}
+	return samples[BATT_OVERSAMPLE / 2];
+}
+
+/**
+ * @brief Update the discharge rate once a full window has passed
+ */
+static void battery_update_rate(void)
+{
+	uint32_t elapsed = millis() - rate_anchor_millis;
+	if (elapsed < BATT_RATE_WINDOW_MS)
+	{
+		return;
+	}
+
+	int32_t drop = (int32_t)rate_anchor_soc - battery_soc();
+	int32_t rate = (int64_t)drop * (24L * 60 * 60 * 1000) / elapsed;
+	batt_rate = (batt_rate == BATT_RATE_UNKNOWN) ? rate : batt_rate + (rate - batt_rate) / 4;
+
+	rate_anchor_soc = battery_soc();
+	rate_anchor_millis = millis();
+}
+
+/**
+ * @brief Take a filtered LiPo sample, skipped while a relay is powered
+ *
+ * @return true a sample was taken
+ */
+bool battery_sample(void)
+{
+	if (battery_relay_active())
+	{
+		MYLOG("BAT", "Relay active, sample skipped");
+		return false;
+	}
+
+	uint32_t sample = (uint32_t)battery_read_median() << 4;
+	if (batt_ewma == 0)
+	{
+		batt_ewma = sample;
+		rate_anchor_soc = battery_soc();
+		rate_anchor_millis = millis();
+	}
+	else
+	{
+		// EWMA with alpha 1/4
+		batt_ewma = batt_ewma + ((int32_t)(sample - batt_ewma) >> 2);
+	}
+
+	uint16_t soc = battery_soc();
+	if (soc < BATT_LOW_SOC)
+	{
+		batt_low = true;
+	}
+	else if (soc > BATT_LOW_SOC + BATT_LOW_HYST)
+	{
+		batt_low = false;
+	}
+
+	battery_update_rate();
+	MYLOG("BAT", "%d mV, SoC %d.%d %%", battery_mv(), soc / 10, soc % 10);
+	return true;
+}
+
+/**
+ * @brief Filtered LiPo voltage
+ *
+ * @return uint16_t voltage in mV
+ */
+uint16_t battery_mv(void)
+{
+	return (batt_ewma + 8) >> 4;
+}
+
+/**
+ * @brief LiPo state of charge from the discharge curve
+ *
+ * @return uint16_t state of charge in 0.1 %
+ */
+uint16_t battery_soc(void)
+{
+	uint16_t mv = battery_mv();
+	if (mv <= lipo_curve[0][0])
+	{
+		return 0;
+	}
+	for (uint8_t idx = 1; idx < LIPO_CURVE_POINTS; idx++)
+	{
+		if (mv < lipo_curve[idx][0])
+		{
+			uint16_t dv = lipo_curve[idx][0] - lipo_curve[idx - 1][0];
+			uint16_t ds = lipo_curve[idx][1] - lipo_curve[idx - 1][1];
+			return lipo_curve[idx - 1][1] + (uint32_t)(mv - lipo_curve[idx - 1][0]) * ds / dv;
+		}
+	}
+	return 1000;
+}
+
+/**
+ * @brief Projected days until the LiPo is empty
+ *
+ * @return uint16_t days, BATT_DAYS_UNKNOWN if not discharging or not known yet
+ */
+uint16_t battery_days_left(void)
+{
+	if ((batt_rate == BATT_RATE_UNKNOWN) || (batt_rate <= 0))
+	{
+		return BATT_DAYS_UNKNOWN;
+	}
+	uint32_t days = battery_soc() / batt_rate;
+	return days < BATT_DAYS_UNKNOWN ? days : BATT_DAYS_UNKNOWN - 1;
+}
+
+/**
+ * @brief Check if the LiPo is low, with hysteresis
+ */
+bool battery_low(void)
+{
+	return batt_low;
+}
+
+/**
+ * @brief Status period for the projected remaining life
+ *		  With BATT_FULL_RATE_DAYS or more left the configured period is used,
+ *		  below it the period grows linearly up to BATT_PERIOD_MAX_MS at an
+ *		  empty battery. Until the discharge rate is known the state of charge
+ *		  stands in, the period grows below BATT_FULL_RATE_SOC. While the
+ *		  battery is charging the configured period is used.
+ *
+ * @param base_ms configured period
+ * @return uint32_t period to use in ms
+ */
+uint32_t battery_report_period(uint32_t base_ms)
+{
+	if ((batt_ewma == 0) || (base_ms >= BATT_PERIOD_MAX_MS))
+	{
+		return base_ms;
+	}
+
+	uint32_t left;
+	uint32_t full;
+	if (batt_rate == BATT_RATE_UNKNOWN)
+	{
+		left = battery_soc();
+		full = BATT_FULL_RATE_SOC;
+	}
+	else if (batt_rate <= 0)
+	{
+		return base_ms;
+	}
+	else
+	{
+		left = battery_days_left();
+		full = BATT_FULL_RATE_DAYS;
+	}
+
+	if (left >= full)
+	{
+		return base_ms;
+	}
+	return base_ms + (uint64_t)(BATT_PERIOD_MAX_MS - base_ms) * (full - left) / full;
+}
+
+/**
+ * @brief Book valve motor run time against the 9V battery
+ *
+ * @param ms motor run time
+ */
+void battery_motor_add_ms(uint32_t ms)
+{
+	motor_used_mas += ms * VALVE_MOTOR_CURRENT_MA / 1000;
+}
+
+/**
+ * @brief Charge drawn from the 9V battery
+ *
+ * @return uint32_t charge in mAs
+ */
+uint32_t battery_motor_used(void)
+{
+	return motor_used_mas;
+}
+
+/**
+ * @brief Set the charge drawn from the 9V battery, 0 after a battery change
+ *
+ * @param mas charge in mAs
+ */
+void battery_motor_set_used(uint32_t mas)
+{
+	motor_used_mas = mas;
+}
+
+/**
+ * @brief Remaining charge of the 9V battery
+ *
+ * @return uint16_t state of charge in 0.1 %
+ */
+uint16_t battery_motor_soc(void)
+{
+	uint32_t used_mah = motor_used_mas / 3600;
+	if (used_mah >= MOTOR_BATT_CAPACITY_MAH)
+	{
+		return 0;
+	}
+	return 1000 - used_mah * 1000 / MOTOR_BATT_CAPACITY_MAH;
+}
+
+/**
+ * @brief Write the battery state in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void battery_print(char *buf, uint16_t size)
+{
+	uint16_t soc = battery_soc();
+	uint16_t motor = battery_motor_soc();
+	int len = snprintf(buf, size, "LiPo %d mV %d.%d%%", battery_mv(), soc / 10, soc % 10);
+	if (battery_days_left() != BATT_DAYS_UNKNOWN)
+	{
+		len += snprintf(&buf[len], size - len, " %d days", battery_days_left());
+	}
+	snprintf(&buf[len], size - len, ", 9V %d.%d%%, period %lu s", motor / 10, motor % 10,
+			 (unsigned long)(battery_report_period(g_lorawan_settings.send_repeat_time) / 1000));
+}
@@ -0,0 +1,58 @@
+#include "app.h"
+
+/** Seconds since boot at uptime_base_millis */
+static uint32_t uptime_base_sec = 0;
+static uint32_t uptime_base_millis = 0;
+
+/** Wall clock, seconds since epoch at time_base_millis, 0 if never set */
+static uint32_t time_base_sec = 0;
+static uint32_t time_base_millis = 0;
+
+/**
+ * @brief Set the wall clock, it is journaled to survive a reset
+ *
+ * @param epoch seconds since 1970-01-01, local time
+ */
+void time_set(uint32_t epoch)
+{
+	time_base_sec = epoch;
+	time_base_millis = millis();
+	MYLOG("APP", "Time set to %lu", epoch);
+	journal_time(epoch);
+
+	// Pending schedule occurrences depend on the clock
+	schedule_rebuild();
+}
+
+/**
+ * @brief Get the wall clock
+ *		  The base is moved forward on every call so millis() wrapping is
+ *		  handled as long as the clock is read at least every 49 days.
+ *
+ * @return uint32_t seconds since 1970-01-01, 0 if the time was never set
+ */
+uint32_t time_now(void)
+{
+	if (time_base_sec == 0)
+	{
+		return 0;
+	}
+
+	uint32_t elapsed_sec = (millis() - time_base_millis) / 1000;
+	time_base_sec += elapsed_sec;
+	time_base_millis += elapsed_sec * 1000;
+	return time_base_sec;
+}
+
+/**
+ * @brief Get the time since boot, like time_now() safe against millis() wrapping
+ *
+ * @return uint32_t seconds since boot
+ */
+uint32_t uptime_sec(void)
+{
+	uint32_t elapsed_sec = (millis() - uptime_base_millis) / 1000;
+	uptime_base_sec += elapsed_sec;
+	uptime_base_millis += elapsed_sec * 1000;
+	return uptime_base_sec;
+}
@@ -0,0 +1,46 @@
+// Sample Datacake encoder for binary command frames, see downlink.h.
+// - Configure the downlink to use FPort 10.
+// - Optional measurements: "OPER_TIME_CONFIGURE" (seconds), "INTERVAL_CONFIGURE" (seconds),
+//   "VALVE_CONFIGURE" (0 close / 1 open), "HISTORY_ACK" (seq of the last history event stored),
+//   "VOLUME_CONFIGURE" (liters for zone 0), "FLOW_RESET" (any value clears the flow alarm).
+// - An uplink is always requested so the command results are reported right away.
+
+function packInterval(sec) {
+  for (var exp = 0; exp < 4; exp++) {
+    var unit = Math.pow(2, 3 * exp);
+    var mantissa = Math.ceil(sec / unit);
+    if (mantissa <= 0x3FFF) {
+      return (exp << 14) | mantissa;
+    }
+  }
+  return 0xFFFF;
+}
+
+function Encoder(measurements, port) {
+  var frame = [];
+
+  if (measurements["OPER_TIME_CONFIGURE"]) {
+    frame.push(0x04, measurements["OPER_TIME_CONFIGURE"].value & 0xFF);
+  }
+  if (measurements["VALVE_CONFIGURE"]) {
+    frame.push(0x01, measurements["VALVE_CONFIGURE"].value ? 1 : 0);
+  }
+  if (measurements["INTERVAL_CONFIGURE"]) {
+    var packed = packInterval(measurements["INTERVAL_CONFIGURE"].value);
+    frame.push(0x02, packed >> 8, packed & 0xFF);
+  }
+  if (measurements["VOLUME_CONFIGURE"]) {
+    var liters = measurements["VOLUME_CONFIGURE"].value;
+    frame.push(0x0D, 0, (liters >> 8) & 0xFF, liters & 0xFF);
+  }
+  if (measurements["FLOW_RESET"]) {
+    frame.push(0x0E);
+  }
+  if (measurements["HISTORY_ACK"]) {
+    var seq = measurements["HISTORY_ACK"].value;
+    frame.push(0x0C, (seq >> 8) & 0xFF, seq & 0xFF);
+  }
+  frame.push(0x05);
+
+  return frame;
+}
@@ -1,11 +1,201 @@
+// Datacake decoder for the valve controller uplinks.
+// The field tables mirror the schemas in payload.h / payload.cpp, keep them in sync,
+// host_test/test_decoder.cpp compares them.
+
+var FLAG_OPEN = 0x1;
+var FLAG_INTERVAL = 0x2;
+var FLAG_FAULT = 0x4;
+var FLAG_LOW_BATT = 0x8;
+
+// Binary command result codes, see downlink.h
+var RESULTS = ["OK", "UNKNOWN", "BAD_ARG", "REJECTED"];
+
+// [name, bits, gate field, gate mask, repeat field]
+// A repeated field is present once per set bit of its repeat field, named name + bit.
+var SCHEMAS = {
+  1: [
+    ["VERSION", 4, null, 0, null],
+    ["FLAGS", 4, null, 0, null],
+    ["BATT", 8, null, 0, null],
+    ["REMAIN", 16, "FLAGS", FLAG_INTERVAL, null]
+  ],
+  2: [
+    ["VERSION", 4, null, 0, null],
+    ["FLAGS", 4, null, 0, null],
+    ["BATT", 8, null, 0, null],
+    ["ZONE_OPEN", 8, null, 0, null],
+    ["ZONE_RUN", 8, "FLAGS", FLAG_INTERVAL, null],
+    ["ZONE_REMAIN", 16, "FLAGS", FLAG_INTERVAL, "ZONE_RUN"]
+  ],
+  3: [
+    ["VERSION", 4, null, 0, null],
+    ["FLAGS", 4, null, 0, null],
+    ["BATT", 8, null, 0, null],
+    ["FLOW_RATE", 16, null, 0, null],
+    ["VOLUME", 24, null, 0, null],
+    ["REMAIN", 16, "FLAGS", FLAG_INTERVAL, null]
+  ],
+  4: [
+    ["VERSION", 4, null, 0, null],
+    ["FLAGS", 4, null, 0, null],
+    ["BATT", 8, null, 0, null],
+    ["FLOW_RATE", 16, null, 0, null],
+    ["VOLUME", 24, null, 0, null],
+    ["ZONE_OPEN", 8, null, 0, null],
+    ["ZONE_RUN", 8, "FLAGS", FLAG_INTERVAL, null],
+    ["ZONE_REMAIN", 16, "FLAGS", FLAG_INTERVAL, "ZONE_RUN"]
+  ]
+};
+
+var MAX_ZONES = 8;
+
+function readBits(bytes, state, bits) {
+  var value = 0;
+  for (var i = 0; i < bits; i++) {
+    var bit = (bytes[state.pos >> 3] >> (7 - (state.pos & 7))) & 1;
+    value = value * 2 + bit;
+    state.pos++;
+  }
+  return value;
+}
+
+function unpackRemain(packed) {
+  return (packed & 0x3FFF) * Math.pow(2, 3 * (packed >> 14));
+}
+
+function decodeLegacy(bytes) {
+  return {
+    BATTERY_V: (bytes[0] << 8 | bytes[1]) / 100,
+    INTERVAL_REMAIN: (bytes[2] << 8 | bytes[3]),
+    VALVE_STATE: (bytes[4] & 0x1)
+  };
+}
+
+// Energy report on ENERGY_FPORT, charge per subsystem in 0.1 mAh, see energy.cpp
+var ENERGY_FPORT = 3;
+var ENERGY_NAMES = ["RELAY_OPEN", "RELAY_CLOSE", "LORA_TX", "LORA_RX", "BLE", "MCU"];
+
+function decodeEnergy(bytes) {
+  var out = {};
+  for (var i = 0; i < ENERGY_NAMES.length && 2 + 2 * i < bytes.length; i++) {
+    out["ENERGY_" + ENERGY_NAMES[i] + "_MAH"] = (bytes[1 + 2 * i] << 8 | bytes[2 + 2 * i]) / 10;
+  }
+  // Version 2 adds the worst command latency of the latency mode
+  var lat = 1 + 2 * ENERGY_NAMES.length;
+  if (bytes[0] >= 2 && lat + 1 < bytes.length) {
+    out.LATENCY_WORST_S = bytes[lat] << 8 | bytes[lat + 1];
+  }
+  return out;
+}
+
+// Valve event history batches on HISTORY_FPORT, see history.cpp
+var HISTORY_FPORT = 4;
+var HISTORY_FLAG_EPOCH = 0x1;
+var HISTORY_TYPES = ["OPEN", "CLOSE", "INTERVAL_START", "INTERVAL_END", "INTERVAL_ABORT", "LEAK", "FLOW_HIGH", "STALL"];
+var HISTORY_CAUSES = ["MANUAL", "SCHEDULE", "INTERVAL", "BOOT"];
+
+function decodeHistory(bytes) {
+  var seq = bytes[1] << 8 | bytes[2];
+  var time = ((bytes[3] << 24) >>> 0) + (bytes[4] << 16 | bytes[5] << 8 | bytes[6]);
+  var events = [];
+  var pos = 7;
+  while (pos < bytes.length) {
+    var ev = bytes[pos++];
+    var delta = 0;
+    var shift = 0;
+    var b;
+    do {
+      b = bytes[pos++];
+      delta += (b & 0x7F) * Math.pow(2, shift);
+      shift += 7;
+    } while ((b & 0x80) && pos < bytes.length);
+    time += delta;
+    events.push({
+      seq: (seq + events.length) & 0xFFFF,
+      time: time,
+      type: HISTORY_TYPES[ev >> 5],
+      zone: (ev >> 2) & 0x7,
+      cause: HISTORY_CAUSES[ev & 0x3]
+    });
+  }
+  return {
+    HISTORY_EPOCH: (bytes[0] & HISTORY_FLAG_EPOCH) ? 1 : 0,
+    HISTORY_LAST_SEQ: events.length ? events[events.length - 1].seq : seq,
+    HISTORY: JSON.stringify(events)
+  };
+}
+
 function Decoder(bytes, port) {
-    var battery = (bytes[0]<<8 | bytes[1])/100;//Battery,units:V
-    var interval_remain = (bytes[2]<<8 | bytes[3]);//Remaining seconds in the interval,units:Seconds
-    var valve_state = (bytes[4] & 0x1);//Valve state
-
-    return {
-      BATTERY_V:battery,
-      INTERVAL_REMAIN:interval_remain,
-      VALVE_STATE:valve_state
-    };
-}
\ No newline at end of file
+  if (port === ENERGY_FPORT) {
+    return decodeEnergy(bytes);
+  }
+  if (port === HISTORY_FPORT) {
+    return decodeHistory(bytes);
+  }
+
+  var version = bytes[0] >> 4;
+  if (version === 0 && bytes.length === 5) {
+    return decodeLegacy(bytes);
+  }
+
+  var schema = SCHEMAS[version];
+  if (!schema) {
+    return { ERROR: "unknown payload version " + version };
+  }
+
+  var state = { pos: 0 };
+  var v = {};
+  for (var i = 0; i < schema.length; i++) {
+    var field = schema[i];
+    if (field[2] !== null && !(v[field[2]] & field[3])) {
+      continue;
+    }
+    var repeat = field[4] !== null ? (v[field[4]] || 0) : 1;
+    for (var n = 0; n < MAX_ZONES; n++) {
+      if (!(repeat & (1 << n))) {
+        continue;
+      }
+      if (state.pos + field[1] > bytes.length * 8) {
+        return { ERROR: "truncated payload" };
+      }
+      v[field[4] !== null ? field[0] + n : field[0]] = readBits(bytes, state, field[1]);
+    }
+  }
+
+  // Results of the last binary command frame, byte aligned after the fields
+  var results = [];
+  var offset = (state.pos + 7) >> 3;
+  if (offset < bytes.length) {
+    var trailer = { pos: offset * 8 };
+    var count = readBits(bytes, trailer, 4);
+    for (var r = 0; r < count && trailer.pos + 2 <= bytes.length * 8; r++) {
+      results.push(RESULTS[readBits(bytes, trailer, 2)]);
+    }
+  }
+
+  var out = {
+    CMD_RESULTS: results.join(","),
+    BATTERY_V: (2000 + v.BATT * 10) / 1000,
+    INTERVAL_REMAIN: v.REMAIN !== undefined ? unpackRemain(v.REMAIN) : 0,
+    VALVE_STATE: (v.FLAGS & FLAG_OPEN) ? 1 : 0,
+    FAULT: (v.FLAGS & FLAG_FAULT) ? 1 : 0,
+    LOW_BATTERY: (v.FLAGS & FLAG_LOW_BATT) ? 1 : 0
+  };
+
+  // Flow meter, the total volume wraps at 2^24 * 0.1 L
+  if (v.FLOW_RATE !== undefined) {
+    out.FLOW_RATE_L_MIN = v.FLOW_RATE / 10;
+    out.VOLUME_L = v.VOLUME / 10;
+  }
+
+  // Per zone state, zone 0 also fills the single valve fields above
+  if (v.ZONE_OPEN !== undefined) {
+    for (var z = 0; z < MAX_ZONES; z++) {
+      out["VALVE_STATE_" + z] = (v.ZONE_OPEN >> z) & 1;
+      out["INTERVAL_REMAIN_" + z] = v["ZONE_REMAIN" + z] !== undefined ? unpackRemain(v["ZONE_REMAIN" + z]) : 0;
+    }
+    out.VALVE_STATE = out.VALVE_STATE_0;
+    out.INTERVAL_REMAIN = out.INTERVAL_REMAIN_0;
+  }
+  return out;
+}
@@ -0,0 +1,274 @@
+#include "app.h"
+
+extern s_valve_settings g_valve_settings;
+
+/** Results of the commands received since the last uplink that carried them */
+static uint8_t cmd_results[DL_MAX_RESULTS];
+static uint8_t cmd_results_num = 0;
+
+/**
+ * @brief Get the argument size of an opcode
+ *
+ * @param opcode command opcode
+ * @return int argument size in bytes, -1 for unknown opcodes
+ */
+static int downlink_arg_len(uint8_t opcode)
+{
+	switch (opcode)
+	{
+	case DL_OP_VALVE:
+		return 1;
+	case DL_OP_INTERVAL:
+		return 2;
+	case DL_OP_STOP_INTERVAL:
+		return 0;
+	case DL_OP_OPER_TIME:
+		return 1;
+	case DL_OP_UPLINK:
+		return 0;
+	case DL_OP_SET_TIME:
+		return 4;
+	case DL_OP_SCHEDULE:
+		return 6;
+	case DL_OP_SKIP:
+		return 1;
+	case DL_OP_ZONE_INTERVAL:
+		return 3;
+	case DL_OP_ZONE_STOP:
+		return 1;
+	case DL_OP_ZONE_SCHEDULE:
+		return 7;
+	case DL_OP_HISTORY_ACK:
+		return 2;
+	case DL_OP_ZONE_VOLUME:
+		return 3;
+	case DL_OP_FLOW_RESET:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * @brief Execute a single command
+ *
+ * @param opcode command opcode
+ * @param args command arguments
+ * @param send_uplink set if an uplink was requested
+ * @return uint8_t DL_RESULT_* code
+ */
+static uint8_t downlink_exec(uint8_t opcode, const uint8_t *args, bool *send_uplink)
+{
+	switch (opcode)
+	{
+	case DL_OP_VALVE:
+	{
+		uint8_t zone = (args[0] >> 4) & 0x07;
+		if ((args[0] & 0x8E) || (zone >= VALVE_ZONES))
+		{
+			return DL_RESULT_BAD_ARG;
+		}
+		// Closing is never limited
+		if ((args[0] & 0x01) && !act_admit(AT_SRC_LORA))
+		{
+			return DL_RESULT_REJECTED;
+		}
+		// A refused open leaves a running interval alone
+		if (!setValve(zone, args[0] & 0x01, g_valve_settings.oper_time_sec[zone]))
+		{
+			return DL_RESULT_REJECTED;
+		}
+		if (args[0] & 0x01)
+		{
+			act_charge(AT_SRC_LORA);
+		}
+		stopValveInterval(zone);
+		return DL_RESULT_OK;
+	}
+
+	case DL_OP_INTERVAL:
+	case DL_OP_ZONE_INTERVAL:
+	{
+		uint8_t zone = 0;
+		if (opcode == DL_OP_ZONE_INTERVAL)
+		{
+			zone = *args++;
+		}
+		uint32_t sec = payload_unpack_remain((args[0] << 8) | args[1]);
+		if ((sec == 0) || (zone >= VALVE_ZONES))
+		{
+			return DL_RESULT_BAD_ARG;
+		}
+		if (!act_admit(AT_SRC_LORA) || !beginValveInterval(zone, sec))
+		{
+			return DL_RESULT_REJECTED;
+		}
+		act_charge(AT_SRC_LORA);
+		return DL_RESULT_OK;
+	}
+
+	case DL_OP_STOP_INTERVAL:
+		for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+		{
+			stopValveInterval(zone);
+			setValve(zone, VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec[zone], true);
+		}
+		return DL_RESULT_OK;
+
+	case DL_OP_ZONE_STOP:
+		if (args[0] >= VALVE_ZONES)
+		{
+			return DL_RESULT_BAD_ARG;
+		}
+		stopValveInterval(args[0]);
+		setValve(args[0], VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec[args[0]], true);
+		return DL_RESULT_OK;
+
+	case DL_OP_OPER_TIME:
+		if ((args[0] < DL_OPER_TIME_MIN) || (args[0] > DL_OPER_TIME_MAX))
+		{
+			return DL_RESULT_BAD_ARG;
+		}
+		for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+		{
+			valve_set_oper_time(zone, args[0]);
+		}
+		return DL_RESULT_OK;
+
+	case DL_OP_UPLINK:
+		*send_uplink = true;
+		return DL_RESULT_OK;
+
+	case DL_OP_SET_TIME:
+	{
+		uint32_t epoch = ((uint32_t)args[0] << 24) | ((uint32_t)args[1] << 16) | (args[2] << 8) | args[3];
+		if (epoch == 0)
+		{
+			return DL_RESULT_BAD_ARG;
+		}
+		time_set(epoch);
+		return DL_RESULT_OK;
+	}
+
+	case DL_OP_SCHEDULE:
+	case DL_OP_ZONE_SCHEDULE:
+	{
+		uint16_t start_min = (args[2] << 8) | args[3];
+		uint32_t sec = payload_unpack_remain((args[4] << 8) | args[5]);
+		uint8_t zone = (opcode == DL_OP_ZONE_SCHEDULE) ? args[6] : 0;
+		return schedule_set(args[0], args[1], start_min, sec, zone) ? DL_RESULT_OK : DL_RESULT_BAD_ARG;
+	}
+
+	case DL_OP_SKIP:
+		return schedule_skip(args[0]) ? DL_RESULT_OK : DL_RESULT_BAD_ARG;
+
+	case DL_OP_HISTORY_ACK:
+		return history_ack((args[0] << 8) | args[1]) ? DL_RESULT_OK : DL_RESULT_BAD_ARG;
+
+	case DL_OP_ZONE_VOLUME:
+	{
+		uint16_t liters = (args[1] << 8) | args[2];
+		if (!FLOW_METER)
+		{
+			return DL_RESULT_UNKNOWN;
+		}
+		if ((liters == 0) || (args[0] >= VALVE_ZONES))
+		{
+			return DL_RESULT_BAD_ARG;
+		}
+		if (!act_admit(AT_SRC_LORA) || !flow_begin_volume(args[0], liters))
+		{
+			return DL_RESULT_REJECTED;
+		}
+		act_charge(AT_SRC_LORA);
+		return DL_RESULT_OK;
+	}
+
+	case DL_OP_FLOW_RESET:
+		flow_alarm_clear();
+		return DL_RESULT_OK;
+
+	default:
+		return DL_RESULT_UNKNOWN;
+	}
+}
+
+/**
+ * @brief Handle a binary command frame received on DOWNLINK_CMD_FPORT
+ *
+ * @param data frame content
+ * @param len frame length
+ */
+void downlink_handler(uint8_t *data, uint8_t len)
+{
+	bool send_uplink = false;
+	uint8_t idx = 0;
+	uint8_t count = 0;
+
+	// Results not sent yet are kept, the new ones are appended
+	while ((idx < len) && (count++ < DL_MAX_RESULTS))
+	{
+		uint8_t opcode = data[idx++];
+		int arg_len = downlink_arg_len(opcode);
+		if (arg_len < 0)
+		{
+			MYLOG("DL", "Unknown opcode %02X", opcode);
+			downlink_add_result(DL_RESULT_UNKNOWN);
+			break;
+		}
+		if ((idx + arg_len) > len)
+		{
+			MYLOG("DL", "Opcode %02X truncated", opcode);
+			downlink_add_result(DL_RESULT_BAD_ARG);
+			break;
+		}
+
+		uint8_t result = downlink_exec(opcode, &data[idx], &send_uplink);
+		MYLOG("DL", "Opcode %02X result %d", opcode, result);
+		downlink_add_result(result);
+		idx += arg_len;
+	}
+
+	if (send_uplink)
+	{
+		uplink_enqueue(UPLINK_REQUEST);
+	}
+}
+
+/**
+ * @brief Record the result of a downlink command
+ *		  Results are kept until they were sent, once DL_MAX_RESULTS are
+ *		  pending newer ones are dropped.
+ *
+ * @param result DL_RESULT_* code
+ */
+void downlink_add_result(uint8_t result)
+{
+	if (cmd_results_num < DL_MAX_RESULTS)
+	{
+		cmd_results[cmd_results_num++] = result;
+		return;
+	}
+	MYLOG("DL", "Result %d dropped, %d results not sent yet", result, cmd_results_num);
+}
+
+/**
+ * @brief Append the pending command results to an uplink payload
+ *
+ * @param out payload buffer
+ * @param len current payload length
+ * @param max_len size of the payload buffer
+ * @return uint8_t new payload length
+ */
+uint8_t downlink_append_results(uint8_t *out, uint8_t len, uint8_t max_len)
+{
+	return payload_append_results(out, len, max_len, cmd_results, cmd_results_num);
+}
+
+/**
+ * @brief The pending results were enqueued for sending
+ */
+void downlink_results_sent(void)
+{
+	cmd_results_num = 0;
+}
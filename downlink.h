@@ -0,0 +1,74 @@
+#ifndef DOWNLINK_H
+#define DOWNLINK_H
+
+/**
+ * Binary downlink command frames, shared by the firmware and host tools.
+ *
+ * Frames are received on DOWNLINK_CMD_FPORT, AT command text keeps working
+ * on any other port. A frame is a sequence of commands, each one opcode
+ * byte followed by its fixed size arguments (multi-byte arguments MSB first):
+ *
+ * | opcode | name          | args | argument                                  |
+ * |--------|---------------|------|-------------------------------------------|
+ * |  0x01  | VALVE         |   1  | bit 0 valve state, bits 4..6 zone, others |
+ * |        |               |      | must be 0                                 |
+ * |  0x02  | INTERVAL      |   2  | zone 0 interval, packed like REMAIN       |
+ * |  0x03  | STOP_INTERVAL |   0  | stop all intervals and close all zones    |
+ * |  0x04  | OPER_TIME     |   1  | relay pulse of all zones, 1 .. 60 s       |
+ * |  0x05  | UPLINK        |   0  | send an uplink after the frame            |
+ * |  0x06  | SET_TIME      |   4  | local time, seconds since 1970-01-01      |
+ * |  0x07  | SCHEDULE      |   6  | index, weekday mask (0 removes), start    |
+ * |        |               |      | minute of the day (2), packed duration (2)|
+ * |  0x08  | SKIP          |   1  | skip the next run of a schedule entry     |
+ * |  0x09  | ZONE_INTERVAL |   3  | zone, packed interval (2)                 |
+ * |  0x0A  | ZONE_STOP     |   1  | stop the interval and close one zone      |
+ * |  0x0B  | ZONE_SCHEDULE |   7  | SCHEDULE arguments followed by the zone   |
+ * |  0x0C  | HISTORY_ACK   |   2  | seq of the last history event received    |
+ * |  0x0D  | ZONE_VOLUME   |   3  | zone, liters (2), open until they flowed  |
+ * |  0x0E  | FLOW_RESET    |   0  | clear the flow alarm                      |
+ *
+ * Example: 04 08 02 0A 8C 05 sets an 8 s oper time, starts a 2700 s
+ * interval and asks for an uplink.
+ *
+ * The result of each command (DL_RESULT_*) is returned in the next uplink
+ * as a byte aligned trailer after the payload fields: a 4 bit count, then
+ * 2 bits per command in frame order. Results of frames received before
+ * that uplink are kept and sent together, up to DL_MAX_RESULTS. Parsing
+ * stops at the first command with an unknown opcode or truncated arguments.
+ */
+
+#include <stdint.h>
+
+/** FPort of binary command frames */
+#define DOWNLINK_CMD_FPORT 10
+
+/** Command opcodes */
+#define DL_OP_VALVE 0x01
+#define DL_OP_INTERVAL 0x02
+#define DL_OP_STOP_INTERVAL 0x03
+#define DL_OP_OPER_TIME 0x04
+#define DL_OP_UPLINK 0x05
+#define DL_OP_SET_TIME 0x06
+#define DL_OP_SCHEDULE 0x07
+#define DL_OP_SKIP 0x08
+#define DL_OP_ZONE_INTERVAL 0x09
+#define DL_OP_ZONE_STOP 0x0A
+#define DL_OP_ZONE_SCHEDULE 0x0B
+#define DL_OP_HISTORY_ACK 0x0C
+#define DL_OP_ZONE_VOLUME 0x0D
+#define DL_OP_FLOW_RESET 0x0E
+
+/** Command result codes */
+#define DL_RESULT_OK 0
+#define DL_RESULT_UNKNOWN 1
+#define DL_RESULT_BAD_ARG 2
+#define DL_RESULT_REJECTED 3
+
+/** Maximum number of results returned in one uplink */
+#define DL_MAX_RESULTS 15
+
+/** Limits of the relay pulse time */
+#define DL_OPER_TIME_MIN 1
+#define DL_OPER_TIME_MAX 60
+
+#endif
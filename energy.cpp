@@ -0,0 +1,183 @@
+#include "app.h"
+
+/** Active time per subsystem in us */
+static uint64_t energy_active_us[EN_COUNT];
+
+/** Start of the running period of each subsystem in micros(), valid if set in energy_running */
+static uint32_t energy_begin_us[EN_COUNT];
+static uint8_t energy_running = 0;
+
+/** Status uplinks since the last energy report */
+static uint16_t energy_report_count = 0;
+
+/** Assumed current of each subsystem while active */
+static const uint32_t energy_current_ua[EN_COUNT] = {
+	EN_CURRENT_RELAY_UA, EN_CURRENT_RELAY_UA, EN_CURRENT_LORA_TX_UA, EN_CURRENT_LORA_RX_UA, EN_CURRENT_BLE_UA, EN_CURRENT_MCU_UA};
+
+/** Short names used by AT+ENERGY */
+static const char *energy_names[EN_COUNT] = {"RLY+", "RLY-", "TX", "RX", "BLE", "MCU"};
+
+/**
+ * @brief Add active time to a subsystem
+ *
+ * @param sub EN_* subsystem
+ * @param ms active time
+ */
+void energy_add_ms(uint8_t sub, uint32_t ms)
+{
+	energy_active_us[sub] += (uint64_t)ms * 1000;
+}
+
+/**
+ * @brief Start timing a subsystem, nested calls are ignored
+ *
+ * @param sub EN_* subsystem
+ */
+void energy_begin(uint8_t sub)
+{
+	if (!(energy_running & (1 << sub)))
+	{
+		energy_running |= 1 << sub;
+		energy_begin_us[sub] = micros();
+	}
+}
+
+/**
+ * @brief Stop timing a subsystem and book the elapsed time
+ *
+ * @param sub EN_* subsystem
+ */
+void energy_end(uint8_t sub)
+{
+	if (energy_running & (1 << sub))
+	{
+		energy_running &= ~(1 << sub);
+		energy_active_us[sub] += micros() - energy_begin_us[sub];
+	}
+}
+
+/**
+ * @brief Active time of a subsystem, including a running period
+ *
+ * @param sub EN_* subsystem
+ * @return uint64_t active time in us
+ */
+static uint64_t energy_active(uint8_t sub)
+{
+	uint64_t active = energy_active_us[sub];
+	if (energy_running & (1 << sub))
+	{
+		active += micros() - energy_begin_us[sub];
+	}
+	return active;
+}
+
+/**
+ * @brief Estimated charge of a subsystem
+ *
+ * @param sub EN_* subsystem
+ * @return uint32_t charge in uAh
+ */
+uint32_t energy_charge_uah(uint8_t sub)
+{
+	return energy_active(sub) * energy_current_ua[sub] / 3600000000ULL;
+}
+
+/**
+ * @brief Clear the ledger, running periods restart now
+ */
+void energy_reset(void)
+{
+	uint32_t now = micros();
+	for (uint8_t sub = 0; sub < EN_COUNT; sub++)
+	{
+		energy_active_us[sub] = 0;
+		energy_begin_us[sub] = now;
+	}
+}
+
+/**
+ * @brief Book the radio time of an uplink that was enqueued
+ *
+ * @param len application payload length
+ */
+void energy_lora_uplink(uint8_t len)
+{
+	energy_add_ms(EN_LORA_TX, airtime_uplink_ms(len));
+	// RX1 and RX2 are opened after each uplink
+	energy_add_ms(EN_LORA_RX, 2 * EN_LORA_RX_WINDOW_MS);
+}
+
+/**
+ * @brief Write the ledger in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void energy_print(char *buf, uint16_t size)
+{
+	int len = snprintf(buf, size, "sec/uAh");
+	for (uint8_t sub = 0; (sub < EN_COUNT) && (len < size); sub++)
+	{
+		len += snprintf(&buf[len], size - len, " %s %lu/%lu", energy_names[sub],
+						(unsigned long)(energy_active(sub) / 1000000), (unsigned long)energy_charge_uah(sub));
+	}
+}
+
+/**
+ * @brief Count a status uplink, check if the energy report is due
+ *
+ * @return true the energy report should be sent now
+ */
+bool energy_report_due(void)
+{
+	if (ENERGY_REPORT_EVERY == 0)
+	{
+		return false;
+	}
+	if (++energy_report_count < ENERGY_REPORT_EVERY)
+	{
+		return false;
+	}
+	energy_report_count = 0;
+	return true;
+}
+
+/**
+ * @brief Build the energy report uplink
+ *		  One version byte, then the charge of each subsystem in 0.1 mAh, 16 bit MSB first.
+ *		  Version 2 adds the worst command latency of the latency mode in seconds.
+ *		  A report longer than max_len is cut after the last whole field, the
+ *		  decoder reads the fields that are present.
+ *
+ * @param out payload buffer, at least ENERGY_REPORT_LEN bytes
+ * @param max_len largest payload the data rate allows
+ * @return uint8_t payload length
+ */
+uint8_t energy_report(uint8_t *out, uint8_t max_len)
+{
+	out[0] = ENERGY_REPORT_VERSION;
+	for (uint8_t sub = 0; sub < EN_COUNT; sub++)
+	{
+		uint32_t charge = energy_charge_uah(sub) / 100;
+		if (charge > 0xFFFF)
+		{
+			charge = 0xFFFF;
+		}
+		out[1 + 2 * sub] = charge >> 8;
+		out[2 + 2 * sub] = charge & 0xFF;
+	}
+	uint32_t latency = latency_worst_sec();
+	if (latency > 0xFFFF)
+	{
+		latency = 0xFFFF;
+	}
+	out[1 + 2 * EN_COUNT] = latency >> 8;
+	out[2 + 2 * EN_COUNT] = latency & 0xFF;
+
+	if (max_len < ENERGY_REPORT_LEN)
+	{
+		return 1 + 2 * ((max_len - 1) / 2);
+	}
+	return ENERGY_REPORT_LEN;
+}
@@ -0,0 +1,94 @@
+#include "app.h"
+
+/** One queue per producer context, so each queue has a single producer */
+static spsc_queue_s<s_app_event, EVENT_QUEUE_LEN> event_queues[EVQ_COUNT];
+
+/** Event of each queue raised again when items were dropped */
+static const uint8_t event_recover[EVQ_COUNT] = {EV_WAKE, EV_VALVE_FB, EV_FLOW};
+
+/** Dropped items already recovered from */
+static uint32_t event_recovered[EVQ_COUNT];
+
+/** Events handled since boot */
+static uint32_t event_count = 0;
+
+/**
+ * @brief Queue an event and wake the app task
+ *		  Called from timer callbacks and interrupts, each queue only from
+ *		  its own context. Nothing else is done here.
+ *
+ * @param queue EVQ_* queue of the calling context
+ * @param type EV_* event
+ * @param value event data, e.g. the time it happened
+ */
+void event_post(uint8_t queue, uint8_t type, uint32_t value)
+{
+	s_app_event event;
+	event.type = type;
+	event.value = value;
+	spsc_push(&event_queues[queue], event);
+	// Raised even if the queue was full, the handler recovers
+	api_wake_loop(APP_EVENT);
+}
+
+/**
+ * @brief Run the handler of one event
+ *
+ * @param event queued event
+ */
+static void event_dispatch(const s_app_event *event)
+{
+	event_count++;
+	switch (event->type)
+	{
+	case EV_WAKE:
+		wake_handler();
+		break;
+	case EV_VALVE_FB:
+		valve_feedback_handler(event->value);
+		break;
+	case EV_FLOW:
+		flow_handler();
+		break;
+	}
+}
+
+/**
+ * @brief Handle the queued events, oldest first, called from the app event handler
+ *		  A queue that overflowed gets one more event of its kind. The
+ *		  handlers check the current state, so that covers the dropped ones.
+ */
+void event_handler(void)
+{
+	for (uint8_t queue = 0; queue < EVQ_COUNT; queue++)
+	{
+		s_app_event event;
+		while (spsc_pop(&event_queues[queue], &event))
+		{
+			event_dispatch(&event);
+		}
+
+		uint32_t dropped = spsc_dropped(&event_queues[queue]);
+		if (dropped != event_recovered[queue])
+		{
+			MYLOG("EVQ", "Queue %d dropped %lu events", queue, dropped - event_recovered[queue]);
+			event_recovered[queue] = dropped;
+			event.type = event_recover[queue];
+			event.value = millis();
+			event_dispatch(&event);
+		}
+	}
+}
+
+/**
+ * @brief Write the event counters in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void event_print(char *buf, uint16_t size)
+{
+	snprintf(buf, size, "Events %lu, dropped timer %lu fb %lu flow %lu", (unsigned long)event_count,
+			 (unsigned long)spsc_dropped(&event_queues[EVQ_TIMER]), (unsigned long)spsc_dropped(&event_queues[EVQ_VALVE_FB]),
+			 (unsigned long)spsc_dropped(&event_queues[EVQ_FLOW]));
+}
@@ -0,0 +1,173 @@
+#include "app.h"
+
+/** Register shadows, power on values of the MCP23017 */
+static uint16_t shadow_iodir = 0xFFFF;
+static uint16_t shadow_gppu = 0x0000;
+static uint16_t shadow_olat = 0x0000;
+
+/** Shadows that differ from the device */
+#define DIRTY_IODIR 0x01
+#define DIRTY_GPPU 0x02
+#define DIRTY_OLAT 0x04
+static uint8_t dirty = 0;
+
+uint32_t g_expander_i2c_count = 0;
+
+/**
+ * @brief Write a register pair in one transaction
+ *
+ * @param reg port A register, port B follows
+ * @param value port A in the low byte, port B in the high byte
+ * @return true the expander acknowledged
+ */
+static bool expander_write_reg16(uint8_t reg, uint16_t value)
+{
+	Wire.beginTransmission(EXPANDER_ADDR);
+	Wire.write(reg);
+	Wire.write(value & 0xFF);
+	Wire.write(value >> 8);
+	g_expander_i2c_count++;
+	return Wire.endTransmission() == 0;
+}
+
+/**
+ * @brief Check the expander is present
+ *		  The expander was reset through WB_IO4 before, so the device
+ *		  registers match the power on shadows and nothing is written.
+ *
+ * @return true the expander acknowledged its address
+ */
+bool expander_init(void)
+{
+	Wire.begin();
+	Wire.beginTransmission(EXPANDER_ADDR);
+	g_expander_i2c_count++;
+	if (Wire.endTransmission() != 0)
+	{
+		MYLOG("IOX", "Expander not found");
+		return false;
+	}
+	dirty = 0;
+	return true;
+}
+
+/**
+ * @brief Set a pin direction, applied by expander_flush()
+ *
+ * @param pin expander pin 0 .. 15
+ * @param mode INPUT, INPUT_PULLUP or OUTPUT
+ */
+void expander_pin_mode(uint8_t pin, uint8_t mode)
+{
+	uint16_t bit = 1 << pin;
+	uint16_t iodir = (mode == OUTPUT) ? (shadow_iodir & ~bit) : (shadow_iodir | bit);
+	uint16_t gppu = (mode == INPUT_PULLUP) ? (shadow_gppu | bit) : (shadow_gppu & ~bit);
+
+	if (iodir != shadow_iodir)
+	{
+		shadow_iodir = iodir;
+		dirty |= DIRTY_IODIR;
+	}
+	if (gppu != shadow_gppu)
+	{
+		shadow_gppu = gppu;
+		dirty |= DIRTY_GPPU;
+	}
+}
+
+/**
+ * @brief Set the output level of several pins, applied by expander_flush()
+ *
+ * @param mask pins to change
+ * @param levels new levels of the pins in mask
+ */
+void expander_write_mask(uint16_t mask, uint16_t levels)
+{
+	uint16_t olat = (shadow_olat & ~mask) | (levels & mask);
+	if (olat != shadow_olat)
+	{
+		shadow_olat = olat;
+		dirty |= DIRTY_OLAT;
+	}
+}
+
+/**
+ * @brief Set the output level of a pin, applied by expander_flush()
+ *
+ * @param pin expander pin 0 .. 15
+ * @param level LOW or HIGH
+ */
+void expander_write(uint8_t pin, uint8_t level)
+{
+	expander_write_mask(1 << pin, level ? 0xFFFF : 0);
+}
+
+/**
+ * @brief Write the changed shadows to the expander
+ *		  The output latches are written before the directions, so new
+ *		  outputs start at their intended level. All pins of a port change
+ *		  on the same acknowledge, a relay pair on one port never glitches.
+ *
+ * @return true all writes were acknowledged, failed writes stay pending
+ */
+bool expander_flush(void)
+{
+	if ((dirty & DIRTY_OLAT) && expander_write_reg16(EXPANDER_REG_OLATA, shadow_olat))
+	{
+		dirty &= ~DIRTY_OLAT;
+	}
+	if ((dirty & DIRTY_IODIR) && expander_write_reg16(EXPANDER_REG_IODIRA, shadow_iodir))
+	{
+		dirty &= ~DIRTY_IODIR;
+	}
+	if ((dirty & DIRTY_GPPU) && expander_write_reg16(EXPANDER_REG_GPPUA, shadow_gppu))
+	{
+		dirty &= ~DIRTY_GPPU;
+	}
+
+	if (dirty)
+	{
+		MYLOG("IOX", "Expander write failed");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Read the input levels of both ports in one transaction
+ *
+ * @return uint16_t port A in the low byte, port B in the high byte
+ */
+uint16_t expander_read(void)
+{
+	Wire.beginTransmission(EXPANDER_ADDR);
+	Wire.write(EXPANDER_REG_GPIOA);
+	Wire.endTransmission(false);
+	Wire.requestFrom((uint8_t)EXPANDER_ADDR, (uint8_t)2);
+	g_expander_i2c_count++;
+
+	uint16_t levels = Wire.read();
+	levels |= Wire.read() << 8;
+	return levels;
+}
+
+/**
+ * @brief Signal input changes on the interrupt outputs
+ *		  Pins in mask raise INTA and INTB when they differ from their last
+ *		  read level, reading the inputs clears the interrupt. The outputs
+ *		  are open drain, the MCU pin needs a pull-up.
+ *
+ * @param mask pins that raise the interrupt
+ * @return true the expander acknowledged
+ */
+bool expander_interrupt_enable(uint16_t mask)
+{
+	// IOCON is mapped twice, both bytes of the pair write the same register
+	uint8_t iocon = EXPANDER_IOCON_MIRROR | EXPANDER_IOCON_ODR;
+	bool result = expander_write_reg16(EXPANDER_REG_IOCON, (iocon << 8) | iocon);
+	result &= expander_write_reg16(EXPANDER_REG_GPINTENA, mask);
+
+	// Clear a change that is already latched
+	expander_read();
+	return result;
+}
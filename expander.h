@@ -0,0 +1,42 @@
+#ifndef EXPANDER_H
+#define EXPANDER_H
+
+/**
+ * Driver for the MCP23017 on the RAK13003 IO expander.
+ *
+ * IODIR, GPPU and OLAT are kept as RAM shadows, pin changes only touch the
+ * shadows until expander_flush() writes each changed register pair in a
+ * single 16 bit transaction (port A in the low byte). Registers are used in
+ * the power on layout (IOCON.BANK = 0), so the A and B registers are
+ * adjacent and the address pointer advances from A to B.
+ */
+
+#include <stdint.h>
+
+/** I2C address with A0..A2 low */
+#define EXPANDER_ADDR 0x20
+
+/** Register addresses, IOCON.BANK = 0 */
+#define EXPANDER_REG_IODIRA 0x00
+#define EXPANDER_REG_GPINTENA 0x04
+#define EXPANDER_REG_IOCON 0x0A
+#define EXPANDER_REG_GPPUA 0x0C
+#define EXPANDER_REG_GPIOA 0x12
+#define EXPANDER_REG_OLATA 0x14
+
+/** IOCON bits */
+#define EXPANDER_IOCON_MIRROR 0x40 // INTA and INTB both signal changes of either port
+#define EXPANDER_IOCON_ODR 0x04	   // Interrupt outputs are open drain
+
+/** Number of I2C transactions sent to the expander since boot */
+extern uint32_t g_expander_i2c_count;
+
+bool expander_init(void);
+void expander_pin_mode(uint8_t pin, uint8_t mode);
+void expander_write(uint8_t pin, uint8_t level);
+void expander_write_mask(uint16_t mask, uint16_t levels);
+bool expander_flush(void);
+uint16_t expander_read(void);
+bool expander_interrupt_enable(uint16_t mask);
+
+#endif
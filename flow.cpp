@@ -0,0 +1,423 @@
+#include "app.h"
+
+extern s_valve_settings g_valve_settings;
+
+/** Pulses since boot, only written by the interrupt, a 32 bit load is atomic on the Cortex-M4 */
+static volatile uint32_t flow_pulses = FLOW_PULSES_START;
+
+/** The interrupt queues EV_FLOW once flow_pulses reaches flow_wake_at */
+static volatile uint32_t flow_wake_at = 0;
+static volatile bool flow_wake_armed = false;
+
+/** Last rate sample */
+static uint32_t sample_pulses = FLOW_PULSES_START;
+static uint32_t sample_millis = 0;
+
+/** Flow rate in 0.1 L/min */
+static uint16_t rate = 0;
+
+/** Volume counted before boot in 0.1 L, restored from the journal */
+static uint32_t volume_base = 0;
+
+/** Pulse count at which the volume interval of each zone ends */
+static uint32_t volume_target[VALVE_ZONES];
+
+/** All valves closed, flow is watched for leaks once the line settled */
+static bool all_closed = false;
+static uint32_t closed_millis = 0;
+static bool leak_watch = false;
+static uint32_t leak_base = 0;
+
+/** Latched FLOW_ALARM_* bits */
+static uint8_t alarm = 0;
+
+/** Flow rate limit in 0.1 L/min, 0 if disabled */
+static uint16_t max_rate = FLOW_MAX_RATE;
+
+#if FLOW_METER
+/**
+ * @brief Count one pulse, wake the app task when the armed count is reached
+ *		  The interrupt is the only writer of flow_pulses, nothing is locked.
+ */
+static void flow_isr(void)
+{
+	uint32_t count = flow_pulses + 1;
+	flow_pulses = count;
+	if (flow_wake_armed && ((int32_t)(count - flow_wake_at) >= 0))
+	{
+		flow_wake_armed = false;
+		event_post(EVQ_FLOW, EV_FLOW, count);
+	}
+}
+#endif
+
+/**
+ * @brief Queue EV_FLOW from the interrupt once the pulse count reaches a value
+ *
+ * @param count pulse count to wake at
+ */
+static void flow_arm(uint32_t count)
+{
+	flow_wake_armed = false;
+	flow_wake_at = count;
+	flow_wake_armed = true;
+
+	// The count may have passed while arming
+	if (flow_wake_armed && ((int32_t)(flow_pulses - count) >= 0))
+	{
+		flow_wake_armed = false;
+		api_wake_loop(FLOW_DUE);
+	}
+}
+
+/**
+ * @brief Check if all valves are closed and none is moving
+ */
+static bool flow_valves_closed(void)
+{
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (valve_is_busy(zone) || (g_valve_settings.state[zone] == VALVE_STATE_OPENED))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Zones with a running volume interval
+ */
+static uint8_t flow_volume_zones(void)
+{
+	return g_valve_settings.interval_running & g_valve_settings.interval_volume;
+}
+
+/**
+ * @brief Update the flow rate from the pulses since the last sample
+ *		  Samples closer than 1 s keep the last rate.
+ */
+static void flow_sample(void)
+{
+	uint32_t now = millis();
+	uint32_t elapsed = now - sample_millis;
+	if (elapsed < 1000)
+	{
+		return;
+	}
+
+	uint32_t pulses = flow_pulses;
+	uint64_t value = (uint64_t)(pulses - sample_pulses) * 600000 / ((uint64_t)FLOW_PULSES_PER_L * elapsed);
+	rate = value > 0xFFFF ? 0xFFFF : value;
+	sample_pulses = pulses;
+	sample_millis = now;
+}
+
+/**
+ * @brief Arm the interrupt for the nearest volume interval target
+ */
+static void flow_rearm_volume(void)
+{
+	uint8_t zones = flow_volume_zones();
+	if (!zones)
+	{
+		flow_wake_armed = false;
+		return;
+	}
+
+	uint32_t pulses = flow_pulses;
+	uint32_t nearest = UINT32_MAX;
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if ((zones & (1 << zone)) && ((volume_target[zone] - pulses) < nearest))
+		{
+			nearest = volume_target[zone] - pulses;
+		}
+	}
+	flow_arm(pulses + nearest);
+}
+
+/**
+ * @brief Latch an alarm and close all valves
+ *
+ * @param bit FLOW_ALARM_*
+ * @param type HE_* event recorded in the history
+ */
+static void flow_raise_alarm(uint8_t bit, uint8_t type)
+{
+	if (alarm & bit)
+	{
+		return;
+	}
+	alarm |= bit;
+	MYLOG("FLOW", "Alarm 0x%02X at %d.%d L/min, closing all valves", alarm, rate / 10, rate % 10);
+	history_add(type, 0, HC_MANUAL);
+
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		stopValveInterval(zone);
+		setValve(zone, VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec[zone], true);
+	}
+}
+
+/**
+ * @brief Set up the flow meter input
+ */
+void flow_init(void)
+{
+#if FLOW_METER
+	pinMode(FLOW_PIN, INPUT_PULLUP);
+	attachInterrupt(digitalPinToInterrupt(FLOW_PIN), flow_isr, FALLING);
+	sample_millis = millis();
+	MYLOG("FLOW", "Flow meter on pin %d, %d pulses/L", FLOW_PIN, FLOW_PULSES_PER_L);
+#endif
+}
+
+/**
+ * @brief Switch between the open and the closed watch when a valve starts or ends moving
+ *		  Called by the valve actuator.
+ */
+void flow_valve_changed(void)
+{
+	if (!FLOW_METER)
+	{
+		return;
+	}
+
+	bool closed = flow_valves_closed();
+	if (closed == all_closed)
+	{
+		return;
+	}
+	all_closed = closed;
+	leak_watch = false;
+	flow_wake_armed = false;
+
+	if (closed)
+	{
+		// Water still drains after the last valve closed
+		closed_millis = millis();
+		wake_set(WAKE_FLOW, closed_millis + FLOW_SETTLE_MS, 0);
+	}
+	else
+	{
+		wake_set(WAKE_FLOW, millis() + FLOW_CHECK_MS, FLOW_CHECK_MS / 5);
+		flow_rearm_volume();
+	}
+}
+
+/**
+ * @brief Check volume targets, the rate limit and leaks, called from the app event handler
+ *		  Raised by WAKE_FLOW or by the interrupt when an armed count is reached.
+ */
+void flow_handler(void)
+{
+	if (!FLOW_METER)
+	{
+		return;
+	}
+
+	flow_sample();
+	uint32_t pulses = flow_pulses;
+
+	if (!all_closed)
+	{
+		// A volume interval that reached its target ends like an expired interval
+		uint8_t zones = flow_volume_zones();
+		for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+		{
+			if ((zones & (1 << zone)) && ((int32_t)(pulses - volume_target[zone]) >= 0))
+			{
+				MYLOG("FLOW", "Zone %d volume reached, closing valve", zone);
+				endValveInterval(zone);
+			}
+		}
+
+		if (max_rate && (rate > max_rate))
+		{
+			flow_raise_alarm(FLOW_ALARM_RATE, HE_FLOW_HIGH);
+		}
+
+		flow_rearm_volume();
+		wake_set(WAKE_FLOW, millis() + FLOW_CHECK_MS, FLOW_CHECK_MS / 5);
+		return;
+	}
+
+	if (leak_watch)
+	{
+		if ((pulses - leak_base) >= FLOW_LEAK_PULSES)
+		{
+			leak_watch = false;
+			flow_raise_alarm(FLOW_ALARM_LEAK, HE_LEAK);
+		}
+		return;
+	}
+
+	// Line settled, any further flow is a leak
+	if ((int32_t)(millis() - closed_millis - FLOW_SETTLE_MS) >= -10)
+	{
+		wake_clear(WAKE_FLOW);
+		if (!(alarm & FLOW_ALARM_LEAK))
+		{
+			leak_watch = true;
+			leak_base = pulses;
+			flow_arm(leak_base + FLOW_LEAK_PULSES);
+		}
+	}
+}
+
+/**
+ * @brief Status period tick, a leak has to show within one period
+ *		  so meter noise does not add up over days.
+ */
+void flow_tick(void)
+{
+	if (!FLOW_METER)
+	{
+		return;
+	}
+
+	flow_sample();
+	if (leak_watch)
+	{
+		leak_base = flow_pulses;
+		flow_arm(leak_base + FLOW_LEAK_PULSES);
+	}
+}
+
+/**
+ * @brief Open a zone until a volume has flowed, limited to FLOW_VOLUME_MAX_SEC
+ *		  A volume interval is not resumed after a reset.
+ *
+ * @param zone valve zone
+ * @param liters volume to let through
+ * @param cause HC_* cause recorded in the history
+ * @return true interval started
+ * @return false no flow meter, invalid arguments or the interval could not start
+ */
+bool flow_begin_volume(uint8_t zone, uint16_t liters, uint8_t cause)
+{
+	if (!FLOW_METER || (liters == 0) || (zone >= VALVE_ZONES))
+	{
+		return false;
+	}
+	if (!beginValveInterval(zone, FLOW_VOLUME_MAX_SEC, cause))
+	{
+		return false;
+	}
+	volume_target[zone] = flow_pulses + (uint32_t)liters * FLOW_PULSES_PER_L;
+	g_valve_settings.interval_volume |= 1 << zone;
+	journal_interval(zone, 0);
+	flow_rearm_volume();
+	MYLOG("FLOW", "Zone %d open for %d L", zone, liters);
+	return true;
+}
+
+/**
+ * @brief Volume left of a volume interval
+ *
+ * @param zone valve zone
+ * @return uint32_t volume in 0.1 L, 0 if no volume interval is running
+ */
+uint32_t flow_volume_remaining(uint8_t zone)
+{
+	if ((zone >= VALVE_ZONES) || !(flow_volume_zones() & (1 << zone)))
+	{
+		return 0;
+	}
+	int32_t left = volume_target[zone] - flow_pulses;
+	return left > 0 ? (uint32_t)left * 10 / FLOW_PULSES_PER_L : 0;
+}
+
+/**
+ * @brief Flow rate of the last sample
+ *
+ * @return uint16_t rate in 0.1 L/min
+ */
+uint16_t flow_rate(void)
+{
+	return rate;
+}
+
+/**
+ * @brief Total volume, kept across resets
+ *
+ * @return uint32_t volume in 0.1 L
+ */
+uint32_t flow_volume(void)
+{
+	return volume_base + (uint64_t)(flow_pulses - FLOW_PULSES_START) * 10 / FLOW_PULSES_PER_L;
+}
+
+/**
+ * @brief Restore the total volume from the journal
+ *
+ * @param volume volume in 0.1 L
+ */
+void flow_set_volume(uint32_t volume)
+{
+	volume_base = volume - (uint64_t)(flow_pulses - FLOW_PULSES_START) * 10 / FLOW_PULSES_PER_L;
+}
+
+/**
+ * @brief Latched FLOW_ALARM_* bits
+ */
+uint8_t flow_alarm(void)
+{
+	return alarm;
+}
+
+/**
+ * @brief Clear the alarms, valves may open again
+ */
+void flow_alarm_clear(void)
+{
+	alarm = 0;
+	if (FLOW_METER && all_closed && !leak_watch)
+	{
+		// Start watching for leaks right away
+		closed_millis = millis() - FLOW_SETTLE_MS;
+		flow_handler();
+	}
+}
+
+/**
+ * @brief Flow rate limit
+ *
+ * @return uint16_t rate in 0.1 L/min, 0 if disabled
+ */
+uint16_t flow_max_rate(void)
+{
+	return max_rate;
+}
+
+/**
+ * @brief Set the flow rate limit
+ *
+ * @param limit rate in 0.1 L/min, 0 disables the limit
+ */
+void flow_set_max_rate(uint16_t limit)
+{
+	max_rate = limit;
+}
+
+/**
+ * @brief Write the flow meter state in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void flow_print(char *buf, uint16_t size)
+{
+	if (!FLOW_METER)
+	{
+		snprintf(buf, size, "No flow meter");
+		return;
+	}
+
+	flow_sample();
+	uint32_t volume = flow_volume();
+	snprintf(buf, size, "Flow %d.%d L/min, total %lu.%lu L, limit %d.%d L/min, alarm 0x%02X, %s", rate / 10, rate % 10,
+			 (unsigned long)(volume / 10), (unsigned long)(volume % 10), max_rate / 10, max_rate % 10, alarm,
+			 all_closed ? (leak_watch ? "leak watch" : "settling") : "open");
+}
@@ -0,0 +1,214 @@
+#include "app.h"
+
+/** One valve event */
+struct s_history_event
+{
+	uint32_t uptime; // seconds since boot
+	uint8_t type;	 // HE_*
+	uint8_t zone;	 // valve zone
+	uint8_t cause;	 // HC_*
+};
+
+/** Event ring, event seq is stored at seq % HISTORY_SIZE */
+static s_history_event history_ring[HISTORY_SIZE];
+
+/** Next sequence number, oldest unacknowledged and next unsent event */
+static uint16_t head_seq = 0;
+static uint16_t acked_seq = 0;
+static uint16_t sent_seq = 0;
+
+/** Status periods since events were sent without an acknowledge */
+static uint8_t ack_wait = 0;
+
+/**
+ * @brief Drop events that were overwritten by newer ones
+ */
+static void history_trim(void)
+{
+	if ((uint16_t)(head_seq - acked_seq) > HISTORY_SIZE)
+	{
+		acked_seq = head_seq - HISTORY_SIZE;
+	}
+	if ((int16_t)(sent_seq - acked_seq) < 0)
+	{
+		sent_seq = acked_seq;
+	}
+}
+
+/**
+ * @brief Record a valve event
+ *
+ * @param type HE_* event
+ * @param zone valve zone
+ * @param cause HC_* cause
+ */
+void history_add(uint8_t type, uint8_t zone, uint8_t cause)
+{
+	s_history_event *event = &history_ring[head_seq % HISTORY_SIZE];
+	event->uptime = uptime_sec();
+	event->type = type;
+	event->zone = zone;
+	event->cause = cause;
+	head_seq++;
+	history_trim();
+
+	if (history_pending() >= HISTORY_BATCH_EVENTS)
+	{
+		uplink_enqueue(UPLINK_HISTORY);
+	}
+}
+
+/**
+ * @brief Number of events not sent yet
+ */
+uint16_t history_pending(void)
+{
+	return head_seq - sent_seq;
+}
+
+/**
+ * @brief Called every status period, events that were not acknowledged
+ *		  after HISTORY_ACK_PERIODS are sent again
+ */
+void history_tick(void)
+{
+	if (sent_seq == acked_seq)
+	{
+		ack_wait = 0;
+		return;
+	}
+	if (++ack_wait >= HISTORY_ACK_PERIODS)
+	{
+		MYLOG("HIST", "No acknowledge, resending from %d", acked_seq);
+		sent_seq = acked_seq;
+		ack_wait = 0;
+	}
+}
+
+/**
+ * @brief Acknowledge all events up to and including seq
+ *
+ * @param seq last event received by the backend
+ * @return true seq was sent before
+ */
+bool history_ack(uint16_t seq)
+{
+	uint16_t next = seq + 1;
+	if (((int16_t)(next - acked_seq) <= 0) || ((int16_t)(next - head_seq) > 0))
+	{
+		return false;
+	}
+	acked_seq = next;
+	if ((int16_t)(sent_seq - acked_seq) < 0)
+	{
+		sent_seq = acked_seq;
+	}
+	ack_wait = 0;
+	return true;
+}
+
+/**
+ * @brief Append an unsigned LEB128 value
+ *
+ * @return uint8_t bytes written, 0 if it did not fit
+ */
+static uint8_t history_put_varint(uint8_t *out, uint8_t max_len, uint32_t value)
+{
+	uint8_t len = 0;
+	do
+	{
+		if (len >= max_len)
+		{
+			return 0;
+		}
+		out[len] = value & 0x7F;
+		value >>= 7;
+		if (value)
+		{
+			out[len] |= 0x80;
+		}
+		len++;
+	} while (value);
+	return len;
+}
+
+/**
+ * @brief Pack the unsent events into a batch uplink
+ *		  Header: version and flags (1), first seq (2), time of the first event (4),
+ *		  then per event the type/zone/cause byte and the time delta to the
+ *		  previous event as LEB128. Times are local epoch seconds if the clock
+ *		  is set (flag HISTORY_FLAG_EPOCH), else seconds since boot.
+ *
+ * @param out payload buffer
+ * @param max_len size of the payload buffer
+ * @param next set to the seq following the last packed event, pass it to history_sent()
+ * @return uint8_t payload length, 0 if nothing is pending
+ */
+uint8_t history_build(uint8_t *out, uint8_t max_len, uint16_t *next)
+{
+	if ((history_pending() == 0) || (max_len < HISTORY_HEADER_LEN + 2))
+	{
+		return 0;
+	}
+
+	// Event times are kept as uptime, shifted to epoch when the clock is known
+	uint32_t now = time_now();
+	uint32_t offset = now ? now - uptime_sec() : 0;
+
+	s_history_event *first = &history_ring[sent_seq % HISTORY_SIZE];
+	uint32_t base = first->uptime + offset;
+	out[0] = (HISTORY_VERSION << 4) | (now ? HISTORY_FLAG_EPOCH : 0);
+	out[1] = sent_seq >> 8;
+	out[2] = sent_seq & 0xFF;
+	out[3] = base >> 24;
+	out[4] = (base >> 16) & 0xFF;
+	out[5] = (base >> 8) & 0xFF;
+	out[6] = base & 0xFF;
+
+	uint8_t len = HISTORY_HEADER_LEN;
+	uint32_t prev = first->uptime;
+	uint16_t seq = sent_seq;
+	while (seq != head_seq)
+	{
+		s_history_event *event = &history_ring[seq % HISTORY_SIZE];
+		if (len >= max_len)
+		{
+			break;
+		}
+		uint8_t delta_len = history_put_varint(&out[len + 1], max_len - len - 1, event->uptime - prev);
+		if (delta_len == 0)
+		{
+			break;
+		}
+		out[len] = (event->type << 5) | (event->zone << 2) | event->cause;
+		len += 1 + delta_len;
+		prev = event->uptime;
+		seq++;
+	}
+
+	MYLOG("HIST", "Batch of %d events from %d, %d bytes", (uint16_t)(seq - sent_seq), sent_seq, len);
+	*next = seq;
+	return len;
+}
+
+/**
+ * @brief A batch was enqueued for sending
+ *
+ * @param next seq following the last event of the batch
+ */
+void history_sent(uint16_t next)
+{
+	sent_seq = next;
+}
+
+/**
+ * @brief Write the history state in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void history_print(char *buf, uint16_t size)
+{
+	snprintf(buf, size, "Events %d, next seq %d, unacked %d, unsent %d", HISTORY_SIZE, head_seq,
+			 (uint16_t)(head_seq - acked_seq), history_pending());
+}
@@ -0,0 +1,97 @@
+#include "check.h"
+#include "sim.h"
+#include "app.h"
+
+/**
+ * Airtime per day of the whole firmware under different LoRaWAN settings:
+ * region, data rate, duty cycle and confirmed uplinks. Every policy runs
+ * the same two days of four manual intervals a day. The settings are
+ * applied after the boot like AT commands would, with the link adaptation
+ * and the budget started again on them.
+ */
+
+/** LoRaWAN settings of a run */
+struct bench_policy
+{
+	const char *name;
+	LoRaMacRegion_t region;
+	uint8_t dr;
+	bool duty_cycle;
+	bool confirmed;
+};
+
+static const bench_policy policies[] = {
+	{"US915 DR3", LORAMAC_REGION_US915, DR_3, false, true},
+	{"US915 DR3 unconf", LORAMAC_REGION_US915, DR_3, false, false},
+	{"US915 DR0", LORAMAC_REGION_US915, DR_0, false, true},
+	{"US915 DR4", LORAMAC_REGION_US915, DR_4, false, true},
+	{"AU915 DR2", LORAMAC_REGION_AU915, DR_2, false, true},
+	{"AU915 DR6", LORAMAC_REGION_AU915, DR_6, false, true},
+	{"EU868 DR5", LORAMAC_REGION_EU868, DR_5, true, true},
+	{"EU868 DR0", LORAMAC_REGION_EU868, DR_0, true, true},
+	{"AS923 DR2", LORAMAC_REGION_AS923, DR_2, true, true},
+};
+
+#define BENCH_DAYS 2
+
+static const bench_policy *policy;
+
+/**
+ * @brief Uplinks held back by the budget, from AT+AIR
+ */
+static unsigned long airtime_deferred(void)
+{
+	char buf[128];
+	unsigned long deferred = 0;
+	airtime_print(buf, sizeof(buf));
+	const char *field = strstr(buf, "deferred ");
+	if (field)
+	{
+		sscanf(field, "deferred %lu", &deferred);
+	}
+	return deferred;
+}
+
+/**
+ * @brief Run one policy in a child and print its row
+ */
+static int bench_run(void)
+{
+	sim_boot();
+	g_lorawan_settings.lora_region = policy->region;
+	g_lorawan_settings.data_rate = policy->dr;
+	g_lorawan_settings.duty_cycle_enabled = policy->duty_cycle;
+	g_lorawan_settings.confirmed_msg_enabled = policy->confirmed ? LMH_CONFIRMED_MSG : LMH_UNCONFIRMED_MSG;
+	link_init();
+	airtime_init();
+
+	for (uint32_t hour = 0; hour < BENCH_DAYS * 24UL; hour++)
+	{
+		uint32_t of_day = hour % 24;
+		if ((of_day == 6) || (of_day == 12) || (of_day == 18) || (of_day == 21))
+		{
+			sim_usb_at("AT+VLVI=900");
+		}
+		sim_run_for(60 * 60 * 1000);
+	}
+
+	sim_stats *stats = sim_get_stats();
+	double days = BENCH_DAYS;
+	printf("%-18s %6u/%-3u %10.1f %12.1f %9.1f %10.1f %8lu\n", policy->name, airtime_dr_sf(airtime_plan(), policy->dr),
+		   airtime_dr_bw(airtime_plan(), policy->dr), stats->uplinks / days, stats->airtime_us / 1000.0 / days,
+		   stats->uplinks ? stats->uplink_bytes / (double)stats->uplinks : 0.0, airtime_deferred() / days,
+		   (unsigned long)stats->rejected);
+	return stats->stuck_events ? 1 : 0;
+}
+
+int main()
+{
+	printf("%-18s %10s %10s %12s %9s %10s %8s\n", "policy", "SF/kHz", "uplinks/d", "airtime ms/d", "bytes", "deferred/d",
+		   "rejected");
+	for (uint8_t idx = 0; idx < sizeof(policies) / sizeof(policies[0]); idx++)
+	{
+		policy = &policies[idx];
+		CHECK(sim_fork(bench_run) == 0);
+	}
+	return check_result("bench_airtime");
+}
@@ -0,0 +1,620 @@
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <vector>
+
+#include "check.h"
+#include "app.h"
+
+/**
+ * Discrete-event model of a fleet of controllers behind one US915 gateway on
+ * subband 2: eight 125 kHz uplink channels, eight demodulators and a half
+ * duplex radio that cannot receive while it sends an acknowledge or a command
+ * in RX1. Single threaded, one event queue over all nodes, fixed random seed.
+ *
+ * The nodes follow the uplink rules of uplink.cpp: a state uplink when a valve
+ * reached its position, the status every period restarted by any uplink, an
+ * unchanged status suppressed UPLINK_HEARTBEAT_EVERY times in a row, a state
+ * or requested uplink that was not delivered sent again after a delay growing
+ * from UPLINK_RETRY_MS. Payloads are built with payload.cpp and timed with
+ * airtime.h, so the model follows any change of the payload layout. The data
+ * rate of a node is fixed, the link adaptation and the airtime budget are left
+ * out: at 2 to 5 bytes neither comes into play on a clear channel.
+ *
+ * Every node runs the same irrigation schedule on its own clock, read from a
+ * trace file given as the only argument, one "HH:MM seconds" interval per
+ * line, or a morning and an evening interval without one. Collisions are
+ * two uplinks on the same channel and spreading factor overlapping in time,
+ * both are lost. US915 has no duty cycle limit, the payload limits of the
+ * data rates keep every uplink under the 400 ms dwell time.
+ */
+
+/** Subband 2, channels 8 .. 15 */
+#define FLEET_CHANNELS 8
+/** Uplinks an SX1301 gateway demodulates at once */
+#define FLEET_DEMODULATORS 8
+/** US915 DR0 .. DR3, SF10 .. SF7 on the 125 kHz channels */
+#define FLEET_SFS 4
+
+#define FLEET_DAY_US (24ULL * 60 * 60 * 1000000)
+/** The second day answers the commands of the first */
+#define FLEET_DAYS 2
+#define FLEET_RX1_DELAY_US 1000000
+#define FLEET_RX2_DELAY_US 2000000
+#define FLEET_RX_WINDOW_US 50000
+
+/** Command frame of the network server, one op and DL_OP_UPLINK, one result code each */
+#define FLEET_CMD_LEN 3
+#define FLEET_CMD_RESULTS 2
+/** Commands per node on the first day, at random times */
+#define FLEET_CMDS_PER_DAY 1
+/** Node clocks are set over the network to the second */
+#define FLEET_CLOCK_SPREAD_US 1000000
+
+/** Fleet sizes of the sweep */
+static const uint32_t fleet_sizes[] = {100, 1000, 3000, 10000};
+
+/** Uplink settings of a run */
+struct fleet_policy
+{
+	const char *name;
+	uint32_t period_sec;  // status period
+	bool confirmed;		  // confirmed uplinks
+	uint32_t stagger_sec; // schedule start spread over the fleet
+};
+
+static const fleet_policy policies[] = {
+	{"firmware", 900, true, 0},
+	{"unconfirmed", 900, false, 0},
+	{"staggered", 900, true, 900},
+	{"stag unconf 1h", 3600, false, 900},
+};
+
+/** Watering interval of the trace */
+struct fleet_interval
+{
+	uint32_t start_sec; // second of the day
+	uint32_t duration_sec;
+};
+
+static std::vector<fleet_interval> trace;
+
+/** Data rates of the fleet once the link adaptation settled, in percent of the nodes */
+static const uint8_t dr_share[] = {8, 12, 20, 60};
+
+/** Events of a node */
+enum fleet_event_type
+{
+	EV_STATUS,	  // status period ended
+	EV_VALVE,	  // valve reached its position, aux is open
+	EV_CLOSE,	  // interval ended, the relay starts to move
+	EV_COMMAND,	  // network server queued a command
+	EV_RETRY,	  // state or requested uplink sent again
+	EV_TX_END,	  // uplink ended at the gateway
+	EV_TX_DONE,	  // receive windows closed at the node
+	EV_START_DAY, // schedule of the day, aux is the interval
+};
+
+/** Event of the queue, ordered by time */
+struct fleet_event
+{
+	uint64_t at_us;
+	uint32_t node;
+	uint32_t aux;
+	uint8_t type;
+
+	bool operator>(const fleet_event &other) const
+	{
+		return at_us > other.at_us;
+	}
+};
+
+/** Uplink state of a controller and its command at the network server */
+struct fleet_node
+{
+	uint8_t dr;
+	uint8_t batt;
+	uint64_t offset_us;	 // schedule start of the node, its clock and the stagger
+	uint32_t status_gen; // status events of an older period are stale
+	uint64_t interval_end_us;
+	bool open;
+	bool running;
+	bool busy;			 // TX cycle running
+	uint8_t pending;	 // UPLINK_* kinds waiting for the radio
+	uint8_t suppressed;	 // status reports skipped in a row
+	uint8_t fail_streak; // undelivered uplinks in a row
+	uint8_t results;	 // result codes waiting for an uplink
+	uint8_t last_len;	 // last status sent, acknowledged if confirmed
+	uint8_t last[PAYLOAD_MAX_LEN];
+	bool cmd_queued;	// command waiting at the network server
+	bool cmd_running;	// command delivered, results not received yet
+	uint64_t cmd_at_us; // when the command was queued
+};
+
+/** Uplink on the air or in its receive windows */
+struct fleet_uplink
+{
+	uint32_t node;
+	uint64_t start_us;
+	uint64_t end_us;
+	uint8_t channel;
+	uint8_t sf;
+	uint8_t kinds;
+	bool results; // carries the command results
+	bool lost;	  // collision, no demodulator or the gateway was sending
+	bool acked;	  // acknowledge or command sent in RX1
+	bool command; // the command went out in RX1
+	uint8_t len;
+	uint8_t data[PAYLOAD_MAX_LEN];
+};
+
+/** Totals of a run */
+struct fleet_stats
+{
+	uint64_t uplinks;
+	uint64_t delivered;
+	uint64_t collided;
+	uint64_t no_demod;
+	uint64_t gw_busy; // lost while the gateway was sending
+	uint64_t no_ack;  // delivered, the RX1 slot was taken
+	uint64_t airtime_us;
+	uint32_t commands;
+	uint32_t answered;
+	std::vector<uint32_t> latency_ms;
+};
+
+static const fleet_policy *policy;
+static std::vector<fleet_node> nodes;
+/** Uplink in flight of each node, a node sends one at a time */
+static std::vector<fleet_uplink> uplinks;
+static std::priority_queue<fleet_event, std::vector<fleet_event>, std::greater<fleet_event>> events;
+/** Nodes sending on each channel and spreading factor */
+static std::vector<uint32_t> on_air[FLEET_CHANNELS][FLEET_SFS];
+/** End of each uplink the gateway is receiving */
+static std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> demod_end;
+/** Downlinks the gateway sends, start and end */
+static std::deque<std::pair<uint64_t, uint64_t>> gw_tx;
+static uint64_t now_us;
+static fleet_stats stats;
+
+static uint32_t rng_state;
+
+/**
+ * @brief xorshift32, the same sequence on every run
+ */
+static uint32_t fleet_random(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/**
+ * @brief Queue an event of a node
+ */
+static void push(uint64_t at_us, uint32_t node, uint8_t type, uint32_t aux = 0)
+{
+	fleet_event event = {at_us, node, aux, type};
+	events.push(event);
+}
+
+/**
+ * @brief Start the status period over, any uplink counts as status
+ */
+static void status_restart(uint32_t idx)
+{
+	fleet_node &node = nodes[idx];
+	node.status_gen++;
+	push(now_us + policy->period_sec * 1000000ULL, idx, EV_STATUS, node.status_gen);
+}
+
+/**
+ * @brief Status payload of a node like uplink_build_status() of a single valve
+ */
+static uint8_t build_status(fleet_node &node, uint8_t *out)
+{
+	uint32_t fields[PF_COUNT] = {0};
+	fields[PF_VERSION] = PAYLOAD_VERSION;
+	if (node.open)
+	{
+		fields[PF_FLAGS] |= PAYLOAD_FLAG_OPEN;
+	}
+	if (node.running)
+	{
+		fields[PF_FLAGS] |= PAYLOAD_FLAG_INTERVAL;
+		uint64_t left_us = (node.interval_end_us > now_us) ? node.interval_end_us - now_us : 0;
+		fields[PF_REMAIN] = payload_pack_remain((left_us + 999999) / 1000000);
+	}
+	fields[PF_BATT] = node.batt;
+	uint8_t max_len = std::min<uint8_t>(airtime_dr_max_len(AIRTIME_PLAN_US915, node.dr), PAYLOAD_MAX_LEN);
+	uint8_t len = payload_encode(payload_schema(PAYLOAD_VERSION), fields, out, max_len);
+
+	static const uint8_t codes[FLEET_CMD_RESULTS] = {0};
+	return payload_append_results(out, len, max_len, codes, node.results);
+}
+
+/**
+ * @brief Send the pending uplinks of a node if its radio is free, see uplink_drain()
+ */
+static void drain(uint32_t idx)
+{
+	fleet_node &node = nodes[idx];
+	if (node.busy || !node.pending)
+	{
+		return;
+	}
+
+	uint8_t data[PAYLOAD_MAX_LEN];
+	uint8_t len = build_status(node, data);
+	uint8_t kinds = node.pending;
+	node.pending = 0;
+	if ((kinds == UPLINK_STATUS) && (len == node.last_len) && (memcmp(data, node.last, len) == 0) &&
+		(node.suppressed < UPLINK_HEARTBEAT_EVERY))
+	{
+		node.suppressed++;
+		return;
+	}
+	node.suppressed = 0;
+
+	fleet_uplink uplink = {};
+	uplink.node = idx;
+	uplink.start_us = now_us;
+	uplink.end_us = now_us + airtime_uplink_us(AIRTIME_PLAN_US915, node.dr, len);
+	uplink.channel = fleet_random() % FLEET_CHANNELS;
+	uplink.sf = airtime_dr_sf(AIRTIME_PLAN_US915, node.dr);
+	uplink.kinds = kinds;
+	uplink.results = node.results != 0;
+	uplink.len = len;
+	memcpy(uplink.data, data, len);
+	node.results = 0;
+
+	stats.uplinks++;
+	stats.airtime_us += uplink.end_us - uplink.start_us;
+
+	// Overlap on the same channel and spreading factor destroys both. A node
+	// left in a list by an older uplink may be sending elsewhere by now.
+	std::vector<uint32_t> &same = on_air[uplink.channel][10 - uplink.sf];
+	same.erase(std::remove_if(same.begin(), same.end(),
+							  [&uplink](uint32_t other) {
+								  const fleet_uplink &rx = uplinks[other];
+								  return (rx.end_us <= now_us) || (rx.channel != uplink.channel) || (rx.sf != uplink.sf);
+							  }),
+			   same.end());
+	for (uint32_t other : same)
+	{
+		fleet_uplink &rx = uplinks[other];
+		if (!rx.lost)
+		{
+			rx.lost = true;
+			stats.collided++;
+		}
+		if (!uplink.lost)
+		{
+			uplink.lost = true;
+			stats.collided++;
+		}
+	}
+
+	while (!demod_end.empty() && (demod_end.top() <= now_us))
+	{
+		demod_end.pop();
+	}
+	if (!uplink.lost && (demod_end.size() >= FLEET_DEMODULATORS))
+	{
+		uplink.lost = true;
+		stats.no_demod++;
+	}
+	while (!gw_tx.empty() && (gw_tx.front().second <= now_us))
+	{
+		gw_tx.pop_front();
+	}
+	for (const std::pair<uint64_t, uint64_t> &tx : gw_tx)
+	{
+		if (!uplink.lost && (uplink.start_us < tx.second) && (uplink.end_us > tx.first))
+		{
+			uplink.lost = true;
+			stats.gw_busy++;
+		}
+	}
+
+	uplinks[idx] = uplink;
+	same.push_back(idx);
+	demod_end.push(uplink.end_us);
+	node.busy = true;
+	push(uplink.end_us, idx, EV_TX_END);
+	status_restart(idx);
+}
+
+/**
+ * @brief Queue an uplink kind, see uplink_enqueue()
+ */
+static void enqueue(uint32_t idx, uint8_t kind)
+{
+	nodes[idx].pending |= kind;
+	drain(idx);
+}
+
+/**
+ * @brief The gateway got the uplink, an acknowledge or a queued command goes out in RX1
+ */
+static void tx_end(fleet_uplink &uplink)
+{
+	fleet_node &node = nodes[uplink.node];
+	uint64_t rx1_us = uplink.end_us + FLEET_RX1_DELAY_US;
+	uint64_t done_us = uplink.end_us + FLEET_RX2_DELAY_US + FLEET_RX_WINDOW_US;
+
+	if (!uplink.lost)
+	{
+		stats.delivered++;
+		if (uplink.results && node.cmd_running)
+		{
+			node.cmd_running = false;
+			stats.answered++;
+			stats.latency_ms.push_back((uplink.end_us - node.cmd_at_us) / 1000);
+		}
+
+		if (policy->confirmed || node.cmd_queued)
+		{
+			uint8_t dl_len = AIRTIME_LORAWAN_OVERHEAD - 1 + (node.cmd_queued ? FLEET_CMD_LEN + 1 : 0);
+			// RX1 of US915 DR0 .. DR3 is DR10 .. DR13, SF10 .. SF7 at 500 kHz
+			uint32_t dl_us = airtime_us(10 - node.dr, 500, AIRTIME_CR_4_5, dl_len);
+			if (gw_tx.empty() || (rx1_us >= gw_tx.back().second))
+			{
+				// The dwell time keeps every uplink shorter than the RX1 delay, only
+				// uplinks that start later can overlap the downlink
+				gw_tx.push_back(std::make_pair(rx1_us, rx1_us + dl_us));
+				uplink.acked = true;
+				if (node.cmd_queued)
+				{
+					node.cmd_queued = false;
+					node.cmd_running = true;
+					uplink.command = true;
+				}
+				// The node listens until the frame ended
+				done_us = rx1_us + dl_us;
+			}
+			else
+			{
+				stats.no_ack++;
+			}
+		}
+	}
+	push(done_us, uplink.node, EV_TX_DONE);
+}
+
+/**
+ * @brief The TX cycle of a node finished, see uplink_tx_done()
+ */
+static void tx_done(fleet_uplink &uplink)
+{
+	fleet_node &node = nodes[uplink.node];
+	node.busy = false;
+	// An unconfirmed uplink always counts as sent
+	bool success = !policy->confirmed || uplink.acked;
+	if (success)
+	{
+		node.fail_streak = 0;
+		memcpy(node.last, uplink.data, uplink.len);
+		node.last_len = uplink.len;
+	}
+	else
+	{
+		node.fail_streak++;
+		if (uplink.kinds & (UPLINK_STATE | UPLINK_REQUEST))
+		{
+			uint8_t shift = std::min<uint8_t>(node.fail_streak - 1, LINK_BACKOFF_MAX_SHIFT);
+			push(now_us + ((uint64_t)UPLINK_RETRY_MS << shift) * 1000, uplink.node, EV_RETRY, uplink.kinds);
+		}
+	}
+
+	// A command frame with DL_OP_UPLINK asks for the results right away
+	if (uplink.command)
+	{
+		node.results = FLEET_CMD_RESULTS;
+		node.pending |= UPLINK_REQUEST;
+	}
+	drain(uplink.node);
+}
+
+/**
+ * @brief Run an event at its time
+ */
+static void handle(const fleet_event &event)
+{
+	fleet_node &node = nodes[event.node];
+	switch (event.type)
+	{
+	case EV_STATUS:
+		if (event.aux == node.status_gen)
+		{
+			enqueue(event.node, UPLINK_STATUS);
+			// A suppressed report starts the next period as well
+			if (event.aux == node.status_gen)
+			{
+				status_restart(event.node);
+			}
+		}
+		break;
+	case EV_START_DAY:
+	{
+		const fleet_interval &interval = trace[event.aux];
+		node.running = true;
+		node.interval_end_us = now_us + interval.duration_sec * 1000000ULL;
+		push(now_us + (VALVE_HOLD_MS + DEFAULT_VALVE_OPER_TIME_SEC * 1000) * 1000ULL, event.node, EV_VALVE, 1);
+		push(node.interval_end_us, event.node, EV_CLOSE);
+		break;
+	}
+	case EV_CLOSE:
+		node.running = false;
+		push(now_us + DEFAULT_VALVE_OPER_TIME_SEC * 1000000ULL, event.node, EV_VALVE, 0);
+		break;
+	case EV_VALVE:
+		node.open = event.aux;
+		enqueue(event.node, UPLINK_STATE);
+		break;
+	case EV_COMMAND:
+		stats.commands++;
+		node.cmd_queued = true;
+		node.cmd_at_us = now_us;
+		break;
+	case EV_RETRY:
+		enqueue(event.node, event.aux);
+		break;
+	case EV_TX_END:
+		tx_end(uplinks[event.node]);
+		break;
+	case EV_TX_DONE:
+		tx_done(uplinks[event.node]);
+		break;
+	}
+}
+
+/**
+ * @brief Read the schedule trace, one "HH:MM seconds" interval per line
+ */
+static bool read_trace(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		return false;
+	}
+	char line[64];
+	unsigned hour, minute, duration;
+	while (fgets(line, sizeof(line), file))
+	{
+		if ((sscanf(line, "%u:%u %u", &hour, &minute, &duration) == 3) && (hour < 24) && (minute < 60) && duration)
+		{
+			fleet_interval interval = {hour * 3600 + minute * 60, duration};
+			trace.push_back(interval);
+		}
+	}
+	fclose(file);
+	return !trace.empty();
+}
+
+/**
+ * @brief Run the days of a fleet under the current policy
+ */
+static void fleet_run(uint32_t count)
+{
+	rng_state = 0x2545F491;
+	nodes.assign(count, fleet_node());
+	uplinks.assign(count, fleet_uplink());
+	events = decltype(events)();
+	for (uint8_t ch = 0; ch < FLEET_CHANNELS; ch++)
+	{
+		for (uint8_t sf = 0; sf < FLEET_SFS; sf++)
+		{
+			on_air[ch][sf].clear();
+		}
+	}
+	demod_end = decltype(demod_end)();
+	gw_tx.clear();
+	stats = fleet_stats();
+	now_us = 0;
+
+	for (uint32_t idx = 0; idx < count; idx++)
+	{
+		fleet_node &node = nodes[idx];
+		uint32_t share = fleet_random() % 100;
+		for (node.dr = 0; share >= dr_share[node.dr]; node.dr++)
+		{
+			share -= dr_share[node.dr];
+		}
+		node.batt = payload_quantize_batt(3600 + fleet_random() % 500);
+		node.offset_us = fleet_random() % FLEET_CLOCK_SPREAD_US;
+		if (policy->stagger_sec)
+		{
+			node.offset_us += fleet_random() % (policy->stagger_sec * 1000000ULL);
+		}
+
+		// Nodes joined at different times, the status periods are out of phase
+		push(fleet_random() % (policy->period_sec * 1000000ULL), idx, EV_STATUS, node.status_gen);
+		for (uint8_t day = 0; day < FLEET_DAYS; day++)
+		{
+			for (uint32_t interval = 0; interval < trace.size(); interval++)
+			{
+				push(day * FLEET_DAY_US + trace[interval].start_sec * 1000000ULL + node.offset_us, idx, EV_START_DAY,
+					 interval);
+			}
+		}
+		for (uint8_t cmd = 0; cmd < FLEET_CMDS_PER_DAY; cmd++)
+		{
+			push(fleet_random() % FLEET_DAY_US, idx, EV_COMMAND);
+		}
+	}
+
+	while (!events.empty() && (events.top().at_us < FLEET_DAYS * FLEET_DAY_US))
+	{
+		fleet_event event = events.top();
+		events.pop();
+		now_us = event.at_us;
+		handle(event);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc > 1) && !read_trace(argv[1]))
+	{
+		printf("%s: no \"HH:MM seconds\" lines\n", argv[1]);
+		return 1;
+	}
+	if (trace.empty())
+	{
+		// Morning and evening watering of a drip line
+		static const fleet_interval watering[] = {{6 * 3600, 900}, {19 * 3600, 600}};
+		trace.assign(watering, watering + sizeof(watering) / sizeof(watering[0]));
+	}
+
+	// Losses in percent of the uplinks, the acknowledges not sent in percent of the delivered ones
+	printf("%-15s %6s %9s %12s %6s %6s %6s %6s %6s %6s %6s %10s %9s\n", "policy", "nodes", "uplinks/d", "airtime ms/d",
+		   "load%", "PDR%", "coll%", "demod%", "gwtx%", "noack%", "cmds%", "cmd mean s", "cmd p95 s");
+	for (uint8_t idx = 0; idx < sizeof(policies) / sizeof(policies[0]); idx++)
+	{
+		policy = &policies[idx];
+		double pdr_before = 1.0;
+		for (uint8_t size = 0; size < sizeof(fleet_sizes) / sizeof(fleet_sizes[0]); size++)
+		{
+			uint32_t count = fleet_sizes[size];
+			fleet_run(count);
+
+			double pdr = stats.uplinks ? stats.delivered / (double)stats.uplinks : 0.0;
+			double mean_s = 0.0;
+			double p95_s = 0.0;
+			if (!stats.latency_ms.empty())
+			{
+				std::sort(stats.latency_ms.begin(), stats.latency_ms.end());
+				uint64_t sum = 0;
+				for (uint32_t ms : stats.latency_ms)
+				{
+					sum += ms;
+				}
+				mean_s = sum / 1000.0 / stats.latency_ms.size();
+				p95_s = stats.latency_ms[stats.latency_ms.size() * 95 / 100] / 1000.0;
+			}
+			double up_pct = 100.0 / stats.uplinks;
+			printf("%-15s %6lu %9.1f %12.1f %6.2f %6.2f %6.2f %6.2f %6.2f %6.2f %6.1f %10.1f %9.1f\n", policy->name,
+				   (unsigned long)count, stats.uplinks / (double)count / FLEET_DAYS,
+				   stats.airtime_us / 1000.0 / count / FLEET_DAYS,
+				   100.0 * stats.airtime_us / (FLEET_CHANNELS * FLEET_DAYS * FLEET_DAY_US), 100.0 * pdr,
+				   stats.collided * up_pct, stats.no_demod * up_pct, stats.gw_busy * up_pct,
+				   stats.delivered ? 100.0 * stats.no_ack / stats.delivered : 0.0,
+				   stats.commands ? 100.0 * stats.answered / stats.commands : 0.0, mean_s, p95_s);
+
+			CHECK(stats.uplinks > 0);
+			// More nodes never deliver more of their uplinks, within the noise of the seed
+			CHECK(pdr <= pdr_before + 0.005);
+			pdr_before = pdr;
+			// A small fleet with staggered schedules hardly collides
+			if (policy->stagger_sec && (count <= 100))
+			{
+				CHECK(pdr > 0.97);
+				CHECK(stats.answered >= stats.commands * 95 / 100);
+			}
+		}
+	}
+	return check_result("bench_fleet");
+}
@@ -0,0 +1,134 @@
+#include "check.h"
+#include "sim.h"
+#include "app.h"
+
+/**
+ * Runs the whole firmware through simulated days of typical use and reports
+ * the uplinks, airtime, relay on time and wakeups per day, and the time
+ * spent in each handler. Handler times are host time, so compare them
+ * between builds on the same machine; the virtual time is how long a
+ * handler blocked the device in delay().
+ */
+
+/** 2026-01-01 00:00 local time, a Thursday */
+#define BENCH_EPOCH 1767225600UL
+
+/** A day of use */
+struct bench_scenario
+{
+	const char *name;
+	uint8_t days;
+	void (*setup)(void);		 // before the boot
+	void (*hour)(uint32_t hour); // at the start of every simulated hour
+};
+
+static void setup_lossy(void)
+{
+	sim_radio_model()->loss_permille = 300;
+}
+
+static void setup_low_battery(void)
+{
+	sim_batt_mv(3450);
+}
+
+/**
+ * @brief Four manual intervals of 15 min a day over USB
+ */
+static void hour_intervals(uint32_t hour)
+{
+	uint32_t of_day = hour % 24;
+	if ((of_day == 6) || (of_day == 12) || (of_day == 18) || (of_day == 21))
+	{
+		sim_usb_at("AT+VLVI=900");
+	}
+}
+
+/**
+ * @brief Watering in the morning and the evening from the schedule
+ */
+static void hour_schedule(uint32_t hour)
+{
+	if (hour == 0)
+	{
+		char line[32];
+		snprintf(line, sizeof(line), "AT+TIME=%lu", BENCH_EPOCH);
+		sim_usb_at(line);
+		sim_usb_at("AT+SCHED=0:127:0600:900");
+		sim_usb_at("AT+SCHED=1:127:1900:600");
+	}
+}
+
+/**
+ * @brief The valve is opened and closed by binary downlinks every few hours
+ */
+static void hour_downlinks(uint32_t hour)
+{
+	if (hour % 3 == 0)
+	{
+		const uint8_t frame[] = {DL_OP_VALVE, (uint8_t)((hour / 3) & 1)};
+		sim_downlink(DOWNLINK_CMD_FPORT, frame, sizeof(frame));
+	}
+}
+
+static const bench_scenario scenarios[] = {
+	{"idle", 2, NULL, NULL},
+	{"intervals", 2, NULL, hour_intervals},
+	{"schedule", 7, NULL, hour_schedule},
+	{"downlinks", 2, NULL, hour_downlinks},
+	{"lossy link", 2, setup_lossy, hour_intervals},
+	{"low battery", 2, setup_low_battery, NULL},
+};
+
+static const char *handler_names[SIM_H_COUNT] = {"app", "lora", "ble", "usb"};
+
+static const bench_scenario *bench;
+
+/**
+ * @brief Run one scenario in a child and print its row
+ */
+static int bench_run(void)
+{
+	if (bench->setup)
+	{
+		bench->setup();
+	}
+	sim_boot();
+	for (uint32_t hour = 0; hour < bench->days * 24UL; hour++)
+	{
+		if (bench->hour)
+		{
+			bench->hour(hour);
+		}
+		sim_run_for(60 * 60 * 1000);
+	}
+
+	sim_stats *stats = sim_get_stats();
+	double days = bench->days;
+	printf("%-12s %10.1f %12.1f %10.1f %10.1f %8.1f %6lu\n", bench->name, stats->uplinks / days,
+		   stats->airtime_us / 1000.0 / days, sim_relay_on_ms() / 1000.0 / days, g_wake_count / days,
+		   stats->i2c_transactions / days, (unsigned long)stats->stuck_events);
+	for (uint8_t handler = 0; handler < SIM_H_COUNT; handler++)
+	{
+		sim_handler_stats *time = &stats->handlers[handler];
+		if (time->calls)
+		{
+			printf("  %-10s %9.1f calls/day %8.2f us mean %8.2f us max %6.0f ms blocked\n", handler_names[handler],
+				   time->calls / days, time->host_ns / 1000.0 / time->calls, time->host_max_ns / 1000.0,
+				   time->virt_max_us / 1000.0);
+		}
+	}
+	return stats->stuck_events ? 1 : 0;
+}
+
+int main()
+{
+	printf("%-12s %10s %12s %10s %10s %8s %6s\n", "scenario", "uplinks/d", "airtime ms/d", "relay s/d", "wakeups/d",
+		   "i2c/d", "stuck");
+	for (uint8_t idx = 0; idx < sizeof(scenarios) / sizeof(scenarios[0]); idx++)
+	{
+		bench = &scenarios[idx];
+		CHECK(sim_fork(bench_run) == 0);
+	}
+	return check_result("bench_scenarios");
+}
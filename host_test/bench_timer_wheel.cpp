@@ -0,0 +1,75 @@
+#include <chrono>
+#include "timer_wheel.h"
+#include "check.h"
+
+/**
+ * Times wheel_next_deadline() with a growing number of queued entries and
+ * compares it with a scan over all entries. The wheel lookup stays flat,
+ * the scan grows with the entries.
+ */
+
+static timer_wheel_s wheel;
+static uint32_t due[WHEEL_CAPACITY];
+
+/**
+ * @brief Earliest deadline by walking all entries, the reference
+ */
+static uint32_t scan_next(uint16_t count)
+{
+	uint32_t best = WHEEL_NEVER;
+	for (uint16_t id = 0; id < count; id++)
+	{
+		if (due[id] < best)
+		{
+			best = due[id];
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Nanoseconds per call of a lookup
+ */
+template <typename F>
+static double time_ns(F lookup, uint32_t *sink)
+{
+	const int rounds = 200000;
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		*sink += lookup();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+}
+
+int main()
+{
+	static const uint16_t counts[] = {8, 32, 128, 256, 512};
+	uint32_t sink = 0;
+
+	printf("%8s %14s %14s\n", "entries", "wheel ns", "scan ns");
+	for (uint8_t idx = 0; idx < sizeof(counts) / sizeof(counts[0]); idx++)
+	{
+		uint16_t count = counts[idx];
+		if (count > WHEEL_CAPACITY)
+		{
+			break;
+		}
+
+		// A week of minute ticks, as the schedule uses the wheel
+		wheel_init(&wheel, 1000);
+		for (uint16_t id = 0; id < count; id++)
+		{
+			due[id] = 1000 + 64 + check_random() % (7 * 24 * 60);
+			CHECK(wheel_insert(&wheel, id, due[id]));
+		}
+		CHECK_EQ(wheel_next_deadline(&wheel), scan_next(count));
+
+		double wheel_ns = time_ns([] { return wheel_next_deadline(&wheel); }, &sink);
+		double scan_ns = time_ns([count] { return scan_next(count); }, &sink);
+		printf("%8d %14.1f %14.1f\n", count, wheel_ns, scan_ns);
+	}
+	printf("(%lu)\n", (unsigned long)(sink & 1));
+	return check_result("bench_timer_wheel");
+}
@@ -0,0 +1,56 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/**
+ * Minimal checks for the host tests, a failed check is printed and counted,
+ * main() returns check_result().
+ */
+
+#include <stdio.h>
+
+static int check_failed = 0;
+
+#define CHECK(cond)                                                    \
+	do                                                                 \
+	{                                                                  \
+		if (!(cond))                                                   \
+		{                                                              \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			check_failed++;                                            \
+		}                                                              \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                                                      \
+	do                                                                                                      \
+	{                                                                                                       \
+		unsigned long check_a = (unsigned long)(a);                                                         \
+		unsigned long check_b = (unsigned long)(b);                                                         \
+		if (check_a != check_b)                                                                             \
+		{                                                                                                   \
+			printf("%s:%d: check failed: %s == %s (%lu != %lu)\n", __FILE__, __LINE__, #a, #b, check_a, check_b); \
+			check_failed++;                                                                                 \
+		}                                                                                                   \
+	} while (0)
+
+/**
+ * @brief Print the summary, the exit code of the test
+ */
+static inline int check_result(const char *name)
+{
+	printf("%s: %s\n", name, check_failed ? "FAILED" : "passed");
+	return check_failed ? 1 : 0;
+}
+
+/**
+ * @brief Small deterministic random generator, xorshift32
+ */
+static inline unsigned long check_random(void)
+{
+	static unsigned long state = 2463534242UL;
+	state ^= (state << 13) & 0xFFFFFFFFUL;
+	state ^= state >> 17;
+	state ^= (state << 5) & 0xFFFFFFFFUL;
+	return state & 0xFFFFFFFFUL;
+}
+
+#endif
@@ -0,0 +1,1226 @@
+#include "app.h"
+#include "sim.h"
+
+#include <InternalFileSystem.h>
+
+#include <chrono>
+#include <new>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Exit status of a child that called api_reset() */
+#define SIM_EXIT_RESET 77
+
+/** Event bits handled by the API, the others belong to app_event_handler() */
+#define SIM_API_EVENTS (BLE_CONFIG | BLE_DATA | LORA_DATA | LORA_TX_FIN | AT_CMD | LORA_JOIN_FIN)
+#define SIM_LORA_EVENTS (LORA_DATA | LORA_TX_FIN | LORA_JOIN_FIN)
+
+/** Handler calls in a row before the raised events count as stuck */
+#define SIM_MAX_ROUNDS 16
+
+/** LoRaWAN receive windows after the end of an uplink */
+#define SIM_RX1_DELAY_US 1000000
+#define SIM_RX2_DELAY_US 2000000
+#define SIM_JOIN_ACCEPT_DELAY_US 5000000
+#define SIM_RX_WINDOW_US 50000
+
+/** Join request, MHDR, JoinEUI, DevEUI, DevNonce and MIC */
+#define SIM_JOIN_REQUEST_LEN 23
+
+/** Downlinks waiting for an uplink */
+#define SIM_DOWNLINKS 8
+
+/** A file of the simulated flash */
+struct sim_file
+{
+	char name[32]; // empty if the slot is free
+	uint32_t len;
+	uint8_t data[SIM_FS_FILE_MAX];
+};
+
+/** Downlink queued by the network server */
+struct sim_frame
+{
+	uint8_t fport;
+	uint8_t len;
+	uint8_t data[256];
+};
+
+/** State that lives through a reset, shared by the parent and its children */
+struct sim_shared
+{
+	uint64_t now_us;  // virtual time since sim_fork()
+	uint64_t boot_us; // virtual time of the last boot, millis() counts from here
+	uint32_t rng;
+	uint16_t batt_mv;
+	sim_radio radio;
+	sim_stats stats;
+	bool credentials_valid;
+	s_lorawan_settings credentials;
+	sim_file files[SIM_FS_FILES];
+	bool cut_armed; // power lost during a write, see sim_fs_cut()
+	uint32_t cut_writes;
+	uint32_t cut_bytes;
+	sim_frame downlinks[SIM_DOWNLINKS];
+	uint8_t downlink_count;
+};
+
+static sim_shared *shared = NULL;
+
+/** Globals of the WisBlock-API */
+volatile uint16_t g_task_event_type = NO_EVENT;
+s_lorawan_settings g_lorawan_settings;
+bool g_join_result = false;
+bool g_rx_fin_result = false;
+uint8_t g_rx_lora_data[256];
+uint8_t g_rx_data_len = 0;
+uint8_t g_last_fport = 0;
+int16_t g_last_rssi = 0;
+int8_t g_last_snr = 0;
+bool g_enable_ble = false;
+bool g_ble_uart_is_connected = false;
+BLEUart g_ble_uart;
+char g_at_query_buf[ATQUERY_SIZE];
+
+Stream Serial;
+TwoWire Wire;
+InternalFileSystem InternalFS;
+
+/** Armed timers, in the order they were started */
+static std::vector<TimerEvent_t *> timers;
+
+/** Send timer of the API, repeats every send_repeat_time */
+static TimerEvent_t api_send_timer;
+
+/** Radio of the LoRaWAN stack */
+static TimerEvent_t radio_timer;
+static bool radio_joined = false;
+static bool radio_busy = false;
+static bool radio_joining = false;
+static bool radio_lost = false;
+static bool radio_confirmed = false;
+static uint8_t radio_dr = DR_0;
+
+/** MCU pins */
+static uint8_t pin_level[SIM_PINS];
+static void (*pin_isr[SIM_PINS])(void);
+
+/** MCP23017 registers, IOCON.BANK = 0 */
+#define SIM_MCP_REGS 0x16
+static uint8_t mcp_reg[SIM_MCP_REGS];
+static uint16_t mcp_inputs = 0xFFFF; // levels of the pins that are inputs
+static uint8_t mcp_ptr = 0;			 // register address pointer
+static bool mcp_int = false;		 // interrupt output asserted
+static uint64_t relay_since_us = 0;	 // last relay on time update
+
+/** USB AT line of at_serial_input() */
+static char usb_line[256];
+static uint16_t usb_len = 0;
+
+/**
+ * @brief Pseudo random number of the radio model, repeatable for a seed
+ */
+static uint32_t sim_random(void)
+{
+	uint32_t x = shared->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	shared->rng = x;
+	return x;
+}
+
+/************************************************************************
+ * Virtual time and timers
+ ************************************************************************/
+
+uint32_t millis(void)
+{
+	return (shared->now_us - shared->boot_us) / 1000;
+}
+
+uint32_t micros(void)
+{
+	return shared->now_us - shared->boot_us;
+}
+
+uint64_t sim_now_us(void)
+{
+	return shared->now_us;
+}
+
+/**
+ * @brief Earliest armed timer
+ *
+ * @return TimerEvent_t* timer or NULL if none is armed
+ */
+static TimerEvent_t *sim_next_timer(void)
+{
+	TimerEvent_t *next = NULL;
+	for (TimerEvent_t *timer : timers)
+	{
+		if ((next == NULL) || (timer->due_us < next->due_us))
+		{
+			next = timer;
+		}
+	}
+	return next;
+}
+
+/**
+ * @brief Move the virtual time forward and fire the timers that are due on the way
+ *
+ * @param to_us virtual time to move to
+ */
+static void sim_advance(uint64_t to_us)
+{
+	TimerEvent_t *timer;
+	while (((timer = sim_next_timer()) != NULL) && (timer->due_us <= to_us))
+	{
+		if (timer->due_us > shared->now_us)
+		{
+			shared->now_us = timer->due_us;
+		}
+		TimerStop(timer);
+		timer->Callback();
+	}
+	if (to_us > shared->now_us)
+	{
+		shared->now_us = to_us;
+	}
+}
+
+void delay(uint32_t ms)
+{
+	sim_advance(shared->now_us + (uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	sim_advance(shared->now_us + us);
+}
+
+void TimerInit(TimerEvent_t *obj, void (*callback)(void))
+{
+	TimerStop(obj);
+	obj->Callback = callback;
+	obj->ReloadValue = 0;
+}
+
+void TimerSetValue(TimerEvent_t *obj, uint32_t value)
+{
+	obj->ReloadValue = value;
+}
+
+void TimerStart(TimerEvent_t *obj)
+{
+	TimerStop(obj);
+	obj->due_us = shared->now_us + (uint64_t)obj->ReloadValue * 1000;
+	obj->IsRunning = true;
+	timers.push_back(obj);
+}
+
+void TimerStop(TimerEvent_t *obj)
+{
+	for (size_t idx = 0; idx < timers.size(); idx++)
+	{
+		if (timers[idx] == obj)
+		{
+			timers.erase(timers.begin() + idx);
+			break;
+		}
+	}
+	obj->IsRunning = false;
+}
+
+/************************************************************************
+ * Pins
+ ************************************************************************/
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+	if ((pin < SIM_PINS) && (mode == INPUT_PULLUP))
+	{
+		pin_level[pin] = HIGH;
+	}
+}
+
+/**
+ * @brief Power on values of the MCP23017
+ */
+static void sim_expander_reset(void)
+{
+	memset(mcp_reg, 0, sizeof(mcp_reg));
+	mcp_reg[EXPANDER_REG_IODIRA] = 0xFF;
+	mcp_reg[EXPANDER_REG_IODIRA + 1] = 0xFF;
+	mcp_int = false;
+}
+
+void digitalWrite(uint32_t pin, uint32_t level)
+{
+	if (pin >= SIM_PINS)
+	{
+		return;
+	}
+	// The RAK13003 reset input
+	if ((pin == WB_IO4) && pin_level[pin] && !level)
+	{
+		sim_expander_reset();
+	}
+	pin_level[pin] = level ? HIGH : LOW;
+}
+
+int digitalRead(uint32_t pin)
+{
+	return (pin < SIM_PINS) ? pin_level[pin] : LOW;
+}
+
+int analogRead(uint32_t pin)
+{
+	(void)pin;
+	return 0;
+}
+
+void attachInterrupt(uint32_t irq, void (*isr)(void), int mode)
+{
+	(void)mode;
+	if (irq < SIM_PINS)
+	{
+		pin_isr[irq] = isr;
+	}
+}
+
+void detachInterrupt(uint32_t irq)
+{
+	if (irq < SIM_PINS)
+	{
+		pin_isr[irq] = NULL;
+	}
+}
+
+void sim_pin_interrupt(uint32_t pin)
+{
+	if ((pin < SIM_PINS) && pin_isr[pin])
+	{
+		pin_isr[pin]();
+	}
+}
+
+/************************************************************************
+ * Serial streams
+ ************************************************************************/
+
+int Stream::available()
+{
+	return rx.size() - rx_pos;
+}
+
+int Stream::read()
+{
+	if (rx_pos >= rx.size())
+	{
+		return -1;
+	}
+	return (uint8_t)rx[rx_pos++];
+}
+
+size_t Stream::read(uint8_t *buf, size_t len)
+{
+	size_t count = 0;
+	while ((count < len) && (rx_pos < rx.size()))
+	{
+		buf[count++] = rx[rx_pos++];
+	}
+	if (rx_pos == rx.size())
+	{
+		rx.clear();
+		rx_pos = 0;
+	}
+	return count;
+}
+
+size_t Stream::write(const uint8_t *buf, size_t len)
+{
+	tx.append((const char *)buf, len);
+	if (echo)
+	{
+		fwrite(buf, 1, len, stdout);
+	}
+	return len;
+}
+
+int Stream::printf(const char *fmt, ...)
+{
+	char text[512];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+	if (len > 0)
+	{
+		write((const uint8_t *)text, strlen(text));
+	}
+	return len;
+}
+
+void sim_ble_send(const char *data)
+{
+	g_ble_uart.rx.append(data);
+	g_ble_uart_is_connected = true;
+	api_wake_loop(BLE_DATA);
+}
+
+void sim_usb_at(const char *line)
+{
+	Serial.rx.append(line);
+	Serial.rx.append("\r\n");
+}
+
+/************************************************************************
+ * MCP23017 on the I2C bus
+ ************************************************************************/
+
+/**
+ * @brief Add the time the driven outputs were HIGH
+ */
+static void sim_relay_update(void)
+{
+	uint16_t on = sim_expander_outputs();
+	uint64_t elapsed = shared->now_us - relay_since_us;
+	for (uint8_t pin = 0; pin < 16; pin++)
+	{
+		if (on & (1 << pin))
+		{
+			shared->stats.relay_on_us[pin] += elapsed;
+		}
+	}
+	relay_since_us = shared->now_us;
+}
+
+uint16_t sim_expander_outputs(void)
+{
+	uint16_t iodir = mcp_reg[EXPANDER_REG_IODIRA] | (mcp_reg[EXPANDER_REG_IODIRA + 1] << 8);
+	uint16_t olat = mcp_reg[EXPANDER_REG_OLATA] | (mcp_reg[EXPANDER_REG_OLATA + 1] << 8);
+	return olat & ~iodir;
+}
+
+/**
+ * @brief Levels of all pins, outputs read back their latch
+ */
+static uint16_t sim_expander_levels(void)
+{
+	uint16_t iodir = mcp_reg[EXPANDER_REG_IODIRA] | (mcp_reg[EXPANDER_REG_IODIRA + 1] << 8);
+	return sim_expander_outputs() | (mcp_inputs & iodir);
+}
+
+/**
+ * @brief Write an expander register
+ */
+static void sim_expander_write(uint8_t reg, uint8_t value)
+{
+	if (reg >= SIM_MCP_REGS)
+	{
+		return;
+	}
+	// GPIO writes go to the output latch, IOCON is mapped twice
+	if ((reg & ~1) == EXPANDER_REG_GPIOA)
+	{
+		reg = EXPANDER_REG_OLATA + (reg & 1);
+	}
+	if ((reg & ~1) == EXPANDER_REG_IOCON)
+	{
+		mcp_reg[EXPANDER_REG_IOCON] = value;
+		mcp_reg[EXPANDER_REG_IOCON + 1] = value;
+		return;
+	}
+
+	uint16_t before = sim_expander_outputs();
+	sim_relay_update();
+	mcp_reg[reg] = value;
+	uint16_t raised = sim_expander_outputs() & ~before;
+	while (raised)
+	{
+		shared->stats.relay_pulses++;
+		raised &= raised - 1;
+	}
+}
+
+void sim_expander_input(uint16_t mask, uint16_t levels)
+{
+	uint16_t before = sim_expander_levels();
+	mcp_inputs = (mcp_inputs & ~mask) | (levels & mask);
+	uint16_t gpinten = mcp_reg[EXPANDER_REG_GPINTENA] | (mcp_reg[EXPANDER_REG_GPINTENA + 1] << 8);
+	if (((before ^ sim_expander_levels()) & gpinten) && !mcp_int)
+	{
+		// Open drain output pulled low, a falling edge on the MCU pin
+		mcp_int = true;
+		sim_pin_interrupt(VALVE_FB_INT_PIN);
+	}
+}
+
+void TwoWire::beginTransmission(uint8_t addr)
+{
+	this->addr = addr;
+	tx_len = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	if (tx_len >= sizeof(tx_buf))
+	{
+		return 0;
+	}
+	tx_buf[tx_len++] = data;
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t len)
+{
+	size_t count = 0;
+	while ((count < len) && write(data[count]))
+	{
+		count++;
+	}
+	return count;
+}
+
+uint8_t TwoWire::endTransmission(bool stop)
+{
+	(void)stop;
+	shared->stats.i2c_transactions++;
+	if (addr != EXPANDER_ADDR)
+	{
+		// Address not acknowledged
+		return 2;
+	}
+	if (tx_len)
+	{
+		// The first byte sets the address pointer, it advances with each data byte
+		mcp_ptr = tx_buf[0];
+		for (uint8_t idx = 1; idx < tx_len; idx++)
+		{
+			sim_expander_write(mcp_ptr++, tx_buf[idx]);
+		}
+	}
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t addr, uint8_t len)
+{
+	if (addr != EXPANDER_ADDR)
+	{
+		rx_len = 0;
+		return 0;
+	}
+	uint8_t reg = mcp_ptr;
+	uint16_t levels = sim_expander_levels();
+	for (rx_len = 0; (rx_len < len) && (rx_len < sizeof(rx_buf)); rx_len++, reg++)
+	{
+		if ((reg & ~1) == EXPANDER_REG_GPIOA)
+		{
+			// Reading the port clears the interrupt
+			rx_buf[rx_len] = (reg & 1) ? (levels >> 8) : (levels & 0xFF);
+			mcp_int = false;
+		}
+		else
+		{
+			rx_buf[rx_len] = (reg < SIM_MCP_REGS) ? mcp_reg[reg] : 0;
+		}
+	}
+	rx_pos = 0;
+	return rx_len;
+}
+
+int TwoWire::available()
+{
+	return rx_len - rx_pos;
+}
+
+int TwoWire::read()
+{
+	if (rx_pos >= rx_len)
+	{
+		return -1;
+	}
+	return rx_buf[rx_pos++];
+}
+
+/************************************************************************
+ * LittleFS on the internal flash
+ ************************************************************************/
+
+/**
+ * @brief Find a file of the simulated flash
+ *
+ * @return int slot or -1 if it does not exist
+ */
+static int sim_file_find(const char *name)
+{
+	for (int idx = 0; idx < SIM_FS_FILES; idx++)
+	{
+		if (strncmp(shared->files[idx].name, name, sizeof(shared->files[idx].name)) == 0)
+		{
+			return idx;
+		}
+	}
+	return -1;
+}
+
+bool File::open(const char *name, uint8_t mode)
+{
+	close();
+	delayMicroseconds(SIM_FS_OPEN_US);
+	if (strlen(name) >= sizeof(shared->files[0].name))
+	{
+		return false;
+	}
+	int slot = sim_file_find(name);
+	if ((slot < 0) && (mode == FILE_O_WRITE))
+	{
+		slot = sim_file_find("");
+		if (slot < 0)
+		{
+			return false;
+		}
+		strcpy(shared->files[slot].name, name);
+		shared->files[slot].len = 0;
+	}
+	if (slot < 0)
+	{
+		return false;
+	}
+	idx = slot;
+	this->mode = mode;
+	// Writes append to the end of the file
+	pos = (mode == FILE_O_WRITE) ? shared->files[slot].len : 0;
+	return true;
+}
+
+size_t File::read(void *buf, size_t len)
+{
+	if (idx < 0)
+	{
+		return 0;
+	}
+	delayMicroseconds(SIM_FS_READ_US);
+	sim_file *file = &shared->files[idx];
+	size_t count = (pos < file->len) ? file->len - pos : 0;
+	count = (count < len) ? count : len;
+	memcpy(buf, &file->data[pos], count);
+	pos += count;
+	return count;
+}
+
+int File::read(void)
+{
+	uint8_t data;
+	return (read(&data, 1) == 1) ? data : -1;
+}
+
+size_t File::write(const uint8_t *buf, size_t len)
+{
+	if ((idx < 0) || (mode != FILE_O_WRITE))
+	{
+		return 0;
+	}
+	sim_file *file = &shared->files[idx];
+	size_t count = (pos < SIM_FS_FILE_MAX) ? SIM_FS_FILE_MAX - pos : 0;
+	count = (count < len) ? count : len;
+
+	bool cut = shared->cut_armed && (shared->cut_writes-- == 0);
+	if (cut && (count > shared->cut_bytes))
+	{
+		count = shared->cut_bytes;
+	}
+	delayMicroseconds(SIM_FS_WRITE_US + (count + 3) / 4 * SIM_FS_WORD_US);
+	memcpy(&file->data[pos], buf, count);
+	pos += count;
+	if (pos > file->len)
+	{
+		file->len = pos;
+	}
+	shared->stats.fs_writes++;
+	shared->stats.fs_write_bytes += count;
+
+	if (cut)
+	{
+		shared->cut_armed = false;
+		shared->stats.power_cuts++;
+		fflush(stdout);
+		_exit(SIM_EXIT_RESET);
+	}
+	return count;
+}
+
+bool File::seek(uint32_t pos)
+{
+	if ((idx < 0) || (pos > shared->files[idx].len))
+	{
+		return false;
+	}
+	this->pos = pos;
+	return true;
+}
+
+uint32_t File::size()
+{
+	return (idx < 0) ? 0 : shared->files[idx].len;
+}
+
+bool File::truncate(uint32_t len)
+{
+	if ((idx < 0) || (mode != FILE_O_WRITE) || (len > shared->files[idx].len))
+	{
+		return false;
+	}
+	shared->files[idx].len = len;
+	return true;
+}
+
+bool Adafruit_LittleFS::exists(const char *name)
+{
+	return sim_file_find(name) >= 0;
+}
+
+bool Adafruit_LittleFS::remove(const char *name)
+{
+	delayMicroseconds(SIM_FS_REMOVE_US);
+	int slot = sim_file_find(name);
+	if (slot < 0)
+	{
+		return false;
+	}
+	memset(shared->files[slot].name, 0, sizeof(shared->files[slot].name));
+	shared->files[slot].len = 0;
+	return true;
+}
+
+File Adafruit_LittleFS::open(const char *name, uint8_t mode)
+{
+	File file(*this);
+	file.open(name, mode);
+	return file;
+}
+
+uint8_t *sim_fs_file(const char *name, uint32_t **len)
+{
+	int slot = sim_file_find(name);
+	if ((slot < 0) || (name[0] == 0))
+	{
+		return NULL;
+	}
+	*len = &shared->files[slot].len;
+	return shared->files[slot].data;
+}
+
+void sim_fs_cut(uint32_t writes, uint32_t bytes)
+{
+	shared->cut_armed = true;
+	shared->cut_writes = writes;
+	shared->cut_bytes = bytes;
+}
+
+/************************************************************************
+ * WisBlock-API
+ ************************************************************************/
+
+void api_wake_loop(uint16_t reason)
+{
+	g_task_event_type |= reason;
+}
+
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3)
+{
+	(void)sw_1;
+	(void)sw_2;
+	(void)sw_3;
+}
+
+void api_read_credentials(void)
+{
+	if (shared->credentials_valid)
+	{
+		g_lorawan_settings = shared->credentials;
+	}
+}
+
+void api_set_credentials(void)
+{
+	shared->credentials = g_lorawan_settings;
+	shared->credentials_valid = true;
+	shared->stats.credential_writes++;
+}
+
+void api_reset(void)
+{
+	shared->stats.resets++;
+	fflush(stdout);
+	_exit(SIM_EXIT_RESET);
+}
+
+static void api_send_timer_handler(void)
+{
+	api_wake_loop(STATUS);
+	TimerStart(&api_send_timer);
+}
+
+void api_timer_start(void)
+{
+	TimerSetValue(&api_send_timer, g_lorawan_settings.send_repeat_time);
+	TimerStart(&api_send_timer);
+}
+
+void api_timer_stop(void)
+{
+	TimerStop(&api_send_timer);
+}
+
+void api_timer_restart(uint32_t new_time)
+{
+	TimerStop(&api_send_timer);
+	TimerSetValue(&api_send_timer, new_time);
+	TimerStart(&api_send_timer);
+}
+
+void api_log_settings(void)
+{
+}
+
+float read_batt(void)
+{
+	return shared->batt_mv;
+}
+
+void sim_batt_mv(uint16_t mv)
+{
+	shared->batt_mv = mv;
+}
+
+void restart_advertising(uint16_t timeout)
+{
+	(void)timeout;
+}
+
+/**
+ * @brief Execute a USB AT command line like the API parser
+ *		  AT+CMD? shows the help, AT+CMD=? the value, AT+CMD=x executes.
+ */
+static void sim_at_line(char *line)
+{
+	if (strncasecmp(line, "AT", 2) != 0)
+	{
+		Serial.printf("+CME ERROR:%d\r\n", AT_ERR_NOT_SUPPORTED);
+		return;
+	}
+	char *name = &line[2];
+	if (*name == 0)
+	{
+		Serial.printf("OK\r\n");
+		return;
+	}
+
+	size_t name_len = strcspn(name, "=?");
+	atcmd_t *cmd = NULL;
+	for (uint8_t idx = 0; idx < g_user_at_cmd_num; idx++)
+	{
+		const char *cmd_name = g_user_at_cmd_list[idx].cmd_name;
+		if ((strlen(cmd_name) == name_len) && (strncasecmp(cmd_name, name, name_len) == 0))
+		{
+			cmd = &g_user_at_cmd_list[idx];
+			break;
+		}
+	}
+
+	int result = AT_ERR_NOT_SUPPORTED;
+	char *param = &name[name_len];
+	if (cmd == NULL)
+	{
+		// Commands of the API itself are not simulated
+	}
+	else if (param[0] == '?')
+	{
+		Serial.printf("AT%s:\"%s\"\r\n", cmd->cmd_name, cmd->cmd_desc);
+		result = 0;
+	}
+	else if ((param[0] == '=') && (param[1] == '?'))
+	{
+		if (cmd->query_cmd && ((result = cmd->query_cmd()) == 0))
+		{
+			Serial.printf("AT%s=%s\r\n", cmd->cmd_name, g_at_query_buf);
+		}
+	}
+	else if (param[0] == '=')
+	{
+		if (cmd->exec_cmd)
+		{
+			result = cmd->exec_cmd(&param[1]);
+		}
+	}
+	else if (cmd->exec_cmd_no_para)
+	{
+		result = cmd->exec_cmd_no_para();
+	}
+
+	if (result == 0)
+	{
+		Serial.printf("OK\r\n");
+	}
+	else
+	{
+		Serial.printf("+CME ERROR:%d\r\n", result);
+	}
+}
+
+void at_serial_input(uint8_t cmd)
+{
+	if ((cmd == '\r') || (cmd == '\n'))
+	{
+		if (usb_len)
+		{
+			usb_line[usb_len] = 0;
+			usb_len = 0;
+			sim_at_line(usb_line);
+		}
+		return;
+	}
+	if (usb_len < sizeof(usb_line) - 1)
+	{
+		usb_line[usb_len++] = cmd;
+	}
+}
+
+/************************************************************************
+ * LoRaWAN stack
+ ************************************************************************/
+
+/**
+ * @brief End of the receive windows of an uplink or a join
+ */
+static void radio_timer_handler(void)
+{
+	if (radio_joining)
+	{
+		radio_joining = false;
+		radio_joined = !radio_lost && shared->radio.join_ok;
+		g_join_result = radio_joined;
+		if (radio_joined)
+		{
+			shared->stats.joins++;
+			radio_dr = g_lorawan_settings.data_rate;
+			// The API starts the send timer once joined
+			if (g_lorawan_settings.send_repeat_time)
+			{
+				api_timer_start();
+			}
+		}
+		else
+		{
+			shared->stats.join_fails++;
+		}
+		api_wake_loop(LORA_JOIN_FIN);
+		return;
+	}
+
+	radio_busy = false;
+	if (!radio_lost && shared->downlink_count)
+	{
+		sim_frame *frame = &shared->downlinks[0];
+		memcpy(g_rx_lora_data, frame->data, frame->len);
+		g_rx_data_len = frame->len;
+		g_last_fport = frame->fport;
+		g_last_snr = shared->radio.snr;
+		g_last_rssi = -100;
+		shared->downlink_count--;
+		memmove(&shared->downlinks[0], &shared->downlinks[1], shared->downlink_count * sizeof(sim_frame));
+		shared->stats.downlinks++;
+		api_wake_loop(LORA_DATA);
+	}
+
+	if (radio_confirmed)
+	{
+		if (radio_lost)
+		{
+			shared->stats.naks++;
+		}
+		else
+		{
+			shared->stats.acks++;
+		}
+	}
+	g_rx_fin_result = !radio_confirmed || !radio_lost;
+	api_wake_loop(LORA_TX_FIN);
+}
+
+lmh_error_status lmh_join(void)
+{
+	if (radio_busy || radio_joining)
+	{
+		return LMH_BUSY;
+	}
+	radio_joined = false;
+	radio_joining = true;
+	radio_lost = (sim_random() % 1000) < shared->radio.loss_permille;
+
+	uint32_t toa = airtime_uplink_us(airtime_plan(), g_lorawan_settings.data_rate, SIM_JOIN_REQUEST_LEN - AIRTIME_LORAWAN_OVERHEAD);
+	shared->stats.airtime_us += toa;
+	TimerInit(&radio_timer, radio_timer_handler);
+	TimerSetValue(&radio_timer, (toa + SIM_JOIN_ACCEPT_DELAY_US + SIM_RX_WINDOW_US) / 1000);
+	TimerStart(&radio_timer);
+	return LMH_SUCCESS;
+}
+
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	(void)data;
+	(void)fport;
+	if (!radio_joined)
+	{
+		shared->stats.rejected++;
+		return LMH_ERROR;
+	}
+	if (radio_busy)
+	{
+		shared->stats.busy++;
+		return LMH_BUSY;
+	}
+	if (size > airtime_dr_max_len(airtime_plan(), radio_dr))
+	{
+		shared->stats.rejected++;
+		return LMH_ERROR;
+	}
+
+	uint32_t toa = airtime_uplink_us(airtime_plan(), radio_dr, size);
+	shared->stats.uplinks++;
+	shared->stats.uplink_bytes += size;
+	shared->stats.uplinks_dr[radio_dr & 7]++;
+	shared->stats.airtime_us += toa;
+
+	radio_busy = true;
+	radio_confirmed = g_lorawan_settings.confirmed_msg_enabled == LMH_CONFIRMED_MSG;
+	radio_lost = (sim_random() % 1000) < shared->radio.loss_permille;
+
+	// An acknowledge or a downlink ends the exchange in RX1
+	bool rx1 = !radio_lost && (radio_confirmed || shared->downlink_count);
+	uint32_t done_us = toa + (rx1 ? SIM_RX1_DELAY_US : SIM_RX2_DELAY_US) + SIM_RX_WINDOW_US;
+	TimerInit(&radio_timer, radio_timer_handler);
+	TimerSetValue(&radio_timer, done_us / 1000);
+	TimerStart(&radio_timer);
+	return LMH_SUCCESS;
+}
+
+lmh_error_status lmh_class_request(DeviceClass_t new_class)
+{
+	(void)new_class;
+	return LMH_SUCCESS;
+}
+
+void lmh_datarate_set(uint8_t data_rate, bool enable_adr)
+{
+	(void)enable_adr;
+	radio_dr = data_rate;
+}
+
+LoRaMacStatus_t LoRaMacMibSetRequestConfirm(MibRequestConfirm_t *mibSet)
+{
+	if (mibSet->Type == MIB_CHANNELS_DATARATE)
+	{
+		radio_dr = mibSet->Param.ChannelsDatarate;
+	}
+	return LORAMAC_STATUS_OK;
+}
+
+void sim_downlink(uint8_t fport, const uint8_t *data, uint8_t len)
+{
+	if (shared->downlink_count >= SIM_DOWNLINKS)
+	{
+		return;
+	}
+	sim_frame *frame = &shared->downlinks[shared->downlink_count++];
+	frame->fport = fport;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+}
+
+sim_radio *sim_radio_model(void)
+{
+	return &shared->radio;
+}
+
+/************************************************************************
+ * Main loop
+ ************************************************************************/
+
+/**
+ * @brief Call a handler and add its host and virtual time to the counters
+ */
+static void sim_call(uint8_t handler, void (*func)(void))
+{
+	sim_handler_stats *stats = &shared->stats.handlers[handler];
+	uint64_t virt_start = shared->now_us;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	func();
+	uint64_t host_ns =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	stats->calls++;
+	stats->host_ns += host_ns;
+	if (host_ns > stats->host_max_ns)
+	{
+		stats->host_max_ns = host_ns;
+	}
+	if (shared->now_us - virt_start > stats->virt_max_us)
+	{
+		stats->virt_max_us = shared->now_us - virt_start;
+	}
+}
+
+/**
+ * @brief Execute the USB AT lines received
+ */
+static void sim_usb_handler(void)
+{
+	while (Serial.available() > 0)
+	{
+		int chr = Serial.read();
+		at_serial_input(chr);
+		if ((chr == '\n') || (chr == '\r'))
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Handle the raised events until none is left
+ */
+static void sim_dispatch(void)
+{
+	while (Serial.available() > 0)
+	{
+		sim_call(SIM_H_USB, sim_usb_handler);
+	}
+
+	for (uint8_t round = 0; g_task_event_type != NO_EVENT; round++)
+	{
+		if (round == SIM_MAX_ROUNDS)
+		{
+			fprintf(stderr, "sim: events %04X not handled\n", g_task_event_type);
+			shared->stats.stuck_events++;
+			g_task_event_type = NO_EVENT;
+			break;
+		}
+		if (g_task_event_type & SIM_LORA_EVENTS)
+		{
+			sim_call(SIM_H_LORA, lora_data_handler);
+		}
+		if ((g_task_event_type & BLE_DATA) && ble_data_handler)
+		{
+			sim_call(SIM_H_BLE, ble_data_handler);
+		}
+		if (g_task_event_type & ~SIM_API_EVENTS)
+		{
+			sim_call(SIM_H_APP, app_event_handler);
+		}
+	}
+}
+
+void sim_run_for(uint32_t ms)
+{
+	uint64_t end_us = shared->now_us + (uint64_t)ms * 1000;
+	sim_dispatch();
+
+	TimerEvent_t *timer;
+	while (((timer = sim_next_timer()) != NULL) && (timer->due_us <= end_us))
+	{
+		sim_advance(timer->due_us);
+		sim_dispatch();
+	}
+	sim_advance(end_us);
+	sim_dispatch();
+}
+
+void sim_boot(void)
+{
+	shared->stats.boots++;
+	shared->boot_us = shared->now_us;
+	relay_since_us = shared->now_us;
+	TimerInit(&api_send_timer, api_send_timer_handler);
+
+	setup_app();
+	init_app();
+	if (g_lorawan_settings.lorawan_enable && g_lorawan_settings.auto_join)
+	{
+		lmh_join();
+	}
+	sim_dispatch();
+}
+
+sim_stats *sim_get_stats(void)
+{
+	sim_relay_update();
+	return &shared->stats;
+}
+
+uint64_t sim_relay_on_ms(void)
+{
+	uint64_t on_us = 0;
+	for (uint8_t pin = 0; pin < 16; pin++)
+	{
+		on_us += sim_get_stats()->relay_on_us[pin];
+	}
+	return on_us / 1000;
+}
+
+int sim_fork(int (*run)(void))
+{
+	if (shared == NULL)
+	{
+		shared = (sim_shared *)mmap(NULL, sizeof(sim_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (shared == MAP_FAILED)
+		{
+			perror("mmap");
+			exit(1);
+		}
+	}
+	new (shared) sim_shared();
+	shared->rng = 0x2545F491;
+	shared->batt_mv = 4000;
+	shared->radio.join_ok = true;
+	shared->radio.snr = 5;
+	sim_expander_reset();
+
+	for (uint8_t boot = 0; boot < SIM_MAX_BOOTS; boot++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0)
+		{
+			int status = run();
+			fflush(stdout);
+			_exit(status);
+		}
+
+		int status;
+		if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status))
+		{
+			fprintf(stderr, "sim: child crashed\n");
+			return 1;
+		}
+		if (WEXITSTATUS(status) != SIM_EXIT_RESET)
+		{
+			return WEXITSTATUS(status);
+		}
+	}
+	fprintf(stderr, "sim: more than %d resets\n", SIM_MAX_BOOTS);
+	return 1;
+}
@@ -0,0 +1,185 @@
+#ifndef SIM_H
+#define SIM_H
+
+/**
+ * Host simulation of the valve controller board.
+ *
+ * The firmware sources are built unchanged against the stand-ins in stubs/:
+ * the Arduino core, the WisBlock-API with a LoRaWAN radio model, the
+ * MCP23017 of the RAK13003 behind Wire and LittleFS on the internal flash.
+ *
+ * Time is virtual. millis() and micros() only move when the simulation runs
+ * to the next timer, or when a handler calls delay(). The main loop calls
+ * the handlers for the raised events like the WisBlock-API does.
+ *
+ * Every run is a child process that starts from the power on state of the
+ * firmware, see sim_fork(). The flash, the virtual time, the radio model and
+ * the counters are kept in memory shared with the parent, so api_reset()
+ * boots a new child that finds the files of the one before.
+ */
+
+#include <WisBlock-API.h>
+
+/** Handlers timed by the simulation */
+#define SIM_H_APP 0	 // app_event_handler()
+#define SIM_H_LORA 1 // lora_data_handler()
+#define SIM_H_BLE 2	 // ble_data_handler()
+#define SIM_H_USB 3	 // at_serial_input() of a USB line
+#define SIM_H_COUNT 4
+
+/** Simulated flash, files of the internal LittleFS */
+#define SIM_FS_FILES 8
+#define SIM_FS_FILE_MAX 8192
+
+/** Time the LittleFS calls take on the internal flash of the nRF52840, rough values */
+#define SIM_FS_OPEN_US 300	 // directory lookup
+#define SIM_FS_READ_US 20	 // per read call
+#define SIM_FS_WRITE_US 50	 // per write call, plus the word writes
+#define SIM_FS_WORD_US 41	 // program one 32 bit word
+#define SIM_FS_REMOVE_US 500 // directory update
+
+/** Children started for one sim_fork(), a reset loop fails the run */
+#define SIM_MAX_BOOTS 32
+
+/** Time spent in a handler */
+struct sim_handler_stats
+{
+	uint32_t calls;
+	uint64_t host_ns;	  // host time of all calls
+	uint64_t host_max_ns; // longest call in host time
+	uint64_t virt_max_us; // longest call in virtual time, delay() inside the handler
+};
+
+/** Radio model, may be changed at any time */
+struct sim_radio
+{
+	uint16_t loss_permille; // uplinks lost, with their acknowledge and downlink
+	bool join_ok;			// the network accepts the join request
+	int8_t snr;				// SNR of the downlinks
+};
+
+/** Counters since the start of sim_fork(), kept across resets */
+struct sim_stats
+{
+	uint32_t boots;
+	uint32_t resets; // api_reset() calls
+	uint32_t uplinks;
+	uint32_t uplink_bytes;
+	uint32_t uplinks_dr[8];
+	uint64_t airtime_us;
+	uint32_t acks; // confirmed uplinks acknowledged
+	uint32_t naks; // confirmed uplinks not acknowledged
+	uint32_t busy; // send_lora_packet() while a frame was on air
+	uint32_t rejected; // send_lora_packet() not joined or too long for the data rate
+	uint32_t joins;
+	uint32_t join_fails;
+	uint32_t downlinks;
+	uint32_t i2c_transactions;
+	uint32_t relay_pulses;		// expander outputs raised
+	uint64_t relay_on_us[16];	// time each expander pin was driven HIGH
+	uint32_t fs_writes;			// File::write() calls
+	uint32_t fs_write_bytes;
+	uint32_t credential_writes; // api_set_credentials() calls
+	uint32_t power_cuts;		// resets by sim_fs_cut()
+	uint32_t stuck_events;		// event bits left set by all handlers
+	sim_handler_stats handlers[SIM_H_COUNT];
+};
+
+/**
+ * @brief Run a simulation in a child process with the power on state of the firmware
+ *		  The flash is empty and the virtual time starts at 0. When the child
+ *		  calls api_reset() a new child runs the function again.
+ *
+ * @param run simulation, calls sim_boot() first, returns the exit status
+ * @return int exit status of the last child, 0 on success
+ */
+int sim_fork(int (*run)(void));
+
+/**
+ * @brief Start the firmware like the WisBlock-API: setup_app(), init_app() and the join
+ */
+void sim_boot(void);
+
+/**
+ * @brief Run the main loop, fire the timers and call the handlers of the raised events
+ *
+ * @param ms virtual time to run
+ */
+void sim_run_for(uint32_t ms);
+
+/**
+ * @brief Virtual time since sim_fork(), continues across resets
+ */
+uint64_t sim_now_us(void);
+
+/**
+ * @brief Send an AT command line over the USB serial, the reply is in Serial.tx
+ */
+void sim_usb_at(const char *line);
+
+/**
+ * @brief Write data from a BLE UART client, the reply is in g_ble_uart.tx
+ */
+void sim_ble_send(const char *data);
+
+/**
+ * @brief Queue a downlink, it is received in the RX window of the next uplink that is not lost
+ */
+void sim_downlink(uint8_t fport, const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Raise the interrupt attached to an MCU pin
+ */
+void sim_pin_interrupt(uint32_t pin);
+
+/**
+ * @brief Drive the expander inputs, a change of an enabled input raises the expander interrupt
+ *
+ * @param mask pins to change
+ * @param levels new levels of the pins in mask
+ */
+void sim_expander_input(uint16_t mask, uint16_t levels);
+
+/**
+ * @brief Expander pins that are outputs and driven HIGH
+ */
+uint16_t sim_expander_outputs(void);
+
+/**
+ * @brief Contents of a file of the simulated flash, to inspect or damage it
+ *
+ * @param name file name
+ * @param len set to the file length, may be lowered to cut the file
+ * @return uint8_t* file data or NULL if the file does not exist
+ */
+uint8_t *sim_fs_file(const char *name, uint32_t **len);
+
+/**
+ * @brief Lose the power during a later write, the node boots again
+ *
+ * @param writes File::write() calls that still complete
+ * @param bytes bytes of the next write that reach the flash
+ */
+void sim_fs_cut(uint32_t writes, uint32_t bytes);
+
+/**
+ * @brief Set the battery voltage read by read_batt()
+ */
+void sim_batt_mv(uint16_t mv);
+
+/**
+ * @brief Radio model of the current run
+ */
+sim_radio *sim_radio_model(void);
+
+/**
+ * @brief Counters of the current run, relay on times up to now
+ */
+sim_stats *sim_get_stats(void);
+
+/**
+ * @brief Time any relay was powered, the sum over all expander outputs
+ */
+uint64_t sim_relay_on_ms(void);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef ADAFRUIT_LITTLEFS_H
+#define ADAFRUIT_LITTLEFS_H
+
+/**
+ * Host stand-in for LittleFS on the internal flash. The files are kept in
+ * memory that survives a simulated reset, see sim.h.
+ */
+
+#include <Arduino.h>
+
+namespace Adafruit_LittleFS_Namespace
+{
+#define FILE_O_READ 0
+#define FILE_O_WRITE 1
+
+class Adafruit_LittleFS;
+
+class File
+{
+public:
+	File(Adafruit_LittleFS &fs) : fs(&fs) {}
+	bool open(const char *name, uint8_t mode);
+	size_t read(void *buf, size_t len);
+	int read(void);
+	size_t write(const uint8_t *buf, size_t len);
+	size_t write(uint8_t data) { return write(&data, 1); }
+	bool seek(uint32_t pos);
+	uint32_t position() { return pos; }
+	uint32_t size();
+	bool truncate(uint32_t len);
+	void flush() {}
+	void close() { idx = -1; }
+	operator bool() { return idx >= 0; }
+
+private:
+	Adafruit_LittleFS *fs;
+	int idx = -1; // open file in the simulated flash, -1 if closed
+	uint32_t pos = 0;
+	uint8_t mode = FILE_O_READ;
+};
+
+class Adafruit_LittleFS
+{
+public:
+	bool begin() { return true; }
+	bool exists(const char *name);
+	bool remove(const char *name);
+	File open(const char *name, uint8_t mode);
+};
+} // namespace Adafruit_LittleFS_Namespace
+
+#endif
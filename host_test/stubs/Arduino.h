@@ -0,0 +1,89 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/**
+ * Host stand-in for the parts of the Arduino core the firmware uses.
+ * Time is virtual, see sim.h. Pins only keep their level, interrupts are
+ * raised by the simulation with sim_pin_interrupt().
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+/** WisBlock RAK4631 pin numbers */
+#define LED_GREEN 35
+#define LED_BLUE 36
+#define WB_IO1 17
+#define WB_IO2 34
+#define WB_IO3 21
+#define WB_IO4 4
+#define WB_IO5 9
+#define WB_IO6 10
+#define WB_A0 5
+
+/** Pins of the simulated board */
+#define SIM_PINS 48
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t level);
+int digitalRead(uint32_t pin);
+int analogRead(uint32_t pin);
+void attachInterrupt(uint32_t irq, void (*isr)(void), int mode);
+void detachInterrupt(uint32_t irq);
+inline uint32_t digitalPinToInterrupt(uint32_t pin) { return pin; }
+
+/** The simulation runs the interrupts in the same thread */
+inline void noInterrupts(void) {}
+inline void interrupts(void) {}
+
+/**
+ * Byte stream of the USB serial and the BLE UART
+ * Received bytes are queued by the simulation, sent text is collected in tx.
+ */
+class Stream
+{
+public:
+	std::string rx;
+	size_t rx_pos = 0;
+	std::string tx;
+	bool echo = false; // copy sent text to stdout
+
+	void begin(unsigned long) {}
+	operator bool() { return true; }
+	int available();
+	int read();
+	size_t read(uint8_t *buf, size_t len);
+	size_t write(const uint8_t *buf, size_t len);
+	size_t write(uint8_t chr) { return write(&chr, 1); }
+	int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+	size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+	size_t println(const char *text) { return print(text) + print("\r\n"); }
+	void flush() {}
+};
+
+extern Stream Serial;
+
+#endif
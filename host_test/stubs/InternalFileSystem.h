@@ -0,0 +1,12 @@
+#ifndef INTERNALFILESYSTEM_H
+#define INTERNALFILESYSTEM_H
+
+#include <Adafruit_LittleFS.h>
+
+class InternalFileSystem : public Adafruit_LittleFS_Namespace::Adafruit_LittleFS
+{
+};
+
+extern InternalFileSystem InternalFS;
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+/**
+ * Host stand-in for the I2C bus, the only device is the simulated MCP23017
+ * of the RAK13003 at EXPANDER_ADDR, see sim.cpp.
+ */
+
+#include <Arduino.h>
+
+class TwoWire
+{
+public:
+	void begin() {}
+	void setClock(uint32_t) {}
+	void beginTransmission(uint8_t addr);
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *data, size_t len);
+	uint8_t endTransmission(bool stop = true);
+	uint8_t requestFrom(uint8_t addr, uint8_t len);
+	int available();
+	int read();
+
+private:
+	uint8_t addr = 0;
+	uint8_t tx_buf[32];
+	uint8_t tx_len = 0;
+	uint8_t rx_buf[32];
+	uint8_t rx_len = 0;
+	uint8_t rx_pos = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef WISBLOCK_API_H
+#define WISBLOCK_API_H
+
+/**
+ * Host stand-in for the WisBlock-API and the LoRaWAN stack below it.
+ *
+ * The API main loop, its timers, the USB AT parser and a LoRaWAN radio
+ * model are implemented by the simulation in sim.cpp, with the same event
+ * bits and callbacks as on the device.
+ */
+
+#include <Arduino.h>
+
+#define PRINTF(...) Serial.printf(__VA_ARGS__)
+
+/** Timer of the LoRaWAN stack, one shot */
+typedef struct TimerEvent_s
+{
+	uint32_t ReloadValue; // ms
+	bool IsRunning;
+	void (*Callback)(void);
+	uint64_t due_us; // virtual time the timer fires
+} TimerEvent_t;
+
+void TimerInit(TimerEvent_t *obj, void (*callback)(void));
+void TimerSetValue(TimerEvent_t *obj, uint32_t value);
+void TimerStart(TimerEvent_t *obj);
+void TimerStop(TimerEvent_t *obj);
+
+/** Events of the API main loop */
+extern volatile uint16_t g_task_event_type;
+#define NO_EVENT 0
+#define STATUS 0b0000000000000001
+#define N_STATUS 0b1111111111111110
+#define BLE_CONFIG 0b0000000000000010
+#define N_BLE_CONFIG 0b1111111111111101
+#define BLE_DATA 0b0000000000000100
+#define N_BLE_DATA 0b1111111111111011
+#define LORA_DATA 0b0000000000001000
+#define N_LORA_DATA 0b1111111111110111
+#define LORA_TX_FIN 0b0000000000010000
+#define N_LORA_TX_FIN 0b1111111111101111
+#define AT_CMD 0b0000000000100000
+#define N_AT_CMD 0b1111111111011111
+#define LORA_JOIN_FIN 0b0000000001000000
+#define N_LORA_JOIN_FIN 0b1111111110111111
+
+void api_wake_loop(uint16_t reason);
+void api_set_version(uint16_t sw_1, uint16_t sw_2, uint16_t sw_3);
+void api_read_credentials(void);
+void api_set_credentials(void);
+void api_reset(void) __attribute__((noreturn));
+void api_timer_start(void);
+void api_timer_stop(void);
+void api_timer_restart(uint32_t new_time);
+void api_log_settings(void);
+float read_batt(void);
+void restart_advertising(uint16_t timeout);
+
+/** Application callbacks */
+void setup_app(void);
+bool init_app(void);
+void app_event_handler(void);
+void ble_data_handler(void) __attribute__((weak));
+void lora_data_handler(void);
+
+typedef enum
+{
+	LMH_SUCCESS = 0,
+	LMH_BUSY = -1,
+	LMH_ERROR = -2
+} lmh_error_status;
+
+typedef enum
+{
+	LMH_UNCONFIRMED_MSG = 0,
+	LMH_CONFIRMED_MSG = 1
+} lmh_confirm;
+
+typedef enum
+{
+	CLASS_A,
+	CLASS_B,
+	CLASS_C
+} DeviceClass_t;
+
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport = 0);
+lmh_error_status lmh_class_request(DeviceClass_t new_class);
+void lmh_datarate_set(uint8_t data_rate, bool enable_adr);
+lmh_error_status lmh_join(void);
+
+enum
+{
+	DR_0,
+	DR_1,
+	DR_2,
+	DR_3,
+	DR_4,
+	DR_5,
+	DR_6,
+	DR_7
+};
+
+enum
+{
+	TX_POWER_0,
+	TX_POWER_1,
+	TX_POWER_2,
+	TX_POWER_3,
+	TX_POWER_4,
+	TX_POWER_5,
+	TX_POWER_6,
+	TX_POWER_7,
+	TX_POWER_8,
+	TX_POWER_9,
+	TX_POWER_10
+};
+
+typedef enum
+{
+	LORAMAC_REGION_AS923,
+	LORAMAC_REGION_AU915,
+	LORAMAC_REGION_CN470,
+	LORAMAC_REGION_CN779,
+	LORAMAC_REGION_EU433,
+	LORAMAC_REGION_EU868,
+	LORAMAC_REGION_KR920,
+	LORAMAC_REGION_IN865,
+	LORAMAC_REGION_US915
+} LoRaMacRegion_t;
+
+#define LORAWAN_APP_PORT 2
+
+/** Settings stored in flash, same layout as the API */
+struct s_lorawan_settings
+{
+	uint8_t valid_mark_1 = 0xAA;
+	uint8_t valid_mark_2 = 0x55;
+	uint8_t node_device_eui[8] = {0};
+	uint8_t node_app_eui[8] = {0};
+	uint8_t node_app_key[16] = {0};
+	uint32_t node_dev_addr = 0;
+	uint8_t node_nws_key[16] = {0};
+	uint8_t node_apps_key[16] = {0};
+	bool otaa_enabled = true;
+	bool adr_enabled = false;
+	bool public_network = true;
+	bool duty_cycle_enabled = false;
+	uint32_t send_repeat_time = 0;
+	uint8_t join_trials = 5;
+	uint8_t tx_power = 0;
+	uint8_t data_rate = 3;
+	uint8_t lora_class = 0;
+	uint8_t subband_channels = 1;
+	bool auto_join = false;
+	uint8_t app_port = 2;
+	lmh_confirm confirmed_msg_enabled = LMH_UNCONFIRMED_MSG;
+	bool resetRequest = true;
+	LoRaMacRegion_t lora_region = LORAMAC_REGION_US915;
+	bool lorawan_enable = true;
+};
+
+extern s_lorawan_settings g_lorawan_settings;
+extern bool g_join_result;
+extern bool g_rx_fin_result;
+extern uint8_t g_rx_lora_data[256];
+extern uint8_t g_rx_data_len;
+extern uint8_t g_last_fport;
+extern int16_t g_last_rssi;
+extern int8_t g_last_snr;
+
+extern bool g_enable_ble;
+extern bool g_ble_uart_is_connected;
+class BLEUart : public Stream
+{
+};
+extern BLEUart g_ble_uart;
+extern char g_ble_dev_name[10];
+
+/** User AT commands, searched by at_serial_input() */
+typedef struct atcmd_s
+{
+	const char *cmd_name;
+	const char *cmd_desc;
+	int (*query_cmd)(void);
+	int (*exec_cmd)(char *str);
+	int (*exec_cmd_no_para)(void);
+} atcmd_t;
+
+#define ATQUERY_SIZE 128
+extern char g_at_query_buf[ATQUERY_SIZE];
+extern atcmd_t *g_user_at_cmd_list;
+extern uint8_t g_user_at_cmd_num;
+void at_serial_input(uint8_t cmd);
+
+/** MAC information base requests used by the link adaptation */
+typedef enum
+{
+	MIB_CHANNELS_DATARATE = 20,
+	MIB_CHANNELS_TX_POWER = 22
+} Mib_t;
+
+typedef union
+{
+	int8_t ChannelsDatarate;
+	int8_t ChannelsTxPower;
+} MibParam_t;
+
+typedef struct
+{
+	Mib_t Type;
+	MibParam_t Param;
+} MibRequestConfirm_t;
+
+typedef enum
+{
+	LORAMAC_STATUS_OK = 0,
+	LORAMAC_STATUS_PARAMETER_INVALID = 3
+} LoRaMacStatus_t;
+
+LoRaMacStatus_t LoRaMacMibSetRequestConfirm(MibRequestConfirm_t *mibSet);
+
+#endif
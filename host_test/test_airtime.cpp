@@ -0,0 +1,95 @@
+#include "check.h"
+#include "app.h"
+
+/**
+ * Data rate tables of the channel plans against each other and the region
+ * mapping of airtime_plan(). Regions without a plan of their own use the
+ * layout of EU868, AU915 has the SF12 .. SF7 data rates of EU868 and the
+ * SF8 at 500 kHz of US915.
+ */
+
+/**
+ * @brief Check that two data rates have the same modulation and time on air
+ */
+static void same_rate(uint8_t plan_a, uint8_t dr_a, uint8_t plan_b, uint8_t dr_b)
+{
+	CHECK_EQ(airtime_dr_sf(plan_a, dr_a), airtime_dr_sf(plan_b, dr_b));
+	CHECK_EQ(airtime_dr_bw(plan_a, dr_a), airtime_dr_bw(plan_b, dr_b));
+	for (uint16_t len = 0; len <= 242; len++)
+	{
+		CHECK_EQ(airtime_uplink_us(plan_a, dr_a, len), airtime_uplink_us(plan_b, dr_b, len));
+	}
+}
+
+/**
+ * @brief US915 DR4 is SF8 at 500 kHz, shorter than DR3 for every length
+ */
+static void test_us915(void)
+{
+	CHECK_EQ(airtime_dr_sf(AIRTIME_PLAN_US915, 4), 8);
+	CHECK_EQ(airtime_dr_bw(AIRTIME_PLAN_US915, 4), 500);
+	CHECK_EQ(airtime_dr_max_len(AIRTIME_PLAN_US915, 0), 11);
+	CHECK_EQ(airtime_dr_max_len(AIRTIME_PLAN_US915, 4), 242);
+	// Semtech calculator: SF8, 500 kHz, 24 bytes, CR 4/5, 8 symbol preamble, CRC on
+	CHECK_EQ(airtime_uplink_us(AIRTIME_PLAN_US915, 4, 11), 28288);
+	for (uint8_t dr = 0; dr < 4; dr++)
+	{
+		CHECK(airtime_uplink_us(AIRTIME_PLAN_US915, dr + 1, 11) < airtime_uplink_us(AIRTIME_PLAN_US915, dr, 11));
+	}
+}
+
+/**
+ * @brief AU915 is EU868 up to DR5 and US915 DR4 at DR6
+ */
+static void test_au915(void)
+{
+	for (uint8_t dr = 0; dr <= 5; dr++)
+	{
+		same_rate(AIRTIME_PLAN_AU915, dr, AIRTIME_PLAN_EU868, dr);
+	}
+	same_rate(AIRTIME_PLAN_AU915, 6, AIRTIME_PLAN_US915, 4);
+	// SF12 with low data rate optimization, not the SF10 of US915 DR0
+	CHECK_EQ(airtime_uplink_us(AIRTIME_PLAN_AU915, 0, 2), 1155072);
+	CHECK_EQ(airtime_dr_max_len(AIRTIME_PLAN_AU915, 0), 51);
+	CHECK_EQ(airtime_dr_max_len(AIRTIME_PLAN_AU915, 6), 242);
+}
+
+/**
+ * @brief The configured region selects the plan, the others fall back to EU868
+ */
+static void test_region_plan(void)
+{
+	static const struct
+	{
+		LoRaMacRegion_t region;
+		uint8_t plan;
+	} regions[] = {
+		{LORAMAC_REGION_US915, AIRTIME_PLAN_US915}, {LORAMAC_REGION_AU915, AIRTIME_PLAN_AU915},
+		{LORAMAC_REGION_EU868, AIRTIME_PLAN_EU868}, {LORAMAC_REGION_AS923, AIRTIME_PLAN_EU868},
+		{LORAMAC_REGION_KR920, AIRTIME_PLAN_EU868}, {LORAMAC_REGION_IN865, AIRTIME_PLAN_EU868},
+		{LORAMAC_REGION_CN470, AIRTIME_PLAN_EU868}, {LORAMAC_REGION_EU433, AIRTIME_PLAN_EU868},
+	};
+	for (uint8_t idx = 0; idx < sizeof(regions) / sizeof(regions[0]); idx++)
+	{
+		g_lorawan_settings.lora_region = regions[idx].region;
+		CHECK_EQ(airtime_plan(), regions[idx].plan);
+	}
+
+	// AS923 DR2 is SF10 at 125 kHz like EU868
+	g_lorawan_settings.lora_region = LORAMAC_REGION_AS923;
+	g_lorawan_settings.data_rate = DR_2;
+	CHECK_EQ(airtime_uplink_ms(11), (airtime_uplink_us(AIRTIME_PLAN_EU868, 2, 11) + 999) / 1000);
+	CHECK_EQ(airtime_max_len(), 51);
+
+	g_lorawan_settings.lora_region = LORAMAC_REGION_AU915;
+	g_lorawan_settings.data_rate = DR_6;
+	CHECK_EQ(airtime_uplink_ms(11), 29);
+}
+
+int main()
+{
+	test_us915();
+	test_au915();
+	test_region_plan();
+	return check_result("test_airtime");
+}
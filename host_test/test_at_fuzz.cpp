@@ -0,0 +1,382 @@
+#include <time.h>
+
+#include "check.h"
+#include "sim.h"
+#include "app.h"
+
+/**
+ * Malformed AT command lines against the argument parser and the direct
+ * dispatch of BLE and LoRa commands. A seed corpus is mutated with a fixed
+ * random sequence, so a failure repeats. The parser is checked against the
+ * rules of at_parse_args(), every dispatched line has to be answered once.
+ * Ends with the time of the name lookup plus the argument parse per line.
+ */
+
+/** Mutated inputs per loop */
+#define FUZZ_PARSE_RUNS 200000
+#define FUZZ_DISPATCH_RUNS 20000
+
+/** Lines of the timing loop */
+#define TIMING_RUNS 1000000
+
+/** Argument schemas like the firmware commands */
+static constexpr at_arg_s args_valve[] = {{0, 7, 8, AT_ARG_LEAD}, {0, 1, 0, AT_ARG_REQ}, {1, 60, 9, AT_ARG_TRAIL}};
+static constexpr at_arg_s args_time[] = {{1577836800UL, 4102444799UL, 0, AT_ARG_REQ}};
+static constexpr at_arg_s args_sched[] = {{0, 7, 0, AT_ARG_REQ},
+										  {0, 127, 0, AT_ARG_REQ},
+										  {0, 2359, 0, AT_ARG_REQ},
+										  {0, 86400, 0, AT_ARG_REQ},
+										  {0, 7, 0, AT_ARG_TRAIL}};
+
+static const struct
+{
+	const at_arg_s *schema;
+	uint8_t num;
+} schemas[] = {{args_valve, 3}, {args_time, 1}, {args_sched, 5}};
+
+/** Argument strings, valid and malformed */
+static const char *const arg_seeds[] = {
+	"1", "0:1", "7:1:60", "1:30", "1767225600", "0:127:600:900", "1:127:1900:600:3", "", ":", "::", "1:", ":1", "1::1",
+	"x", "1x", "0x1", "-1", "+1", " 1", "1 ", "1.5", "1e3", "4294967295", "4294967296", "99999999999999999999",
+	"00000000000000000001", "8:1", "1:2:61", "1:1:1:1", "1:1:1:1:1:1:1:1:1", "\xff", "1\t", "1;2",
+};
+
+/** Command lines, valid and malformed, AT+REBOOT is left out */
+static const char *const line_seeds[] = {
+	"AT", "at", "AT+VLVS=?", "AT+VLVS?", "AT+vlvo=8", "AT+VLVO=0:9", "AT+VLVI=1:120", "AT+VLVI=", "AT+VLVI=?",
+	"AT+VLVZ=0:1", "AT+UPLINK", "AT+UPLINK=30", "AT+TIME=1767225600", "AT+SCHED=0:127:0600:900", "AT+SCHED=?",
+	"AT+HIST=?", "AT+LOG=0", "AT+FLOWMAX=300", "AT+AIR=?", "AT+JRNL=?", "AT+EVQ=?", "AT+ACT=?", "AT+LAT=0",
+	"AT+", "AT+=", "AT+?", "AT=", "AT?", "AT+VLV", "AT+VLVSS=?", "AT+VLVS=??", "AT+VLVO=:", "AT+VLVO=99999999999",
+	"AT+VLVI=1:2:3:4:5:6:7:8:9", "AT+NWM=1", "AT+DEVEUI=?", "ATZ", "A", "T+VLVS=?", "XT+VLVS=?", "AT+VLVS=\xff",
+};
+
+/** Characters that are likely to reach new paths */
+static const char mutate_chars[] = "0123456789:=?+ATVLSIOat \xff";
+
+/**
+ * @brief Fixed random sequence, xorshift32
+ */
+static uint32_t fuzz_random(void)
+{
+	static uint32_t state = 0x2545F491;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/**
+ * @brief Apply a few random edits, the result is NUL terminated and has no line end
+ *
+ * @param str string to change in place
+ * @param max buffer size
+ * @param splice another seed to take a piece from
+ */
+static void mutate(char *str, size_t max, const char *splice)
+{
+	size_t len = strlen(str);
+	uint8_t edits = 1 + fuzz_random() % 4;
+	for (uint8_t edit = 0; edit < edits; edit++)
+	{
+		size_t pos = len ? fuzz_random() % (len + 1) : 0;
+		switch (fuzz_random() % 6)
+		{
+		case 0: // Replace a character
+			if (pos < len)
+			{
+				str[pos] = mutate_chars[fuzz_random() % (sizeof(mutate_chars) - 1)];
+			}
+			break;
+		case 1: // Insert a character
+			if (len + 1 < max)
+			{
+				memmove(&str[pos + 1], &str[pos], len - pos + 1);
+				str[pos] = mutate_chars[fuzz_random() % (sizeof(mutate_chars) - 1)];
+				len++;
+			}
+			break;
+		case 2: // Delete a character
+			if (pos < len)
+			{
+				memmove(&str[pos], &str[pos + 1], len - pos);
+				len--;
+			}
+			break;
+		case 3: // Cut the end
+			str[pos] = 0;
+			len = pos;
+			break;
+		case 4: // Repeat the end
+			for (size_t idx = pos; (idx < len) && (len + 1 < max); idx++)
+			{
+				str[len++] = str[idx];
+			}
+			str[len] = 0;
+			break;
+		default: // Append the end of another seed
+		{
+			size_t other = strlen(splice);
+			size_t from = other ? fuzz_random() % other : 0;
+			for (size_t idx = from; (idx < other) && (pos + 1 < max); idx++)
+			{
+				str[pos++] = splice[idx];
+			}
+			str[pos] = 0;
+			len = pos;
+			break;
+		}
+		}
+	}
+}
+
+/**
+ * @brief Split an argument string like the rules of at_parse_args()
+ *
+ * @return int number of values, -1 if a value is not a decimal number that fits 32 bits
+ */
+static int split_args(const char *str, uint32_t *values, uint8_t max)
+{
+	int count = 0;
+	while (true)
+	{
+		uint64_t value = 0;
+		const char *start = str;
+		while ((*str >= '0') && (*str <= '9'))
+		{
+			value = value * 10 + (*str++ - '0');
+			if (value > UINT32_MAX)
+			{
+				return -1;
+			}
+		}
+		if (str == start)
+		{
+			return -1;
+		}
+		if (count < max)
+		{
+			values[count] = value;
+		}
+		count++;
+		if (*str == 0)
+		{
+			return count;
+		}
+		if (*str++ != ':')
+		{
+			return -1;
+		}
+	}
+}
+
+/**
+ * @brief Check one argument string against a schema
+ */
+static void check_parse(const char *str, const at_arg_s *schema, uint8_t num)
+{
+	uint32_t values[AT_ARGS_MAX];
+	uint32_t given[AT_ARGS_MAX];
+	int result = at_parse_args(str, schema, num, values);
+	int count = split_args(str, given, AT_ARGS_MAX);
+
+	bool ok = true;
+	if ((result != 0) && (result != AT_ERR_PARAM))
+	{
+		ok = false;
+	}
+	else if (result == 0)
+	{
+		// Only well formed values, all within range or left out
+		ok = (count > 0) && (count <= num);
+		for (uint8_t idx = 0; ok && (idx < num); idx++)
+		{
+			bool in_range = (values[idx] >= schema[idx].min) && (values[idx] <= schema[idx].max);
+			ok = in_range || ((schema[idx].flags != AT_ARG_REQ) && (values[idx] == schema[idx].def));
+		}
+	}
+	else if (count == num)
+	{
+		// Every value given and in range has to be accepted
+		bool in_range = true;
+		for (uint8_t idx = 0; idx < num; idx++)
+		{
+			in_range = in_range && (given[idx] >= schema[idx].min) && (given[idx] <= schema[idx].max);
+		}
+		ok = !in_range;
+	}
+	if ((result == 0) && (count == num))
+	{
+		ok = ok && (memcmp(values, given, num * sizeof(values[0])) == 0);
+	}
+
+	if (!ok)
+	{
+		printf("at_parse_args(\"%s\") = %d, %d values\n", str, result, count);
+		check_failed++;
+	}
+}
+
+/**
+ * @brief The seeds and their mutations against every schema
+ */
+static void test_parse(void)
+{
+	const uint8_t num_seeds = sizeof(arg_seeds) / sizeof(arg_seeds[0]);
+	char str[64];
+
+	for (uint8_t seed = 0; seed < num_seeds; seed++)
+	{
+		for (uint8_t idx = 0; idx < sizeof(schemas) / sizeof(schemas[0]); idx++)
+		{
+			check_parse(arg_seeds[seed], schemas[idx].schema, schemas[idx].num);
+		}
+	}
+
+	for (uint32_t run = 0; (run < FUZZ_PARSE_RUNS) && !check_failed; run++)
+	{
+		snprintf(str, sizeof(str), "%s", arg_seeds[fuzz_random() % num_seeds]);
+		mutate(str, sizeof(str), arg_seeds[fuzz_random() % num_seeds]);
+		uint8_t idx = fuzz_random() % (sizeof(schemas) / sizeof(schemas[0]));
+		check_parse(str, schemas[idx].schema, schemas[idx].num);
+	}
+}
+
+/**
+ * @brief Count the result codes a stream received
+ */
+static int results(const std::string &tx)
+{
+	int count = 0;
+	for (size_t pos = 0; (pos = tx.find("OK\r\n", pos)) != std::string::npos; pos++)
+	{
+		count++;
+	}
+	for (size_t pos = 0; (pos = tx.find("+CME ERROR:", pos)) != std::string::npos; pos++)
+	{
+		count++;
+	}
+	return count;
+}
+
+/**
+ * @brief Dispatch one line from BLE, it is answered once on BLE or by the API parser
+ */
+static void check_dispatch(const char *text)
+{
+	char line[AT_LINE_MAX + 1];
+	size_t len = strlen(text);
+	// AT+REBOOT would end the run
+	if ((len >= 9) && (strncasecmp(&text[2], "+REBOOT", 7) == 0))
+	{
+		return;
+	}
+	memcpy(line, text, len + 1);
+
+	g_ble_uart.tx.clear();
+	Serial.tx.clear();
+	at_dispatch(line, len, AT_SRC_BLE);
+	// Empty lines are skipped
+	int answers = results(g_ble_uart.tx) + results(Serial.tx);
+	if (answers != (len ? 1 : 0))
+	{
+		printf("dispatch \"%s\": %d answers\n", text, answers);
+		check_failed++;
+	}
+}
+
+/**
+ * @brief The seed lines and their mutations through the dispatch of the running firmware
+ */
+static int test_dispatch(void)
+{
+	const uint8_t num_seeds = sizeof(line_seeds) / sizeof(line_seeds[0]);
+	char line[96];
+
+	sim_boot();
+	sim_run_for(10 * 1000);
+	g_ble_uart_is_connected = true;
+
+	for (uint8_t seed = 0; seed < num_seeds; seed++)
+	{
+		check_dispatch(line_seeds[seed]);
+	}
+	for (uint32_t run = 0; (run < FUZZ_DISPATCH_RUNS) && !check_failed; run++)
+	{
+		snprintf(line, sizeof(line), "%s", line_seeds[fuzz_random() % num_seeds]);
+		mutate(line, sizeof(line), line_seeds[fuzz_random() % num_seeds]);
+		check_dispatch(line);
+		// Let the started valve moves and uplinks run
+		if ((run % 100) == 0)
+		{
+			sim_run_for(1000);
+		}
+	}
+
+	// The firmware still runs, LoRa commands are answered in the next uplink
+	sim_run_for(60 * 1000);
+	CHECK_EQ(sim_get_stats()->stuck_events, 0);
+	downlink_results_sent();
+	char lora[] = "AT+VLVS=?\nAT+VLVO=99";
+	at_dispatch(lora, strlen(lora), AT_SRC_LORA);
+	uint8_t payload[32];
+	CHECK(downlink_append_results(payload, 0, sizeof(payload)) > 0);
+	return check_failed;
+}
+
+/**
+ * @brief Host time of the name lookup plus the argument parse, and of a scan of all names
+ */
+static int bench_lookup(void)
+{
+	static const char *const names[] = {"+VLVI", "+VLVO", "+SCHED", "+TIME", "+ACT", "+UPLINK", "+NWM", "+FLOWMAX"};
+	static const char *const args[] = {"1:120", "0:9", "0:127:600:900", "1767225600", "1", "30", "1", "300"};
+	const uint8_t num = sizeof(names) / sizeof(names[0]);
+	uint32_t values[AT_ARGS_MAX];
+	uint32_t found = 0;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32_t run = 0; run < TIMING_RUNS; run++)
+	{
+		uint8_t idx = run % num;
+		found += at_user_find(names[idx], strlen(names[idx])) != NULL;
+		found += at_parse_args(args[idx], schemas[idx % 3].schema, schemas[idx % 3].num, values) == 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double hash_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / TIMING_RUNS;
+
+	// Like the WisBlock-API, a compare with every name of the list
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32_t run = 0; run < TIMING_RUNS; run++)
+	{
+		uint8_t idx = run % num;
+		size_t len = strlen(names[idx]);
+		for (uint8_t cmd = 0; cmd < g_user_at_cmd_num; cmd++)
+		{
+			const char *cmd_name = g_user_at_cmd_list[cmd].cmd_name;
+			if ((strlen(cmd_name) == len) && (strncasecmp(cmd_name, names[idx], len) == 0))
+			{
+				found++;
+				break;
+			}
+		}
+		found += at_parse_args(args[idx], schemas[idx % 3].schema, schemas[idx % 3].num, values) == 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double scan_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / TIMING_RUNS;
+
+	printf("lookup + parse: %.1f ns hashed, %.1f ns scanning %d names (%lu)\n", hash_ns, scan_ns, g_user_at_cmd_num,
+		   (unsigned long)found);
+	return 0;
+}
+
+int main()
+{
+	test_parse();
+	int failed = check_failed;
+	check_failed = 0;
+	CHECK(sim_fork(test_dispatch) == 0);
+	check_failed += failed;
+	bench_lookup();
+	return check_result("test_at_fuzz");
+}
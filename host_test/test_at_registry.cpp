@@ -0,0 +1,107 @@
+#include <string.h>
+#include "at_registry.h"
+#include "check.h"
+
+/** Names like the firmware command list */
+static constexpr const char *names[] = {"+LIST", "+REBOOT", "+VLVS", "+VLVO", "+VLVI", "+VLVL", "+VLVZ", "+VLVT", "+UPLINK",
+										"+TIME", "+SCHED", "+SCHSKIP", "+IOX", "+WAKE", "+ENERGY", "+JRNL", "+BOOT", "+SOC",
+										"+MBAT", "+HIST", "+FLOW", "+FLOWMAX", "+LAT", "+LINK", "+AIR", "+LOG", "+EVQ", "+ACT"};
+static constexpr uint8_t num_names = sizeof(names) / sizeof(names[0]);
+static constexpr uint32_t seed = at_seed_for(names, num_names);
+static_assert(seed != AT_HASH_NO_SEED, "No seed for the test names");
+
+/**
+ * @brief Every name has its own slot, the runtime hash matches the compile time hash
+ */
+static void test_hash(void)
+{
+	bool used[AT_HASH_SLOTS] = {false};
+	for (uint8_t idx = 0; idx < num_names; idx++)
+	{
+		uint8_t slot = at_slot(at_hash(names[idx], seed));
+		CHECK(!used[slot]);
+		used[slot] = true;
+		CHECK_EQ(at_hash_name(names[idx], strlen(names[idx]), seed), at_hash(names[idx], seed));
+	}
+
+	// Case insensitive
+	CHECK_EQ(at_hash_name("+vlvs", 5, seed), at_hash("+VLVS", seed));
+
+	// A list without a perfect seed in range is reported, not a compile error
+	static constexpr const char *same[] = {"+A", "+A"};
+	CHECK_EQ(at_seed_for(same, 2), AT_HASH_NO_SEED);
+}
+
+/** zone (optional, leading), state, sec (optional, trailing) */
+static constexpr at_arg_s args_valve[] = {{0, 7, 0, AT_ARG_LEAD}, {0, 1, 0, AT_ARG_REQ}, {0, 60, 9, AT_ARG_TRAIL}};
+
+static int parse(const char *str, uint32_t *values)
+{
+	return at_parse_args(str, args_valve, 3, values);
+}
+
+/**
+ * @brief Argument parsing by schema
+ */
+static void test_parse(void)
+{
+	uint32_t values[3];
+
+	CHECK_EQ(parse("1", values), 0);
+	CHECK_EQ(values[0], 0);
+	CHECK_EQ(values[1], 1);
+	CHECK_EQ(values[2], 9);
+
+	// Leading values are left out first
+	CHECK_EQ(parse("1:30", values), 0);
+	CHECK_EQ(values[0], 0);
+	CHECK_EQ(values[1], 1);
+	CHECK_EQ(values[2], 30);
+
+	CHECK_EQ(parse("2:0:30", values), 0);
+	CHECK_EQ(values[2], 30);
+
+	static const char *const bad[] = {"", ":", "1:", ":1", "x", "1x", "0x1", "-1", " 1", "2", "8:1", "1:2:61",
+									  "1:1:1:1", "99999999999", "4294967296"};
+	for (uint8_t idx = 0; idx < sizeof(bad) / sizeof(bad[0]); idx++)
+	{
+		if (parse(bad[idx], values) != AT_ERR_PARAM)
+		{
+			printf("accepted \"%s\"\n", bad[idx]);
+			check_failed++;
+		}
+	}
+}
+
+static uint32_t handled[3];
+
+static int handler(const uint32_t *values)
+{
+	memcpy(handled, values, sizeof(handled));
+	return 0;
+}
+
+/**
+ * @brief The typed exec wrapper only calls the handler with valid values
+ */
+static void test_exec(void)
+{
+	char good[] = "3:1:20";
+	char bad[] = "3:1:70";
+	int (*exec)(char *) = at_exec_typed<args_valve, 3, handler>;
+
+	CHECK_EQ(exec(good), 0);
+	CHECK_EQ(handled[0], 3);
+	CHECK_EQ(handled[2], 20);
+	handled[2] = 0;
+	CHECK_EQ(exec(bad), AT_ERR_PARAM);
+	CHECK_EQ(handled[2], 0);
+}
+
+int main()
+{
+	test_hash();
+	test_parse();
+	test_exec();
+	return check_result("at_registry");
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "payload.h"
+#include "check.h"
+
+/** Names of the fields in decoder.js, indexed by payload_field_id */
+static const char *const field_names[] = {"VERSION", "FLAGS", "BATT", "REMAIN", "FLOW_RATE", "VOLUME", "ZONE_OPEN", "ZONE_RUN", "ZONE_REMAIN"};
+
+static std::string field_name(uint8_t id)
+{
+	return (id < sizeof(field_names) / sizeof(field_names[0])) ? field_names[id] : "?";
+}
+
+/** One row of a decoder.js schema, [name, bits, gate field, gate mask, repeat field] */
+struct js_field_s
+{
+	std::string name;
+	unsigned long bits;
+	std::string gate;
+	unsigned long mask;
+	std::string repeat;
+};
+
+static std::string trim(std::string str)
+{
+	const char *space = " \t\r\"";
+	size_t start = str.find_first_not_of(space);
+	if (start == std::string::npos)
+	{
+		return "";
+	}
+	return str.substr(start, str.find_last_not_of(space) - start + 1);
+}
+
+/**
+ * @brief Read the constants and the SCHEMAS table of decoder.js
+ */
+static bool read_decoder(std::map<std::string, unsigned long> &consts, std::map<unsigned long, std::vector<js_field_s>> &schemas)
+{
+	std::ifstream file(DECODER_JS);
+	if (!file)
+	{
+		printf("cannot open %s\n", DECODER_JS);
+		return false;
+	}
+
+	std::string line;
+	bool in_schemas = false;
+	unsigned long version = 0;
+	while (std::getline(file, line))
+	{
+		line = trim(line);
+		char name[64];
+		long value;
+		if (sscanf(line.c_str(), "var %63[A-Z_] = %li;", name, &value) == 2)
+		{
+			consts[name] = value;
+		}
+		if (line.compare(0, 15, "var SCHEMAS = {") == 0)
+		{
+			in_schemas = true;
+			continue;
+		}
+		if (!in_schemas)
+		{
+			continue;
+		}
+		if (line == "};")
+		{
+			in_schemas = false;
+			continue;
+		}
+		if (sscanf(line.c_str(), "%lu: [", &version) == 1)
+		{
+			schemas[version];
+			continue;
+		}
+		if (line[0] != '[')
+		{
+			continue;
+		}
+
+		// ["NAME", bits, gate, mask, repeat]
+		std::vector<std::string> cols;
+		std::stringstream row(line.substr(1, line.find(']') - 1));
+		std::string col;
+		while (std::getline(row, col, ','))
+		{
+			cols.push_back(trim(col));
+		}
+		CHECK_EQ(cols.size(), 5);
+		if (cols.size() != 5)
+		{
+			continue;
+		}
+		js_field_s field;
+		field.name = cols[0];
+		field.bits = strtoul(cols[1].c_str(), 0, 0);
+		field.gate = cols[2];
+		field.mask = consts.count(cols[3]) ? consts[cols[3]] : strtoul(cols[3].c_str(), 0, 0);
+		field.repeat = cols[4];
+		schemas[version].push_back(field);
+	}
+	return !schemas.empty();
+}
+
+/**
+ * @brief The decoder.js tables match the schemas of the firmware
+ */
+static void test_tables(void)
+{
+	std::map<std::string, unsigned long> consts;
+	std::map<unsigned long, std::vector<js_field_s>> schemas;
+
+	CHECK(read_decoder(consts, schemas));
+	CHECK_EQ(consts["FLAG_OPEN"], PAYLOAD_FLAG_OPEN);
+	CHECK_EQ(consts["FLAG_INTERVAL"], PAYLOAD_FLAG_INTERVAL);
+	CHECK_EQ(consts["FLAG_FAULT"], PAYLOAD_FLAG_FAULT);
+	CHECK_EQ(consts["FLAG_LOW_BATT"], PAYLOAD_FLAG_LOW_BATT);
+	CHECK_EQ(consts["MAX_ZONES"], PAYLOAD_MAX_ZONES);
+
+	uint8_t known = 0;
+	for (uint8_t version = 0; version < 16; version++)
+	{
+		const payload_schema_s *schema = payload_schema(version);
+		if (schema == 0)
+		{
+			if (schemas.count(version))
+			{
+				printf("decoder.js has version %d, the firmware does not\n", version);
+				check_failed++;
+			}
+			continue;
+		}
+		known++;
+		if (!schemas.count(version))
+		{
+			printf("decoder.js lacks version %d\n", version);
+			check_failed++;
+			continue;
+		}
+
+		const std::vector<js_field_s> &js = schemas[version];
+		CHECK_EQ(js.size(), schema->num_fields);
+		for (uint8_t idx = 0; (idx < schema->num_fields) && (idx < js.size()); idx++)
+		{
+			const payload_field_s *field = &schema->fields[idx];
+			bool gated = field->gate_id != PF_ALWAYS;
+			bool repeated = field->repeat_id != PF_SINGLE;
+			if ((js[idx].name != field_name(field->id)) || (js[idx].bits != field->bits) ||
+				(js[idx].gate != (gated ? field_name(field->gate_id) : "null")) || (js[idx].mask != (gated ? field->gate_mask : 0)) ||
+				(js[idx].repeat != (repeated ? field_name(field->repeat_id) : "null")))
+			{
+				printf("decoder.js version %d field %d (%s) does not match payload.cpp\n", version, idx, js[idx].name.c_str());
+				check_failed++;
+			}
+		}
+	}
+	CHECK_EQ(schemas.size(), known);
+}
+
+int main()
+{
+	test_tables();
+	return check_result("decoder");
+}
@@ -0,0 +1,185 @@
+#include "check.h"
+#include "sim.h"
+#include "app.h"
+
+/**
+ * The whole firmware on the simulated board, each test runs in its own
+ * child with the power on state, see sim_fork().
+ */
+
+extern s_valve_settings g_valve_settings;
+
+/** Relay pulse of the default oper time */
+#define PULSE_MS (DEFAULT_VALVE_OPER_TIME_SEC * 1000)
+
+/**
+ * @brief Check if a stream received a text
+ */
+static bool sent(Stream &stream, const char *text)
+{
+	return stream.tx.find(text) != std::string::npos;
+}
+
+/**
+ * @brief Boot closes the valve once, joins and reports the event
+ */
+static int test_boot(void)
+{
+	sim_boot();
+	sim_run_for(60 * 60 * 1000);
+
+	sim_stats *stats = sim_get_stats();
+	CHECK_EQ(stats->joins, 1);
+	CHECK(stats->uplinks >= 1);
+	CHECK_EQ(stats->rejected, 0);
+	CHECK_EQ(stats->stuck_events, 0);
+	CHECK_EQ(stats->relay_pulses, 1);
+	CHECK_EQ(stats->relay_on_us[VPIN_CLOSED] / 1000, PULSE_MS);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+	return check_failed;
+}
+
+/**
+ * @brief An interval started over USB opens and closes the valve with one pulse each
+ */
+static int test_usb_interval(void)
+{
+	sim_boot();
+	sim_run_for(60 * 1000);
+
+	sim_usb_at("AT+VLVI=120");
+	sim_run_for(1000);
+	CHECK(sent(Serial, "OK"));
+	CHECK_EQ(sim_expander_outputs(), 1 << VPIN_OPEN);
+
+	sim_run_for(PULSE_MS);
+	CHECK_EQ(sim_expander_outputs(), 0);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_OPENED);
+
+	sim_run_for(120 * 1000);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+	// Flash writes between the relay write and the timer start may add a few ms
+	CHECK(sim_relay_on_ms() >= 3 * PULSE_MS);
+	CHECK(sim_relay_on_ms() <= 3 * PULSE_MS + 10);
+	CHECK_EQ(sim_get_stats()->stuck_events, 0);
+	return check_failed;
+}
+
+/**
+ * @brief BLE commands run with or without a line end
+ */
+static int test_ble_command(void)
+{
+	sim_boot();
+	sim_run_for(10 * 1000);
+
+	sim_ble_send("AT+VLVS=?");
+	sim_run_for(10);
+	CHECK(sent(g_ble_uart, "Valve State: 0\r\nOK\r\n"));
+
+	g_ble_uart.tx.clear();
+	sim_ble_send("AT+VLVZ=");
+	sim_ble_send("?\r\n");
+	sim_run_for(10);
+	CHECK(sent(g_ble_uart, "OK\r\n"));
+	CHECK(!sent(g_ble_uart, "ERROR"));
+	return check_failed;
+}
+
+/**
+ * @brief A binary command frame opens the valve and its result is acknowledged
+ */
+static int test_downlink_frame(void)
+{
+	sim_boot();
+	sim_run_for(10 * 1000);
+
+	const uint8_t frame[] = {DL_OP_VALVE, VALVE_STATE_OPENED, DL_OP_UPLINK};
+	sim_downlink(DOWNLINK_CMD_FPORT, frame, sizeof(frame));
+	sim_usb_at("AT+UPLINK=0");
+	sim_run_for(30 * 1000);
+
+	sim_stats *stats = sim_get_stats();
+	CHECK_EQ(stats->downlinks, 1);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_OPENED);
+	CHECK_EQ(stats->relay_on_us[VPIN_OPEN] / 1000, PULSE_MS);
+	// The results go out with the uplink the frame asked for
+	CHECK(stats->uplinks >= 2);
+	return check_failed;
+}
+
+/**
+ * @brief An interval keeps running after a reset, the journal is in the simulated flash
+ */
+static int test_reset_resume(void)
+{
+	if (sim_get_stats()->boots == 0)
+	{
+		sim_boot();
+		sim_run_for(10 * 1000);
+		sim_usb_at("AT+VLVI=600");
+		sim_run_for(100 * 1000);
+		CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_OPENED);
+		sim_usb_at("AT+REBOOT=1");
+		sim_run_for(2000);
+		// Not reached, api_reset() ends the child
+		CHECK(false);
+		return check_failed;
+	}
+
+	sim_boot();
+	sim_run_for(1000);
+	CHECK_EQ(sim_get_stats()->resets, 1);
+	CHECK(g_valve_settings.interval_running);
+	CHECK(valve_interval_remaining(0) > 300);
+	CHECK(valve_interval_remaining(0) < 600);
+
+	sim_run_for(600 * 1000);
+	CHECK(!g_valve_settings.interval_running);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+	return check_failed;
+}
+
+/**
+ * @brief A lossy link lowers the data rate and every event is still handled
+ */
+static int test_lossy_link(void)
+{
+	sim_radio_model()->loss_permille = 400;
+	sim_boot();
+	for (uint8_t hour = 0; hour < 24; hour++)
+	{
+		sim_usb_at("AT+UPLINK=0");
+		sim_run_for(60 * 60 * 1000);
+	}
+
+	sim_stats *stats = sim_get_stats();
+	CHECK(stats->joins >= 1);
+	CHECK(stats->naks > 0);
+	CHECK(stats->uplinks_dr[DR_0] + stats->uplinks_dr[DR_1] + stats->uplinks_dr[DR_2] > 0);
+	CHECK_EQ(stats->stuck_events, 0);
+	return check_failed;
+}
+
+/**
+ * @brief Run a test in a child that counts only its own failed checks
+ */
+static int run(int (*test)(void))
+{
+	int failed = check_failed;
+	check_failed = 0;
+	int status = sim_fork(test);
+	check_failed = failed;
+	return status;
+}
+
+int main()
+{
+	CHECK(run(test_boot) == 0);
+	CHECK(run(test_usb_interval) == 0);
+	CHECK(run(test_ble_command) == 0);
+	CHECK(run(test_downlink_frame) == 0);
+	CHECK(run(test_reset_resume) == 0);
+	CHECK(run(test_lossy_link) == 0);
+	return check_result("test_firmware");
+}
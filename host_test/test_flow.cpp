@@ -0,0 +1,202 @@
+#include "check.h"
+#include "sim.h"
+#include "app.h"
+
+/**
+ * Pulse trains of the flow meter replayed on the simulated board through the
+ * pin interrupt. The firmware is built with two zones and the pulse counter
+ * starting just before the 32 bit wrap, see FLOW_PULSES_START, so every
+ * volume target and leak count is armed across the wrap.
+ */
+
+extern s_valve_settings g_valve_settings;
+
+/** Pulses are injected in steps of virtual time */
+#define STEP_MS 10
+
+/** Relay pulse of the default oper time */
+#define PULSE_MS (DEFAULT_VALVE_OPER_TIME_SEC * 1000)
+
+/** Rate of a pulse train in 0.1 L/min */
+#define RATE(hz) ((hz) * 600 / FLOW_PULSES_PER_L)
+
+/** Rate of the run, set by the parent before sim_fork() */
+static uint32_t train_hz;
+
+/**
+ * @brief Check if a stream received a text
+ */
+static bool sent(Stream &stream, const char *text)
+{
+	return stream.tx.find(text) != std::string::npos;
+}
+
+/**
+ * @brief Check if the interval of a zone is running
+ */
+static bool running(uint8_t zone)
+{
+	return g_valve_settings.interval_running & (1 << zone);
+}
+
+/**
+ * @brief Inject a pulse train until the interval of a zone ends or the time is up
+ *
+ * @param hz pulses per second, a multiple of 1000 / STEP_MS
+ * @param ms length of the train
+ * @param zone zone to watch, VALVE_ZONES to run the whole train
+ * @return uint32_t pulses injected
+ */
+static uint32_t pulse_train(uint32_t hz, uint32_t ms, uint8_t zone)
+{
+	uint32_t pulses = 0;
+	for (uint32_t elapsed = 0; elapsed < ms; elapsed += STEP_MS)
+	{
+		for (uint32_t pulse = 0; pulse < hz * STEP_MS / 1000; pulse++)
+		{
+			sim_pin_interrupt(FLOW_PIN);
+		}
+		pulses += hz * STEP_MS / 1000;
+		sim_run_for(STEP_MS);
+		if ((zone < VALVE_ZONES) && !running(zone))
+		{
+			break;
+		}
+	}
+	return pulses;
+}
+
+/**
+ * @brief Boot and let the line settle after the valves closed at boot
+ */
+static void boot_settled(void)
+{
+	sim_boot();
+	sim_run_for(2 * FLOW_SETTLE_MS + 2 * PULSE_MS);
+}
+
+/**
+ * @brief A volume interval ends within one step of its target across the wrap
+ */
+static int test_volume(void)
+{
+	boot_settled();
+	sim_usb_at("AT+FLOWMAX=0");
+	sim_usb_at("AT+VLVL=0:20");
+	// Water flows once the held open starts moving the valve, pulses before are a leak
+	sim_run_for(VALVE_HOLD_MS + STEP_MS);
+	CHECK(sent(Serial, "OK"));
+
+	uint32_t pulses = pulse_train(train_hz, FLOW_VOLUME_MAX_SEC * 1000UL, 0);
+	printf("%5lu Hz: ended after %lu pulses, target %d, rate %d\n", (unsigned long)train_hz, (unsigned long)pulses,
+		   20 * FLOW_PULSES_PER_L, flow_rate());
+	CHECK(!running(0));
+	CHECK(pulses >= 20 * FLOW_PULSES_PER_L);
+	CHECK(pulses <= 20 * FLOW_PULSES_PER_L + train_hz * STEP_MS / 1000);
+	// The target was past the wrap of the counter
+	CHECK((uint32_t)(FLOW_PULSES_START + pulses) < FLOW_PULSES_START);
+	if (pulses / train_hz >= 2)
+	{
+		// Samples closer than 1 s keep the last rate
+		CHECK(flow_rate() >= RATE(train_hz) * 95 / 100);
+		CHECK(flow_rate() <= RATE(train_hz) * 105 / 100);
+	}
+	CHECK_EQ(flow_volume(), pulses * 10 / FLOW_PULSES_PER_L);
+	CHECK_EQ(flow_alarm(), 0);
+
+	sim_run_for(VALVE_HOLD_MS + PULSE_MS);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+	CHECK_EQ(sim_expander_outputs(), 0);
+	CHECK_EQ(sim_get_stats()->stuck_events, 0);
+	return check_failed;
+}
+
+/**
+ * @brief Two volume intervals, the interrupt is rearmed for the nearer target each time
+ */
+static int test_two_targets(void)
+{
+	boot_settled();
+	sim_usb_at("AT+FLOWMAX=0");
+	sim_usb_at("AT+VLVL=0:10");
+	sim_usb_at("AT+VLVL=1:4");
+	sim_run_for(VALVE_HOLD_MS + STEP_MS);
+
+	uint32_t first = pulse_train(train_hz, FLOW_VOLUME_MAX_SEC * 1000UL, 1);
+	CHECK(!running(1));
+	CHECK(running(0));
+	CHECK(first >= 4 * FLOW_PULSES_PER_L);
+	CHECK(first <= 4 * FLOW_PULSES_PER_L + train_hz * STEP_MS / 1000);
+	CHECK(flow_volume_remaining(0) > 0);
+
+	uint32_t second = first + pulse_train(train_hz, FLOW_VOLUME_MAX_SEC * 1000UL, 0);
+	CHECK(!running(0));
+	CHECK(second >= 10 * FLOW_PULSES_PER_L);
+	CHECK(second <= 10 * FLOW_PULSES_PER_L + train_hz * STEP_MS / 1000);
+
+	sim_run_for(VALVE_HOLD_MS + 2 * PULSE_MS);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+	CHECK_EQ(g_valve_settings.state[1], VALVE_STATE_CLOSED);
+	CHECK_EQ(sim_expander_outputs(), 0);
+	return check_failed;
+}
+
+/**
+ * @brief A train above the rate limit closes the valve within one rate check
+ */
+static int test_rate_alarm(void)
+{
+	boot_settled();
+	sim_usb_at("AT+VLVI=600");
+	sim_run_for(VALVE_HOLD_MS + STEP_MS);
+
+	uint64_t start = sim_now_us();
+	pulse_train(train_hz, 60 * 1000, 0);
+	uint32_t took_ms = (sim_now_us() - start) / 1000;
+	CHECK(flow_alarm() & FLOW_ALARM_RATE);
+	CHECK(took_ms <= FLOW_CHECK_MS + STEP_MS);
+	CHECK(!g_valve_settings.interval_running);
+	return check_failed;
+}
+
+/**
+ * @brief Flow with all valves closed counts as a leak from the leak count on, across the wrap
+ */
+static int test_leak(void)
+{
+	boot_settled();
+	pulse_train(100, (FLOW_LEAK_PULSES - 1) * 10, VALVE_ZONES);
+	CHECK_EQ(flow_alarm(), 0);
+	pulse_train(100, STEP_MS, VALVE_ZONES);
+	sim_run_for(STEP_MS);
+	CHECK_EQ(flow_alarm(), FLOW_ALARM_LEAK);
+	return check_failed;
+}
+
+/**
+ * @brief Run a test in a child that counts only its own failed checks
+ */
+static int run(int (*test)(void))
+{
+	int failed = check_failed;
+	check_failed = 0;
+	int status = sim_fork(test);
+	check_failed = failed;
+	return status;
+}
+
+int main()
+{
+	// Up to 1333 L/min, far above any meter, the interrupt load is the limit
+	static const uint32_t rates[] = {100, 500, 2000, 10000};
+	for (uint8_t idx = 0; idx < sizeof(rates) / sizeof(rates[0]); idx++)
+	{
+		train_hz = rates[idx];
+		CHECK(run(test_volume) == 0);
+		CHECK(run(test_two_targets) == 0);
+	}
+	train_hz = 400;
+	CHECK(run(test_rate_alarm) == 0);
+	CHECK(run(test_leak) == 0);
+	return check_result("test_flow");
+}
@@ -0,0 +1,312 @@
+#include <sys/mman.h>
+
+#include "check.h"
+#include "sim.h"
+#include "app.h"
+
+/**
+ * The valve journal on the simulated flash: the records written per event,
+ * the boot replay time against the segment length, and power cuts in the
+ * middle of a record and of a segment switch. A cut stores part of a write
+ * and boots the node again, see sim_fs_cut().
+ */
+
+extern s_valve_settings g_valve_settings;
+
+/** Records of the snapshot that starts a segment, the wall clock is not set */
+#define SNAPSHOT_RECORDS (5 + 4 * VALVE_ZONES)
+/** Index of the zone 0 oper time in the snapshot */
+#define SNAPSHOT_OPER 5
+
+/** Record layout and the types of journal.cpp */
+#define REC_SIZE 12
+#define REC_TYPE 6
+#define REC_TYPES 11
+#define REC_STATE 2
+#define REC_INTERVAL 4
+
+/** Boot replay of a full segment and the one before, from the flash timing of the simulation */
+#define SCAN_MAX_US (4 * SIM_FS_OPEN_US + (2 * JOURNAL_SEG_RECORDS + 4) * SIM_FS_READ_US)
+
+/** Parameters of the run, set by the parent before sim_fork() */
+static uint16_t fill_records;
+static uint8_t cut_write;
+static uint8_t cut_bytes;
+
+/** Results of the runs, shared with the parent */
+struct journal_result
+{
+	uint32_t scan_us;
+	uint16_t count;
+	uint8_t oper; // oper time before the cut
+};
+static journal_result *result;
+
+/**
+ * @brief Records in the open segment, from AT+JRNL
+ *
+ * @param seg set to the open segment if not NULL
+ */
+static int journal_records(int *seg = NULL)
+{
+	char buf[96];
+	int count = -1;
+	int open = -1;
+	journal_print(buf, sizeof(buf));
+	sscanf(buf, "Seg %d gen %*u, %d/", &open, &count);
+	if (seg)
+	{
+		*seg = open;
+	}
+	return count;
+}
+
+/**
+ * @brief Count the records of each type in the open segment from a record on
+ */
+static void journal_types(int first, uint16_t *types)
+{
+	int seg;
+	char name[8];
+	uint32_t *len;
+	journal_records(&seg);
+	snprintf(name, sizeof(name), "/vlv_j%d", seg);
+	uint8_t *data = sim_fs_file(name, &len);
+	memset(types, 0, REC_TYPES * sizeof(types[0]));
+	for (uint32_t pos = first * REC_SIZE; data && (pos + REC_SIZE <= *len); pos += REC_SIZE)
+	{
+		types[data[pos + REC_TYPE] % REC_TYPES]++;
+	}
+}
+
+/**
+ * @brief Set the oper time of zone 0 over USB
+ */
+static void set_oper(uint8_t sec)
+{
+	char line[24];
+	snprintf(line, sizeof(line), "AT+VLVO=0:%d", sec);
+	sim_usb_at(line);
+	sim_run_for(100);
+}
+
+/**
+ * @brief Change the oper time until the open segment holds a number of records
+ *
+ * @return uint8_t the last oper time set
+ */
+static uint8_t fill_to(int records)
+{
+	uint8_t sec = g_valve_settings.oper_time_sec[0];
+	while (journal_records() < records)
+	{
+		sec = (sec == 20) ? 21 : 20;
+		set_oper(sec);
+	}
+	return sec;
+}
+
+/**
+ * @brief Reset over USB, the child ends
+ */
+static void reboot(void)
+{
+	sim_usb_at("AT+REBOOT=1");
+	sim_run_for(2000);
+	// Not reached, api_reset() ends the child
+	CHECK(false);
+}
+
+/**
+ * @brief A watering interval writes two positions and its start and end, the
+ *		  checkpoints of the status timer add the time left and the 9V battery use
+ */
+static int test_writes_per_event(void)
+{
+	sim_boot();
+	sim_run_for(10 * 1000);
+
+	uint32_t writes = g_journal_writes;
+	uint32_t fs_writes = sim_get_stats()->fs_writes;
+	int first = journal_records();
+	sim_usb_at("AT+VLVI=60");
+	sim_run_for(80 * 1000);
+	CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+
+	writes = g_journal_writes - writes;
+	fs_writes = sim_get_stats()->fs_writes - fs_writes;
+	uint16_t types[REC_TYPES];
+	journal_types(first, types);
+	printf("interval: %lu journal records, %lu flash writes, %d positions, %d interval\n", (unsigned long)writes,
+		   (unsigned long)fs_writes, types[REC_STATE], types[REC_INTERVAL]);
+	CHECK_EQ(types[REC_STATE], 2);
+	// Start and end, the checkpoints add the time left
+	CHECK(types[REC_INTERVAL] >= 2);
+	CHECK_EQ(journal_records() - first, writes);
+	CHECK(writes <= 8);
+	// One flash write per record, the rest are the history and the settings
+	CHECK(fs_writes >= writes);
+
+	// An unchanged oper time is not written
+	writes = g_journal_writes;
+	set_oper(g_valve_settings.oper_time_sec[0]);
+	CHECK_EQ(g_journal_writes, writes);
+	set_oper(g_valve_settings.oper_time_sec[0] + 1);
+	CHECK_EQ(g_journal_writes, writes + 1);
+	return check_failed;
+}
+
+/**
+ * @brief The boot replay time grows with the records and the settings are restored
+ */
+static int test_recovery(void)
+{
+	if (sim_get_stats()->boots == 0)
+	{
+		sim_boot();
+		sim_run_for(10 * 1000);
+		uint32_t writes = g_journal_writes;
+		fill_to(journal_records() + fill_records);
+		CHECK_EQ(g_journal_writes - writes, fill_records);
+		reboot();
+		return check_failed;
+	}
+
+	sim_boot();
+	sim_run_for(100);
+	result->scan_us = g_journal_scan_us;
+	result->count = journal_records();
+	CHECK(g_journal_scan_us > 0);
+	CHECK(g_journal_scan_us <= SCAN_MAX_US);
+	// The fill alternates 20 and 21, starting from the default
+	uint8_t sec = (fill_records & 1) ? 20 : 21;
+	CHECK_EQ(g_valve_settings.oper_time_sec[0], fill_records ? sec : DEFAULT_VALVE_OPER_TIME_SEC);
+	return check_failed;
+}
+
+/**
+ * @brief Power lost in the middle of a record keeps every record before it
+ */
+static int test_torn_record(void)
+{
+	switch (sim_get_stats()->boots)
+	{
+	case 0:
+		sim_boot();
+		sim_run_for(10 * 1000);
+		set_oper(11);
+		set_oper(12);
+		sim_fs_cut(0, cut_bytes);
+		set_oper(13);
+		// Not reached, the cut ends the child
+		CHECK(false);
+		break;
+	case 1:
+		sim_boot();
+		sim_run_for(100);
+		CHECK_EQ(sim_get_stats()->power_cuts, 1);
+		CHECK_EQ(g_valve_settings.oper_time_sec[0], 12);
+		// The damaged segment is left for a new one
+		CHECK_EQ(journal_records(), SNAPSHOT_RECORDS);
+		set_oper(14);
+		reboot();
+		break;
+	default:
+		sim_boot();
+		sim_run_for(100);
+		CHECK_EQ(g_valve_settings.oper_time_sec[0], 14);
+		CHECK_EQ(journal_records(), SNAPSHOT_RECORDS + 1);
+		break;
+	}
+	return check_failed;
+}
+
+/**
+ * @brief Power lost while the snapshot of a new segment is written replays the old segment
+ */
+static int test_rotation_cut(void)
+{
+	switch (sim_get_stats()->boots)
+	{
+	case 0:
+		sim_boot();
+		sim_run_for(10 * 1000);
+		result->oper = fill_to(JOURNAL_SEG_RECORDS);
+		CHECK_EQ(journal_records(), JOURNAL_SEG_RECORDS);
+		// The next record switches segments, the cut hits the snapshot or the record itself
+		sim_fs_cut(cut_write, cut_bytes);
+		set_oper(result->oper == 20 ? 21 : 20);
+		// Not reached, the cut ends the child
+		CHECK(false);
+		break;
+	case 1:
+		sim_boot();
+		sim_run_for(100);
+		CHECK_EQ(sim_get_stats()->power_cuts, 1);
+		// Once the snapshot holds the new oper time the new segment has it, before that the old one is replayed
+		CHECK_EQ(g_valve_settings.oper_time_sec[0],
+				 (cut_write > SNAPSHOT_OPER) ? ((result->oper == 20) ? 21 : 20) : result->oper);
+		CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+		CHECK(g_journal_scan_us <= SCAN_MAX_US);
+		CHECK(journal_records() <= JOURNAL_SEG_RECORDS);
+		set_oper(33);
+		reboot();
+		break;
+	default:
+		sim_boot();
+		sim_run_for(100);
+		CHECK_EQ(g_valve_settings.oper_time_sec[0], 33);
+		CHECK_EQ(g_valve_settings.state[0], VALVE_STATE_CLOSED);
+		break;
+	}
+	return check_failed;
+}
+
+/**
+ * @brief Run a test in a child that counts only its own failed checks
+ */
+static int run(int (*test)(void))
+{
+	int failed = check_failed;
+	check_failed = 0;
+	int status = sim_fork(test);
+	check_failed = failed;
+	return status;
+}
+
+int main()
+{
+	result = (journal_result *)mmap(NULL, sizeof(journal_result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+									-1, 0);
+	CHECK(result != MAP_FAILED);
+
+	CHECK(run(test_writes_per_event) == 0);
+
+	static const uint16_t fills[] = {0, 60, 120, 180, 240};
+	uint32_t scan_before = 0;
+	printf("%8s %8s %10s\n", "records", "replayed", "scan us");
+	for (uint8_t idx = 0; idx < sizeof(fills) / sizeof(fills[0]); idx++)
+	{
+		fill_records = fills[idx];
+		CHECK(run(test_recovery) == 0);
+		printf("%8u %8u %10lu\n", fill_records, result->count, (unsigned long)result->scan_us);
+		CHECK(result->scan_us > scan_before);
+		scan_before = result->scan_us;
+	}
+	printf("scan limit %u us\n", SCAN_MAX_US);
+
+	// Part of the record reaches the flash
+	for (cut_bytes = 1; cut_bytes < sizeof(uint32_t) * 3; cut_bytes += 5)
+	{
+		CHECK(run(test_torn_record) == 0);
+	}
+
+	for (cut_write = 0; cut_write <= SNAPSHOT_RECORDS; cut_write++)
+	{
+		for (cut_bytes = 0; cut_bytes < sizeof(uint32_t) * 3; cut_bytes += 7)
+		{
+			CHECK(run(test_rotation_cut) == 0);
+		}
+	}
+	return check_result("test_journal");
+}
@@ -0,0 +1,197 @@
+#include "payload.h"
+#include "check.h"
+
+/**
+ * @brief Known encodings of the status payload versions
+ */
+static void test_known_payloads(void)
+{
+	uint32_t values[PF_COUNT] = {0};
+	uint8_t out[PAYLOAD_MAX_LEN];
+
+	// Version 1 idle: version, flags, battery
+	values[PF_VERSION] = PAYLOAD_VERSION;
+	values[PF_BATT] = payload_quantize_batt(3700);
+	CHECK_EQ(payload_encode(payload_schema(PAYLOAD_VERSION), values, out, sizeof(out)), 2);
+	CHECK_EQ(out[0], 0x10);
+	CHECK_EQ(out[1], 170);
+
+	// Version 1 with a running interval adds the packed remaining time
+	values[PF_FLAGS] = PAYLOAD_FLAG_OPEN | PAYLOAD_FLAG_INTERVAL;
+	values[PF_REMAIN] = payload_pack_remain(2700);
+	CHECK_EQ(payload_encode(payload_schema(PAYLOAD_VERSION), values, out, sizeof(out)), 4);
+	CHECK_EQ(out[0], 0x13);
+	CHECK_EQ((out[2] << 8) | out[3], 2700);
+
+	// Too small for the fields
+	CHECK_EQ(payload_encode(payload_schema(PAYLOAD_VERSION), values, out, 3), 0);
+
+	// Unknown versions
+	CHECK(payload_schema(0) == 0);
+	CHECK(payload_schema(5) == 0);
+	out[0] = 0x50;
+	CHECK_EQ(payload_decode(out, 4, values), 0);
+}
+
+/**
+ * @brief Remaining time packing, exact up to 16383 s, rounded up above
+ */
+static void test_remain_packing(void)
+{
+	CHECK_EQ(payload_unpack_remain(payload_pack_remain(0)), 0);
+	CHECK_EQ(payload_unpack_remain(payload_pack_remain(16383)), 16383);
+	CHECK_EQ(payload_unpack_remain(payload_pack_remain(16384)), 16384);
+	CHECK_EQ(payload_unpack_remain(payload_pack_remain(16385)), 16392);
+	CHECK_EQ(payload_pack_remain(0x3FFFUL << 9), 0xFFFF);
+	CHECK_EQ(payload_pack_remain((0x3FFFUL << 9) + 1), 0xFFFF);
+
+	for (int idx = 0; idx < 10000; idx++)
+	{
+		uint32_t sec = check_random() % (0x3FFFUL << 9);
+		uint32_t back = payload_unpack_remain(payload_pack_remain(sec));
+		CHECK(back >= sec);
+		CHECK((back - sec) < 512);
+	}
+}
+
+/**
+ * @brief Battery quantization in 10 mV steps above 2.0 V
+ */
+static void test_battery(void)
+{
+	CHECK_EQ(payload_quantize_batt(0), 0);
+	CHECK_EQ(payload_quantize_batt(2000), 0);
+	CHECK_EQ(payload_quantize_batt(2004), 0);
+	CHECK_EQ(payload_quantize_batt(2005), 1);
+	CHECK_EQ(payload_quantize_batt(4550), 255);
+	CHECK_EQ(payload_quantize_batt(9000), 255);
+	CHECK_EQ(payload_batt_mv(payload_quantize_batt(4200)), 4200);
+}
+
+/**
+ * @brief Command results trailer
+ */
+static void test_results(void)
+{
+	uint8_t out[PAYLOAD_MAX_LEN] = {0x10, 0xAA};
+	uint8_t codes[15] = {0, 1, 2, 3, 3, 2, 1};
+	uint8_t back[15];
+
+	uint8_t len = payload_append_results(out, 2, sizeof(out), codes, 7);
+	CHECK_EQ(len, 2 + 3);
+	CHECK_EQ(payload_decode_results(out, len, 2, back), 7);
+	for (uint8_t idx = 0; idx < 7; idx++)
+	{
+		CHECK_EQ(back[idx], codes[idx]);
+	}
+
+	// No room, the payload is left as it is
+	CHECK_EQ(payload_append_results(out, 2, 3, codes, 7), 2);
+	CHECK_EQ(payload_append_results(out, 2, sizeof(out), codes, 0), 2);
+}
+
+/**
+ * @brief Random values of a schema, masked to the field widths and
+ *		  0 where a field is not sent, so they survive a round trip
+ */
+static void random_values(const payload_schema_s *schema, uint32_t *values)
+{
+	uint32_t present[PF_COUNT] = {0};
+
+	for (uint8_t idx = 0; idx < PF_COUNT; idx++)
+	{
+		values[idx] = check_random();
+	}
+	values[PF_VERSION] = schema->version;
+
+	for (uint8_t idx = 0; idx < schema->num_fields; idx++)
+	{
+		const payload_field_s *field = &schema->fields[idx];
+		if ((field->gate_id != PF_ALWAYS) && !(present[field->gate_id] & field->gate_mask))
+		{
+			continue;
+		}
+		uint32_t repeat = (field->repeat_id == PF_SINGLE) ? 1 : present[field->repeat_id];
+		for (uint8_t n = 0; n < PAYLOAD_MAX_ZONES; n++)
+		{
+			if (repeat & (1UL << n))
+			{
+				present[field->id + n] = values[field->id + n] & ((1ULL << field->bits) - 1);
+			}
+		}
+	}
+
+	for (uint8_t idx = 0; idx < PF_COUNT; idx++)
+	{
+		values[idx] = present[idx];
+	}
+}
+
+/**
+ * @brief decode(encode(values)) gives back the values for random inputs of
+ *		  every version, truncated payloads are refused
+ */
+static void test_round_trip(void)
+{
+	uint32_t values[PF_COUNT];
+	uint32_t back[PF_COUNT];
+	uint8_t out[PAYLOAD_MAX_LEN];
+
+	for (int round = 0; round < 20000; round++)
+	{
+		const payload_schema_s *schema = payload_schema(1 + round % 4);
+		random_values(schema, values);
+
+		uint8_t len = payload_encode(schema, values, out, sizeof(out));
+		CHECK(len > 0);
+		CHECK_EQ(payload_decode(out, len, back), len);
+		for (uint8_t idx = 0; idx < PF_COUNT; idx++)
+		{
+			CHECK_EQ(back[idx], values[idx]);
+		}
+		for (uint8_t cut = 0; cut < len; cut++)
+		{
+			CHECK_EQ(payload_decode(out, cut, back), 0);
+		}
+		if (check_failed > 20)
+		{
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Random bytes never decode beyond their length
+ */
+static void test_fuzz(void)
+{
+	uint32_t values[PF_COUNT];
+	uint8_t in[PAYLOAD_MAX_LEN];
+
+	for (int round = 0; round < 100000; round++)
+	{
+		uint8_t len = check_random() % (sizeof(in) + 1);
+		for (uint8_t idx = 0; idx < len; idx++)
+		{
+			in[idx] = check_random();
+		}
+		uint8_t used = payload_decode(in, len, values);
+		CHECK(used <= len);
+
+		uint8_t codes[15];
+		uint8_t count = payload_decode_results(in, len, used, codes);
+		CHECK(count <= 15);
+		CHECK((count == 0) || ((used + (4 + 2 * count + 7) / 8) <= len));
+	}
+}
+
+int main()
+{
+	test_known_payloads();
+	test_remain_packing();
+	test_battery();
+	test_results();
+	test_round_trip();
+	test_fuzz();
+	return check_result("payload");
+}
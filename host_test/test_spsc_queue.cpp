@@ -0,0 +1,83 @@
+#include <thread>
+#include "spsc_queue.h"
+#include "check.h"
+
+/**
+ * @brief Order, full queue and index wrap in one thread
+ */
+static void test_single(void)
+{
+	static spsc_queue_s<uint32_t, 8> queue;
+	uint32_t item;
+
+	CHECK(!spsc_pop(&queue, &item));
+	for (uint32_t idx = 0; idx < 8; idx++)
+	{
+		CHECK(spsc_push(&queue, idx));
+	}
+	CHECK(!spsc_push(&queue, (uint32_t)8));
+	CHECK_EQ(spsc_dropped(&queue), 1);
+	for (uint32_t idx = 0; idx < 8; idx++)
+	{
+		CHECK(spsc_pop(&queue, &item));
+		CHECK_EQ(item, idx);
+	}
+	CHECK(!spsc_pop(&queue, &item));
+
+	// The 8 bit indices wrap many times
+	for (uint32_t idx = 0; idx < 1000; idx++)
+	{
+		CHECK(spsc_push(&queue, idx));
+		CHECK(spsc_push(&queue, (uint32_t)(idx + 1)));
+		CHECK(spsc_pop(&queue, &item));
+		CHECK_EQ(item, idx);
+		CHECK(spsc_pop(&queue, &item));
+		CHECK_EQ(item, idx + 1);
+	}
+	CHECK_EQ(spsc_dropped(&queue), 1);
+}
+
+/**
+ * @brief A producer thread and a consumer, nothing lost, nothing reordered
+ */
+static void test_threads(void)
+{
+	static spsc_queue_s<uint32_t, 8> queue;
+	const uint32_t count = 200000;
+
+	std::thread producer([&] {
+		for (uint32_t idx = 0; idx < count; idx++)
+		{
+			while (!spsc_push(&queue, idx))
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	uint32_t next = 0;
+	uint32_t item;
+	while (next < count)
+	{
+		if (!spsc_pop(&queue, &item))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		if (item != next)
+		{
+			CHECK_EQ(item, next);
+			break;
+		}
+		next++;
+	}
+	producer.join();
+	CHECK_EQ(next, count);
+}
+
+int main()
+{
+	test_single();
+	test_threads();
+	return check_result("spsc_queue");
+}
@@ -0,0 +1,131 @@
+#include "timer_wheel.h"
+#include "check.h"
+
+/** Reference model, deadline of each entry or WHEEL_NEVER */
+static uint32_t model[WHEEL_CAPACITY];
+
+static uint32_t model_next(void)
+{
+	uint32_t best = WHEEL_NEVER;
+	for (uint16_t id = 0; id < WHEEL_CAPACITY; id++)
+	{
+		if (model[id] < best)
+		{
+			best = model[id];
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Simple cases at the level boundaries
+ */
+static void test_basic(void)
+{
+	timer_wheel_s wheel;
+	uint16_t expired[WHEEL_CAPACITY];
+
+	wheel_init(&wheel, 100);
+	CHECK_EQ(wheel_next_deadline(&wheel), WHEEL_NEVER);
+	CHECK(!wheel_insert(&wheel, 0, 99));
+	CHECK(!wheel_insert(&wheel, WHEEL_CAPACITY, 200));
+	CHECK(!wheel_insert(&wheel, 0, 100 + WHEEL_SPAN));
+	CHECK(wheel_insert(&wheel, 0, 100 + WHEEL_REACH));
+	wheel_remove(&wheel, 0);
+
+	CHECK(wheel_insert(&wheel, 0, 100 + 63));
+	CHECK(wheel_insert(&wheel, 1, 100 + 64 * 64 + 5));
+	CHECK(wheel_insert(&wheel, 2, 100 + 70));
+	CHECK_EQ(wheel_next_deadline(&wheel), 163);
+
+	CHECK_EQ(wheel_advance(&wheel, 162, expired, WHEEL_CAPACITY), 0);
+	CHECK_EQ(wheel_advance(&wheel, 170, expired, WHEEL_CAPACITY), 2);
+	CHECK_EQ(expired[0], 0);
+	CHECK_EQ(expired[1], 2);
+	CHECK_EQ(wheel_next_deadline(&wheel), 100 + 64 * 64 + 5);
+
+	// Moving an entry replaces its deadline
+	CHECK(wheel_insert(&wheel, 1, 180));
+	CHECK_EQ(wheel_next_deadline(&wheel), 180);
+	wheel_remove(&wheel, 1);
+	CHECK_EQ(wheel_next_deadline(&wheel), WHEEL_NEVER);
+	wheel_remove(&wheel, 1);
+}
+
+/**
+ * @brief Random inserts, removes and advances against the reference model
+ */
+static void test_random(void)
+{
+	timer_wheel_s wheel;
+	uint16_t expired[4];
+	uint32_t now = 1000;
+
+	wheel_init(&wheel, now);
+	for (uint16_t id = 0; id < WHEEL_CAPACITY; id++)
+	{
+		model[id] = WHEEL_NEVER;
+	}
+
+	for (int round = 0; round < 200000; round++)
+	{
+		uint16_t id = check_random() % WHEEL_CAPACITY;
+		switch (check_random() % 4)
+		{
+		case 0:
+		{
+			// Short, medium and long deadlines
+			static const uint32_t ranges[] = {64, 4096, WHEEL_REACH + 1};
+			uint32_t due = now + check_random() % ranges[check_random() % 3];
+			CHECK(wheel_insert(&wheel, id, due));
+			model[id] = due;
+			break;
+		}
+		case 1:
+			wheel_remove(&wheel, id);
+			model[id] = WHEEL_NEVER;
+			break;
+		default:
+		{
+			// Step to each deadline, nothing expires a tick early
+			uint32_t to = now + check_random() % 3000;
+			uint32_t due;
+			while ((due = model_next()) <= to)
+			{
+				if (due > now)
+				{
+					CHECK_EQ(wheel_advance(&wheel, due - 1, expired, 4), 0);
+				}
+				uint16_t num;
+				do
+				{
+					// A small buffer, the call is repeated with the same time
+					num = wheel_advance(&wheel, due, expired, 4);
+					for (uint16_t idx = 0; idx < num; idx++)
+					{
+						CHECK_EQ(model[expired[idx]], due);
+						model[expired[idx]] = WHEEL_NEVER;
+					}
+				} while (num == 4);
+				CHECK(model_next() > due);
+				now = due;
+			}
+			CHECK_EQ(wheel_advance(&wheel, to, expired, 4), 0);
+			now = to;
+			break;
+		}
+		}
+		CHECK_EQ(wheel_next_deadline(&wheel), model_next());
+		if (check_failed > 20)
+		{
+			return;
+		}
+	}
+}
+
+int main()
+{
+	test_basic();
+	test_random();
+	return check_result("timer_wheel");
+}
@@ -0,0 +1,239 @@
+#include "check.h"
+#include "app.h"
+
+/**
+ * Counts the wakeups of a scripted day with the slack windows of the
+ * firmware and with every slack at 0, and checks every client event is
+ * raised within its window. Only millis() and the timer are stand-ins,
+ * wakeup.cpp is the firmware code.
+ */
+
+volatile uint16_t g_task_event_type = NO_EVENT;
+
+/** Virtual time and the single timer of wakeup.cpp */
+static uint32_t now_ms = 0;
+static TimerEvent_t *armed = NULL;
+static uint32_t armed_due = 0;
+static bool wake_posted = false;
+
+uint32_t millis(void)
+{
+	return now_ms;
+}
+
+void TimerInit(TimerEvent_t *obj, void (*callback)(void))
+{
+	obj->Callback = callback;
+}
+
+void TimerSetValue(TimerEvent_t *obj, uint32_t value)
+{
+	obj->ReloadValue = value;
+}
+
+void TimerStart(TimerEvent_t *obj)
+{
+	armed = obj;
+	armed_due = now_ms + obj->ReloadValue;
+}
+
+void TimerStop(TimerEvent_t *obj)
+{
+	if (armed == obj)
+	{
+		armed = NULL;
+	}
+}
+
+void event_post(uint8_t queue, uint8_t type, uint32_t value)
+{
+	(void)value;
+	wake_posted = (queue == EVQ_TIMER) && (type == EV_WAKE);
+}
+
+/** Day of the script */
+#define DAY_MS (24UL * 60 * 60 * 1000)
+#define STATUS_MS (15UL * 60 * 1000)
+#define PULSE_MS (DEFAULT_VALVE_OPER_TIME_SEC * 1000UL)
+#define INTERVAL_MS (40UL * 60 * 1000)
+
+/** Watering started by the schedule, ms of the day */
+static const uint32_t schedule_starts[] = {6 * 3600000UL, 19 * 3600000UL + 30 * 60000UL};
+
+/** Uplinks requested with AT+UPLINK=30, ms of the day */
+static const uint32_t uplink_requests[] = {8 * 3600000UL + 123456, 13 * 3600000UL + 654321, 17 * 3600000UL + 42000};
+
+/** Client deadlines of the running day */
+struct s_expect
+{
+	bool set;
+	uint32_t deadline;
+	uint32_t slack;
+};
+
+static s_expect expect[WAKE_CLIENTS];
+static bool coalesce;
+static bool flow_meter;
+static uint8_t valve_phase; // 0 closed, 1 opening, 2 open, 3 closing
+static uint8_t next_schedule;
+
+/**
+ * @brief Set a deadline like the firmware does, without slack when not coalescing
+ */
+static void set(uint8_t client, uint32_t delay, uint32_t slack)
+{
+	expect[client].set = true;
+	expect[client].deadline = now_ms + delay;
+	expect[client].slack = coalesce ? slack : 0;
+	wake_set(client, expect[client].deadline, expect[client].slack);
+}
+
+/**
+ * @brief Arm the next schedule occurrence
+ */
+static void schedule_next(void)
+{
+	if (next_schedule < sizeof(schedule_starts) / sizeof(schedule_starts[0]))
+	{
+		set(WAKE_SCHEDULE, schedule_starts[next_schedule++] - now_ms, 0);
+	}
+}
+
+/**
+ * @brief Any uplink starts the status period over, see status_restart()
+ */
+static void uplink_sent(void)
+{
+	set(WAKE_STATUS, STATUS_MS, WAKE_STATUS_SLACK_MS);
+}
+
+/**
+ * @brief React to a raised client event like its handler
+ */
+static void raised(uint8_t client)
+{
+	// Never late, never earlier than the slack allows
+	CHECK((int32_t)(now_ms - expect[client].deadline) <= 0);
+	CHECK((int32_t)(expect[client].deadline - now_ms) <= (int32_t)(expect[client].slack + 10));
+	expect[client].set = false;
+
+	switch (client)
+	{
+	case WAKE_STATUS:
+	case WAKE_UPLINK:
+		uplink_sent();
+		break;
+	case WAKE_SCHEDULE:
+		valve_phase = 1;
+		set(WAKE_VALVE_ACT, PULSE_MS, 0);
+		schedule_next();
+		break;
+	case WAKE_VALVE_ACT:
+		// Every valve change is reported right away
+		uplink_sent();
+		if (valve_phase == 1)
+		{
+			valve_phase = 2;
+			set(WAKE_VALVE_INTERVAL, INTERVAL_MS - PULSE_MS, 0);
+			if (flow_meter)
+			{
+				set(WAKE_FLOW, FLOW_CHECK_MS, FLOW_CHECK_MS / 5);
+			}
+		}
+		else
+		{
+			valve_phase = 0;
+			if (flow_meter)
+			{
+				set(WAKE_FLOW, FLOW_SETTLE_MS, 0);
+			}
+		}
+		break;
+	case WAKE_VALVE_INTERVAL:
+		valve_phase = 3;
+		set(WAKE_VALVE_ACT, PULSE_MS, 0);
+		break;
+	case WAKE_FLOW:
+		if (valve_phase == 2)
+		{
+			set(WAKE_FLOW, FLOW_CHECK_MS, FLOW_CHECK_MS / 5);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Run the scripted day
+ *
+ * @return uint32_t number of wakeups
+ */
+static uint32_t run_day(bool with_slack, bool with_flow)
+{
+	coalesce = with_slack;
+	flow_meter = with_flow;
+	valve_phase = 0;
+	next_schedule = 0;
+	now_ms = 1000;
+	memset(expect, 0, sizeof(expect));
+	wake_init();
+	g_wake_count = 0;
+	uplink_sent();
+	schedule_next();
+
+	uint8_t next_request = 0;
+	while (now_ms < DAY_MS)
+	{
+		uint32_t request = (next_request < sizeof(uplink_requests) / sizeof(uplink_requests[0]))
+							   ? uplink_requests[next_request]
+							   : DAY_MS;
+		if (armed && ((int32_t)(armed_due - request) < 0))
+		{
+			TimerEvent_t *timer = armed;
+			now_ms = armed_due;
+			armed = NULL;
+			wake_posted = false;
+			timer->Callback();
+			CHECK(wake_posted);
+
+			g_task_event_type = 0;
+			wake_handler();
+			for (uint8_t client = 0; client < WAKE_CLIENTS; client++)
+			{
+				if (expect[client].set && !wake_pending(client))
+				{
+					raised(client);
+				}
+			}
+			// The sleep time is the time to the armed timer
+			CHECK_EQ(wake_next_ms(), armed ? armed_due - now_ms : WAKE_NEVER);
+			continue;
+		}
+
+		// The command arrived over BLE, that wakeup is not the timer's
+		now_ms = request;
+		next_request++;
+		if (request < DAY_MS)
+		{
+			set(WAKE_UPLINK, 30000, WAKE_UPLINK_SLACK_MS);
+		}
+	}
+	return g_wake_count;
+}
+
+int main()
+{
+	static const char *names[] = {"valve only", "flow meter"};
+
+	printf("%-12s %12s %12s\n", "day", "coalesced", "uncoalesced");
+	for (uint8_t flow = 0; flow < 2; flow++)
+	{
+		uint32_t coalesced = run_day(true, flow);
+		uint32_t uncoalesced = run_day(false, flow);
+		printf("%-12s %12lu %12lu\n", names[flow], (unsigned long)coalesced, (unsigned long)uncoalesced);
+
+		CHECK(coalesced < uncoalesced);
+	}
+	return check_result("test_wakeup");
+}
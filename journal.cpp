@@ -0,0 +1,453 @@
+#include "app.h"
+
+#ifdef NRF52_SERIES
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Journal segments, the newest one is appended to */
+static const char *journal_seg_name[2] = {"/vlv_j0", "/vlv_j1"};
+static File journal_file(InternalFS);
+#endif
+
+extern s_valve_settings g_valve_settings;
+
+/** Record types */
+#define JR_SEGMENT 1  // First record of a segment, value is the segment generation
+#define JR_STATE 2	  // Valve reached a position, value is VALVE_STATE_*
+#define JR_OPER 3	  // Operational time changed, value in sec
+#define JR_INTERVAL 4 // Interval started or checkpointed, value is remaining sec, 0 when it ended
+#define JR_MAX_OPEN 5 // Number of zones open at once changed
+#define JR_MOTOR 6	  // Charge drawn from the 9V battery in mAs
+#define JR_VOLUME 7	  // Total flow meter volume in 0.1 L
+#define JR_FLOW_MAX 8 // Flow rate limit in 0.1 L/min
+#define JR_TRAVEL 9	  // Learned travel time in ms, 0 if unknown
+#define JR_TIME 10	  // Wall clock in sec since epoch
+
+/** One journal record, CRC over all fields before it */
+struct s_journal_rec
+{
+	uint32_t value;
+	uint16_t seq;
+	uint8_t type;
+	uint8_t zone;
+	uint16_t spare;
+	uint16_t crc;
+};
+
+/** Segment in use, its generation and number of records */
+static uint8_t journal_seg = 0;
+static uint32_t journal_gen = 0;
+static uint16_t journal_count = 0;
+
+/** Record sequence number */
+static uint16_t journal_seq = 0;
+
+/** Last recorded interval time left per zone, restored at boot */
+static uint32_t restored_interval[VALVE_ZONES];
+
+/** Last recorded wall clock, 0 if never set */
+static uint32_t restored_time = 0;
+
+/** Last recorded 9V battery charge */
+static uint32_t recorded_motor_used = 0;
+static uint32_t recorded_volume = 0;
+
+/** Statistics for AT+JRNL */
+uint32_t g_journal_writes = 0;
+uint32_t g_journal_scan_us = 0;
+
+/**
+ * @brief CRC-16/CCITT
+ */
+static uint16_t journal_crc(const uint8_t *data, uint8_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		crc ^= data[idx] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Check a record read from flash
+ */
+static bool journal_valid(const s_journal_rec *rec)
+{
+	return rec->crc == journal_crc((const uint8_t *)rec, offsetof(s_journal_rec, crc));
+}
+
+/**
+ * @brief Apply a record to the valve settings
+ */
+static void journal_apply(const s_journal_rec *rec)
+{
+	if (rec->zone >= VALVE_ZONES)
+	{
+		return;
+	}
+
+	switch (rec->type)
+	{
+	case JR_STATE:
+		g_valve_settings.state[rec->zone] = rec->value ? VALVE_STATE_OPENED : VALVE_STATE_CLOSED;
+		break;
+	case JR_OPER:
+		g_valve_settings.oper_time_sec[rec->zone] = rec->value;
+		break;
+	case JR_INTERVAL:
+		restored_interval[rec->zone] = rec->value;
+		break;
+	case JR_MAX_OPEN:
+		if ((rec->value >= 1) && (rec->value <= VALVE_ZONES))
+		{
+			g_valve_settings.max_open = rec->value;
+		}
+		break;
+	case JR_MOTOR:
+		battery_motor_set_used(rec->value);
+		recorded_motor_used = rec->value;
+		break;
+	case JR_TRAVEL:
+		g_valve_settings.travel_ms[rec->zone] = rec->value;
+		break;
+	case JR_VOLUME:
+		flow_set_volume(rec->value);
+		recorded_volume = rec->value;
+		break;
+	case JR_FLOW_MAX:
+		flow_set_max_rate(rec->value);
+		break;
+	case JR_TIME:
+		restored_time = rec->value;
+		break;
+	}
+}
+
+#ifdef NRF52_SERIES
+/**
+ * @brief Read the generation of a segment
+ *
+ * @return uint32_t generation, 0 if the segment is missing or damaged
+ */
+static uint32_t journal_seg_gen(uint8_t seg)
+{
+	s_journal_rec rec;
+	uint32_t gen = 0;
+	if (journal_file.open(journal_seg_name[seg], FILE_O_READ))
+	{
+		if ((journal_file.read(&rec, sizeof(rec)) == sizeof(rec)) && journal_valid(&rec) && (rec.type == JR_SEGMENT))
+		{
+			gen = rec.value;
+		}
+		journal_file.close();
+	}
+	return gen;
+}
+
+/**
+ * @brief Replay a segment, stops at the first damaged record
+ *
+ * @param seg segment index
+ * @param torn set if the segment ends in a damaged record
+ * @return uint16_t number of valid records
+ */
+static uint16_t journal_replay(uint8_t seg, bool *torn)
+{
+	s_journal_rec rec;
+	uint16_t count = 0;
+	*torn = false;
+	if (!journal_file.open(journal_seg_name[seg], FILE_O_READ))
+	{
+		return 0;
+	}
+	while (count < JOURNAL_SEG_RECORDS)
+	{
+		size_t len = journal_file.read(&rec, sizeof(rec));
+		if (len == 0)
+		{
+			break;
+		}
+		if ((len != sizeof(rec)) || !journal_valid(&rec))
+		{
+			*torn = true;
+			break;
+		}
+		journal_apply(&rec);
+		journal_seq = rec.seq;
+		count++;
+	}
+	journal_file.close();
+	return count;
+}
+#endif
+
+/**
+ * @brief Append one record to the open segment
+ */
+static bool journal_write(uint8_t type, uint8_t zone, uint32_t value)
+{
+	s_journal_rec rec;
+	rec.value = value;
+	rec.seq = ++journal_seq;
+	rec.type = type;
+	rec.zone = zone;
+	rec.spare = 0;
+	rec.crc = journal_crc((uint8_t *)&rec, offsetof(s_journal_rec, crc));
+
+#ifdef NRF52_SERIES
+	// FILE_O_WRITE opens at the end of the file
+	if (!journal_file.open(journal_seg_name[journal_seg], FILE_O_WRITE))
+	{
+		MYLOG("JRNL", "Failed to open journal");
+		return false;
+	}
+	bool ok = journal_file.write((uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+	journal_file.close();
+	g_journal_writes++;
+	journal_count++;
+	return ok;
+#else
+	return true;
+#endif
+}
+
+/**
+ * @brief Zones whose interval is resumed after a reset, volume intervals are not
+ */
+static uint8_t journal_resumable(void)
+{
+	return g_valve_settings.interval_running & ~g_valve_settings.interval_volume;
+}
+
+/**
+ * @brief Start a new segment in the other file with a snapshot of the current state
+ *		  The old segment is kept until the snapshot is complete, a reset during
+ *		  the switch replays the old segment first.
+ */
+static void journal_rotate(void)
+{
+	journal_seg ^= 1;
+	journal_gen++;
+	journal_count = 0;
+#ifdef NRF52_SERIES
+	InternalFS.remove(journal_seg_name[journal_seg]);
+#endif
+	journal_write(JR_SEGMENT, 0, journal_gen);
+	journal_write(JR_MAX_OPEN, 0, g_valve_settings.max_open);
+	journal_write(JR_MOTOR, 0, battery_motor_used());
+	journal_write(JR_VOLUME, 0, flow_volume());
+	journal_write(JR_FLOW_MAX, 0, flow_max_rate());
+	if (time_now())
+	{
+		journal_write(JR_TIME, 0, time_now());
+	}
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		journal_write(JR_OPER, zone, g_valve_settings.oper_time_sec[zone]);
+		journal_write(JR_STATE, zone, g_valve_settings.state[zone]);
+		journal_write(JR_TRAVEL, zone, g_valve_settings.travel_ms[zone]);
+		uint32_t remaining = (journal_resumable() & (1 << zone)) ? valve_interval_remaining(zone) : restored_interval[zone];
+		journal_write(JR_INTERVAL, zone, remaining);
+	}
+}
+
+/**
+ * @brief Append a record, switching segments when the current one is full
+ */
+static void journal_record(uint8_t type, uint8_t zone, uint32_t value)
+{
+	if (journal_count >= JOURNAL_SEG_RECORDS)
+	{
+		journal_rotate();
+	}
+	journal_write(type, zone, value);
+}
+
+/**
+ * @brief Restore the valve settings from the journal, call after the defaults are set
+ *		  Reads at most two segments, the older one first.
+ */
+void journal_init(void)
+{
+	uint32_t start = micros();
+	memset(restored_interval, 0, sizeof(restored_interval));
+
+#ifdef NRF52_SERIES
+	uint32_t gen[2] = {journal_seg_gen(0), journal_seg_gen(1)};
+	uint8_t newest = (gen[1] > gen[0]) ? 1 : 0;
+	bool torn = false;
+
+	if (gen[newest] == 0)
+	{
+		MYLOG("JRNL", "No journal, starting new");
+		journal_seg = 1;
+		journal_gen = 0;
+		journal_rotate();
+		return;
+	}
+
+	if (gen[newest ^ 1])
+	{
+		journal_replay(newest ^ 1, &torn);
+	}
+	journal_seg = newest;
+	journal_gen = gen[newest];
+	journal_count = journal_replay(newest, &torn);
+
+	g_journal_scan_us = micros() - start;
+	MYLOG("JRNL", "Restored gen %lu, %d records in %lu us", journal_gen, journal_count, g_journal_scan_us);
+
+	// Records after a damaged one would not be read back
+	if (torn)
+	{
+		MYLOG("JRNL", "Damaged record, new segment");
+		journal_rotate();
+	}
+#else
+	(void)start;
+#endif
+}
+
+/**
+ * @brief Interval time left of a zone when the node was reset
+ *
+ * @param zone valve zone
+ * @return uint32_t seconds, 0 if no interval was running
+ */
+uint32_t journal_interval_restored(uint8_t zone)
+{
+	return restored_interval[zone];
+}
+
+/**
+ * @brief Wall clock at the last record before the reset
+ *
+ * @return uint32_t seconds since epoch, 0 if the clock was never set
+ */
+uint32_t journal_time_restored(void)
+{
+	return restored_time;
+}
+
+/**
+ * @brief Record the wall clock, restored after a reset
+ */
+void journal_time(uint32_t epoch)
+{
+	journal_record(JR_TIME, 0, epoch);
+}
+
+/**
+ * @brief Record a valve that reached its position
+ */
+void journal_valve_state(uint8_t zone, uint8_t state)
+{
+	journal_record(JR_STATE, zone, state);
+}
+
+/**
+ * @brief Record the operational time of a zone
+ */
+void journal_oper_time(uint8_t zone, uint32_t sec)
+{
+	journal_record(JR_OPER, zone, sec);
+}
+
+/**
+ * @brief Record the time left of an interval, 0 when it ended
+ */
+void journal_interval(uint8_t zone, uint32_t remaining_sec)
+{
+	restored_interval[zone] = remaining_sec;
+	journal_record(JR_INTERVAL, zone, remaining_sec);
+}
+
+/**
+ * @brief Record the number of zones that may be open at once
+ */
+void journal_max_open(uint8_t max_open)
+{
+	journal_record(JR_MAX_OPEN, 0, max_open);
+}
+
+/**
+ * @brief Record a learned valve travel time
+ */
+void journal_travel(uint8_t zone, uint16_t ms)
+{
+	journal_record(JR_TRAVEL, zone, ms);
+}
+
+/**
+ * @brief Record the charge drawn from the 9V battery if it changed
+ */
+void journal_motor_used(void)
+{
+	if (battery_motor_used() != recorded_motor_used)
+	{
+		recorded_motor_used = battery_motor_used();
+		journal_record(JR_MOTOR, 0, recorded_motor_used);
+	}
+}
+
+/**
+ * @brief Record the total flow meter volume if it changed
+ */
+void journal_flow_volume(void)
+{
+	if (flow_volume() != recorded_volume)
+	{
+		recorded_volume = flow_volume();
+		journal_record(JR_VOLUME, 0, recorded_volume);
+	}
+}
+
+/**
+ * @brief Record a new flow rate limit
+ */
+void journal_flow_max_rate(uint16_t rate)
+{
+	journal_record(JR_FLOW_MAX, 0, rate);
+}
+
+/**
+ * @brief Record the time left of all running intervals, the 9V battery use, the flow volume
+ *		  and the wall clock. Limits how much a resumed interval can overrun and
+ *		  how far the clock falls behind after a reset.
+ */
+void journal_checkpoint(void)
+{
+	journal_motor_used();
+	journal_flow_volume();
+	if (time_now())
+	{
+		journal_time(time_now());
+	}
+
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (journal_resumable() & (1 << zone))
+		{
+			journal_interval(zone, valve_interval_remaining(zone));
+		}
+	}
+}
+
+/**
+ * @brief Write the journal statistics in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void journal_print(char *buf, uint16_t size)
+{
+	snprintf(buf, size, "Seg %d gen %lu, %d/%d records, %lu writes, boot scan %lu us", journal_seg,
+			 (unsigned long)journal_gen, journal_count, JOURNAL_SEG_RECORDS, (unsigned long)g_journal_writes,
+			 (unsigned long)g_journal_scan_us);
+}
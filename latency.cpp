@@ -0,0 +1,137 @@
+#include "app.h"
+
+/** Current poll period in ms, 0 while the latency mode is off */
+static uint32_t poll_ms = 0;
+
+/** Time of the last uplink while the latency mode was on */
+static uint32_t last_poll_millis = 0;
+
+/** Longest time between uplinks while the latency mode was on, in ms */
+static uint32_t worst_gap_ms = 0;
+
+/**
+ * @brief Normal status period, not shortened and not stretched
+ */
+static uint32_t latency_normal_ms(void)
+{
+	return battery_report_period(g_lorawan_settings.send_repeat_time);
+}
+
+/**
+ * @brief Check if the latency mode is on
+ *		  It is off on low battery, the node falls back to the normal cadence.
+ */
+bool latency_active(void)
+{
+	return (poll_ms != 0) && !battery_low() && (g_lorawan_settings.send_repeat_time != 0);
+}
+
+/**
+ * @brief Start polling at the shortest period, after a command was received or a valve opened
+ */
+void latency_kick(void)
+{
+	if (battery_low() || (g_lorawan_settings.send_repeat_time == 0))
+	{
+		return;
+	}
+
+	if (!latency_active())
+	{
+		last_poll_millis = millis();
+	}
+	bool restart = (poll_ms != LATENCY_POLL_MIN_MS);
+	poll_ms = LATENCY_POLL_MIN_MS;
+	MYLOG("LAT", "Latency mode, polling every %lu s", poll_ms / 1000);
+
+	// Move the next status uplink forward
+	if (restart)
+	{
+		status_restart();
+	}
+}
+
+/**
+ * @brief An uplink was sent, each one opens the receive windows for pending commands
+ *		  The poll period doubles back to the normal cadence, it stays at
+ *		  LATENCY_POLL_OPEN_MS while a valve is open.
+ */
+void latency_polled(void)
+{
+	if (!latency_active())
+	{
+		poll_ms = 0;
+		return;
+	}
+
+	uint32_t now = millis();
+	if ((now - last_poll_millis) > worst_gap_ms)
+	{
+		worst_gap_ms = now - last_poll_millis;
+	}
+	last_poll_millis = now;
+
+	poll_ms *= 2;
+	if (valve_open_count() && (poll_ms > LATENCY_POLL_OPEN_MS))
+	{
+		poll_ms = LATENCY_POLL_OPEN_MS;
+	}
+	if (poll_ms >= latency_normal_ms())
+	{
+		MYLOG("LAT", "Back to the normal cadence, worst latency %lu s", worst_gap_ms / 1000);
+		poll_ms = 0;
+	}
+}
+
+/**
+ * @brief Status period, shortened while the latency mode is on
+ *
+ * @param normal_ms normal period in ms
+ * @return uint32_t period in ms
+ */
+uint32_t latency_period(uint32_t normal_ms)
+{
+	if (latency_active() && (poll_ms < normal_ms))
+	{
+		return poll_ms;
+	}
+	return normal_ms;
+}
+
+/**
+ * @brief Longest time a command could have waited while the latency mode was on
+ *
+ * @return uint32_t time in seconds, 0 if the latency mode was not used
+ */
+uint32_t latency_worst_sec(void)
+{
+	return worst_gap_ms / 1000;
+}
+
+/**
+ * @brief Forget the worst latency
+ */
+void latency_reset(void)
+{
+	worst_gap_ms = 0;
+}
+
+/**
+ * @brief Write the latency mode state in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void latency_print(char *buf, uint16_t size)
+{
+	if (latency_active())
+	{
+		snprintf(buf, size, "Polling every %lu s, worst latency %lu s", (unsigned long)(poll_ms / 1000),
+				 (unsigned long)latency_worst_sec());
+	}
+	else
+	{
+		snprintf(buf, size, "Normal cadence%s, worst latency %lu s", battery_low() ? " (low battery)" : "",
+				 (unsigned long)latency_worst_sec());
+	}
+}
@@ -0,0 +1,264 @@
+#include "app.h"
+
+/** Outcome counters since boot */
+s_link_stats g_link_stats;
+
+/** Consecutive failed and acknowledged uplinks */
+static uint8_t fail_streak = 0;
+static uint8_t ok_streak = 0;
+
+/** When the current run of failures began */
+static uint32_t loss_millis = 0;
+
+/** Link margin from the SNR of received downlinks, dB in 4.4 fixed point */
+static int16_t margin_x16 = LINK_MARGIN_UNKNOWN;
+
+/** Configured data rate and TX power, the adaptation never goes above them */
+static uint8_t dr_max = 0;
+static uint8_t power_max = 0;
+
+/** Rejoins without success */
+static uint8_t join_fails = 0;
+static bool rejoining = false;
+
+/**
+ * @brief Hand the data rate and TX power to the LoRaWAN stack
+ */
+static void link_apply(void)
+{
+	lmh_datarate_set(g_lorawan_settings.data_rate, g_lorawan_settings.adr_enabled);
+
+	MibRequestConfirm_t mib;
+	mib.Type = MIB_CHANNELS_TX_POWER;
+	mib.Param.ChannelsTxPower = g_lorawan_settings.tx_power;
+	LoRaMacMibSetRequestConfirm(&mib);
+
+	g_link_stats.adaptations++;
+	MYLOG("LINK", "DR %d, TX power %d", g_lorawan_settings.data_rate, g_lorawan_settings.tx_power);
+}
+
+/**
+ * @brief Remember the configured data rate and TX power as the upper limits
+ */
+void link_init(void)
+{
+	dr_max = g_lorawan_settings.data_rate;
+	power_max = g_lorawan_settings.tx_power;
+	memset(&g_link_stats, 0, sizeof(g_link_stats));
+}
+
+/**
+ * @brief Count the result of handing an uplink to the stack
+ *
+ * @param result send_lora_packet() result
+ */
+void link_send_result(lmh_error_status result)
+{
+	switch (result)
+	{
+	case LMH_SUCCESS:
+		break;
+	case LMH_BUSY:
+		g_link_stats.busy++;
+		break;
+	case LMH_ERROR:
+		g_link_stats.errors++;
+		// The payload does not fit a data rate lowered by the adaptation
+		if (!g_lorawan_settings.adr_enabled && (g_lorawan_settings.data_rate < dr_max))
+		{
+			g_lorawan_settings.data_rate++;
+			link_apply();
+		}
+		break;
+	}
+}
+
+/**
+ * @brief Track the link margin from a received downlink
+ *		  The SNR above the demodulation floor of the spreading factor,
+ *		  about -2.5 dB per step from -7.5 dB at SF7.
+ *
+ * @param snr SNR of the downlink in dB
+ */
+void link_rx(int8_t snr)
+{
+	int16_t floor_x2 = -15 - 5 * (airtime_dr_sf(airtime_plan(), g_lorawan_settings.data_rate) - 7);
+	int16_t margin = (2 * snr - floor_x2) * 8;
+	if (margin_x16 == LINK_MARGIN_UNKNOWN)
+	{
+		margin_x16 = margin;
+	}
+	else
+	{
+		margin_x16 += (margin - margin_x16) / 4;
+	}
+}
+
+/**
+ * @brief Start a new join, uplinks wait until it finished
+ */
+static void link_rejoin(void)
+{
+	MYLOG("LINK", "%d uplinks lost in %lu s, rejoining", fail_streak, (millis() - loss_millis) / 1000);
+	g_link_stats.rejoins++;
+	rejoining = true;
+	fail_streak = 0;
+
+	// Back to the configured settings, the network may have moved
+	g_lorawan_settings.data_rate = dr_max;
+	g_lorawan_settings.tx_power = power_max;
+	g_join_result = false;
+	lmh_join();
+}
+
+/**
+ * @brief Count the outcome of an uplink and adapt data rate and TX power
+ *		  Failures first restore the TX power, then lower the data rate
+ *		  every LINK_DR_DOWN_FAILS. A long run of good uplinks with enough
+ *		  margin raises the data rate, then lowers the TX power. Without a
+ *		  known margin the run only raises the data rate. Only sustained
+ *		  loss leads to a rejoin.
+ *
+ * @param success the uplink was sent (and acknowledged if confirmed)
+ */
+void link_tx_done(bool success)
+{
+	bool adapt = !g_lorawan_settings.adr_enabled;
+
+	if (success)
+	{
+		g_link_stats.acked++;
+		fail_streak = 0;
+		if (++ok_streak < LINK_UP_OKS)
+		{
+			return;
+		}
+		ok_streak = 0;
+		if (!adapt)
+		{
+			return;
+		}
+		if (margin_x16 == LINK_MARGIN_UNKNOWN)
+		{
+			// Acknowledgements without app data carry no SNR, the acknowledged
+			// uplinks alone raise the data rate, a failure lowers it again
+			if (g_lorawan_settings.data_rate < dr_max)
+			{
+				g_lorawan_settings.data_rate++;
+				link_apply();
+			}
+			return;
+		}
+		if (margin_x16 < LINK_MARGIN_UP_DB * 16)
+		{
+			return;
+		}
+		if (g_lorawan_settings.data_rate < dr_max)
+		{
+			g_lorawan_settings.data_rate++;
+			link_apply();
+		}
+		else if (g_lorawan_settings.tx_power < power_max + LINK_POWER_SAVE_STEPS)
+		{
+			g_lorawan_settings.tx_power++;
+			link_apply();
+		}
+		// A lower data rate or power spends some of the margin
+		margin_x16 -= 2 * 16;
+		return;
+	}
+
+	g_link_stats.failed++;
+	ok_streak = 0;
+	if (fail_streak == 0)
+	{
+		loss_millis = millis();
+	}
+	if (fail_streak < UINT8_MAX)
+	{
+		fail_streak++;
+	}
+
+	if (adapt && ((fail_streak % LINK_DR_DOWN_FAILS) == 0))
+	{
+		if (g_lorawan_settings.tx_power > power_max)
+		{
+			g_lorawan_settings.tx_power = power_max;
+			link_apply();
+		}
+		else if (g_lorawan_settings.data_rate > LINK_DR_MIN)
+		{
+			g_lorawan_settings.data_rate--;
+			link_apply();
+		}
+	}
+
+	if ((fail_streak >= LINK_REJOIN_FAILS) && ((millis() - loss_millis) >= LINK_LOSS_MIN_MS))
+	{
+		link_rejoin();
+	}
+}
+
+/**
+ * @brief A join finished, a node that cannot rejoin is reset as the last resort
+ *
+ * @param success the node joined
+ */
+void link_join_done(bool success)
+{
+	if (success)
+	{
+		if (rejoining)
+		{
+			link_apply();
+		}
+		rejoining = false;
+		join_fails = 0;
+		return;
+	}
+
+	if (!rejoining)
+	{
+		return;
+	}
+	if (++join_fails >= LINK_RESET_JOINS)
+	{
+		MYLOG("LINK", "Rejoin failed %d times, resetting", join_fails);
+		delay(100);
+		api_reset();
+	}
+	lmh_join();
+}
+
+/**
+ * @brief Time to wait before an undelivered uplink is sent again
+ *		  Doubles with every failure in a row, from UPLINK_RETRY_MS.
+ *
+ * @return uint32_t delay in ms
+ */
+uint32_t link_retry_ms(void)
+{
+	uint8_t shift = fail_streak ? fail_streak - 1 : 0;
+	if (shift > LINK_BACKOFF_MAX_SHIFT)
+	{
+		shift = LINK_BACKOFF_MAX_SHIFT;
+	}
+	return (uint32_t)UPLINK_RETRY_MS << shift;
+}
+
+/**
+ * @brief Write the link state in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void link_print(char *buf, uint16_t size)
+{
+	int len = snprintf(buf, size, "Ack %lu fail %lu busy %lu err %lu rejoin %lu, DR %d pwr %d", (unsigned long)g_link_stats.acked,
+					   (unsigned long)g_link_stats.failed, (unsigned long)g_link_stats.busy, (unsigned long)g_link_stats.errors,
+					   (unsigned long)g_link_stats.rejoins, g_lorawan_settings.data_rate, g_lorawan_settings.tx_power);
+	if (margin_x16 != LINK_MARGIN_UNKNOWN)
+	{
+		snprintf(&buf[len], size - len, ", margin %d dB", margin_x16 / 16);
+	}
+}
@@ -9,23 +9,9 @@
 /** Set the device name, max length is 10 characters */
 char g_ble_dev_name[10] = "RAK-VLVC";
 
-/** Send Fail counter **/
-uint8_t send_fail = 0;
-
-/** Flag for low battery protection */
-bool low_batt_protection = false;
-
-/** Battery level union */
-batt_s batt_level;
-
-/** Valve interval state union */
-valve_s valve_state;
-
 /** LPWAN packet */
-lpwan_data_s g_lpwan_data;
-
-/** RAK13003 GPIO Expander */
-Adafruit_MCP23X17 mcp;
+uint8_t g_lpwan_data[PAYLOAD_MAX_LEN];
+uint8_t g_lpwan_data_len = 0;
 
 /** Global settings for valve state */
 s_valve_settings g_valve_settings;
@@ -33,26 +19,46 @@ s_valve_settings g_valve_settings;
 /** Flag showing if TX cycle is ongoing */
 bool lora_busy = false;
 
-/** Prototypes */
-int setValve(int state, int sec);
-
-/** User timer */
-TimerEvent_t valveTimer;
+/** Time from boot to the first join, 0 while not joined */
+uint32_t g_boot_join_ms = 0;
 
-void valve_interval_expiry_handler(void)
+uint32_t app_timers_init()
 {
-	MYLOG("APP", "Timer handling valve interval expiry, closing valve");
-	setValve(VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec);
-	g_valve_settings.valve_interval_started = false;
+	wake_init();
+	valve_actuator_init();
+	return 0;
+}
 
-	// Manually trigger a lorawan uplink
-	send_lora_uplink();
+/**
+ * @brief Period of the status uplink, stretched as the battery runs down
+ *
+ * @return uint32_t period in ms, 0 if periodic uplinks are disabled
+ */
+static uint32_t status_period_ms(void)
+{
+	if (g_lorawan_settings.send_repeat_time == 0)
+	{
+		return 0;
+	}
+	return latency_period(battery_report_period(g_lorawan_settings.send_repeat_time));
 }
 
-uint32_t app_timers_init()
+/**
+ * @brief Start the status period over, any uplink counts as status
+ */
+void status_restart(void)
 {
-	TimerInit(&valveTimer, valve_interval_expiry_handler);
-	return 0;
+	// The WisBlock-API send timer would wake the node on its own
+	api_timer_stop();
+
+	if (status_period_ms())
+	{
+		wake_set(WAKE_STATUS, millis() + status_period_ms(), WAKE_STATUS_SLACK_MS);
+	}
+	else
+	{
+		wake_clear(WAKE_STATUS);
+	}
 }
 
 /**
@@ -60,26 +66,29 @@ uint32_t app_timers_init()
 */
 void setup_app(void)
 {
+	// Keep the log records of the run before a reset
+	tlog_init();
+
 	pinMode(WB_IO2, OUTPUT);
 	digitalWrite(WB_IO2, 1);
 
-	// Reset device
+	// Reset device, the MCP23017 needs a 1 us low pulse once the slot power is up
 	pinMode(WB_IO4, OUTPUT);
 	digitalWrite(WB_IO4, 1);
-	delay(10);
+	delay(2);
 	digitalWrite(WB_IO4, 0);
-	delay(10);
+	delayMicroseconds(10);
 	digitalWrite(WB_IO4, 1);
-	delay(10);
 
 	// Initialize Serial for debug output
 	Serial.begin(115200);
 
+#if SERIAL_WAIT_MS > 0
 	time_t serial_timeout = millis();
 	// On nRF52840 the USB serial is not available immediately
 	while (!Serial)
 	{
-		if ((millis() - serial_timeout) < 5000)
+		if ((millis() - serial_timeout) < SERIAL_WAIT_MS)
 		{
 			delay(100);
 			digitalWrite(LED_GREEN, !digitalRead(LED_GREEN));
@@ -90,6 +99,7 @@ void setup_app(void)
 		}
 	}
 	digitalWrite(LED_GREEN, LOW);
+#endif
 
 	MYLOG("APP", "WisBlock Valve Controller");
 
@@ -103,9 +113,8 @@ void setup_app(void)
 
 	// Setup GPIO Expander
 	MYLOG("APP", "Initializing RAK13003 GPIO Expander");
-	mcp.begin_I2C(); // Use default address 0.
-	mcp.pinMode(VPIN_OPEN, OUTPUT);
-	mcp.pinMode(VPIN_CLOSED, OUTPUT);
+	expander_init();
+	valve_pins_init();
 
 	MYLOG("APP", "Initializing LoRaWAN settings");
 	// Setup LoRaWAN credentials hard coded
@@ -116,6 +125,8 @@ void setup_app(void)
 
 	// Read LoRaWAN settings from flash
 	api_read_credentials();
+	s_lorawan_settings stored_settings;
+	memcpy(&stored_settings, &g_lorawan_settings, sizeof(s_lorawan_settings));
 
 	// Modify credentials to be unique in credentials.h
 	uint8_t node_device_eui[8] = NODE_DEVICE_EUI;
@@ -148,8 +159,16 @@ void setup_app(void)
 	g_lorawan_settings.resetRequest = true;							// Command from BLE to reset device
 	g_lorawan_settings.lora_region = LORAMAC_REGION_US915;			// LoRa region
 
-	// Save LoRaWAN settings
-	api_set_credentials();
+	// Save LoRaWAN settings, only if they changed to save a flash write on every boot
+	if (memcmp(&stored_settings, &g_lorawan_settings, sizeof(s_lorawan_settings)) != 0)
+	{
+		MYLOG("APP", "LoRaWAN settings changed, saving");
+		api_set_credentials();
+	}
+
+	// The link adaptation stays within the configured data rate and TX power
+	link_init();
+	airtime_init();
 
 	// Create a user timer to periodically check valve interval
 	MYLOG("APP", "Initializing valve timer");
@@ -157,9 +176,33 @@ void setup_app(void)
 
 	// Initialize valve settings
 	MYLOG("APP", "Initializing valve settings");
-	g_valve_settings.valve_interval_started = false;
-	g_valve_settings.oper_time_sec = DEFAULT_VALVE_OPER_TIME_SEC;
-	g_valve_settings.state = VALVE_STATE_CLOSED;
+	g_valve_settings.interval_running = 0;
+	g_valve_settings.interval_volume = 0;
+	g_valve_settings.stalled = 0;
+	g_valve_settings.max_open = VALVE_MAX_OPEN_ZONES;
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		g_valve_settings.oper_time_sec[zone] = DEFAULT_VALVE_OPER_TIME_SEC;
+		g_valve_settings.state[zone] = VALVE_STATE_CLOSED;
+		g_valve_settings.travel_ms[zone] = 0;
+	}
+
+	// Start counting flow meter pulses
+	flow_init();
+
+	// Restore calibration and interrupted intervals
+	MYLOG("APP", "Restoring valve journal");
+	journal_init();
+
+	// Restore the watering schedule, it runs once the clock is set
+	MYLOG("APP", "Initializing schedule");
+	schedule_init();
+
+	// Continue with the journaled clock, the schedule keeps running after a reset without the network
+	if (journal_time_restored())
+	{
+		time_set(journal_time_restored());
+	}
 }
 
 /**
@@ -178,93 +221,111 @@ bool init_app(void)
 	api_log_settings();
 	Serial.println("================================================");
 #endif
-	// Ensure our valve is closed at initialization
-	MYLOG("APP", "Setting default state: Closing valve");
-	setValve(VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec);
+	// First battery sample, before any relay is powered
+	battery_sample();
+
+	// Ensure our valves are closed at initialization, unless an interrupted interval is resumed
+	MYLOG("APP", "Setting default state: Closing valves");
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		uint32_t remaining = journal_interval_restored(zone);
+		if (VALVE_RESUME_INTERVAL && remaining && beginValveInterval(zone, remaining, HC_BOOT))
+		{
+			MYLOG("APP", "Zone %d interval resumed, %lu sec left", zone, remaining);
+			continue;
+		}
+		if (remaining)
+		{
+			journal_interval(zone, 0);
+		}
+		setValve(zone, VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec[zone], false, HC_BOOT);
+	}
 
 #ifdef BLE_ADVERTISE_FOREVER
 	// Start bluetooth to run forever
 	restart_advertising(0);
+	energy_begin(EN_BLE);
 #endif
 
 	return true;
 }
 
 /**
- * @brief Send LoRaWAN uplink
- *		  Payload is battery, remaining valve interval, and valve state
- */
-void send_lora_uplink(void)
+   @brief Application specific event handler
+		  Requires as minimum the handling of STATUS event
+		  Here you handle as well your application specific events
+*/
+void app_event_handler(void)
 {
-	// Check if lora has joined
-	if (g_join_result)
-	{
-		if (!lora_busy)
-		{
-			// Read the current remaining valve interval and state
-			if (g_valve_settings.valve_interval_started)
-			{
-				int curMillis = millis();
-				int diff = curMillis - g_valve_settings.valve_interval_begin_millis;
-				int remain = g_valve_settings.valve_interval_millis - diff;
-				valve_state.valve_ts16 = (uint16_t)(remain / 1000);
-			}
-			else
-			{
-				valve_state.valve_ts16 = 0;
-			}
+	energy_begin(EN_MCU);
 
-			g_lpwan_data.valve_inteval_1 = valve_state.valve_ts8[1];
-			g_lpwan_data.valve_inteval_2 = valve_state.valve_ts8[0];
+	// Events queued by the timer and the interrupts, oldest first. The queues
+	// are drained on every call, so an event whose bit was lost is not missed.
+	// The shared wakeup raises the events of all clients that are due.
+	g_task_event_type &= N_APP_EVENT;
+	event_handler();
 
-			// Current valve state (single bit)
-			g_lpwan_data.valve_opened = (g_valve_settings.state == VALVE_STATE_OPENED);
+	// Relay pulse finished
+	if ((g_task_event_type & VALVE_ACT_DONE) == VALVE_ACT_DONE)
+	{
+		g_task_event_type &= N_VALVE_ACT_DONE;
+		valve_actuator_handler();
+	}
 
-			// Get battery level
-			batt_level.batt16 = read_batt() / 10;
-			g_lpwan_data.batt_1 = batt_level.batt8[1];
-			g_lpwan_data.batt_2 = batt_level.batt8[0];
+	// Valve interval expired
+	if ((g_task_event_type & VALVE_INTERVAL_DONE) == VALVE_INTERVAL_DONE)
+	{
+		g_task_event_type &= N_VALVE_INTERVAL_DONE;
+		valve_interval_handler();
+	}
 
-			lmh_error_status result = send_lora_packet((uint8_t *)&g_lpwan_data, LPWAN_DATA_LEN);
-			switch (result)
-			{
-			case LMH_SUCCESS:
-				MYLOG("APP", "Packet enqueued");
-				// Set a flag that TX cycle is running
-				lora_busy = true;
-				break;
-			case LMH_BUSY:
-				MYLOG("APP", "LoRa transceiver is busy");
-				break;
-			case LMH_ERROR:
-				MYLOG("APP", "Packet error, too big to send with current DR");
-				break;
-			}
-		}
-		else
-		{
-			MYLOG("APP", "LoRaWAN TX cycle not finished, skip this event");
-		}
+	// Flow check due or flow meter count reached
+	if ((g_task_event_type & FLOW_DUE) == FLOW_DUE)
+	{
+		g_task_event_type &= N_FLOW_DUE;
+		flow_handler();
 	}
-	else
+
+	// Scheduled watering due
+	if ((g_task_event_type & SCHEDULE_DUE) == SCHEDULE_DUE)
 	{
-		MYLOG("APP", "LoRaWAN not joined, skip this event");
+		g_task_event_type &= N_SCHEDULE_DUE;
+		schedule_handler();
+	}
+
+	// Requested uplink due
+	if ((g_task_event_type & UPLINK_DUE) == UPLINK_DUE)
+	{
+		g_task_event_type &= N_UPLINK_DUE;
+		MYLOG("APP", "Triggering uplink");
+		uplink_enqueue(UPLINK_REQUEST);
 	}
-}
 
-/**
-   @brief Application specific event handler
-		  Requires as minimum the handling of STATUS event
-		  Here you handle as well your application specific events
-*/
-void app_event_handler(void)
-{
 	// Timer triggered event
 	if ((g_task_event_type & STATUS) == STATUS)
 	{
 		g_task_event_type &= N_STATUS;
 		MYLOG("APP", "Timer wakeup");
 
+		// Battery state sets the length of the next period
+		battery_sample();
+
+		// Restart the period even if no uplink can be sent now
+		status_restart();
+
+		// Bound the overrun of an interval resumed after a reset
+		journal_checkpoint();
+
+		// Flow rate for the report, leaks have to show within a period
+		flow_tick();
+
+		// Valve events since the last batch
+		history_tick();
+		if (history_pending())
+		{
+			uplink_enqueue(UPLINK_HISTORY);
+		}
+
 #ifndef BLE_ADVERTISE_FOREVER
 #ifdef NRF52_SERIES
 		// If BLE is enabled, restart Advertising
@@ -273,36 +334,30 @@ void app_event_handler(void)
 			if (g_lorawan_settings.auto_join)
 			{
 				restart_advertising(15);
+				energy_add_ms(EN_BLE, 15000);
 			}
 		}
 #endif
 #endif
 
-		if (lora_busy)
+		// A status is sent when the radio is free, an uplink that is about to go out carries it as well
+		if (valve_report_pending() || wake_pending(WAKE_UPLINK))
 		{
-			MYLOG("APP", "LoRaWAN TX cycle not finished, skip this event");
+			MYLOG("APP", "Status merged with pending uplink");
+		}
+		else if (energy_report_due())
+		{
+			uplink_enqueue(UPLINK_ENERGY);
 		}
 		else
 		{
-			send_lora_uplink();
-
-			// Protection against battery drain
-			if (batt_level.batt16 < 290)
-			{
-				// Battery is very low, change send time to 1 hour to protect battery
-				low_batt_protection = true;			   // Set low_batt_protection active
-				api_timer_restart(1 * 60 * 60 * 1000); // Set send time to one hour
-				MYLOG("APP", "Battery protection activated");
-			}
-			else if ((batt_level.batt16 > 380) && low_batt_protection)
-			{
-				// Battery is higher than 4V, change send time back to original setting
-				low_batt_protection = false;
-				api_timer_restart(g_lorawan_settings.send_repeat_time);
-				MYLOG("APP", "Battery protection deactivated");
-			}
+			uplink_enqueue(UPLINK_STATUS);
 		}
 	}
+
+	// Log records are sent once the event was handled
+	tlog_drain();
+	energy_end(EN_MCU);
 }
 
 #ifdef NRF52_SERIES
@@ -312,6 +367,7 @@ void app_event_handler(void)
 */
 void ble_data_handler(void)
 {
+	energy_begin(EN_MCU);
 	if (g_enable_ble)
 	{
 		// BLE UART data handling
@@ -321,14 +377,18 @@ void ble_data_handler(void)
 			/** BLE UART data arrived */
 			g_task_event_type &= N_BLE_DATA;
 
+			// Commands may be split across packets, complete lines are executed
+			char ble_rx_buf[BLE_RX_CHUNK];
 			while (g_ble_uart.available() > 0)
 			{
-				at_serial_input(uint8_t(g_ble_uart.read()));
-				delay(5);
+				uint16_t len = g_ble_uart.read((uint8_t *)ble_rx_buf, BLE_RX_CHUNK);
+				at_feed(ble_rx_buf, len, AT_SRC_BLE);
 			}
-			at_serial_input(uint8_t('\n'));
+			at_feed_end(AT_SRC_BLE);
 		}
 	}
+	tlog_drain();
+	energy_end(EN_MCU);
 }
 #endif
 
@@ -338,6 +398,8 @@ void ble_data_handler(void)
 */
 void lora_data_handler(void)
 {
+	energy_begin(EN_MCU);
+
 	// LoRa data handling
 	if ((g_task_event_type & LORA_DATA) == LORA_DATA)
 	{
@@ -349,30 +411,29 @@ void lora_data_handler(void)
 		/**************************************************************/
 		g_task_event_type &= N_LORA_DATA;
 		MYLOG("APP", "Received package over LoRa");
-		char log_buff[g_rx_data_len * 3] = {0};
-		uint8_t log_idx = 0;
-		for (int idx = 0; idx < g_rx_data_len; idx++)
-		{
-			sprintf(&log_buff[log_idx], "%02X ", g_rx_lora_data[idx]);
-			log_idx += 3;
-		}
+		MYLOG_HEX("APP", g_rx_lora_data, g_rx_data_len);
 
 		lora_busy = false;
-		MYLOG("APP", "%s", log_buff);
+		link_rx(g_last_snr);
 
-		// Currently all valve operations can be handled by user AT commands
+		// Valve operations are accepted as binary command frames or as user AT commands
 		// If additional actions based on downlink data are to be added, do it here
 
+		// A command may be followed by more, keep the receive windows coming
+		latency_kick();
+
+		// Binary command frames have their own port
+		if (g_last_fport == DOWNLINK_CMD_FPORT)
+		{
+			MYLOG("APP", "RECEIVED COMMAND FRAME");
+			downlink_handler(g_rx_lora_data, g_rx_data_len);
+		}
 		// Check to see if the data received over LoRa is an AT Command
-		if ((g_rx_lora_data[0] == 'A') && (g_rx_lora_data[1] == 'T') && (g_rx_lora_data[2] == '+'))
+		else if ((g_rx_lora_data[0] == 'A') && (g_rx_lora_data[1] == 'T') && (g_rx_lora_data[2] == '+'))
 		{
 			MYLOG("AT", "RECEIVED LORA");
-			for (int idx = 0; idx < g_rx_data_len; idx++)
-			{
-				at_serial_input(uint8_t(g_rx_lora_data[idx]));
-				delay(5);
-			}
-			at_serial_input(uint8_t('\n'));
+			// Parse in place, results are returned with the next uplink
+			at_dispatch((char *)g_rx_lora_data, g_rx_data_len, AT_SRC_LORA);
 		}
 	}
 
@@ -383,30 +444,30 @@ void lora_data_handler(void)
 
 		MYLOG("APP", "LPWAN TX cycle %s", g_rx_fin_result ? "finished ACK" : "failed NAK");
 
-		if (!g_rx_fin_result)
-		{
-			// Increase fail send counter
-			send_fail++;
+		// Failures lower the data rate, only sustained loss leads to a rejoin
+		link_tx_done(g_rx_fin_result);
 
-			if (send_fail == 10)
-			{
-				// Too many failed sendings, reset node and try to rejoin
-				delay(100);
-				api_reset();
-			}
-		}
-
-		// Clear the LoRa TX flag
+		// Clear the LoRa TX flag and send what was queued meanwhile
 		lora_busy = false;
+		uplink_tx_done(g_rx_fin_result);
+		uplink_drain();
 	}
 
 	// LoRa Join finished handling
 	if ((g_task_event_type & LORA_JOIN_FIN) == LORA_JOIN_FIN)
 	{
 		g_task_event_type &= N_LORA_JOIN_FIN;
+		link_join_done(g_join_result);
 		if (g_join_result)
 		{
-			MYLOG("APP", "Successfully joined network");
+			if (g_boot_join_ms == 0)
+			{
+				g_boot_join_ms = millis();
+			}
+			MYLOG("APP", "Successfully joined network %lu ms after boot", g_boot_join_ms);
+			// Periodic uplinks are timed by the deadline scheduler
+			status_restart();
+			uplink_drain();
 		}
 		else
 		{
@@ -415,4 +476,6 @@ void lora_data_handler(void)
 			// lmh_join();
 		}
 	}
+	tlog_drain();
+	energy_end(EN_MCU);
 }
\ No newline at end of file
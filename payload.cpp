@@ -0,0 +1,360 @@
+#include "payload.h"
+
+/**
+ * Version 1, 2 bytes while the valve is idle, 4 bytes during an interval
+ *
+ * | bits | field                                               |
+ * |------|-----------------------------------------------------|
+ * |   4  | version                                             |
+ * |   4  | flags (PAYLOAD_FLAG_*)                              |
+ * |   8  | battery, 10 mV steps above 2.0 V                    |
+ * |  16  | remaining interval, only with PAYLOAD_FLAG_INTERVAL |
+ *
+ * The remaining time is a 2 bit exponent and a 14 bit mantissa,
+ * seconds = mantissa << (3 * exponent). Exact up to 4.5 hours,
+ * 8 s steps up to 36 hours, up to 97 days in 512 s steps.
+ */
+static const payload_field_s schema_v1_fields[] = {
+	{PF_VERSION, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_FLAGS, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_BATT, 8, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_REMAIN, 16, PF_FLAGS, PAYLOAD_FLAG_INTERVAL, PF_SINGLE},
+};
+
+static const payload_schema_s schema_v1 = {1, sizeof(schema_v1_fields) / sizeof(payload_field_s), schema_v1_fields};
+
+/**
+ * Version 2, multi zone controllers, 3 bytes plus 1 + 2 per running interval
+ *
+ * | bits | field                                                 |
+ * |------|-------------------------------------------------------|
+ * |   4  | version                                               |
+ * |   4  | flags, OPEN and INTERVAL are set if any zone has them |
+ * |   8  | battery, 10 mV steps above 2.0 V                      |
+ * |   8  | open zones, bit 0 is zone 0                           |
+ * |   8  | zones with a running interval, with FLAG_INTERVAL     |
+ * | 16xN | remaining interval of each running zone, zone order   |
+ */
+static const payload_field_s schema_v2_fields[] = {
+	{PF_VERSION, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_FLAGS, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_BATT, 8, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_ZONE_OPEN, 8, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_ZONE_RUN, 8, PF_FLAGS, PAYLOAD_FLAG_INTERVAL, PF_SINGLE},
+	{PF_ZONE_REMAIN, 16, PF_FLAGS, PAYLOAD_FLAG_INTERVAL, PF_ZONE_RUN},
+};
+
+static const payload_schema_s schema_v2 = {2, sizeof(schema_v2_fields) / sizeof(payload_field_s), schema_v2_fields};
+
+/**
+ * Version 3, single valve with a flow meter, version 1 plus 5 bytes
+ *
+ * | bits | field                                               |
+ * |------|-----------------------------------------------------|
+ * |   4  | version                                             |
+ * |   4  | flags (PAYLOAD_FLAG_*), FAULT is a flow alarm       |
+ * |   8  | battery, 10 mV steps above 2.0 V                    |
+ * |  16  | flow rate in 0.1 L/min                              |
+ * |  24  | total volume in 0.1 L, wraps                        |
+ * |  16  | remaining interval, only with PAYLOAD_FLAG_INTERVAL |
+ */
+static const payload_field_s schema_v3_fields[] = {
+	{PF_VERSION, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_FLAGS, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_BATT, 8, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_FLOW_RATE, 16, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_VOLUME, 24, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_REMAIN, 16, PF_FLAGS, PAYLOAD_FLAG_INTERVAL, PF_SINGLE},
+};
+
+static const payload_schema_s schema_v3 = {3, sizeof(schema_v3_fields) / sizeof(payload_field_s), schema_v3_fields};
+
+/**
+ * Version 4, multi zone controllers with a flow meter, version 2 plus 5 bytes
+ * after the battery, flow rate and total volume as in version 3
+ */
+static const payload_field_s schema_v4_fields[] = {
+	{PF_VERSION, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_FLAGS, 4, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_BATT, 8, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_FLOW_RATE, 16, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_VOLUME, 24, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_ZONE_OPEN, 8, PF_ALWAYS, 0, PF_SINGLE},
+	{PF_ZONE_RUN, 8, PF_FLAGS, PAYLOAD_FLAG_INTERVAL, PF_SINGLE},
+	{PF_ZONE_REMAIN, 16, PF_FLAGS, PAYLOAD_FLAG_INTERVAL, PF_ZONE_RUN},
+};
+
+static const payload_schema_s schema_v4 = {4, sizeof(schema_v4_fields) / sizeof(payload_field_s), schema_v4_fields};
+
+/**
+ * @brief Get the schema of a payload version
+ *
+ * @param version payload version
+ * @return const payload_schema_s* schema or NULL if unknown
+ */
+const payload_schema_s *payload_schema(uint8_t version)
+{
+	switch (version)
+	{
+	case 1:
+		return &schema_v1;
+	case 2:
+		return &schema_v2;
+	case 3:
+		return &schema_v3;
+	case 4:
+		return &schema_v4;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Append bits MSB first, the target buffer must be zeroed
+ */
+void bitpack_put(uint8_t *buf, uint16_t *pos, uint32_t value, uint8_t bits)
+{
+	while (bits)
+	{
+		bits--;
+		if ((value >> bits) & 1)
+		{
+			buf[*pos >> 3] |= 0x80 >> (*pos & 7);
+		}
+		(*pos)++;
+	}
+}
+
+/**
+ * @brief Read bits MSB first
+ */
+uint32_t bitpack_get(const uint8_t *buf, uint16_t *pos, uint8_t bits)
+{
+	uint32_t value = 0;
+	while (bits)
+	{
+		bits--;
+		value = (value << 1) | ((buf[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+		(*pos)++;
+	}
+	return value;
+}
+
+/**
+ * @brief Encode the values following a schema
+ *
+ * @param schema payload schema
+ * @param values field values, indexed by payload_field_id
+ * @param out output buffer
+ * @param max_len size of the output buffer
+ * @return uint8_t encoded length, 0 if it does not fit
+ */
+uint8_t payload_encode(const payload_schema_s *schema, const uint32_t *values, uint8_t *out, uint8_t max_len)
+{
+	uint16_t pos = 0;
+
+	for (uint8_t idx = 0; idx < max_len; idx++)
+	{
+		out[idx] = 0;
+	}
+
+	for (uint8_t idx = 0; idx < schema->num_fields; idx++)
+	{
+		const payload_field_s *field = &schema->fields[idx];
+		if ((field->gate_id != PF_ALWAYS) && !(values[field->gate_id] & field->gate_mask))
+		{
+			continue;
+		}
+		uint32_t repeat = (field->repeat_id == PF_SINGLE) ? 1 : (values[field->repeat_id] & ((1UL << PAYLOAD_MAX_ZONES) - 1));
+		for (uint8_t n = 0; repeat; n++, repeat >>= 1)
+		{
+			if (!(repeat & 1))
+			{
+				continue;
+			}
+			if ((pos + field->bits) > (max_len * 8))
+			{
+				return 0;
+			}
+			uint32_t value = values[field->id + n];
+			if (field->bits < 32)
+			{
+				value &= (1UL << field->bits) - 1;
+			}
+			bitpack_put(out, &pos, value, field->bits);
+		}
+	}
+
+	return (pos + 7) / 8;
+}
+
+/**
+ * @brief Decode a payload, the schema is selected by the version nibble
+ *
+ * @param in received payload
+ * @param len payload length
+ * @param values decoded values, indexed by payload_field_id, absent fields are 0
+ * @return uint8_t number of bytes consumed, 0 on unknown version or truncated payload
+ */
+uint8_t payload_decode(const uint8_t *in, uint8_t len, uint32_t *values)
+{
+	if (len == 0)
+	{
+		return 0;
+	}
+
+	const payload_schema_s *schema = payload_schema(in[0] >> 4);
+	if (schema == 0)
+	{
+		return 0;
+	}
+
+	for (uint8_t idx = 0; idx < PF_COUNT; idx++)
+	{
+		values[idx] = 0;
+	}
+
+	uint16_t pos = 0;
+	for (uint8_t idx = 0; idx < schema->num_fields; idx++)
+	{
+		const payload_field_s *field = &schema->fields[idx];
+		if ((field->gate_id != PF_ALWAYS) && !(values[field->gate_id] & field->gate_mask))
+		{
+			continue;
+		}
+		uint32_t repeat = (field->repeat_id == PF_SINGLE) ? 1 : (values[field->repeat_id] & ((1UL << PAYLOAD_MAX_ZONES) - 1));
+		for (uint8_t n = 0; repeat; n++, repeat >>= 1)
+		{
+			if (!(repeat & 1))
+			{
+				continue;
+			}
+			if ((pos + field->bits) > (len * 8))
+			{
+				return 0;
+			}
+			values[field->id + n] = bitpack_get(in, &pos, field->bits);
+		}
+	}
+
+	return (pos + 7) / 8;
+}
+
+/**
+ * @brief Append the command results trailer, see downlink.h
+ *
+ * @param out payload buffer
+ * @param len current payload length, the trailer starts byte aligned
+ * @param max_len size of the payload buffer
+ * @param codes 2 bit result codes
+ * @param count number of results, at most 15
+ * @return uint8_t new payload length, unchanged if the trailer does not fit
+ */
+uint8_t payload_append_results(uint8_t *out, uint8_t len, uint8_t max_len, const uint8_t *codes, uint8_t count)
+{
+	if (count == 0)
+	{
+		return len;
+	}
+	if (count > 15)
+	{
+		count = 15;
+	}
+
+	uint8_t trailer_len = (4 + 2 * count + 7) / 8;
+	if ((len + trailer_len) > max_len)
+	{
+		return len;
+	}
+
+	uint8_t *trailer = &out[len];
+	for (uint8_t idx = 0; idx < trailer_len; idx++)
+	{
+		trailer[idx] = 0;
+	}
+
+	uint16_t pos = 0;
+	bitpack_put(trailer, &pos, count, 4);
+	for (uint8_t idx = 0; idx < count; idx++)
+	{
+		bitpack_put(trailer, &pos, codes[idx], 2);
+	}
+	return len + trailer_len;
+}
+
+/**
+ * @brief Decode the command results trailer
+ *
+ * @param in received payload
+ * @param len payload length
+ * @param offset length returned by payload_decode()
+ * @param codes decoded result codes, room for 15
+ * @return uint8_t number of results, 0 if there is no trailer
+ */
+uint8_t payload_decode_results(const uint8_t *in, uint8_t len, uint8_t offset, uint8_t *codes)
+{
+	if (offset >= len)
+	{
+		return 0;
+	}
+
+	uint16_t pos = 0;
+	const uint8_t *trailer = &in[offset];
+	uint8_t count = bitpack_get(trailer, &pos, 4);
+	if ((4 + 2 * count) > ((len - offset) * 8))
+	{
+		return 0;
+	}
+	for (uint8_t idx = 0; idx < count; idx++)
+	{
+		codes[idx] = bitpack_get(trailer, &pos, 2);
+	}
+	return count;
+}
+
+/**
+ * @brief Quantize a battery voltage to 8 bits
+ */
+uint8_t payload_quantize_batt(uint32_t mv)
+{
+	if (mv <= PAYLOAD_BATT_BASE_MV)
+	{
+		return 0;
+	}
+	uint32_t steps = (mv - PAYLOAD_BATT_BASE_MV + (PAYLOAD_BATT_STEP_MV / 2)) / PAYLOAD_BATT_STEP_MV;
+	return steps > 255 ? 255 : steps;
+}
+
+/**
+ * @brief Battery voltage of a quantized value
+ */
+uint32_t payload_batt_mv(uint8_t batt)
+{
+	return PAYLOAD_BATT_BASE_MV + (uint32_t)batt * PAYLOAD_BATT_STEP_MV;
+}
+
+/**
+ * @brief Pack a remaining time in seconds into 16 bits, rounded up
+ *		  so a running interval is never reported as 0
+ */
+uint16_t payload_pack_remain(uint32_t sec)
+{
+	for (uint8_t exp = 0; exp < 4; exp++)
+	{
+		uint8_t shift = 3 * exp;
+		uint32_t mantissa = (sec + (1UL << shift) - 1) >> shift;
+		if (mantissa <= 0x3FFF)
+		{
+			return (exp << 14) | mantissa;
+		}
+	}
+	return 0xFFFF;
+}
+
+/**
+ * @brief Remaining time in seconds of a packed value
+ */
+uint32_t payload_unpack_remain(uint16_t packed)
+{
+	return (uint32_t)(packed & 0x3FFF) << (3 * (packed >> 14));
+}
@@ -0,0 +1,95 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+/**
+ * Bit packed uplink payload, shared by the firmware and host tools.
+ * No Arduino dependencies in here, decoder.js mirrors the schema tables.
+ *
+ * Fields are written MSB first in schema order, the last byte is zero padded.
+ * The first byte always holds the version nibble and the flag nibble.
+ */
+
+#include <stdint.h>
+
+/** Payload schema version, upper nibble of the first byte.
+ * Version 0 is the legacy 5 byte struct (battery MSB is always < 0x10).
+ * Version 1 is used by single valve controllers, version 2 adds per zone data.
+ * Versions 3 and 4 are versions 1 and 2 with flow meter data. */
+#define PAYLOAD_VERSION 1
+#define PAYLOAD_VERSION_ZONES 2
+#define PAYLOAD_VERSION_FLOW 3
+#define PAYLOAD_VERSION_ZONES_FLOW 4
+
+/** Number of zones the payload can describe */
+#define PAYLOAD_MAX_ZONES 8
+
+/** Flag bits, lower nibble of the first byte */
+#define PAYLOAD_FLAG_OPEN 0x1	  // A valve is open
+#define PAYLOAD_FLAG_INTERVAL 0x2 // A valve interval is running, remaining time follows
+#define PAYLOAD_FLAG_FAULT 0x4	  // Fault detected, flow alarm or valve stall
+#define PAYLOAD_FLAG_LOW_BATT 0x8 // Low battery protection active
+
+/** Battery quantization, 8 bits of 10 mV steps above 2.0 V */
+#define PAYLOAD_BATT_BASE_MV 2000
+#define PAYLOAD_BATT_STEP_MV 10
+
+/** Largest encoded payload in bytes, version 4 with 8 running zones and the command results */
+#define PAYLOAD_MAX_LEN 32
+
+/** Field is always present */
+#define PF_ALWAYS 0xFF
+
+/** Field is not repeated */
+#define PF_SINGLE 0xFF
+
+/** Field identifiers, index into the value array */
+enum payload_field_id
+{
+	PF_VERSION = 0,
+	PF_FLAGS,
+	PF_BATT,
+	PF_REMAIN,
+	PF_FLOW_RATE,
+	PF_VOLUME,
+	PF_ZONE_OPEN,
+	PF_ZONE_RUN,
+	PF_ZONE_REMAIN,
+	PF_COUNT = PF_ZONE_REMAIN + PAYLOAD_MAX_ZONES
+};
+
+/** Schema entry, the field is only present if values[gate_id] & gate_mask.
+ * A repeated field is written as values[id + n] for each bit n set in values[repeat_id]. */
+struct payload_field_s
+{
+	uint8_t id;
+	uint8_t bits;
+	uint8_t gate_id;
+	uint32_t gate_mask;
+	uint8_t repeat_id;
+};
+
+/** Schema description */
+struct payload_schema_s
+{
+	uint8_t version;
+	uint8_t num_fields;
+	const payload_field_s *fields;
+};
+
+const payload_schema_s *payload_schema(uint8_t version);
+
+uint8_t payload_encode(const payload_schema_s *schema, const uint32_t *values, uint8_t *out, uint8_t max_len);
+uint8_t payload_decode(const uint8_t *in, uint8_t len, uint32_t *values);
+
+uint8_t payload_append_results(uint8_t *out, uint8_t len, uint8_t max_len, const uint8_t *codes, uint8_t count);
+uint8_t payload_decode_results(const uint8_t *in, uint8_t len, uint8_t offset, uint8_t *codes);
+
+uint8_t payload_quantize_batt(uint32_t mv);
+uint32_t payload_batt_mv(uint8_t batt);
+uint16_t payload_pack_remain(uint32_t sec);
+uint32_t payload_unpack_remain(uint16_t packed);
+
+void bitpack_put(uint8_t *buf, uint16_t *pos, uint32_t value, uint8_t bits);
+uint32_t bitpack_get(const uint8_t *buf, uint16_t *pos, uint8_t bits);
+
+#endif
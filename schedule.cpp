@@ -0,0 +1,267 @@
+#include "app.h"
+#include "timer_wheel.h"
+
+#ifdef NRF52_SERIES
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** File to keep the schedule table */
+#define SCHED_FILE "/vlv_sched"
+static File sched_file(InternalFS);
+#endif
+
+#if SCHED_MAX_ENTRIES > WHEEL_CAPACITY
+#error "SCHED_MAX_ENTRIES must not exceed WHEEL_CAPACITY"
+#endif
+
+extern s_valve_settings g_valve_settings;
+
+/** Schedule table */
+s_sched_entry g_sched[SCHED_MAX_ENTRIES];
+
+/** Pending occurrences, one wheel tick is one minute */
+static timer_wheel_s sched_wheel;
+
+#define MIN_PER_DAY 1440
+
+/**
+ * @brief Read the schedule table from flash
+ */
+static void schedule_load(void)
+{
+	memset(g_sched, 0, sizeof(g_sched));
+#ifdef NRF52_SERIES
+	if (sched_file.open(SCHED_FILE, FILE_O_READ))
+	{
+		if (sched_file.read(g_sched, sizeof(g_sched)) != sizeof(g_sched))
+		{
+			MYLOG("SCHED", "Schedule file size mismatch, starting empty");
+			memset(g_sched, 0, sizeof(g_sched));
+		}
+		sched_file.close();
+	}
+#endif
+}
+
+/**
+ * @brief Write the schedule table to flash
+ */
+static void schedule_save(void)
+{
+#ifdef NRF52_SERIES
+	InternalFS.remove(SCHED_FILE);
+	if (sched_file.open(SCHED_FILE, FILE_O_WRITE))
+	{
+		sched_file.write((uint8_t *)g_sched, sizeof(g_sched));
+		sched_file.close();
+	}
+	else
+	{
+		MYLOG("SCHED", "Failed to save schedule");
+	}
+#endif
+}
+
+/**
+ * @brief First start of an entry at or after a given minute
+ *
+ * @param entry schedule entry
+ * @param from_min minutes since epoch
+ * @return uint32_t start in minutes since epoch, WHEEL_NEVER if it has no days
+ */
+static uint32_t schedule_next_start(const s_sched_entry *entry, uint32_t from_min)
+{
+	uint32_t day = from_min / MIN_PER_DAY;
+
+	// Up to a week ahead, 1970-01-01 was a Thursday
+	for (uint8_t offset = 0; offset < 8; offset++)
+	{
+		uint32_t start = (day + offset) * MIN_PER_DAY + entry->start_min;
+		uint8_t weekday = (day + offset + 4) % 7;
+		if ((start >= from_min) && (entry->days & (1 << weekday)))
+		{
+			return start;
+		}
+	}
+	return WHEEL_NEVER;
+}
+
+/**
+ * @brief Set the wakeup for the earliest pending occurrence
+ */
+static void schedule_program_timer(void)
+{
+	uint32_t next_min = wheel_next_deadline(&sched_wheel);
+	uint32_t now = time_now();
+	if ((next_min == WHEEL_NEVER) || (now == 0))
+	{
+		wake_clear(WAKE_SCHEDULE);
+		return;
+	}
+
+	uint32_t due_sec = next_min * 60;
+	uint32_t delay_sec = (due_sec > now) ? (due_sec - now) : 0;
+	wake_set(WAKE_SCHEDULE, millis() + delay_sec * 1000, 0);
+	MYLOG("SCHED", "Next schedule wakeup in %lu sec", delay_sec);
+}
+
+/**
+ * @brief Queue the next occurrence of an entry
+ *
+ * @param idx entry index
+ * @param from_min earliest start in minutes since epoch
+ */
+static void schedule_arm(uint8_t idx, uint32_t from_min)
+{
+	wheel_remove(&sched_wheel, idx);
+	if (g_sched[idx].days == 0)
+	{
+		return;
+	}
+
+	uint32_t start = schedule_next_start(&g_sched[idx], from_min);
+	if (start != WHEEL_NEVER)
+	{
+		wheel_insert(&sched_wheel, idx, start);
+	}
+}
+
+/**
+ * @brief Rebuild the pending occurrences, needed after the clock was set
+ */
+void schedule_rebuild(void)
+{
+	uint32_t now = time_now();
+	if (now == 0)
+	{
+		return;
+	}
+
+	uint32_t now_min = now / 60;
+	wheel_init(&sched_wheel, now_min);
+	for (uint8_t idx = 0; idx < SCHED_MAX_ENTRIES; idx++)
+	{
+		schedule_arm(idx, now_min);
+	}
+	schedule_program_timer();
+}
+
+/**
+ * @brief Load the schedule table, occurrences are armed once the clock is set
+ */
+void schedule_init(void)
+{
+	schedule_load();
+	wheel_init(&sched_wheel, 0);
+}
+
+/**
+ * @brief Start the valve for an entry that became due
+ *
+ * @param idx entry index
+ */
+static void schedule_fire(uint8_t idx)
+{
+	s_sched_entry *entry = &g_sched[idx];
+
+	if (entry->flags & SCHED_FLAG_SKIP)
+	{
+		MYLOG("SCHED", "Entry %d skipped", idx);
+		entry->flags &= ~SCHED_FLAG_SKIP;
+		schedule_save();
+		return;
+	}
+
+	if (g_valve_settings.interval_running & (1 << entry->zone))
+	{
+		MYLOG("SCHED", "Entry %d due, but zone %d is already running", idx, entry->zone);
+		return;
+	}
+
+	MYLOG("SCHED", "Entry %d starting %lu sec interval on zone %d", idx, entry->duration_sec, entry->zone);
+	if (!beginValveInterval(entry->zone, entry->duration_sec, HC_SCHEDULE))
+	{
+		MYLOG("SCHED", "Entry %d could not open zone %d", idx, entry->zone);
+	}
+}
+
+/**
+ * @brief Handle the schedule timer, called from the app event handler
+ */
+void schedule_handler(void)
+{
+	uint32_t now = time_now();
+	if (now == 0)
+	{
+		return;
+	}
+
+	uint32_t now_min = now / 60;
+	uint16_t expired[SCHED_MAX_ENTRIES];
+	uint16_t num;
+	do
+	{
+		num = wheel_advance(&sched_wheel, now_min, expired, SCHED_MAX_ENTRIES);
+		for (uint16_t idx = 0; idx < num; idx++)
+		{
+			schedule_fire(expired[idx]);
+			schedule_arm(expired[idx], now_min + 1);
+		}
+	} while (num == SCHED_MAX_ENTRIES);
+
+	schedule_program_timer();
+}
+
+/**
+ * @brief Add, change or remove a schedule entry
+ *
+ * @param idx entry index
+ * @param days weekday mask, 0 removes the entry
+ * @param start_min start, minutes after midnight
+ * @param duration_sec how long to water
+ * @param zone valve zone to open
+ * @return true entry was stored
+ */
+bool schedule_set(uint8_t idx, uint8_t days, uint16_t start_min, uint32_t duration_sec, uint8_t zone)
+{
+	if ((idx >= SCHED_MAX_ENTRIES) || (days > 0x7F) || (start_min >= MIN_PER_DAY) || (zone >= VALVE_ZONES))
+	{
+		return false;
+	}
+	if (days && (duration_sec == 0))
+	{
+		return false;
+	}
+
+	g_sched[idx].days = days;
+	g_sched[idx].flags = 0;
+	g_sched[idx].start_min = days ? start_min : 0;
+	g_sched[idx].duration_sec = days ? duration_sec : 0;
+	g_sched[idx].zone = days ? zone : 0;
+	schedule_save();
+
+	if (time_now() != 0)
+	{
+		schedule_arm(idx, time_now() / 60);
+		schedule_program_timer();
+	}
+	return true;
+}
+
+/**
+ * @brief Skip the next occurrence of an entry
+ *
+ * @param idx entry index
+ * @return true entry exists
+ */
+bool schedule_skip(uint8_t idx)
+{
+	if ((idx >= SCHED_MAX_ENTRIES) || (g_sched[idx].days == 0))
+	{
+		return false;
+	}
+	g_sched[idx].flags |= SCHED_FLAG_SKIP;
+	schedule_save();
+	return true;
+}
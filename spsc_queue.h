@@ -0,0 +1,82 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+/**
+ * Bounded single producer, single consumer queue, no Arduino dependencies.
+ *
+ * The producer (an interrupt or timer callback) only writes head, the
+ * consumer (the app task) only writes tail, so no lock is needed. The
+ * indices run freely and wrap at 256, the capacity is a power of 2 up to
+ * 128. An item that does not fit is counted in dropped, also only written
+ * by the producer.
+ */
+
+#include <stdint.h>
+
+template <typename T, uint8_t N>
+struct spsc_queue_s
+{
+	static_assert((N > 0) && (N <= 128) && ((N & (N - 1)) == 0), "Capacity must be a power of 2 up to 128");
+	uint8_t head;	  // Next slot to write
+	uint8_t tail;	  // Next slot to read
+	uint32_t dropped; // Items that found the queue full
+	T items[N];
+};
+
+/**
+ * @brief Add an item, called from the producer context only
+ *
+ * @param queue queue
+ * @param item item to copy in
+ * @return true queued
+ * @return false queue full, the item is counted as dropped
+ */
+template <typename T, uint8_t N>
+inline bool spsc_push(spsc_queue_s<T, N> *queue, const T &item)
+{
+	uint8_t head = queue->head;
+	uint8_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+	if ((uint8_t)(head - tail) >= N)
+	{
+		__atomic_store_n(&queue->dropped, queue->dropped + 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	queue->items[head & (N - 1)] = item;
+	// The item is written before the consumer can see the new head
+	__atomic_store_n(&queue->head, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * @brief Take the oldest item, called from the consumer context only
+ *
+ * @param queue queue
+ * @param item filled with the oldest item
+ * @return true an item was taken
+ * @return false queue empty
+ */
+template <typename T, uint8_t N>
+inline bool spsc_pop(spsc_queue_s<T, N> *queue, T *item)
+{
+	uint8_t tail = queue->tail;
+	uint8_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+	if (head == tail)
+	{
+		return false;
+	}
+	*item = queue->items[tail & (N - 1)];
+	// The slot is read before the producer can reuse it
+	__atomic_store_n(&queue->tail, (uint8_t)(tail + 1), __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * @brief Items that found the queue full, readable from any context
+ */
+template <typename T, uint8_t N>
+inline uint32_t spsc_dropped(const spsc_queue_s<T, N> *queue)
+{
+	return __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,272 @@
+#include "timer_wheel.h"
+
+/**
+ * @brief Rotate a slot map so bit 0 is the given slot
+ */
+static uint64_t wheel_rotate(uint64_t map, uint8_t slot)
+{
+	return slot ? (map >> slot) | (map << (WHEEL_SLOTS - slot)) : map;
+}
+
+/**
+ * @brief Slot of the current wheel time on a level
+ */
+static uint8_t wheel_cur_slot(const timer_wheel_s *wheel, uint8_t level)
+{
+	return (wheel->now >> (level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+}
+
+/**
+ * @brief Distance in slots to the first occupied slot of a level
+ */
+static uint8_t wheel_first_slot(const timer_wheel_s *wheel, uint8_t level)
+{
+	return __builtin_ctzll(wheel_rotate(wheel->occupied[level], wheel_cur_slot(wheel, level)));
+}
+
+/**
+ * @brief Initialize an empty wheel
+ *
+ * @param wheel timer wheel
+ * @param now current time in ticks
+ */
+void wheel_init(timer_wheel_s *wheel, uint32_t now)
+{
+	wheel->now = now;
+	for (uint8_t level = 0; level < WHEEL_LEVELS; level++)
+	{
+		wheel->occupied[level] = 0;
+		for (uint8_t slot = 0; slot < WHEEL_SLOTS; slot++)
+		{
+			wheel->head[level][slot] = WHEEL_NONE;
+		}
+	}
+	for (uint16_t id = 0; id < WHEEL_CAPACITY; id++)
+	{
+		wheel->slot[id] = 0xFF;
+	}
+}
+
+/**
+ * @brief Queue an entry, an already queued entry is moved
+ *
+ * @param wheel timer wheel
+ * @param id entry index, below WHEEL_CAPACITY
+ * @param due deadline in ticks, not in the past
+ * @return true entry queued
+ * @return false deadline in the past or too far ahead, see WHEEL_REACH
+ */
+bool wheel_insert(timer_wheel_s *wheel, uint16_t id, uint32_t due)
+{
+	if ((id >= WHEEL_CAPACITY) || (due < wheel->now))
+	{
+		return false;
+	}
+	wheel_remove(wheel, id);
+
+	for (uint8_t level = 0; level < WHEEL_LEVELS; level++)
+	{
+		uint8_t shift = level * WHEEL_SLOT_BITS;
+		if (((due >> shift) - (wheel->now >> shift)) < WHEEL_SLOTS)
+		{
+			uint8_t slot = (due >> shift) & (WHEEL_SLOTS - 1);
+			uint16_t first = wheel->head[level][slot];
+
+			wheel->due[id] = due;
+			wheel->slot[id] = level * WHEEL_SLOTS + slot;
+			wheel->prev[id] = WHEEL_NONE;
+			wheel->next[id] = first;
+			if (first != WHEEL_NONE)
+			{
+				wheel->prev[first] = id;
+			}
+			wheel->head[level][slot] = id;
+			wheel->occupied[level] |= 1ULL << slot;
+			if ((level > 0) && ((first == WHEEL_NONE) || (due < wheel->min_due[level - 1][slot])))
+			{
+				wheel->min_due[level - 1][slot] = due;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Remove an entry, nothing happens if it is not queued
+ *
+ * @param wheel timer wheel
+ * @param id entry index
+ */
+void wheel_remove(timer_wheel_s *wheel, uint16_t id)
+{
+	if ((id >= WHEEL_CAPACITY) || (wheel->slot[id] == 0xFF))
+	{
+		return;
+	}
+
+	uint8_t level = wheel->slot[id] / WHEEL_SLOTS;
+	uint8_t slot = wheel->slot[id] % WHEEL_SLOTS;
+	if (wheel->prev[id] != WHEEL_NONE)
+	{
+		wheel->next[wheel->prev[id]] = wheel->next[id];
+	}
+	else
+	{
+		wheel->head[level][slot] = wheel->next[id];
+	}
+	if (wheel->next[id] != WHEEL_NONE)
+	{
+		wheel->prev[wheel->next[id]] = wheel->prev[id];
+	}
+	wheel->slot[id] = 0xFF;
+	if (wheel->head[level][slot] == WHEEL_NONE)
+	{
+		wheel->occupied[level] &= ~(1ULL << slot);
+	}
+	else if ((level > 0) && (wheel->due[id] == wheel->min_due[level - 1][slot]))
+	{
+		// The earliest entry left, only removals walk a slot
+		uint32_t best = WHEEL_NEVER;
+		for (uint16_t other = wheel->head[level][slot]; other != WHEEL_NONE; other = wheel->next[other])
+		{
+			if (wheel->due[other] < best)
+			{
+				best = wheel->due[other];
+			}
+		}
+		wheel->min_due[level - 1][slot] = best;
+	}
+}
+
+/**
+ * @brief Get the earliest deadline
+ *		  Level 0 slots hold a single deadline each, for the higher levels
+ *		  the first occupied slot holds the earliest deadline as later slots
+ *		  are later. Constant time, independent of the number of entries.
+ *
+ * @param wheel timer wheel
+ * @return uint32_t earliest deadline in ticks, WHEEL_NEVER if empty
+ */
+uint32_t wheel_next_deadline(const timer_wheel_s *wheel)
+{
+	uint32_t best = WHEEL_NEVER;
+
+	for (uint8_t level = 0; level < WHEEL_LEVELS; level++)
+	{
+		if (!wheel->occupied[level])
+		{
+			continue;
+		}
+
+		uint8_t dist = wheel_first_slot(wheel, level);
+		if (level == 0)
+		{
+			if ((wheel->now + dist) < best)
+			{
+				best = wheel->now + dist;
+			}
+			continue;
+		}
+
+		uint8_t slot = (wheel_cur_slot(wheel, level) + dist) & (WHEEL_SLOTS - 1);
+		if (wheel->min_due[level - 1][slot] < best)
+		{
+			best = wheel->min_due[level - 1][slot];
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Next time the wheel has to stop, either a level 0 deadline
+ *		  or the start of an occupied higher level slot to cascade
+ */
+static uint32_t wheel_next_step(const timer_wheel_s *wheel)
+{
+	uint32_t best = WHEEL_NEVER;
+
+	for (uint8_t level = 0; level < WHEEL_LEVELS; level++)
+	{
+		if (!wheel->occupied[level])
+		{
+			continue;
+		}
+
+		uint8_t shift = level * WHEEL_SLOT_BITS;
+		uint32_t step = ((wheel->now >> shift) + wheel_first_slot(wheel, level)) << shift;
+		if (step < best)
+		{
+			best = step;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Move the entries of a higher level slot down
+ */
+static void wheel_cascade(timer_wheel_s *wheel, uint8_t level)
+{
+	uint8_t slot = wheel_cur_slot(wheel, level);
+	uint16_t id = wheel->head[level][slot];
+
+	wheel->head[level][slot] = WHEEL_NONE;
+	wheel->occupied[level] &= ~(1ULL << slot);
+	while (id != WHEEL_NONE)
+	{
+		uint16_t next = wheel->next[id];
+		wheel->slot[id] = 0xFF;
+		wheel_insert(wheel, id, wheel->due[id]);
+		id = next;
+	}
+}
+
+/**
+ * @brief Advance the wheel time and collect the expired entries
+ *		  If the expired buffer fills up, call again with the same time.
+ *
+ * @param wheel timer wheel
+ * @param to new wheel time in ticks
+ * @param expired buffer for the expired entries, in deadline order
+ * @param max_expired size of the buffer
+ * @return uint16_t number of expired entries
+ */
+uint16_t wheel_advance(timer_wheel_s *wheel, uint32_t to, uint16_t *expired, uint16_t max_expired)
+{
+	uint16_t count = 0;
+
+	while (true)
+	{
+		uint32_t step = wheel_next_step(wheel);
+		if ((step == WHEEL_NEVER) || (step > to))
+		{
+			if (to > wheel->now)
+			{
+				wheel->now = to;
+			}
+			return count;
+		}
+		wheel->now = step;
+
+		for (uint8_t level = WHEEL_LEVELS - 1; level > 0; level--)
+		{
+			if ((step & ((1UL << (level * WHEEL_SLOT_BITS)) - 1)) == 0)
+			{
+				wheel_cascade(wheel, level);
+			}
+		}
+
+		uint8_t slot = wheel_cur_slot(wheel, 0);
+		while (wheel->head[0][slot] != WHEEL_NONE)
+		{
+			if (count == max_expired)
+			{
+				return count;
+			}
+			uint16_t id = wheel->head[0][slot];
+			wheel_remove(wheel, id);
+			expired[count++] = id;
+		}
+	}
+}
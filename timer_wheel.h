@@ -0,0 +1,49 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/**
+ * Hierarchical timer wheel, no Arduino dependencies.
+ *
+ * Three levels of 64 slots. Level 0 slots are one tick wide, level 1 slots
+ * 64 ticks and level 2 slots 4096 ticks. Level 2 covers 64 slots from the
+ * slot of the current time, so deadlines up to WHEEL_REACH (258048) ticks
+ * ahead can always be stored, up to 262143 depending on the current time.
+ * Entries of a higher level are cascaded down when the wheel time reaches
+ * their slot. Each level keeps a 64 bit occupancy map and each higher level
+ * slot its earliest deadline, the next deadline is found with a bit scan per
+ * level instead of walking the entries.
+ */
+
+#include <stdint.h>
+
+#ifndef WHEEL_CAPACITY
+#define WHEEL_CAPACITY 32
+#endif
+
+#define WHEEL_LEVELS 3
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SPAN (1UL << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+#define WHEEL_REACH (WHEEL_SPAN - (1UL << ((WHEEL_LEVELS - 1) * WHEEL_SLOT_BITS)))
+#define WHEEL_NONE 0xFFFF
+#define WHEEL_NEVER 0xFFFFFFFF
+
+struct timer_wheel_s
+{
+	uint32_t now;									 // Current wheel time in ticks
+	uint64_t occupied[WHEEL_LEVELS];				 // Slots holding at least one entry
+	uint16_t head[WHEEL_LEVELS][WHEEL_SLOTS];		 // First entry of each slot
+	uint32_t min_due[WHEEL_LEVELS - 1][WHEEL_SLOTS]; // Earliest deadline of each slot above level 0
+	uint16_t next[WHEEL_CAPACITY];					 // Entry links
+	uint16_t prev[WHEEL_CAPACITY];
+	uint8_t slot[WHEEL_CAPACITY]; // level * WHEEL_SLOTS + slot, 0xFF if not queued
+	uint32_t due[WHEEL_CAPACITY]; // Deadline of each entry
+};
+
+void wheel_init(timer_wheel_s *wheel, uint32_t now);
+bool wheel_insert(timer_wheel_s *wheel, uint16_t id, uint32_t due);
+void wheel_remove(timer_wheel_s *wheel, uint16_t id);
+uint32_t wheel_next_deadline(const timer_wheel_s *wheel);
+uint16_t wheel_advance(timer_wheel_s *wheel, uint32_t to, uint16_t *expired, uint16_t max_expired);
+
+#endif
@@ -0,0 +1,213 @@
+#include "app.h"
+
+#if MY_DEBUG == 1
+/** Ring of log words, kept across api_reset() as a flight recorder */
+struct s_tlog_ring
+{
+	uint32_t magic;	  // TLOG_MAGIC, anything else after power up
+	uint32_t check;	  // Indices protected against a half written ring
+	uint16_t head;	  // Next word to write
+	uint16_t used;	  // Words holding records
+	uint16_t pending; // Words not sent yet, the newest ones
+	uint16_t boots;	  // Resets the ring survived
+	uint32_t dropped; // Records overwritten before they were sent
+	uint32_t words[TLOG_RING_WORDS];
+};
+
+/** Not cleared by the startup code, a reset keeps the last records */
+static s_tlog_ring tlog_ring __attribute__((section(".noinit")));
+
+#define TLOG_MAGIC 0x544C4F47
+
+/**
+ * @brief Check value of the ring indices
+ */
+static uint32_t tlog_check(void)
+{
+	return TLOG_MAGIC ^ tlog_ring.head ^ ((uint32_t)tlog_ring.used << 16) ^ ((uint32_t)tlog_ring.pending << 8) ^ TLOG_RING_WORDS;
+}
+
+/**
+ * @brief Start with an empty ring
+ */
+static void tlog_reset(void)
+{
+	tlog_ring.head = 0;
+	tlog_ring.used = 0;
+	tlog_ring.pending = 0;
+	tlog_ring.boots = 0;
+	tlog_ring.dropped = 0;
+	tlog_ring.check = tlog_check();
+	tlog_ring.magic = TLOG_MAGIC;
+}
+
+/**
+ * @brief Words of the record starting at a ring position
+ */
+static uint16_t tlog_rec_words(uint16_t pos)
+{
+	return TLOG_HEAD_WORDS + (tlog_ring.words[pos % TLOG_RING_WORDS] & 0xFF);
+}
+
+/**
+ * @brief Send the words of one record as a hex line
+ *
+ * @param pos ring position of the record
+ * @param len record length in words
+ */
+static void tlog_send(uint16_t pos, uint16_t len)
+{
+	char line[8 + 9 * (TLOG_HEAD_WORDS + TLOG_ARG_WORDS) + 1];
+	int idx = snprintf(line, sizeof(line), "#TLOG");
+	for (uint16_t word = 0; word < len; word++)
+	{
+		idx += snprintf(&line[idx], sizeof(line) - idx, " %08lX", (unsigned long)tlog_ring.words[(pos + word) % TLOG_RING_WORDS]);
+	}
+	Serial.println(line);
+#ifdef NRF52_SERIES
+	if (g_ble_uart_is_connected)
+	{
+		g_ble_uart.printf("%s\n", line);
+	}
+#endif
+}
+#endif
+
+/**
+ * @brief Keep the records of the last run, called first thing at boot
+ *		  The records of the run before the reset stay in the ring, new
+ *		  records follow them.
+ */
+void tlog_init(void)
+{
+#if MY_DEBUG == 1
+	if ((tlog_ring.magic != TLOG_MAGIC) || (tlog_ring.check != tlog_check()) || (tlog_ring.used > TLOG_RING_WORDS) ||
+		(tlog_ring.pending > tlog_ring.used) || (tlog_ring.head >= TLOG_RING_WORDS))
+	{
+		tlog_reset();
+	}
+	else
+	{
+		tlog_ring.boots++;
+	}
+	MYLOG("LOG", "Flight recorder kept %d words over %d resets", tlog_ring.used, tlog_ring.boots);
+#endif
+}
+
+/**
+ * @brief Store a record, the oldest records are overwritten when the ring is full
+ *		  Records are short, interrupts are held off while the ring is updated.
+ *
+ * @param rec record built by tlog_put()
+ */
+void tlog_commit(tlog_rec_s *rec)
+{
+#if MY_DEBUG == 1
+	// Logged before tlog_init()
+	if (tlog_ring.magic != TLOG_MAGIC)
+	{
+		tlog_reset();
+	}
+
+	rec->words[0] |= rec->len - TLOG_HEAD_WORDS;
+	rec->words[1] = millis();
+
+	noInterrupts();
+	while ((tlog_ring.used + rec->len) > TLOG_RING_WORDS)
+	{
+		uint16_t oldest = (tlog_ring.head + TLOG_RING_WORDS - tlog_ring.used) % TLOG_RING_WORDS;
+		uint16_t len = tlog_rec_words(oldest);
+		tlog_ring.used -= (len < tlog_ring.used) ? len : tlog_ring.used;
+		if (tlog_ring.pending > tlog_ring.used)
+		{
+			tlog_ring.pending = tlog_ring.used;
+			tlog_ring.dropped++;
+		}
+	}
+	for (uint8_t idx = 0; idx < rec->len; idx++)
+	{
+		tlog_ring.words[tlog_ring.head] = rec->words[idx];
+		tlog_ring.head = (tlog_ring.head + 1) % TLOG_RING_WORDS;
+	}
+	tlog_ring.used += rec->len;
+	tlog_ring.pending += rec->len;
+	tlog_ring.check = tlog_check();
+	interrupts();
+#else
+	(void)rec;
+#endif
+}
+
+/**
+ * @brief Send the records not sent yet, called when the app task is done with an event
+ *		  Records wait in the ring while neither USB nor BLE is connected.
+ */
+void tlog_drain(void)
+{
+#if MY_DEBUG == 1
+	bool connected = (bool)Serial;
+#ifdef NRF52_SERIES
+	connected = connected || g_ble_uart_is_connected;
+#endif
+	while (connected && tlog_ring.pending)
+	{
+		uint16_t pos = (tlog_ring.head + TLOG_RING_WORDS - tlog_ring.pending) % TLOG_RING_WORDS;
+		uint16_t len = tlog_rec_words(pos);
+		tlog_send(pos, len);
+		noInterrupts();
+		tlog_ring.pending = (len < tlog_ring.pending) ? tlog_ring.pending - len : 0;
+		tlog_ring.check = tlog_check();
+		interrupts();
+	}
+#endif
+}
+
+/**
+ * @brief Send all records in the ring again, including those from before a reset
+ */
+void tlog_dump(void)
+{
+#if MY_DEBUG == 1
+	tlog_drain();
+	uint16_t left = tlog_ring.used;
+	while (left)
+	{
+		uint16_t pos = (tlog_ring.head + TLOG_RING_WORDS - left) % TLOG_RING_WORDS;
+		uint16_t len = tlog_rec_words(pos);
+		if (len > left)
+		{
+			break;
+		}
+		tlog_send(pos, len);
+		left -= len;
+	}
+#endif
+}
+
+/**
+ * @brief Empty the ring
+ */
+void tlog_clear(void)
+{
+#if MY_DEBUG == 1
+	noInterrupts();
+	tlog_reset();
+	interrupts();
+#endif
+}
+
+/**
+ * @brief Write the ring state in readable form
+ *
+ * @param buf output buffer
+ * @param size size of buf
+ */
+void tlog_print(char *buf, uint16_t size)
+{
+#if MY_DEBUG == 1
+	snprintf(buf, size, "Used %d of %d words, %d not sent, %lu dropped, %d resets", tlog_ring.used, TLOG_RING_WORDS,
+			 tlog_ring.pending, (unsigned long)tlog_ring.dropped, tlog_ring.boots);
+#else
+	snprintf(buf, size, "Tokenized log off, build with MY_DEBUG=1");
+#endif
+}
@@ -0,0 +1,159 @@
+#ifndef TLOG_H
+#define TLOG_H
+
+/**
+ * Tokenized log, no Arduino dependencies.
+ *
+ * MYLOG stores a 24 bit ID of its tag and format string and the raw
+ * arguments in a RAM ring, nothing is formatted on the device. The ring is
+ * sent as hex lines when USB or BLE is connected, tlog_decode.py finds the
+ * format strings in the sources by the same hash and prints the text.
+ *
+ * A record is one header word (ID << 8 | number of argument words), the
+ * millis() time and one word per integer argument. A string argument is a
+ * length word followed by at most TLOG_STR_MAX characters, 4 per word,
+ * first character in the low byte. MYLOG_HEX stores bytes the same way,
+ * with the format "%H".
+ */
+
+#include <stdint.h>
+#include <type_traits>
+
+/** Most argument words of one record */
+#define TLOG_ARG_WORDS 14
+
+/** Longest string argument, longer strings are cut */
+#define TLOG_STR_MAX 16
+
+/** Record header and time */
+#define TLOG_HEAD_WORDS 2
+
+/** Record being built on the stack */
+struct tlog_rec_s
+{
+	uint32_t words[TLOG_HEAD_WORDS + TLOG_ARG_WORDS];
+	uint8_t len;
+};
+
+/**
+ * @brief FNV-1a hash, evaluated at compile time for string literals
+ */
+constexpr uint32_t tlog_hash(const char *str, uint32_t hash = 2166136261UL)
+{
+	return *str ? tlog_hash(str + 1, (hash ^ (uint8_t)*str) * 16777619UL) : hash;
+}
+
+/**
+ * @brief Fold a hash to a 24 bit record ID
+ */
+constexpr uint32_t tlog_fold(uint32_t hash)
+{
+	return (hash ^ (hash >> 24)) & 0xFFFFFF;
+}
+
+/** Record ID of a tag and format string, a compile time constant */
+#define TLOG_ID(tag, fmt) (std::integral_constant<uint32_t, tlog_fold(tlog_hash(fmt, tlog_hash(tag)))>::value)
+
+void tlog_commit(tlog_rec_s *rec);
+
+/**
+ * @brief Add bytes as a length word and packed words
+ */
+inline void tlog_arg_bytes(tlog_rec_s *rec, const uint8_t *data, uint8_t len)
+{
+	if (rec->len >= TLOG_HEAD_WORDS + TLOG_ARG_WORDS)
+	{
+		return;
+	}
+	uint8_t max_len = (TLOG_HEAD_WORDS + TLOG_ARG_WORDS - 1 - rec->len) * 4;
+	if (len > max_len)
+	{
+		len = max_len;
+	}
+	rec->words[rec->len++] = len;
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		if ((idx & 3) == 0)
+		{
+			rec->words[rec->len++] = 0;
+		}
+		rec->words[rec->len - 1] |= (uint32_t)data[idx] << (8 * (idx & 3));
+	}
+}
+
+/**
+ * @brief Add a string argument
+ */
+inline void tlog_arg(tlog_rec_s *rec, const char *str)
+{
+	uint8_t len = 0;
+	while (str && str[len] && (len < TLOG_STR_MAX))
+	{
+		len++;
+	}
+	tlog_arg_bytes(rec, (const uint8_t *)str, len);
+}
+
+inline void tlog_arg(tlog_rec_s *rec, char *str)
+{
+	tlog_arg(rec, (const char *)str);
+}
+
+/**
+ * @brief Add an integer argument
+ */
+template <typename T>
+inline void tlog_arg(tlog_rec_s *rec, T value)
+{
+	static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "MYLOG takes integers and strings");
+	static_assert(sizeof(T) <= 4, "MYLOG takes 32 bit integers");
+	if (rec->len < TLOG_HEAD_WORDS + TLOG_ARG_WORDS)
+	{
+		rec->words[rec->len++] = (uint32_t)value;
+	}
+}
+
+inline void tlog_args(tlog_rec_s *)
+{
+}
+
+template <typename T, typename... R>
+inline void tlog_args(tlog_rec_s *rec, T value, R... rest)
+{
+	tlog_arg(rec, value);
+	tlog_args(rec, rest...);
+}
+
+/**
+ * @brief Store a record
+ *
+ * @param id TLOG_ID() of the tag and format string
+ * @param args integer and string arguments
+ */
+template <typename... A>
+inline void tlog_put(uint32_t id, A... args)
+{
+	tlog_rec_s rec;
+	rec.words[0] = id << 8;
+	rec.len = TLOG_HEAD_WORDS;
+	tlog_args(&rec, args...);
+	tlog_commit(&rec);
+}
+
+/**
+ * @brief Store a record of raw bytes, printed as hex by the decoder
+ *
+ * @param id TLOG_ID() of the tag and "%H"
+ * @param data bytes
+ * @param len number of bytes, cut to fit one record
+ */
+inline void tlog_put_bytes(uint32_t id, const uint8_t *data, uint8_t len)
+{
+	tlog_rec_s rec;
+	rec.words[0] = id << 8;
+	rec.len = TLOG_HEAD_WORDS;
+	tlog_arg_bytes(&rec, data, len);
+	tlog_commit(&rec);
+}
+
+#endif
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Decoder for the tokenized log, see tlog.h.
+# The format strings are taken from the MYLOG calls in the sources, the record IDs
+# are the same FNV-1a hash the firmware computes at compile time.
+#
+#   python3 tlog_decode.py [capture.txt] < capture.txt
+#
+# Lines starting with #TLOG are decoded, all other lines are passed through.
+
+import glob
+import os
+import re
+import sys
+
+MYLOG_RE = re.compile(r'MYLOG\(\s*"([^"]*)"\s*,\s*"((?:[^"\\]|\\.)*)"')
+MYLOG_HEX_RE = re.compile(r'MYLOG_HEX\(\s*"([^"]*)"')
+SPEC_RE = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z)?([diuxXcsHp%])')
+
+
+def fnv(text, value=2166136261):
+    for byte in text.encode():
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def record_id(tag, fmt):
+    value = fnv(fmt, fnv(tag))
+    return (value ^ (value >> 24)) & 0xFFFFFF
+
+
+def load_formats(src_dir):
+    formats = {}
+    for path in sorted(glob.glob(os.path.join(src_dir, "*.cpp")) + glob.glob(os.path.join(src_dir, "*.h"))):
+        with open(path, encoding="utf-8", errors="replace") as src:
+            text = src.read()
+        found = [(m.group(1), bytes(m.group(2), "utf-8").decode("unicode_escape")) for m in MYLOG_RE.finditer(text)]
+        found += [(m.group(1), "%H") for m in MYLOG_HEX_RE.finditer(text)]
+        for tag, fmt in found:
+            rid = record_id(tag, fmt)
+            if rid in formats and formats[rid] != (tag, fmt):
+                print("warning: ID %06X used by two messages" % rid, file=sys.stderr)
+            formats[rid] = (tag, fmt)
+    return formats
+
+
+def take_bytes(args):
+    length = args.pop(0) if args else 0
+    data = bytearray()
+    while len(data) < length and args:
+        data += args.pop(0).to_bytes(4, "little")
+    return bytes(data[:length])
+
+
+def render(fmt, args):
+    out = []
+    pos = 0
+    for spec in SPEC_RE.finditer(fmt):
+        out.append(fmt[pos:spec.start()])
+        pos = spec.end()
+        flags, width, prec, _, conv = spec.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        if conv == "s":
+            out.append(take_bytes(args).decode("utf-8", errors="replace"))
+            continue
+        if conv == "H":
+            out.append(" ".join("%02X" % b for b in take_bytes(args)))
+            continue
+        value = args.pop(0) if args else 0
+        if conv in "di" and value & 0x80000000:
+            value -= 1 << 32
+        if conv == "p":
+            conv = "x"
+        py_spec = "%" + flags + width + ("." + prec if prec else "") + conv
+        out.append(py_spec % value)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def decode_line(line, formats):
+    words = [int(word, 16) for word in line.split()[1:]]
+    if len(words) < 2:
+        return "#TLOG short record"
+    rid = words[0] >> 8
+    args = words[2:2 + (words[0] & 0xFF)]
+    if rid not in formats:
+        return "%10.3f [???] unknown ID %06X %s" % (words[1] / 1000, rid, " ".join("%08X" % w for w in args))
+    tag, fmt = formats[rid]
+    return "%10.3f [%s] %s" % (words[1] / 1000, tag, render(fmt, args))
+
+
+def main():
+    formats = load_formats(os.path.dirname(os.path.abspath(__file__)))
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    for line in source:
+        line = line.strip()
+        if line.startswith("#TLOG"):
+            print(decode_line(line, formats))
+        elif line:
+            print(line)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,308 @@
+#include "app.h"
+
+extern s_valve_settings g_valve_settings;
+extern bool lora_busy;
+
+/** Pending uplinks, one bit per UPLINK_* kind, a kind is queued at most once */
+static uint8_t uplink_pending = 0;
+
+/** Kinds carried by the uplink in flight */
+static uint8_t uplink_in_flight = 0;
+
+/** Last acknowledged status payload, identical periodic reports are suppressed */
+static uint8_t last_acked[PAYLOAD_MAX_LEN];
+static uint8_t last_acked_len = 0;
+
+/** Periodic reports suppressed in a row */
+static uint8_t uplink_suppressed = 0;
+
+/** Kinds answered by a status snapshot */
+#define UPLINK_STATUS_GROUP (UPLINK_STATE | UPLINK_REQUEST | UPLINK_STATUS)
+
+/**
+ * @brief Largest uplink the current data rate allows
+ *
+ * @param size size of the payload buffer
+ * @return uint8_t length limit
+ */
+static uint8_t uplink_max_len(uint8_t size)
+{
+	uint8_t max_len = airtime_max_len();
+	return (max_len < size) ? max_len : size;
+}
+
+/**
+ * @brief Build the status payload in g_lpwan_data
+ *		  Payload is bit packed following the schema in payload.h. A payload
+ *		  too long for the data rate drops the least important data first:
+ *		  the command results wait for the next uplink, then the flow data
+ *		  and the remaining times of the highest zones are left out.
+ *
+ * @param max_len largest payload the data rate allows
+ * @return true the command results are included
+ */
+static bool uplink_build_status(uint8_t max_len)
+{
+	uint32_t fields[PF_COUNT] = {0};
+
+	// Current valve states and remaining valve intervals
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (g_valve_settings.state[zone] == VALVE_STATE_OPENED)
+		{
+			fields[PF_ZONE_OPEN] |= 1 << zone;
+		}
+		if (g_valve_settings.interval_running & (1 << zone))
+		{
+			fields[PF_ZONE_RUN] |= 1 << zone;
+			fields[PF_ZONE_REMAIN + zone] = payload_pack_remain(valve_interval_remaining(zone));
+		}
+	}
+	if (fields[PF_ZONE_OPEN])
+	{
+		fields[PF_FLAGS] |= PAYLOAD_FLAG_OPEN;
+	}
+	if (fields[PF_ZONE_RUN])
+	{
+		fields[PF_FLAGS] |= PAYLOAD_FLAG_INTERVAL;
+	}
+
+	// A single valve uses the shorter version 1 layout
+	fields[PF_VERSION] = (VALVE_ZONES > 1) ? PAYLOAD_VERSION_ZONES : PAYLOAD_VERSION;
+	fields[PF_REMAIN] = fields[PF_ZONE_REMAIN];
+
+	// Flow meter data
+	if (FLOW_METER)
+	{
+		fields[PF_VERSION] = (VALVE_ZONES > 1) ? PAYLOAD_VERSION_ZONES_FLOW : PAYLOAD_VERSION_FLOW;
+		fields[PF_FLOW_RATE] = flow_rate();
+		fields[PF_VOLUME] = flow_volume() & 0xFFFFFF;
+	}
+	if (flow_alarm() || g_valve_settings.stalled)
+	{
+		fields[PF_FLAGS] |= PAYLOAD_FLAG_FAULT;
+	}
+
+	if (battery_low())
+	{
+		fields[PF_FLAGS] |= PAYLOAD_FLAG_LOW_BATT;
+	}
+
+	// Filtered battery level, sampled away from relay pulses
+	fields[PF_BATT] = payload_quantize_batt(battery_mv());
+
+	g_lpwan_data_len = payload_encode(payload_schema(fields[PF_VERSION]), fields, g_lpwan_data, max_len);
+	if ((g_lpwan_data_len == 0) && FLOW_METER)
+	{
+		fields[PF_VERSION] = (VALVE_ZONES > 1) ? PAYLOAD_VERSION_ZONES : PAYLOAD_VERSION;
+		g_lpwan_data_len = payload_encode(payload_schema(fields[PF_VERSION]), fields, g_lpwan_data, max_len);
+	}
+	while ((g_lpwan_data_len == 0) && fields[PF_ZONE_RUN])
+	{
+		// Remaining times of the highest zones, the open state is always sent
+		uint8_t zone = 31 - __builtin_clz(fields[PF_ZONE_RUN]);
+		fields[PF_ZONE_RUN] &= ~(1UL << zone);
+		if (!fields[PF_ZONE_RUN])
+		{
+			fields[PF_FLAGS] &= ~PAYLOAD_FLAG_INTERVAL;
+		}
+		g_lpwan_data_len = payload_encode(payload_schema(fields[PF_VERSION]), fields, g_lpwan_data, max_len);
+	}
+
+	// Results of the last binary command frame
+	uint8_t len = g_lpwan_data_len;
+	g_lpwan_data_len = downlink_append_results(g_lpwan_data, g_lpwan_data_len, max_len);
+	return g_lpwan_data_len != len;
+}
+
+/**
+ * @brief Enqueue a packet with the LoRaWAN stack
+ *
+ * @param data payload
+ * @param len payload length
+ * @param fport port to send on
+ * @return lmh_error_status result of send_lora_packet()
+ */
+static lmh_error_status uplink_send(uint8_t *data, uint8_t len, uint8_t fport)
+{
+	lmh_error_status result = send_lora_packet(data, len, fport);
+	link_send_result(result);
+	switch (result)
+	{
+	case LMH_SUCCESS:
+		MYLOG("UPL", "Packet enqueued");
+		// Set a flag that TX cycle is running
+		lora_busy = true;
+		energy_lora_uplink(len);
+		airtime_spend(len);
+		// Each uplink is a poll in the latency mode
+		latency_polled();
+		// Any uplink counts as status
+		status_restart();
+		break;
+	case LMH_BUSY:
+		MYLOG("UPL", "LoRa transceiver is busy");
+		break;
+	case LMH_ERROR:
+		MYLOG("UPL", "Packet error, too big to send with current DR");
+		break;
+	}
+	return result;
+}
+
+/**
+ * @brief Queue an uplink, sent right away if the radio is free
+ *
+ * @param kind UPLINK_* kind
+ */
+void uplink_enqueue(uint8_t kind)
+{
+	uplink_pending |= kind;
+	uplink_drain();
+}
+
+/**
+ * @brief Send the highest priority pending uplink
+ *		  Called whenever the radio may have become free. The snapshot is
+ *		  built now, so a report that waited for the radio is current.
+ */
+void uplink_drain(void)
+{
+	while (uplink_pending && !lora_busy)
+	{
+		if (!g_join_result)
+		{
+			MYLOG("UPL", "LoRaWAN not joined, uplinks kept until join");
+			return;
+		}
+
+		if (uplink_pending & UPLINK_STATUS_GROUP)
+		{
+			uint8_t kinds = uplink_pending & UPLINK_STATUS_GROUP;
+			bool results = uplink_build_status(uplink_max_len(PAYLOAD_MAX_LEN));
+
+			// Only the periodic report may be skipped, a heartbeat goes out now and then
+			if ((kinds == UPLINK_STATUS) && (g_lpwan_data_len == last_acked_len) &&
+				(memcmp(g_lpwan_data, last_acked, last_acked_len) == 0) && (uplink_suppressed < UPLINK_HEARTBEAT_EVERY) && !latency_active())
+			{
+				MYLOG("UPL", "Status unchanged, not sent");
+				uplink_pending &= ~kinds;
+				uplink_suppressed++;
+				continue;
+			}
+			if ((kinds == UPLINK_STATUS) && !airtime_allow(g_lpwan_data_len))
+			{
+				MYLOG("UPL", "Airtime budget spent, status not sent");
+				uplink_pending &= ~kinds;
+				continue;
+			}
+
+			lmh_error_status result = uplink_send(g_lpwan_data, g_lpwan_data_len, g_lorawan_settings.app_port);
+			if (result == LMH_BUSY)
+			{
+				return;
+			}
+			if ((result == LMH_ERROR) && (kinds & (UPLINK_STATE | UPLINK_REQUEST)))
+			{
+				// A state change is not lost, it is sent again like an unacknowledged one
+				MYLOG("UPL", "State uplink refused, retry in %lu ms", link_retry_ms());
+				wake_set(WAKE_UPLINK, millis() + link_retry_ms(), WAKE_UPLINK_SLACK_MS);
+				return;
+			}
+			uplink_pending &= ~kinds;
+			if (result == LMH_SUCCESS)
+			{
+				uplink_in_flight = kinds;
+				uplink_suppressed = 0;
+				if (results)
+				{
+					downlink_results_sent();
+				}
+			}
+		}
+		else if (uplink_pending & UPLINK_ENERGY)
+		{
+			static uint8_t report[ENERGY_REPORT_LEN];
+			uint8_t len = energy_report(report, uplink_max_len(ENERGY_REPORT_LEN));
+			if (!airtime_allow(len))
+			{
+				// Bulk uplinks wait for the budget to refill
+				return;
+			}
+			lmh_error_status result = uplink_send(report, len, ENERGY_FPORT);
+			if (result == LMH_BUSY)
+			{
+				return;
+			}
+			uplink_pending &= ~UPLINK_ENERGY;
+			if (result == LMH_SUCCESS)
+			{
+				uplink_in_flight = UPLINK_ENERGY;
+			}
+		}
+		else if (uplink_pending & UPLINK_HISTORY)
+		{
+			static uint8_t batch[HISTORY_MAX_LEN];
+			uint16_t next;
+			uint8_t max_len = uplink_max_len(HISTORY_MAX_LEN);
+			uint8_t len = history_build(batch, max_len, &next);
+			if (len == 0)
+			{
+				uplink_pending &= ~UPLINK_HISTORY;
+				continue;
+			}
+			if (!airtime_allow(len))
+			{
+				return;
+			}
+			lmh_error_status result = uplink_send(batch, len, HISTORY_FPORT);
+			if ((result == LMH_ERROR) && ((len = history_build(batch, max_len / 2, &next)) != 0))
+			{
+				// Once more with a smaller batch, MAC commands may take room from the payload
+				result = uplink_send(batch, len, HISTORY_FPORT);
+			}
+			if (result == LMH_BUSY)
+			{
+				return;
+			}
+			uplink_pending &= ~UPLINK_HISTORY;
+			if (result != LMH_SUCCESS)
+			{
+				// The events wait for the next status period
+				return;
+			}
+			history_sent(next);
+			uplink_in_flight = UPLINK_HISTORY;
+			// Events that did not fit the batch or the data rate go with the next batch
+			if (history_pending())
+			{
+				uplink_pending |= UPLINK_HISTORY;
+			}
+		}
+	}
+}
+
+/**
+ * @brief The TX cycle of the uplink in flight finished
+ *		  A state change that was not delivered is sent again, the delay grows
+ *		  from UPLINK_RETRY_MS with every failure in a row.
+ *
+ * @param success the uplink was sent (and acknowledged if confirmed)
+ */
+void uplink_tx_done(bool success)
+{
+	if (success)
+	{
+		if (uplink_in_flight & UPLINK_STATUS_GROUP)
+		{
+			memcpy(last_acked, g_lpwan_data, g_lpwan_data_len);
+			last_acked_len = g_lpwan_data_len;
+		}
+	}
+	else if (uplink_in_flight & (UPLINK_STATE | UPLINK_REQUEST))
+	{
+		MYLOG("UPL", "State uplink failed, retry in %lu ms", link_retry_ms());
+		wake_set(WAKE_UPLINK, millis() + link_retry_ms(), WAKE_UPLINK_SLACK_MS);
+	}
+	uplink_in_flight = 0;
+}
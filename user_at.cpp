@@ -1,8 +1,9 @@
 #include "app.h"
 
-extern Adafruit_MCP23X17 mcp;
 extern s_valve_settings g_valve_settings;
-extern TimerEvent_t valveTimer;
+
+/** Commands that only take 0, to clear or reset */
+static constexpr at_arg_s at_args_clear[] = {{0, 0, 0, AT_ARG_REQ}};
 
 /**
  * @brief Example how to show the last LoRa packet content
@@ -11,220 +12,655 @@ extern TimerEvent_t valveTimer;
  */
 static int at_query_packet()
 {
-	snprintf(g_at_query_buf, ATQUERY_SIZE, "Packet: %02X%02X%02X%02X%02X",
-			 g_lpwan_data.batt_1,
-			 g_lpwan_data.batt_2,
-			 g_lpwan_data.valve_inteval_1,
-			 g_lpwan_data.valve_inteval_2,
-			 g_lpwan_data.valve_opened);
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Packet: ");
+	for (int idx = 0; (idx < g_lpwan_data_len) && (len < ATQUERY_SIZE - 2); idx++)
+	{
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, "%02X", g_lpwan_data[idx]);
+	}
 	return 0;
 }
 
 /**
- * @brief Returns the current value of the valve controller
+ * @brief Returns the current state of each valve zone
  *
  * @return int always 0
  */
 static int at_query_valve()
 {
-	snprintf(g_at_query_buf, ATQUERY_SIZE, "Valve State: %d", g_valve_settings.state);
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Valve State:");
+	for (uint8_t zone = 0; (zone < VALVE_ZONES) && (len < ATQUERY_SIZE); zone++)
+	{
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %d%s", g_valve_settings.state[zone], valve_is_busy(zone) ? "(moving)" : "");
+	}
 	return 0;
 }
 
-void setValve(int state, int sec)
+/**
+ * @brief Returns the remaining seconds of the valve interval of each zone
+ *
+ * @return int always 0
+ */
+static int at_query_valve_interval()
 {
-	if (!sec)
-		sec = DEFAULT_VALVE_OPER_TIME_SEC;
-
-	// Only modify valve state in here!
-	if (state)
+	if (!g_valve_settings.interval_running)
 	{
-		mcp.digitalWrite(VPIN_OPEN, HIGH);
-		delay(sec * 1000);
-		mcp.digitalWrite(VPIN_OPEN, LOW);
-		g_valve_settings.state = VALVE_STATE_OPENED;
-		MYLOG("APP", "Valve opened");
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "No interval running");
+		return 0;
 	}
-	else
+
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Sec remaining:");
+	for (uint8_t zone = 0; (zone < VALVE_ZONES) && (len < ATQUERY_SIZE); zone++)
 	{
-		mcp.digitalWrite(VPIN_CLOSED, HIGH);
-		delay(sec * 1000);
-		mcp.digitalWrite(VPIN_CLOSED, LOW);
-		g_valve_settings.state = VALVE_STATE_CLOSED;
-		MYLOG("APP", "Valve closed");
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %lu", (unsigned long)valve_interval_remaining(zone));
 	}
+	return 0;
 }
 
-void beginValveInterval(int sec)
-{
-	// Open the valve for sec seconds starting now
-	setValve(VALVE_STATE_OPENED, g_valve_settings.oper_time_sec);
-	g_valve_settings.valve_interval_millis = sec * 1000;
-	g_valve_settings.valve_interval_begin_millis = millis();
-	g_valve_settings.valve_interval_started = true;
-	TimerSetValue(&valveTimer, g_valve_settings.valve_interval_millis);
-	TimerStart(&valveTimer);
-	MYLOG("APP", "Valve interval of %d sec started", sec);
-
-	// Manually trigger a lorawan uplink
-	send_lora_uplink();
-}
+/** [zone:]sec */
+static constexpr at_arg_s at_args_valve_interval[] = {{0, VALVE_ZONES - 1, 0, AT_ARG_LEAD}, {1, AT_INTERVAL_MAX_SEC, 0, AT_ARG_REQ}};
 
 /**
- * @brief Command to begin the valve OPEN interval
+ * @brief Command to begin the valve OPEN interval, provided seconds
  *
- * @param str the new value for the variable without the AT part
- * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ * @param arg zone, sec
+ * @return int 0 if the command was succesfull, 2 if the interval could not start
  */
-static int at_query_valve_interval()
+static int at_exec_valve_interval(const uint32_t *arg)
 {
-	if (g_valve_settings.valve_interval_started)
+	if (g_valve_settings.interval_running & (1 << arg[0]))
 	{
-		int curMillis = millis();
-		int diff = curMillis - g_valve_settings.valve_interval_begin_millis;
-		int remain = g_valve_settings.valve_interval_millis - diff;
-		snprintf(g_at_query_buf, ATQUERY_SIZE, "Sec remaining: %d", remain / 1000);
+		MYLOG("APP", "Valve interval already running");
+		return AT_ERR_NOT_ALLOWED;
 	}
-	else
+	if (!act_admit(at_source()) || !beginValveInterval(arg[0], arg[1]))
 	{
-		snprintf(g_at_query_buf, ATQUERY_SIZE, "No interval running");
+		return AT_ERR_NOT_ALLOWED;
 	}
+	act_charge(at_source());
 	return 0;
 }
 
 /**
- * @brief Command to begin the valve OPEN interval, provided seconds
+ * @brief Returns the volume left of the volume interval of each zone
  *
- * @param str the new value for the variable without the AT part
- * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ * @return int always 0
  */
-static int at_exec_valve_interval(char *str)
+static int at_query_valve_volume()
 {
-	int sec = strtol(str, NULL, 0);
-	if (g_valve_settings.valve_interval_started)
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Liters remaining:");
+	for (uint8_t zone = 0; (zone < VALVE_ZONES) && (len < ATQUERY_SIZE); zone++)
 	{
-		MYLOG("APP", "Valve interval already running");
-		return 5;
+		uint32_t left = flow_volume_remaining(zone);
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %lu.%lu", (unsigned long)(left / 10), (unsigned long)(left % 10));
 	}
-	else
+	return 0;
+}
+
+/** [zone:]liters */
+static constexpr at_arg_s at_args_valve_volume[] = {{0, VALVE_ZONES - 1, 0, AT_ARG_LEAD}, {1, 0xFFFF, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to open a valve until a volume has flowed
+ *
+ * @param arg zone, liters
+ * @return int 0 if the command was succesfull, 1 without flow meter, 2 if the interval could not start
+ */
+static int at_exec_valve_volume(const uint32_t *arg)
+{
+	if (!FLOW_METER)
 	{
-		beginValveInterval(sec);
-		return 0;
+		return AT_ERR_NOT_SUPPORTED;
 	}
+	if (!act_admit(at_source()) || !flow_begin_volume(arg[0], arg[1]))
+	{
+		return AT_ERR_NOT_ALLOWED;
+	}
+	act_charge(at_source());
+	return 0;
 }
 
+/** [zone:]sec, all zones without a zone */
+static constexpr at_arg_s at_args_valve_oper_time[] = {{0, VALVE_ZONES - 1, VALVE_ZONES, AT_ARG_LEAD},
+													   {DL_OPER_TIME_MIN, DL_OPER_TIME_MAX, 0, AT_ARG_REQ}};
+
 /**
  * @brief Command to set the valve operational interval
  * i.e. How long the signal is held high to close/open the valve
  *
- * @param str the new value for the variable without the AT part
- * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ * @param arg zone or VALVE_ZONES for all zones, sec
+ * @return int always 0
  */
-static int at_exec_valve_oper_time(char *str)
+static int at_exec_valve_oper_time(const uint32_t *arg)
 {
-	int sec = strtol(str, NULL, 0);
-	g_valve_settings.oper_time_sec = sec;
-	MYLOG("APP", "Valve oper time set to %d sec", sec);
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if ((arg[0] == VALVE_ZONES) || (arg[0] == zone))
+		{
+			valve_set_oper_time(zone, arg[1]);
+		}
+	}
+	MYLOG("APP", "Valve oper time set to %lu sec", arg[1]);
 	return 0;
 }
 
 /**
- * @brief Returns the current value of the valve operational interval
+ * @brief Returns the current value of the valve operational interval of each zone
  *
  * @return int always 0
  */
 static int at_query_valve_oper_time()
 {
-	snprintf(g_at_query_buf, ATQUERY_SIZE, "Valve oper time: %d", g_valve_settings.oper_time_sec);
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Valve oper time:");
+	for (uint8_t zone = 0; (zone < VALVE_ZONES) && (len < ATQUERY_SIZE); zone++)
+	{
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %d", g_valve_settings.oper_time_sec[zone]);
+	}
+	return 0;
+}
+
+/**
+ * @brief Returns the learned travel time of each zone and the stalled zones
+ *
+ * @return int always 0
+ */
+static int at_query_valve_travel()
+{
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Travel ms:");
+	for (uint8_t zone = 0; (zone < VALVE_ZONES) && (len < ATQUERY_SIZE); zone++)
+	{
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %d", g_valve_settings.travel_ms[zone]);
+	}
+	if (len < ATQUERY_SIZE)
+	{
+		snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, ", stalled 0x%02X", g_valve_settings.stalled);
+	}
+	return 0;
+}
+
+/**
+ * @brief Command to forget the learned travel times and stalls
+ *
+ * @param arg 0 to clear
+ * @return int always 0
+ */
+static int at_exec_valve_travel(const uint32_t *arg)
+{
+	(void)arg;
+	valve_clear_travel();
 	return 0;
 }
 
+/** [zone:]state[:sec], sec 0 uses the oper time */
+static constexpr at_arg_s at_args_valve[] = {
+	{0, VALVE_ZONES - 1, 0, AT_ARG_LEAD}, {0, 1, 0, AT_ARG_REQ}, {0, DL_OPER_TIME_MAX, 0, AT_ARG_TRAIL}};
+
 /**
  * @brief Command to set the valve control
  *
- * @param str the new value for the variable without the AT part
- * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ * @param arg zone, state, sec
+ * @return int 0 if the command was succesfull, 2 if the valve was not moved
  */
-static int at_exec_valve(char *str)
+static int at_exec_valve(const uint32_t *arg)
 {
-	int valve_time = g_valve_settings.oper_time_sec;
-	int valve_state;
+	uint8_t zone = arg[0];
+	uint32_t valve_time = arg[2] ? arg[2] : g_valve_settings.oper_time_sec[zone];
+	MYLOG("APP", "Zone %d Valve State %lu for %lu sec", zone, arg[1], valve_time);
+
+	// Closing is never limited
+	if (arg[1] && !act_admit(at_source()))
+	{
+		return AT_ERR_NOT_ALLOWED;
+	}
+
+	// Open or close the valve, a refused open leaves a running interval alone
+	if (!setValve(zone, arg[1] ? VALVE_STATE_OPENED : VALVE_STATE_CLOSED, valve_time))
+	{
+		return AT_ERR_NOT_ALLOWED;
+	}
+	if (arg[1])
+	{
+		act_charge(at_source());
+	}
 
-	if (g_valve_settings.valve_interval_started)
+	if (stopValveInterval(zone))
 	{
 		MYLOG("APP", "Valve interval is already started, overriding it with manual control");
-		TimerStop(&valveTimer);
-		g_valve_settings.valve_interval_started = false;
 	}
+	return 0;
+}
+
+/** Number of zones */
+static constexpr at_arg_s at_args_valve_max_open[] = {{1, VALVE_ZONES, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to set how many zones may be open at once
+ *
+ * @param arg number of zones
+ * @return int 0 if the command was succesfull, 2 if more zones are open right now
+ */
+static int at_exec_valve_max_open(const uint32_t *arg)
+{
+	return valve_set_max_open(arg[0]) ? 0 : AT_ERR_NOT_ALLOWED;
+}
+
+/**
+ * @brief Returns how many zones may be open at once
+ *
+ * @return int always 0
+ */
+static int at_query_valve_max_open()
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "Max open zones: %d of %d", g_valve_settings.max_open, VALVE_ZONES);
+	return 0;
+}
+
+/** Confirmation, must be 1 */
+static constexpr at_arg_s at_args_confirm[] = {{1, 1, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to Reboot the device
+ *
+ * @param arg 1 to begin reboot
+ * @return int always 0
+ */
+static int at_exec_reboot(const uint32_t *arg)
+{
+	(void)arg;
+	MYLOG("APP", "Rebooting...");
+	delay(1000);
+	api_reset();
+	return 0;
+}
+
+/** Delay in sec */
+static constexpr at_arg_s at_args_uplink[] = {{0, AT_UPLINK_MAX_SEC, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to manually trigger LoRaWAN uplink
+ *
+ * @param arg number in seconds to wait before uplink
+ * @return int always 0
+ */
+static int at_exec_uplink(const uint32_t *arg)
+{
+	uint32_t sec = arg[0];
+	MYLOG("APP", "Triggering uplink in %lu sec", sec);
+	// Sent from the app event handler, may share the wakeup of a nearby event
+	wake_set(WAKE_UPLINK, millis() + sec * 1000, sec ? WAKE_UPLINK_SLACK_MS : 0);
+	return 0;
+}
+
+/** Epoch sec */
+static constexpr at_arg_s at_args_time[] = {{1, UINT32_MAX, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to set the wall clock used by the schedule
+ *
+ * @param arg local time in seconds since 1970-01-01
+ * @return int always 0
+ */
+static int at_exec_time(const uint32_t *arg)
+{
+	time_set(arg[0]);
+	return 0;
+}
+
+/**
+ * @brief Returns the wall clock, 0 if it was never set
+ *
+ * @return int always 0
+ */
+static int at_query_time()
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "Time: %lu", (unsigned long)time_now());
+	return 0;
+}
+
+/** idx:days:HHMM:sec[:zone] */
+static constexpr at_arg_s at_args_sched[] = {{0, SCHED_MAX_ENTRIES - 1, 0, AT_ARG_REQ},
+											 {0, 0x7F, 0, AT_ARG_REQ},
+											 {0, 2359, 0, AT_ARG_REQ},
+											 {0, AT_INTERVAL_MAX_SEC, 0, AT_ARG_REQ},
+											 {0, VALVE_ZONES - 1, 0, AT_ARG_TRAIL}};
+
+/**
+ * @brief Command to set a schedule entry
+ *
+ * @param arg idx, days, HHMM, sec, zone; days is the weekday mask (bit 0 Sunday, 127 daily), days 0 removes the entry
+ * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ */
+static int at_exec_sched(const uint32_t *arg)
+{
+	uint32_t hhmm = arg[2];
+	if ((hhmm % 100) > 59)
+	{
+		return AT_ERR_PARAM;
+	}
+	return schedule_set(arg[0], arg[1], (hhmm / 100) * 60 + (hhmm % 100), arg[3], arg[4]) ? 0 : AT_ERR_PARAM;
+}
 
-	if (strstr(str, ":"))
+/**
+ * @brief Returns the used schedule entries as idx:days:HHMM:sec:zone, S marks a skipped run
+ *
+ * @return int always 0
+ */
+static int at_query_sched()
+{
+	int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "Schedule:");
+	for (uint8_t idx = 0; (idx < SCHED_MAX_ENTRIES) && (len < ATQUERY_SIZE); idx++)
 	{
-		if (sscanf(str, "%d:%d", &valve_state, &valve_time) == 2)
-		{
-			MYLOG("APP", "Valve State %d for %d sec", valve_state, valve_time);
-		}
-		else
+		s_sched_entry *entry = &g_sched[idx];
+		if (entry->days == 0)
 		{
-			MYLOG("APP", "Invalid arguments provided");
-			return 5;
+			continue;
 		}
+		len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %d:%d:%02d%02d:%lu:%d%s", idx, entry->days,
+						entry->start_min / 60, entry->start_min % 60, (unsigned long)entry->duration_sec, entry->zone,
+						(entry->flags & SCHED_FLAG_SKIP) ? "S" : "");
 	}
-	else
-	{
-		valve_state = strtol(str, NULL, 0);
-		MYLOG("APP", "Valve State %d", valve_state);
-	}
+	return 0;
+}
+
+/** Entry index */
+static constexpr at_arg_s at_args_sched_skip[] = {{0, SCHED_MAX_ENTRIES - 1, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to skip the next run of a schedule entry
+ *
+ * @param arg entry index
+ * @return int 0 if the command was succesfull, 2 if the entry is not used
+ */
+static int at_exec_sched_skip(const uint32_t *arg)
+{
+	return schedule_skip(arg[0]) ? 0 : AT_ERR_NOT_ALLOWED;
+}
+
+/**
+ * @brief Returns the number of I2C transactions sent to the IO expander
+ *
+ * @return int always 0
+ */
+static int at_query_expander()
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "Expander I2C transactions: %lu", (unsigned long)g_expander_i2c_count);
+	return 0;
+}
 
-	if (valve_state)
+/**
+ * @brief Returns the number of timer wakeups and the time to the next one
+ *
+ * @return int always 0
+ */
+static int at_query_wakeup()
+{
+	uint32_t next = wake_next_ms();
+	if (next == WAKE_NEVER)
 	{
-		// Open the valve
-		setValve(VALVE_STATE_OPENED, valve_time);
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "Wakeups: %lu, none pending", (unsigned long)g_wake_count);
 	}
 	else
 	{
-		// Close the valve
-		setValve(VALVE_STATE_CLOSED, valve_time);
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "Wakeups: %lu, next in %lu ms", (unsigned long)g_wake_count, (unsigned long)next);
 	}
+	return 0;
+}
 
+/**
+ * @brief Returns the active time and estimated charge of each subsystem
+ *
+ * @return int always 0
+ */
+static int at_query_energy()
+{
+	energy_print(g_at_query_buf, ATQUERY_SIZE);
 	return 0;
 }
 
 /**
- * @brief Command to Reboot the device
+ * @brief Command to clear the energy ledger
  *
- * @param str must be 1 to begin reboot
- * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ * @param arg 0 to clear
+ * @return int always 0
+ */
+static int at_exec_energy(const uint32_t *arg)
+{
+	(void)arg;
+	energy_reset();
+	return 0;
+}
+
+/**
+ * @brief Returns the state of the valve journal
+ *
+ * @return int always 0
+ */
+static int at_query_journal()
+{
+	journal_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Returns the time from boot to the first join
+ *
+ * @return int always 0
  */
-static int at_exec_reboot(char *str)
+static int at_query_boot()
 {
-	int confirm = strtol(str, NULL, 0);
-	if (confirm)
+	if (g_boot_join_ms)
 	{
-		MYLOG("APP", "Rebooting...");
-		delay(1000);
-		system("reboot");
-		return 0;
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "Joined %lu ms after boot", (unsigned long)g_boot_join_ms);
 	}
 	else
 	{
-		MYLOG("APP", "Reboot command not confirmed");
-		return 5;
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "Not joined, %lu ms since boot", (unsigned long)millis());
 	}
+	return 0;
 }
 
 /**
- * @brief Command to manually trigger LoRaWAN uplink
+ * @brief Returns the battery state of charge, projected days and status period
  *
- * @param str number in seconds to wait before uplink
- * @return int 0 if the command was succesfull, 5 if the parameter was wrong
+ * @return int always 0
+ */
+static int at_query_soc()
+{
+	battery_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Command to reset the 9V battery use after a battery change
+ *
+ * @param arg 0 to reset
+ * @return int always 0
+ */
+static int at_exec_motor_batt(const uint32_t *arg)
+{
+	(void)arg;
+	battery_motor_set_used(0);
+	journal_motor_used();
+	return 0;
+}
+
+/**
+ * @brief Returns the state of the valve event history
+ *
+ * @return int always 0
+ */
+static int at_query_history()
+{
+	history_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/** seq */
+static constexpr at_arg_s at_args_history[] = {{0, 0xFFFF, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to acknowledge valve events
+ *
+ * @param arg seq of the last event received
+ * @return int 0 if the command was succesfull, 5 if the seq was never sent
+ */
+static int at_exec_history(const uint32_t *arg)
+{
+	return history_ack(arg[0]) ? 0 : AT_ERR_PARAM;
+}
+
+/**
+ * @brief Returns the flow rate, total volume and alarm state
+ *
+ * @return int always 0
+ */
+static int at_query_flow()
+{
+	flow_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Command to clear the flow alarm
+ *
+ * @param arg 0 to clear
+ * @return int always 0
+ */
+static int at_exec_flow(const uint32_t *arg)
+{
+	(void)arg;
+	flow_alarm_clear();
+	return 0;
+}
+
+/**
+ * @brief Returns the flow rate limit
+ *
+ * @return int always 0
+ */
+static int at_query_flow_max()
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "Flow limit %d.%d L/min", flow_max_rate() / 10, flow_max_rate() % 10);
+	return 0;
+}
+
+/** Rate in 0.1 L/min */
+static constexpr at_arg_s at_args_flow_max[] = {{0, 0xFFFF, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to set the flow rate limit
+ *
+ * @param arg rate in 0.1 L/min, 0 disables the limit
+ * @return int always 0
  */
-static int at_exec_uplink(char *str)
+static int at_exec_flow_max(const uint32_t *arg)
 {
-	int sec = strtol(str, NULL, 0);
-	MYLOG("APP", "Triggering uplink in %d sec", sec);
-	delay(sec * 1000);
-	MYLOG("APP", "Triggering uplink");
-	send_lora_uplink();
+	uint16_t rate = arg[0];
+	if (rate != flow_max_rate())
+	{
+		flow_set_max_rate(rate);
+		journal_flow_max_rate(rate);
+	}
+	return 0;
+}
+
+/**
+ * @brief Returns the latency mode state and the worst command latency
+ *
+ * @return int always 0
+ */
+static int at_query_latency()
+{
+	latency_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Command to forget the worst command latency
+ *
+ * @param arg 0 to clear
+ * @return int always 0
+ */
+static int at_exec_latency(const uint32_t *arg)
+{
+	(void)arg;
+	latency_reset();
+	return 0;
+}
+
+/**
+ * @brief Returns the uplink outcome counters, data rate, TX power and link margin
+ *
+ * @return int always 0
+ */
+static int at_query_link()
+{
+	link_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Returns the airtime budget and the payload limit of the data rate
+ *
+ * @return int always 0
+ */
+static int at_query_airtime()
+{
+	airtime_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Returns the rate limit count and the newest valve command traces
+ *
+ * @return int always 0
+ */
+static int at_query_actuation()
+{
+	act_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Returns the event queue counters
+ *
+ * @return int always 0
+ */
+static int at_query_events()
+{
+	event_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/**
+ * @brief Returns the state of the tokenized log ring
+ *
+ * @return int always 0
+ */
+static int at_query_log()
+{
+	tlog_print(g_at_query_buf, ATQUERY_SIZE);
+	return 0;
+}
+
+/** 0 or 1 */
+static constexpr at_arg_s at_args_flag[] = {{0, 1, 0, AT_ARG_REQ}};
+
+/**
+ * @brief Command to send the whole log ring again or to empty it
+ *
+ * @param arg 1 to send, 0 to clear
+ * @return int always 0
+ */
+static int at_exec_log(const uint32_t *arg)
+{
+	if (arg[0])
+	{
+		tlog_dump();
+	}
+	else
+	{
+		tlog_clear();
+	}
 	return 0;
 }
 
@@ -235,25 +671,134 @@ static int at_exec_uplink(char *str)
  *  AT+LIST=?   - List the last lorwan packet content
  *  AT+REBOOT=1 - Reboot the WisBlock
  *  AT+VLVS=1   - Set valve state to open
- *  AT+VLVS=?   - Get current valve state
- *  AT+VLVO=10  - Set the valve operational time to 10 sec (how long it takes the valve to fully open/close)
+ *  AT+VLVS=2:1:0 - Set valve state of zone 2 to open, using its operational time
+ *  AT+VLVS=?   - Get current valve state of all zones
+ *  AT+VLVO=10  - Set the valve operational time of all zones to 10 sec (how long it takes the valve to fully open/close)
+ *  AT+VLVO=1:8 - Set the valve operational time of zone 1 to 8 sec
  *  AT+VLVO=?   - Get the current valve operational time
  *  AT+VLVI=600 - Open the valve for 10 minutes (60 sec & 10), the valve will automatically close after expiry
- *  AT+VLVI=?   - Get how many seconds remain before the valve closes
+ *  AT+VLVI=3:600 - Open zone 3 for 10 minutes
+ *  AT+VLVI=?   - Get how many seconds remain before the valves close
+ *  AT+VLVL=1:200 - Open zone 1 until 200 liters flowed (needs FLOW_METER)
+ *  AT+VLVL=?   - Get how many liters remain before the valves close
+ *  AT+VLVZ=2   - Allow 2 zones to be open at once
+ *  AT+VLVT=?   - Get the learned valve travel times and stalled zones (needs VALVE_FEEDBACK)
+ *  AT+VLVT=0   - Forget the learned travel times, after a valve was replaced
  *  AT+UPLINK=5 - Send uplink after 5 seconds
+ *  AT+TIME=1700000000 - Set the local time used by the schedule
+ *  AT+SCHED=0:127:0630:900 - Water daily at 06:30 for 15 minutes
+ *  AT+SCHED=1:34:1900:600:2 - Water zone 2 Monday and Friday at 19:00 for 10 minutes
+ *  AT+SCHED=?  - List the schedule entries
+ *  AT+SCHSKIP=0 - Skip the next run of schedule entry 0
+ *  AT+IOX=?    - Get the number of I2C transactions sent to the IO expander
+ *  AT+WAKE=?   - Get the number of timer wakeups and the time to the next one
+ *  AT+ENERGY=? - Get the active time and estimated charge of each subsystem
+ *  AT+ENERGY=0 - Clear the energy ledger
+ *  AT+JRNL=?   - Get the state of the valve journal
+ *  AT+BOOT=?   - Get the time from boot to the first join
+ *  AT+SOC=?    - Get the battery state of charge and projected days
+ *  AT+MBAT=0   - A new 9V motor battery was fitted
+ *  AT+HIST=?   - Get the state of the valve event history
+ *  AT+HIST=12  - Acknowledge valve events up to seq 12
+ *  AT+FLOW=?   - Get the flow rate, total volume and flow alarm
+ *  AT+FLOW=0   - Clear the flow alarm, valves may open again
+ *  AT+FLOWMAX=250 - Close all valves above 25.0 L/min
+ *  AT+LAT=?    - Get the latency mode state and the worst command latency
+ *  AT+LAT=0    - Forget the worst command latency
+ *  AT+LINK=?   - Get the uplink outcome counters, data rate, TX power and link margin
+ *  AT+AIR=?    - Get the airtime budget left and the largest payload of the data rate
+ *  AT+LOG=?    - Get the state of the tokenized log ring
+ *  AT+LOG=1    - Send all log records again, including those from before a reset
+ *  AT+LOG=0    - Empty the log ring
  */
-atcmd_t g_user_at_cmd_list_example[] = {
-	/*|    CMD    |     AT+CMD?      |    AT+CMD=?    |  AT+CMD=value |  AT+CMD  |*/
-	// GNSS commands
-	{"+LIST", "Show last packet content", at_query_packet, NULL, NULL},
-	{"+REBOOT", "Reboot the device", NULL, at_exec_reboot, NULL},
-	{"+VLVS", "Get/Set the valve state (optional :sec)", at_query_valve, at_exec_valve, NULL},
-	{"+VLVO", "Get/Set the valve operational time", at_query_valve_oper_time, at_exec_valve_oper_time, NULL},
-	{"+VLVI", "Start valve open interval sec/Get remaining", at_query_valve_interval, at_exec_valve_interval, NULL},
-	{"+UPLINK", "Manually trigger the sending of an uplink (sec)", NULL, at_exec_uplink, NULL}};
+#define AT_COMMANDS(X)                                                                                                  \
+	X(LIST, "Show last packet content", at_query_packet, NULL)                                                          \
+	X(REBOOT, "Reboot the device", NULL, AT_EXEC(at_exec_reboot, at_args_confirm))                                      \
+	X(VLVS, "Get/Set the valve state (optional :sec)", at_query_valve, AT_EXEC(at_exec_valve, at_args_valve))           \
+	X(VLVO, "Get/Set the valve operational time", at_query_valve_oper_time,                                             \
+	  AT_EXEC(at_exec_valve_oper_time, at_args_valve_oper_time))                                                        \
+	X(VLVI, "Start valve open interval sec/Get remaining", at_query_valve_interval,                                     \
+	  AT_EXEC(at_exec_valve_interval, at_args_valve_interval))                                                          \
+	X(VLVL, "Start valve open interval liters/Get remaining", at_query_valve_volume,                                    \
+	  AT_EXEC(at_exec_valve_volume, at_args_valve_volume))                                                              \
+	X(VLVZ, "Get/Set the number of zones open at once", at_query_valve_max_open,                                        \
+	  AT_EXEC(at_exec_valve_max_open, at_args_valve_max_open))                                                          \
+	X(VLVT, "Get the learned travel times/Clear (0) them", at_query_valve_travel,                                       \
+	  AT_EXEC(at_exec_valve_travel, at_args_clear))                                                                     \
+	X(UPLINK, "Manually trigger the sending of an uplink (sec)", NULL, AT_EXEC(at_exec_uplink, at_args_uplink))         \
+	X(TIME, "Get/Set the local time (epoch sec)", at_query_time, AT_EXEC(at_exec_time, at_args_time))                   \
+	X(SCHED, "Get/Set a schedule entry idx:days:HHMM:sec", at_query_sched, AT_EXEC(at_exec_sched, at_args_sched))       \
+	X(SCHSKIP, "Skip the next run of a schedule entry", NULL, AT_EXEC(at_exec_sched_skip, at_args_sched_skip))          \
+	X(IOX, "Get the IO expander I2C transaction count", at_query_expander, NULL)                                        \
+	X(WAKE, "Get the wakeup count and next wakeup", at_query_wakeup, NULL)                                              \
+	X(ENERGY, "Get/Clear (0) the energy ledger", at_query_energy, AT_EXEC(at_exec_energy, at_args_clear))               \
+	X(JRNL, "Get the valve journal state", at_query_journal, NULL)                                                      \
+	X(BOOT, "Get the boot to join time", at_query_boot, NULL)                                                           \
+	X(SOC, "Get the battery state of charge", at_query_soc, NULL)                                                       \
+	X(MBAT, "Reset (0) the 9V motor battery use", NULL, AT_EXEC(at_exec_motor_batt, at_args_clear))                     \
+	X(HIST, "Get the event history/Acknowledge up to seq", at_query_history, AT_EXEC(at_exec_history, at_args_history)) \
+	X(FLOW, "Get the flow meter state/Clear (0) the alarm", at_query_flow, AT_EXEC(at_exec_flow, at_args_clear))        \
+	X(FLOWMAX, "Get/Set the flow rate limit (0.1 L/min)", at_query_flow_max, AT_EXEC(at_exec_flow_max, at_args_flow_max)) \
+	X(LAT, "Get the latency mode/Clear (0) the worst latency", at_query_latency, AT_EXEC(at_exec_latency, at_args_clear)) \
+	X(LINK, "Get the link health", at_query_link, NULL)                                                                 \
+	X(AIR, "Get the airtime budget", at_query_airtime, NULL)                                                            \
+	X(LOG, "Get the log ring/Send (1) or clear (0) it", at_query_log, AT_EXEC(at_exec_log, at_args_flag))            \
+	X(EVQ, "Get the event queue counters", at_query_events, NULL)                                                       \
+	X(ACT, "Get the valve command traces", at_query_actuation, NULL)
+
+/** Typed handler, the arguments are parsed and range checked by the schema before it is called */
+#define AT_EXEC(handler, schema) (at_exec_typed<schema, sizeof(schema) / sizeof(schema[0]), handler>)
+
+/** Command indices */
+#define AT_INDEX(id, ...) AT_CMD_##id,
+enum at_cmd_idx
+{
+	AT_COMMANDS(AT_INDEX) AT_CMD_NUM
+};
+
+/** The command list of the WisBlock-API, for commands that arrive over USB */
+#define AT_ENTRY(id, desc, query, exec) {"+" #id, desc, query, exec, NULL},
+atcmd_t g_user_at_cmd_list_example[] = {AT_COMMANDS(AT_ENTRY)};
+
+/** Hash seed that gives every command its own slot, found by the compiler */
+#define AT_NAME(id, ...) "+" #id,
+static constexpr const char *at_names[] = {AT_COMMANDS(AT_NAME)};
+static_assert(AT_CMD_NUM <= AT_HASH_MAX_NAMES, "Too many AT commands, raise AT_HASH_MAX_NAMES and AT_HASH_SLOTS");
+static constexpr uint32_t at_seed = at_seed_for(at_names, AT_CMD_NUM);
+static_assert(at_seed != AT_HASH_NO_SEED, "No perfect hash seed for the AT commands, raise AT_HASH_SLOTS");
 
 /** Number of user defined AT commands */
-uint8_t g_user_at_cmd_num = sizeof(g_user_at_cmd_list_example) / sizeof(atcmd_t);
+uint8_t g_user_at_cmd_num = AT_CMD_NUM;
 
 /** Pointer to the AT command list */
-atcmd_t *g_user_at_cmd_list = g_user_at_cmd_list_example;
\ No newline at end of file
+atcmd_t *g_user_at_cmd_list = g_user_at_cmd_list_example;
+
+/**
+ * @brief Find a user AT command, the cost does not grow with the number of commands
+ *
+ * @param name command name including the '+', case insensitive
+ * @param len length of the name
+ * @return atcmd_t* command or NULL if it is not a user command
+ */
+atcmd_t *at_user_find(const char *name, size_t len)
+{
+	uint8_t idx;
+	switch (at_slot(at_hash_name(name, len, at_seed)))
+	{
+#define AT_CASE(id, ...)                      \
+	case at_slot(at_hash("+" #id, at_seed)): \
+		idx = AT_CMD_##id;                    \
+		break;
+		AT_COMMANDS(AT_CASE)
+	default:
+		return NULL;
+	}
+
+	// Another name can share the slot
+	const char *cmd_name = g_user_at_cmd_list_example[idx].cmd_name;
+	if ((strlen(cmd_name) != len) || (strncasecmp(cmd_name, name, len) != 0))
+	{
+		return NULL;
+	}
+	return &g_user_at_cmd_list_example[idx];
+}
@@ -0,0 +1,775 @@
+#include "app.h"
+
+extern s_valve_settings g_valve_settings;
+
+/** Expander pins {open, closed} of each zone, zone 0 keeps the original wiring
+ * Both pins of a zone are on the same port, so they switch in the same write. */
+static const uint8_t zone_pins[8][2] = {
+	{VPIN_OPEN, VPIN_CLOSED}, {4, 5}, {2, 3}, {0, 1}, {8, 9}, {10, 11}, {12, 13}, {14, 15}};
+
+/** Zones that send an uplink once their running pulse has completed */
+static uint8_t report_mask = 0;
+
+/** Cause of the running pulse of each zone, HC_* */
+static uint8_t act_cause[VALVE_ZONES];
+
+/** Zones whose running pulse started at standstill, their travel time is learned */
+static uint8_t learn_mask = 0;
+
+/** Opens waiting for their hold time, a later command of the zone replaces them */
+static uint8_t hold_mask = 0;
+static uint8_t hold_report = 0;
+static uint32_t hold_deadline[VALVE_ZONES];
+static uint32_t hold_pulse_ms[VALVE_ZONES];
+static uint8_t hold_cause[VALVE_ZONES];
+
+/** Trace of the running pulse and of the held open of each zone */
+static uint16_t trace_run[VALVE_ZONES];
+static uint16_t trace_hold[VALVE_ZONES];
+
+/** Tolerance for timers firing slightly early */
+#define DEADLINE_TOLERANCE_MS 10
+
+/**
+ * @brief Check if a millis() deadline has passed
+ */
+static bool deadline_passed(uint32_t deadline, uint32_t now)
+{
+	return (int32_t)(now + DEADLINE_TOLERANCE_MS - deadline) >= 0;
+}
+
+/**
+ * @brief Set the wakeup of a client to the earliest deadline of the zones in mask
+ *		  The valve is switched from the app task, not from the timer context
+ *
+ * @param client WAKE_VALVE_ACT or WAKE_VALVE_INTERVAL
+ * @param deadlines per zone deadlines in millis()
+ * @param mask zones to consider
+ */
+static void valve_rearm(uint8_t client, const uint32_t *deadlines, uint8_t mask)
+{
+	if (!mask)
+	{
+		wake_clear(client);
+		return;
+	}
+
+	uint32_t now = millis();
+	int32_t earliest = INT32_MAX;
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if ((mask & (1 << zone)) && ((int32_t)(deadlines[zone] - now) < earliest))
+		{
+			earliest = deadlines[zone] - now;
+		}
+	}
+	wake_set(client, now + earliest, 0);
+}
+
+/**
+ * @brief Zones with a relay pulse in progress
+ */
+static uint8_t valve_busy_mask(void)
+{
+	uint8_t mask = 0;
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (g_valve_settings.act_state[zone] != VALVE_ACT_IDLE)
+		{
+			mask |= 1 << zone;
+		}
+	}
+	return mask;
+}
+
+/**
+ * @brief Expander bit mask of both relay pins of a zone
+ */
+static uint16_t zone_mask(uint8_t zone)
+{
+	return (1 << zone_pins[zone][0]) | (1 << zone_pins[zone][1]);
+}
+
+#if VALVE_FEEDBACK
+/**
+ * @brief Expander pin of an end stop switch
+ *
+ * @param zone valve zone
+ * @param opened true for the open end stop
+ */
+static uint8_t valve_stop_pin(uint8_t zone, bool opened)
+{
+	return 8 + 2 * zone + (opened ? 0 : 1);
+}
+
+/**
+ * @brief An end stop switch changed, the inputs are read from the app task
+ *		  The time of the edge is queued, so travel times are learned
+ *		  without the latency of the app task.
+ */
+static void valve_feedback_isr(void)
+{
+	event_post(EVQ_VALVE_FB, EV_VALVE_FB, millis());
+}
+#endif
+
+/**
+ * @brief Check if a travelling zone is at the end stop it is driven to
+ *
+ * @param zone valve zone
+ * @param levels expander input levels
+ * @return true the end stop switch is closed, always false without feedback
+ */
+static bool valve_at_stop(uint8_t zone, uint16_t levels)
+{
+#if VALVE_FEEDBACK
+	bool opening = (g_valve_settings.act_state[zone] == VALVE_ACT_DRIVING_OPEN);
+	return !(levels & (1 << valve_stop_pin(zone, opening)));
+#else
+	(void)zone;
+	(void)levels;
+	return false;
+#endif
+}
+
+/**
+ * @brief Configure the expander pins of all zones, relays released
+ */
+void valve_pins_init(void)
+{
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		expander_write_mask(zone_mask(zone), 0);
+		expander_pin_mode(zone_pins[zone][0], OUTPUT);
+		expander_pin_mode(zone_pins[zone][1], OUTPUT);
+#if VALVE_FEEDBACK
+		expander_pin_mode(valve_stop_pin(zone, true), INPUT_PULLUP);
+		expander_pin_mode(valve_stop_pin(zone, false), INPUT_PULLUP);
+#endif
+	}
+	expander_flush();
+
+#if VALVE_FEEDBACK
+	// End stop changes end the relay pulse without polling the expander
+	uint16_t stops = 0;
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		stops |= (1 << valve_stop_pin(zone, true)) | (1 << valve_stop_pin(zone, false));
+	}
+	expander_interrupt_enable(stops);
+	pinMode(VALVE_FB_INT_PIN, INPUT_PULLUP);
+	attachInterrupt(digitalPinToInterrupt(VALVE_FB_INT_PIN), valve_feedback_isr, FALLING);
+#endif
+}
+
+/**
+ * @brief Initialize the valve actuator state machine
+ */
+void valve_actuator_init(void)
+{
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		g_valve_settings.act_state[zone] = VALVE_ACT_IDLE;
+	}
+}
+
+/**
+ * @brief Check if a relay pulse is in progress
+ *
+ * @param zone valve zone
+ * @return true the valve is travelling
+ */
+bool valve_is_busy(uint8_t zone)
+{
+	return g_valve_settings.act_state[zone] != VALVE_ACT_IDLE;
+}
+
+/**
+ * @brief Check if an uplink will be sent once a valve reached its position
+ */
+bool valve_report_pending(void)
+{
+	return report_mask != 0;
+}
+
+/**
+ * @brief Check if a zone is open or on its way to open
+ */
+static bool valve_is_opening(uint8_t zone)
+{
+	if (hold_mask & (1 << zone))
+	{
+		return true;
+	}
+	switch (g_valve_settings.act_state[zone])
+	{
+	case VALVE_ACT_DRIVING_OPEN:
+		return true;
+	case VALVE_ACT_DRIVING_CLOSED:
+		return false;
+	default:
+		return g_valve_settings.state[zone] == VALVE_STATE_OPENED;
+	}
+}
+
+/**
+ * @brief Number of zones that are open or on their way to open
+ */
+uint8_t valve_open_count(void)
+{
+	uint8_t count = 0;
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (valve_is_opening(zone))
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Book the relay time of a running pulse in the energy ledger and against the 9V battery
+ */
+static void valve_book_pulse(uint8_t zone)
+{
+	uint32_t elapsed = millis() - g_valve_settings.act_begin_millis[zone];
+	switch (g_valve_settings.act_state[zone])
+	{
+	case VALVE_ACT_DRIVING_OPEN:
+		energy_add_ms(EN_RELAY_OPEN, elapsed);
+		battery_motor_add_ms(elapsed);
+		break;
+	case VALVE_ACT_DRIVING_CLOSED:
+		energy_add_ms(EN_RELAY_CLOSE, elapsed);
+		battery_motor_add_ms(elapsed);
+		break;
+	}
+}
+
+/**
+ * @brief Power the relay for one direction and arm the pulse timer
+ *
+ * @param zone valve zone
+ * @param state VALVE_STATE_OPENED or VALVE_STATE_CLOSED
+ * @param pulse_ms how long to hold the relay
+ */
+static void valve_drive(uint8_t zone, int state, uint32_t pulse_ms)
+{
+	// A reversal ends the pulse in the other direction
+	valve_book_pulse(zone);
+
+	// Both relays change in one write, they are never powered together
+	if (state)
+	{
+		expander_write_mask(zone_mask(zone), 1 << zone_pins[zone][0]);
+		g_valve_settings.act_state[zone] = VALVE_ACT_DRIVING_OPEN;
+	}
+	else
+	{
+		expander_write_mask(zone_mask(zone), 1 << zone_pins[zone][1]);
+		g_valve_settings.act_state[zone] = VALVE_ACT_DRIVING_CLOSED;
+	}
+	expander_flush();
+	g_valve_settings.act_begin_millis[zone] = millis();
+	g_valve_settings.act_deadline[zone] = g_valve_settings.act_begin_millis[zone] + pulse_ms;
+
+#if VALVE_FEEDBACK
+	// Already at the end stop, the switch will not change, end the pulse right away
+	if (valve_at_stop(zone, expander_read()))
+	{
+		g_valve_settings.act_deadline[zone] = g_valve_settings.act_begin_millis[zone];
+	}
+#endif
+
+	valve_rearm(WAKE_VALVE_ACT, g_valve_settings.act_deadline, valve_busy_mask());
+	flow_valve_changed();
+}
+
+/**
+ * @brief Hold an open, or replace the held open of a zone
+ *		  The hold time is not extended, a stream of commands cannot delay the open.
+ *
+ * @param zone valve zone
+ * @param pulse_ms how long to hold the relay
+ * @param report send an uplink when the valve is open
+ * @param cause HC_* cause recorded in the history
+ * @param trace trace of the command
+ */
+static void valve_hold(uint8_t zone, uint32_t pulse_ms, bool report, uint8_t cause, uint16_t trace)
+{
+	if (!(hold_mask & (1 << zone)))
+	{
+		hold_mask |= 1 << zone;
+		hold_deadline[zone] = millis() + VALVE_HOLD_MS;
+		valve_rearm(WAKE_VALVE_HOLD, hold_deadline, hold_mask);
+	}
+	act_trace_end(trace_hold[zone], ACT_SUPERSEDED);
+	trace_hold[zone] = trace;
+	hold_pulse_ms[zone] = pulse_ms;
+	hold_cause[zone] = cause;
+	if (report)
+	{
+		hold_report |= 1 << zone;
+	}
+	MYLOG("APP", "Zone %d opens in %d ms", zone, VALVE_HOLD_MS);
+}
+
+/**
+ * @brief Drive a valve for a command, reverses a pulse in the other direction
+ *
+ * @param zone valve zone
+ * @param state VALVE_STATE_OPENED or VALVE_STATE_CLOSED
+ * @param pulse_ms how long to hold the relay
+ * @param trace trace of the command
+ */
+static void valve_start(uint8_t zone, int state, uint32_t pulse_ms, uint16_t trace)
+{
+	// Only modify valve state in here!
+	switch (g_valve_settings.act_state[zone])
+	{
+	case VALVE_ACT_DRIVING_OPEN:
+	case VALVE_ACT_DRIVING_CLOSED:
+	{
+		bool opening = (g_valve_settings.act_state[zone] == VALVE_ACT_DRIVING_OPEN);
+		if ((state != 0) == opening)
+		{
+			MYLOG("APP", "Zone %d already travelling in that direction", zone);
+			act_trace_end(trace, ACT_MERGED);
+			return;
+		}
+
+		// Reversal mid-travel, drive back only as far as the valve has moved
+		uint32_t travelled = millis() - g_valve_settings.act_begin_millis[zone] + VALVE_REVERSAL_MARGIN_MS;
+		if (travelled < pulse_ms)
+		{
+			pulse_ms = travelled;
+		}
+		MYLOG("APP", "Zone %d reversed after %lu ms", zone, travelled - VALVE_REVERSAL_MARGIN_MS);
+		act_trace_end(trace_run[zone], ACT_SUPERSEDED);
+		learn_mask &= ~(1 << zone);
+		valve_drive(zone, state, pulse_ms);
+		break;
+	}
+	default:
+		learn_mask |= 1 << zone;
+		valve_drive(zone, state, pulse_ms);
+		MYLOG("APP", "Zone %d %s for %lu ms", zone, state ? "opening" : "closing", pulse_ms);
+		break;
+	}
+	trace_run[zone] = trace;
+	act_trace_start(trace);
+}
+
+/**
+ * @brief Start moving a valve, returns right away
+ *		  The relay is released by valve_actuator_handler() when the pulse ends
+ *
+ * @param zone valve zone
+ * @param state VALVE_STATE_OPENED or VALVE_STATE_CLOSED
+ * @param sec how long to hold the relay, 0 for the default
+ * @param report send an uplink when the valve reached its new position
+ * @param cause HC_* cause recorded in the history
+ * @return true the command was accepted
+ * @return false invalid zone, or too many zones would be open
+ */
+bool setValve(uint8_t zone, int state, int sec, bool report, uint8_t cause)
+{
+	if (zone >= VALVE_ZONES)
+	{
+		return false;
+	}
+
+	if (state && !valve_is_opening(zone) && (valve_open_count() >= g_valve_settings.max_open))
+	{
+		MYLOG("APP", "Zone %d not opened, %d zones already open", zone, g_valve_settings.max_open);
+		return false;
+	}
+
+	if (state && flow_alarm())
+	{
+		MYLOG("APP", "Zone %d not opened, flow alarm 0x%02X", zone, flow_alarm());
+		return false;
+	}
+
+	// Commands should reach the node quickly while water runs
+	if (state)
+	{
+		latency_kick();
+	}
+
+	if (!sec)
+		sec = DEFAULT_VALVE_OPER_TIME_SEC;
+
+	uint32_t pulse_ms = sec * 1000;
+
+	// With a learned travel time the pulse times out earlier, the end stop normally ends it before
+	// After a stall the full time is allowed, so a valve that became slower is learned again
+	if (VALVE_FEEDBACK && g_valve_settings.travel_ms[zone] && !(g_valve_settings.stalled & (1 << zone)))
+	{
+		uint32_t timeout = g_valve_settings.travel_ms[zone] * 3 / 2 + VALVE_TRAVEL_MARGIN_MS;
+		if (timeout < pulse_ms)
+		{
+			pulse_ms = timeout;
+		}
+	}
+
+	uint16_t trace = act_trace_new(zone, state, cause);
+
+	// Opens are held, so a burst of commands ends in one movement
+	if (state && VALVE_HOLD_MS && (g_valve_settings.act_state[zone] != VALVE_ACT_DRIVING_OPEN))
+	{
+		valve_hold(zone, pulse_ms, report, cause, trace);
+		return true;
+	}
+
+	// A close is never held, it drops the held open
+	if (!state && (hold_mask & (1 << zone)))
+	{
+		hold_mask &= ~(1 << zone);
+		hold_report &= ~(1 << zone);
+		act_trace_end(trace_hold[zone], ACT_SUPERSEDED);
+		valve_rearm(WAKE_VALVE_HOLD, hold_deadline, hold_mask);
+
+		// The valve did not move since it was closed
+		if ((g_valve_settings.act_state[zone] == VALVE_ACT_IDLE) && (g_valve_settings.state[zone] == VALVE_STATE_CLOSED))
+		{
+			MYLOG("APP", "Zone %d open dropped, still closed", zone);
+			act_trace_end(trace, ACT_DONE);
+			if (report)
+			{
+				uplink_enqueue(UPLINK_STATE);
+			}
+			return true;
+		}
+	}
+
+	if (report)
+	{
+		report_mask |= 1 << zone;
+	}
+	act_cause[zone] = cause;
+	valve_start(zone, state, pulse_ms, trace);
+	return true;
+}
+
+/**
+ * @brief Learn the travel time of a zone, or flag a stall
+ *
+ * @param zone valve zone
+ * @param at_stop the end stop was reached
+ * @param end_millis when the pulse ended
+ */
+static void valve_learn(uint8_t zone, bool at_stop, uint32_t end_millis)
+{
+	if (!at_stop)
+	{
+		if (!(g_valve_settings.stalled & (1 << zone)))
+		{
+			MYLOG("APP", "Zone %d did not reach its end stop", zone);
+			g_valve_settings.stalled |= 1 << zone;
+			history_add(HE_STALL, zone, act_cause[zone]);
+		}
+		return;
+	}
+	g_valve_settings.stalled &= ~(1 << zone);
+
+	// Only a pulse from standstill to the end stop is a full travel
+	uint32_t elapsed = end_millis - g_valve_settings.act_begin_millis[zone];
+	if (!(learn_mask & (1 << zone)) || (elapsed < VALVE_TRAVEL_MIN_MS) || (elapsed > 0xFFFF))
+	{
+		return;
+	}
+
+	uint16_t travel = g_valve_settings.travel_ms[zone];
+	travel = travel ? (3 * travel + elapsed) / 4 : elapsed;
+	MYLOG("APP", "Zone %d travelled in %lu ms, learned %d ms", zone, elapsed, travel);
+	if (abs((int32_t)travel - (int32_t)g_valve_settings.travel_ms[zone]) > 100)
+	{
+		journal_travel(zone, travel);
+	}
+	g_valve_settings.travel_ms[zone] = travel;
+}
+
+/**
+ * @brief Release the relay of a zone, the valve is at its new position
+ *
+ * @param zone valve zone
+ * @param at_stop the end stop switch reports the position
+ * @param end_millis when the pulse ended
+ * @return true an uplink was requested for this position
+ */
+static bool valve_finish(uint8_t zone, bool at_stop, uint32_t end_millis)
+{
+	expander_write_mask(zone_mask(zone), 0);
+	valve_book_pulse(zone);
+	if (VALVE_FEEDBACK)
+	{
+		valve_learn(zone, at_stop, end_millis);
+	}
+
+	if (g_valve_settings.act_state[zone] == VALVE_ACT_DRIVING_OPEN)
+	{
+		g_valve_settings.state[zone] = VALVE_STATE_OPENED;
+		MYLOG("APP", "Zone %d opened", zone);
+	}
+	else
+	{
+		g_valve_settings.state[zone] = VALVE_STATE_CLOSED;
+		MYLOG("APP", "Zone %d closed", zone);
+	}
+	g_valve_settings.act_state[zone] = VALVE_ACT_IDLE;
+	act_trace_end(trace_run[zone], ACT_DONE);
+	journal_valve_state(zone, g_valve_settings.state[zone]);
+	history_add(g_valve_settings.state[zone] == VALVE_STATE_OPENED ? HE_OPEN : HE_CLOSE, zone, act_cause[zone]);
+
+	if (report_mask & (1 << zone))
+	{
+		report_mask &= ~(1 << zone);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Write the released relays and follow up on the finished pulses
+ *
+ * @param report an uplink was requested for one of the positions
+ */
+static void valve_finish_done(bool report)
+{
+	// All relays that are due are released in one write
+	expander_flush();
+	valve_rearm(WAKE_VALVE_ACT, g_valve_settings.act_deadline, valve_busy_mask());
+	flow_valve_changed();
+
+	if (report)
+	{
+		uplink_enqueue(UPLINK_STATE);
+	}
+}
+
+/**
+ * @brief Start the held opens and finish the relay pulses that are due, called from the app event handler
+ *		  With end stop feedback a pulse that times out is a stall.
+ */
+void valve_actuator_handler(void)
+{
+	uint32_t now = millis();
+	bool report = false;
+
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if ((hold_mask & (1 << zone)) && deadline_passed(hold_deadline[zone], now))
+		{
+			hold_mask &= ~(1 << zone);
+			report_mask |= hold_report & (1 << zone);
+			hold_report &= ~(1 << zone);
+			act_cause[zone] = hold_cause[zone];
+			valve_start(zone, VALVE_STATE_OPENED, hold_pulse_ms[zone], trace_hold[zone]);
+		}
+	}
+	valve_rearm(WAKE_VALVE_HOLD, hold_deadline, hold_mask);
+
+	uint16_t levels = VALVE_FEEDBACK ? expander_read() : 0xFFFF;
+
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		// A reversal may have moved the deadline after this event was raised
+		if ((g_valve_settings.act_state[zone] == VALVE_ACT_IDLE) || !deadline_passed(g_valve_settings.act_deadline[zone], now))
+		{
+			continue;
+		}
+		report |= valve_finish(zone, valve_at_stop(zone, levels), now);
+	}
+
+	valve_finish_done(report);
+}
+
+/**
+ * @brief Finish the relay pulses whose end stop was reached, called from the app event handler
+ *
+ * @param at_millis when the end stop switch changed
+ */
+void valve_feedback_handler(uint32_t at_millis)
+{
+	// Reading the inputs also clears the expander interrupt
+	uint16_t levels = expander_read();
+	bool report = false;
+
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if ((g_valve_settings.act_state[zone] != VALVE_ACT_IDLE) && valve_at_stop(zone, levels))
+		{
+			report |= valve_finish(zone, true, at_millis);
+		}
+	}
+
+	valve_finish_done(report);
+}
+
+/**
+ * @brief Open a zone for sec seconds starting now
+ *
+ * @param zone valve zone
+ * @param sec interval length in seconds
+ * @param cause HC_* cause recorded in the history
+ * @return true interval started
+ * @return false invalid zone, interval already running or too many zones open
+ */
+bool beginValveInterval(uint8_t zone, uint32_t sec, uint8_t cause)
+{
+	if ((zone >= VALVE_ZONES) || (g_valve_settings.interval_running & (1 << zone)))
+	{
+		return false;
+	}
+
+	// Report once the valve is open
+	if (!setValve(zone, VALVE_STATE_OPENED, g_valve_settings.oper_time_sec[zone], true, cause))
+	{
+		return false;
+	}
+	g_valve_settings.interval_deadline[zone] = millis() + sec * 1000;
+	g_valve_settings.interval_running |= 1 << zone;
+	g_valve_settings.interval_volume &= ~(1 << zone);
+	journal_interval(zone, sec);
+	history_add(HE_INTERVAL_START, zone, cause);
+	valve_rearm(WAKE_VALVE_INTERVAL, g_valve_settings.interval_deadline, g_valve_settings.interval_running);
+	MYLOG("APP", "Zone %d interval of %lu sec started", zone, sec);
+	return true;
+}
+
+/**
+ * @brief Stop a running valve interval, the valve is left as it is
+ *
+ * @param zone valve zone
+ * @return true an interval was running
+ */
+bool stopValveInterval(uint8_t zone)
+{
+	if ((zone >= VALVE_ZONES) || !(g_valve_settings.interval_running & (1 << zone)))
+	{
+		return false;
+	}
+	g_valve_settings.interval_running &= ~(1 << zone);
+	journal_interval(zone, 0);
+	history_add(HE_INTERVAL_ABORT, zone, HC_MANUAL);
+	valve_rearm(WAKE_VALVE_INTERVAL, g_valve_settings.interval_deadline, g_valve_settings.interval_running);
+	return true;
+}
+
+/**
+ * @brief Remaining time of a valve interval
+ *
+ * @param zone valve zone
+ * @return uint32_t remaining seconds rounded up, 0 if no interval is running
+ */
+uint32_t valve_interval_remaining(uint8_t zone)
+{
+	if ((zone >= VALVE_ZONES) || !(g_valve_settings.interval_running & (1 << zone)))
+	{
+		return 0;
+	}
+	int32_t remain = g_valve_settings.interval_deadline[zone] - millis();
+	return remain > 0 ? (remain + 999) / 1000 : 0;
+}
+
+/**
+ * @brief End the interval of a zone and close it
+ */
+static void valve_interval_end(uint8_t zone)
+{
+	g_valve_settings.interval_running &= ~(1 << zone);
+	journal_interval(zone, 0);
+	history_add(HE_INTERVAL_END, zone, HC_INTERVAL);
+
+	// Uplink is sent once the valve is closed
+	setValve(zone, VALVE_STATE_CLOSED, g_valve_settings.oper_time_sec[zone], true, HC_INTERVAL);
+}
+
+/**
+ * @brief End a running valve interval before its time is up, as if it expired
+ *
+ * @param zone valve zone
+ * @return true an interval was running
+ */
+bool endValveInterval(uint8_t zone)
+{
+	if ((zone >= VALVE_ZONES) || !(g_valve_settings.interval_running & (1 << zone)))
+	{
+		return false;
+	}
+	valve_interval_end(zone);
+	valve_rearm(WAKE_VALVE_INTERVAL, g_valve_settings.interval_deadline, g_valve_settings.interval_running);
+	return true;
+}
+
+/**
+ * @brief Close the zones whose interval expired, called from the app event handler
+ */
+void valve_interval_handler(void)
+{
+	uint32_t now = millis();
+
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if ((g_valve_settings.interval_running & (1 << zone)) && deadline_passed(g_valve_settings.interval_deadline[zone], now))
+		{
+			MYLOG("APP", "Zone %d interval expired, closing valve", zone);
+			valve_interval_end(zone);
+		}
+	}
+
+	valve_rearm(WAKE_VALVE_INTERVAL, g_valve_settings.interval_deadline, g_valve_settings.interval_running);
+}
+
+/**
+ * @brief Set the operational time of a zone, kept across resets
+ *
+ * @param zone valve zone
+ * @param sec relay pulse in seconds
+ */
+void valve_set_oper_time(uint8_t zone, uint8_t sec)
+{
+	if (g_valve_settings.oper_time_sec[zone] != sec)
+	{
+		g_valve_settings.oper_time_sec[zone] = sec;
+		journal_oper_time(zone, sec);
+	}
+}
+
+/**
+ * @brief Set how many zones may be open at once, kept across resets
+ *
+ * @param max_open number of zones, 1 .. VALVE_ZONES
+ * @return true value accepted
+ */
+bool valve_set_max_open(uint8_t max_open)
+{
+	if ((max_open < 1) || (max_open > VALVE_ZONES))
+	{
+		return false;
+	}
+	if (g_valve_settings.max_open != max_open)
+	{
+		g_valve_settings.max_open = max_open;
+		journal_max_open(max_open);
+	}
+	return true;
+}
+
+/**
+ * @brief Forget the learned travel times and stalls, after a valve was replaced
+ */
+void valve_clear_travel(void)
+{
+	for (uint8_t zone = 0; zone < VALVE_ZONES; zone++)
+	{
+		if (g_valve_settings.travel_ms[zone])
+		{
+			g_valve_settings.travel_ms[zone] = 0;
+			journal_travel(zone, 0);
+		}
+	}
+	g_valve_settings.stalled = 0;
+}
@@ -0,0 +1,149 @@
+#include "app.h"
+
+/** Pending deadline of each client */
+struct s_wake_client
+{
+	uint32_t deadline; // millis() by which the event must be raised
+	uint32_t slack;	   // how much earlier the event may be raised
+	uint16_t event;	   // g_task_event_type bit to raise
+};
+
+static s_wake_client wake_clients[WAKE_CLIENTS];
+
+/** Clients with a pending deadline */
+static uint8_t wake_active = 0;
+static_assert(WAKE_CLIENTS <= 8, "One bit per client in wake_active");
+
+/** The only application timer, armed for the earliest deadline */
+TimerEvent_t wakeTimer;
+
+/** Number of timer wakeups since boot */
+uint32_t g_wake_count = 0;
+
+/** Tolerance for timers firing slightly early */
+#define WAKE_TOLERANCE_MS 10
+
+static void wake_timer_handler(void)
+{
+	event_post(EVQ_TIMER, EV_WAKE, millis());
+}
+
+/**
+ * @brief Arm the timer for the earliest deadline
+ *		  Waking at the earliest deadline and raising every event whose
+ *		  slack window has opened gives the fewest wakeups.
+ */
+static void wake_program_timer(void)
+{
+	TimerStop(&wakeTimer);
+
+	uint32_t next = wake_next_ms();
+	if (next == WAKE_NEVER)
+	{
+		return;
+	}
+	TimerSetValue(&wakeTimer, next > 1 ? next : 1);
+	TimerStart(&wakeTimer);
+}
+
+/**
+ * @brief Initialize the deadline scheduler
+ */
+void wake_init(void)
+{
+	TimerInit(&wakeTimer, wake_timer_handler);
+	wake_clients[WAKE_STATUS].event = STATUS;
+	wake_clients[WAKE_UPLINK].event = UPLINK_DUE;
+	wake_clients[WAKE_VALVE_ACT].event = VALVE_ACT_DONE;
+	wake_clients[WAKE_VALVE_INTERVAL].event = VALVE_INTERVAL_DONE;
+	wake_clients[WAKE_SCHEDULE].event = SCHEDULE_DUE;
+	wake_clients[WAKE_FLOW].event = FLOW_DUE;
+	wake_clients[WAKE_VALVE_HOLD].event = VALVE_ACT_DONE;
+	wake_clients[WAKE_AT_LINE].event = BLE_DATA;
+	wake_active = 0;
+}
+
+/**
+ * @brief Set or move the deadline of a client
+ *
+ * @param client WAKE_* client
+ * @param deadline millis() by which the client event must be raised
+ * @param slack how many ms earlier the event may be raised to share a wakeup
+ */
+void wake_set(uint8_t client, uint32_t deadline, uint32_t slack)
+{
+	wake_clients[client].deadline = deadline;
+	wake_clients[client].slack = slack;
+	wake_active |= 1 << client;
+	wake_program_timer();
+}
+
+/**
+ * @brief Remove the deadline of a client
+ *
+ * @param client WAKE_* client
+ */
+void wake_clear(uint8_t client)
+{
+	if (wake_active & (1 << client))
+	{
+		wake_active &= ~(1 << client);
+		wake_program_timer();
+	}
+}
+
+/**
+ * @brief Check if a client has a pending deadline
+ *
+ * @param client WAKE_* client
+ */
+bool wake_pending(uint8_t client)
+{
+	return (wake_active & (1 << client)) != 0;
+}
+
+/**
+ * @brief Time until the next wakeup, for sleep decisions
+ *
+ * @return uint32_t ms until the earliest deadline, 0 if one is overdue, WAKE_NEVER if none is set
+ */
+uint32_t wake_next_ms(void)
+{
+	if (!wake_active)
+	{
+		return WAKE_NEVER;
+	}
+
+	uint32_t now = millis();
+	int32_t earliest = INT32_MAX;
+	for (uint8_t client = 0; client < WAKE_CLIENTS; client++)
+	{
+		if ((wake_active & (1 << client)) && ((int32_t)(wake_clients[client].deadline - now) < earliest))
+		{
+			earliest = wake_clients[client].deadline - now;
+		}
+	}
+	return earliest > 0 ? earliest : 0;
+}
+
+/**
+ * @brief Raise the events of all clients whose slack window has opened
+ *		  Called from the app event handler before the client events are handled.
+ */
+void wake_handler(void)
+{
+	uint32_t now = millis();
+	g_wake_count++;
+
+	for (uint8_t client = 0; client < WAKE_CLIENTS; client++)
+	{
+		s_wake_client *entry = &wake_clients[client];
+		if ((wake_active & (1 << client)) && ((int32_t)(now + WAKE_TOLERANCE_MS + entry->slack - entry->deadline) >= 0))
+		{
+			wake_active &= ~(1 << client);
+			g_task_event_type |= entry->event;
+		}
+	}
+
+	wake_program_timer();
+}